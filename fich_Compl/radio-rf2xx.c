@@ -54,10 +54,31 @@ extern rf2xx_t RF2XX_DEVICE;
 #define RF2XX_TX_POWER  PHY_POWER_3dBm
 #endif
 
+/*
+ * Extended operating mode fields, not described in rf2xx_regs.h
+ * (see the AT86RF231 datasheet, section 7.2)
+ */
+#define RF2XX_TRAC_STATUS(reg)                  (((reg) >> 5) & 0x7)
+#define RF2XX_TRAC__SUCCESS                     0
+#define RF2XX_TRAC__SUCCESS_DATA_PENDING        1
+#define RF2XX_TRAC__CHANNEL_ACCESS_FAILURE      3
+#define RF2XX_TRAC__NO_ACK                      5
+#define RF2XX_XAH_CTRL_0__MAX_FRAME_RETRIES(n)  ((n) << 4)
+#define RF2XX_XAH_CTRL_0__MAX_CSMA_RETRIES(n)   ((n) << 1)
+#define RF2XX_XAH_CTRL_1_MASK__AACK_PROM_MODE   0x02
+#define RF2XX_CSMA_BE(max, min)                 (((max) << 4) | (min))
+
 #define RF2XX_MAX_PAYLOAD 125
 static uint8_t tx_buf[RF2XX_MAX_PAYLOAD];
 static uint8_t tx_len;
+// received PSDU (FCS included) followed by the LQI
+static uint8_t rx_buf[RF2XX_MAX_PAYLOAD + 2 + 1];
+static volatile int tx_status;
 int channel_ = 13;
+static uint16_t radio_panid = 0xffff;
+static uint16_t radio_addr = 0xffff;
+static int radio_promisc;
+static int radio_reset_done;
 
 enum rf2xx_state
 {
@@ -81,10 +102,12 @@ static void idle(void);
 static void reset(void);
 static void restart(void);
 static void irq_handler(handler_arg_t arg);
-uint8_t *usr_radio_receive_frame (uint8_t len, uint8_t *frm) ;
-void usr_radio_tx_done (void) ;
+uint8_t *usr_radio_receive_frame_lqi (uint8_t len, uint8_t lqi, uint8_t *frm) ;
+void usr_radio_tx_done (int status) ;
+void usr_radio_rx_crcfail (void) ;
 int getChannelRadio(void);
 void setChannelRadio(int c);
+void setAddrRadio(int panid, int addr, int promisc);
 
 
 PROCESS(rf2xx_process, "rf2xx driver");
@@ -151,7 +174,7 @@ rf2xx_wr_transmit(unsigned short transmit_len)
     int ret, flag;
     uint8_t reg;
     rtimer_clock_t time;
-    log_info("radio-rf2xx: rf2xx_wr_transmit %d", transmit_len);
+    log_debug("radio-rf2xx: rf2xx_wr_transmit %d", transmit_len);
 
     if (tx_len != transmit_len)
     {
@@ -220,6 +243,24 @@ rf2xx_wr_transmit(unsigned short transmit_len)
         }
     } while (reg != RF2XX_TRX_STATUS__PLL_ON);
 
+    /*
+     * Extended operating mode: the radio does the CCA and waits
+     * for the ACK, the result is read in TRAC_STATUS at the end
+     * of the frame
+     */
+    rf2xx_set_state(RF2XX_DEVICE, RF2XX_TRX_STATE__TX_ARET_ON);
+    do
+    {
+        reg = rf2xx_get_status(RF2XX_DEVICE);
+
+        if (RTIMER_CLOCK_LT(time, RTIMER_NOW()))
+        {
+            log_error("radio-rf2xx: Failed to enter tx_aret");
+            restart();
+            return RADIO_TX_ERR;
+        }
+    } while (reg != RF2XX_TRX_STATUS__TX_ARET_ON);
+
     // Enable IRQ interrupt
     rf2xx_irq_enable(RF2XX_DEVICE);
 
@@ -231,20 +272,13 @@ rf2xx_wr_transmit(unsigned short transmit_len)
     // Start TX
     rf2xx_slp_tr_set(RF2XX_DEVICE);
 
-    // Wait until the end of the packet
-    while (rf2xx_state == RF_TX)
-    {
-        ;
-    }
-    usr_radio_tx_done() ;
-
-    ret = (rf2xx_state == RF_TX_DONE) ? RADIO_TX_OK : RADIO_TX_ERR;
-
-#ifdef RF2XX_LEDS_ON
-    leds_off(LEDS_RED);
-#endif
+    /*
+     * Don't wait until the end of the packet: the end of TX
+     * interrupt polls rf2xx_process, which restarts the radio
+     * and reports the TRAC_STATUS with usr_radio_tx_done.
+     */
 
-    restart();
+    ret = RADIO_TX_OK;
     return ret;
 }
 
@@ -271,7 +305,7 @@ static int
 rf2xx_wr_read(void *buf, unsigned short buf_len)
 {
     int len;
-    log_info("radio-rf2xx: rf2xx_wr_read %d", buf_len);
+    log_debug("radio-rf2xx: rf2xx_wr_read %d", buf_len);
 
     // Is there a packet pending
     platform_enter_critical();
@@ -292,54 +326,16 @@ rf2xx_wr_read(void *buf, unsigned short buf_len)
 
 /*---------------------------------------------------------------------------*/
 
-/** Perform a Clear-Channel Assessment (CCA) to find out if there is
-    a packet in the air or not. */
+/** Find out if there is a packet in the air or not. A manual CCA
+    is not available in RX_AACK_ON: the CCA itself is done by
+    TX_ARET_ON just before the frame (TRAC_STATUS reports a busy
+    channel). */
 static int
 rf2xx_wr_channel_clear(void)
 {
-    int clear = 1;
     log_debug("radio-rf2xx: rf2xx_wr_channel_clear");
 
-    // critical section is necessary
-    // to avoid spi access conflicts
-    // with irq_handler
-    switch (rf2xx_state)
-    {
-        uint8_t reg;
-        case RF_LISTEN:
-            //initiate a cca request
-            platform_enter_critical();
-            reg = RF2XX_PHY_CC_CCA_DEFAULT__CCA_MODE |
-                (RF2XX_CHANNEL & RF2XX_PHY_CC_CCA_MASK__CHANNEL) |
-                RF2XX_PHY_CC_CCA_MASK__CCA_REQUEST;
-            rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__PHY_CC_CCA, reg);
-            platform_exit_critical();
-
-            // wait cca to be done
-            do
-            {
-                platform_enter_critical();
-                reg = rf2xx_reg_read(RF2XX_DEVICE, RF2XX_REG__TRX_STATUS);
-                platform_exit_critical();
-            }
-            while (rf2xx_state == RF_LISTEN && !(reg & RF2XX_TRX_STATUS_MASK__CCA_DONE));
-
-            // get result
-            if (!(reg & RF2XX_TRX_STATUS_MASK__CCA_STATUS))
-            {
-                clear = 0;
-            }
-            break;
-
-        case RF_RX:
-            clear = 0;
-            break;
-
-        default:
-            break;
-    }
-
-    return clear;
+    return (rf2xx_state == RF_RX) ? 0 : 1;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -577,6 +573,19 @@ static int convert_power(phy_power_t power)
     return power;
 }
 
+/** Address filter for the automatic ACK of received frames */
+static void set_addr_filter(void)
+{
+    uint8_t reg;
+
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__SHORT_ADDR_0, radio_addr & 0xff);
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__SHORT_ADDR_1, radio_addr >> 8);
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__PAN_ID_0, radio_panid & 0xff);
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__PAN_ID_1, radio_panid >> 8);
+    reg = radio_promisc ? RF2XX_XAH_CTRL_1_MASK__AACK_PROM_MODE : 0;
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__XAH_CTRL_1, reg);
+}
+
 static void reset(void)
 {
     uint8_t reg;
@@ -629,6 +638,16 @@ static void reset(void)
         (RF2XX_CHANNEL & RF2XX_PHY_CC_CCA_MASK__CHANNEL);
     rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__PHY_CC_CCA, reg);
 
+    // One CCA without backoff and no retry: ConMsg does the
+    // backoffs and the retransmissions
+    reg = RF2XX_XAH_CTRL_0__MAX_FRAME_RETRIES(0)
+            | RF2XX_XAH_CTRL_0__MAX_CSMA_RETRIES(0);
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__XAH_CTRL_0, reg);
+    rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__CSMA_BE, RF2XX_CSMA_BE(0, 0));
+
+    set_addr_filter();
+    radio_reset_done = 1;
+
     // Set IRQ to TRX END/RX_START/CCA_DONE
     rf2xx_reg_write(RF2XX_DEVICE, RF2XX_REG__IRQ_MASK,
             RF2XX_IRQ_STATUS_MASK__TRX_END |
@@ -692,7 +711,7 @@ static void listen(void)
     // Start RX
     platform_enter_critical();
     rf2xx_state = RF_LISTEN;
-    rf2xx_set_state(RF2XX_DEVICE, RF2XX_TRX_STATE__RX_ON);
+    rf2xx_set_state(RF2XX_DEVICE, RF2XX_TRX_STATE__RX_AACK_ON);
     platform_exit_critical();
 }
 
@@ -722,6 +741,7 @@ static int read(uint8_t *buf, uint8_t buf_len)
             & RF2XX_PHY_RSSI_MASK__RX_CRC_VALID))
     {
         log_warning("radio-rf2xx: Received packet with bad crc");
+        usr_radio_rx_crcfail();
         return 0;
     }
 
@@ -731,10 +751,10 @@ static int read(uint8_t *buf, uint8_t buf_len)
 
     // Get payload length
     len = rf2xx_fifo_read_first(RF2XX_DEVICE) - 2;
-    log_info("radio-rf2xx: Received packet of length: %u", len);
+    log_debug("radio-rf2xx: Received packet of length: %u", len);
 
     // Check valid length (not zero and enough space to store it)
-    if (len > buf_len)
+    if (len > buf_len || len > RF2XX_MAX_PAYLOAD)
     {
         log_warning("radio-rf2xx: Received packet is too big (%u)", len);
         // Error length, end transfer
@@ -742,11 +762,13 @@ static int read(uint8_t *buf, uint8_t buf_len)
         return 0;
     }
 
-    // Read payload
-    rf2xx_fifo_read_remaining(RF2XX_DEVICE, buf, len);
+    // Read payload, FCS and the LQI appended by the radio
+    rf2xx_fifo_read_remaining(RF2XX_DEVICE, rx_buf, len + 2 + 1);
+    memcpy(buf, rx_buf, len);
 
     //NGUYEN Ky Anh
-    radiostatus.rxframe = usr_radio_receive_frame (len, radiostatus.rxframe);
+    radiostatus.rxframe = usr_radio_receive_frame_lqi (len, rx_buf[len + 2],
+                                        radiostatus.rxframe);
     
 
 
@@ -759,6 +781,23 @@ static int read(uint8_t *buf, uint8_t buf_len)
 
 /*---------------------------------------------------------------------------*/
 
+/** Result of an extended mode transmission, as a RADIO_TX_* code */
+static int trac_status(uint8_t reg)
+{
+    switch (RF2XX_TRAC_STATUS(reg))
+    {
+        case RF2XX_TRAC__SUCCESS:
+        case RF2XX_TRAC__SUCCESS_DATA_PENDING:
+            return RADIO_TX_OK;
+        case RF2XX_TRAC__CHANNEL_ACCESS_FAILURE:
+            return RADIO_TX_COLLISION;
+        case RF2XX_TRAC__NO_ACK:
+            return RADIO_TX_NOACK;
+        default:
+            return RADIO_TX_ERR;
+    }
+}
+
 static void irq_handler(handler_arg_t arg)
 {
     (void) arg;
@@ -793,13 +832,16 @@ static void irq_handler(handler_arg_t arg)
         switch (state)
         {
             case RF_TX:
+                tx_status = trac_status(
+                        rf2xx_reg_read(RF2XX_DEVICE, RF2XX_REG__TRX_STATE));
                 rf2xx_state = state = RF_TX_DONE;
+                process_poll(&rf2xx_process);
                 break;
             case RF_RX:
             case RF_LISTEN:
                 rf2xx_state = state = RF_RX_DONE;
-                // we do not want to start a 2nd RX
-                rf2xx_set_state(RF2XX_DEVICE, RF2XX_TRX_STATE__PLL_ON);
+                // stay in RX_AACK_ON to send the ACK: the frame
+                // buffer is protected (RX_SAFE_MODE) until read
                 process_poll(&rf2xx_process);
 
                 break;
@@ -827,6 +869,20 @@ void setChannelRadio(int c) {
     channel_ = c;
 }
 
+/* Address filter for the automatic ACKs, kept across radio resets */
+void setAddrRadio(int panid, int addr, int promisc) {
+    radio_panid = panid;
+    radio_addr = addr;
+    radio_promisc = promisc;
+    if (radio_reset_done)
+    {
+        // critical section avoids spi access conflicts with irq_handler
+        platform_enter_critical();
+        set_addr_filter();
+        platform_exit_critical();
+    }
+}
+
 
 PROCESS_THREAD(rf2xx_process, ev, data)
 {
@@ -855,14 +911,27 @@ PROCESS_THREAD(rf2xx_process, ev, data)
             rf2xx_state = RF_RX_READ;
             flag = 1;
         }
+        else if (rf2xx_state == RF_TX_DONE)
+        {
+            // end of an asynchronous transmission
+            flag = 2;
+        }
         platform_exit_critical();
 
-        if (flag)
+        if (flag == 1)
         {    
             len = read(radiostatus.rxframe, radiostatus.rxframesz);
             restart();
             
         }
+        else if (flag == 2)
+        {
+#ifdef RF2XX_LEDS_ON
+            leds_off(LEDS_RED);
+#endif
+            restart();
+            usr_radio_tx_done(tx_status);
+        }
     }
 
     PROCESS_END();
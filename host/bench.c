@@ -0,0 +1,121 @@
+/**
+ * @file bench.c
+ * @brief micro-benchmark harness implementation
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include "bench.h"
+
+uint64_t bench_nallocs ;
+uint64_t bench_nbytes ;
+
+static uint64_t realtime_ns (void)
+{
+    struct timespec ts ;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts) ;
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec ;
+}
+
+static double per_op (uint64_t n, uint64_t nops)
+{
+    return nops == 0 ? 0 : (double) n / nops ;
+}
+
+
+Bench *initBench (const char *suite)
+{
+    Bench *b ;
+
+    b = (Bench *) calloc (1, sizeof *b) ;
+    if (b != NULL)
+	b->suite_ = suite ;
+    return b ;
+}
+
+void freeBench (Bench *b)
+{
+    free (b) ;
+}
+
+
+void bench_begin (Bench *b)
+{
+    b->nallocs0_ = bench_nallocs ;
+    b->nbytes0_ = bench_nbytes ;
+    b->t0_ = realtime_ns () ;
+}
+
+
+/*
+ * End of a measure: `nops` operations have been done since
+ * `bench_begin`. Returns NULL if there are too many results.
+ */
+
+BenchResult *bench_end (Bench *b, const char *name, uint64_t nops)
+{
+    BenchResult *r ;
+    uint64_t t1 ;
+
+    t1 = realtime_ns () ;
+    if (b->nres_ == BENCH_MAX)
+	return NULL ;
+    r = &b->res_ [b->nres_++] ;
+    snprintf (r->name_, sizeof r->name_, "%s", name) ;
+    r->nops_ = nops ;
+    r->ns_ = t1 - b->t0_ ;
+    r->nallocs_ = bench_nallocs - b->nallocs0_ ;
+    r->nbytes_ = bench_nbytes - b->nbytes0_ ;
+    return r ;
+}
+
+
+void bench_print (Bench *b)
+{
+    BenchResult *r ;
+    int i ;
+
+    printf ("%-32s %10s %10s %8s %8s\n",
+		b->suite_, "ops", "ns/op", "allocs", "bytes") ;
+    for (i = 0 ; i < b->nres_ ; i++)
+    {
+	r = &b->res_ [i] ;
+	printf ("%-32s %10llu %10.1f %8.2f %8.1f\n", r->name_,
+		    (unsigned long long int) r->nops_,
+		    per_op (r->ns_, r->nops_),
+		    per_op (r->nallocs_, r->nops_),
+		    per_op (r->nbytes_, r->nops_)) ;
+    }
+}
+
+
+bool bench_write_json (Bench *b, const char *file)
+{
+    BenchResult *r ;
+    FILE *fp ;
+    bool ok ;
+    int i ;
+
+    fp = fopen (file, "w") ;
+    if (fp == NULL)
+	return false ;
+    fprintf (fp, "{\n  \"suite\": \"%s\",\n  \"results\": [\n", b->suite_) ;
+    for (i = 0 ; i < b->nres_ ; i++)
+    {
+	r = &b->res_ [i] ;
+	fprintf (fp, "    { \"name\": \"%s\", \"ops\": %llu, "
+			"\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "
+			"\"bytes_per_op\": %.1f }%s\n",
+		    r->name_, (unsigned long long int) r->nops_,
+		    per_op (r->ns_, r->nops_),
+		    per_op (r->nallocs_, r->nops_),
+		    per_op (r->nbytes_, r->nops_),
+		    i < b->nres_ - 1 ? "," : "") ;
+    }
+    fprintf (fp, "  ]\n}\n") ;
+    ok = ! ferror (fp) ;
+    if (fclose (fp) != 0)
+	ok = false ;
+    return ok ;
+}
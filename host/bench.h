@@ -0,0 +1,63 @@
+/**
+ * @file bench.h
+ * @brief micro-benchmark harness for the host
+ *
+ * A benchmark program measures each operation between `bench_begin`
+ * and `bench_end`, which records the number of operations, the real
+ * time spent and the allocations done. Results are printed, and
+ * written as a JSON file such that successive versions of the code
+ * can be compared by a script:
+ *
+ *	{ "suite": "...", "results": [
+ *	    { "name": "...", "ops": N, "ns_per_op": X,
+ *	      "allocs_per_op": Y, "bytes_per_op": Z }, ... ] }
+ *
+ * Allocations are counted in `bench_nallocs` and `bench_nbytes`. The
+ * harness does not replace the allocator: a benchmark program which
+ * wants these figures increments these counters from its own malloc,
+ * calloc and realloc functions (see test/bench). Otherwise, they are
+ * reported as 0.
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "contiki.h"
+#include "stdbool.h"
+
+#define	BENCH_MAX		64	// results in a suite
+#define	BENCH_NAMELEN		48
+
+typedef struct benchresult
+{
+    char name_ [BENCH_NAMELEN] ;
+    uint64_t nops_ ;
+    uint64_t ns_ ;			// real time
+    uint64_t nallocs_ ;
+    uint64_t nbytes_ ;
+} BenchResult ;
+
+typedef struct bench
+{
+    const char *suite_ ;
+    BenchResult res_ [BENCH_MAX] ;
+    int nres_ ;
+    /* current measure */
+    uint64_t t0_ ;
+    uint64_t nallocs0_ ;
+    uint64_t nbytes0_ ;
+} Bench ;
+
+extern uint64_t bench_nallocs ;
+extern uint64_t bench_nbytes ;
+
+Bench *initBench (const char *suite) ;
+void freeBench (Bench *b) ;
+
+void bench_begin (Bench *b) ;
+BenchResult *bench_end (Bench *b, const char *name, uint64_t nops) ;
+
+void bench_print (Bench *b) ;
+bool bench_write_json (Bench *b, const char *file) ;
+
+#endif
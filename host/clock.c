@@ -0,0 +1,52 @@
+/**
+ * @file clock.c
+ * @brief clock for the host (Linux) port
+ *
+ * The clock follows the real (monotonic) time, until a program
+ * switches to another time source:
+ * - a virtual time, with `clock_set_virtual`: time is then advanced
+ *   explicitly with `clock_advance`
+ * - any function, with `clock_set_source` (the discrete-event
+ *   scheduler of sched.h uses its own current time)
+ */
+
+#include <time.h>
+#include "contiki.h"
+
+static clock_time_t virtual_now ;
+
+static clock_time_t virtual_time (void *arg)
+{
+    (void) arg ;
+    return virtual_now ;
+}
+
+static clock_source_t source = NULL ;
+static void *source_arg ;
+
+clock_time_t clock_time (void)
+{
+    struct timespec ts ;
+
+    if (source != NULL)
+	return (*source) (source_arg) ;
+    clock_gettime (CLOCK_MONOTONIC, &ts) ;
+    return (clock_time_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000 ;
+}
+
+void clock_set_source (clock_source_t src, void *arg)
+{
+    source = src ;
+    source_arg = arg ;
+}
+
+void clock_set_virtual (clock_time_t now)
+{
+    virtual_now = now ;
+    clock_set_source (virtual_time, NULL) ;
+}
+
+void clock_advance (clock_time_t delta)
+{
+    virtual_now += delta ;
+}
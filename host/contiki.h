@@ -0,0 +1,48 @@
+/**
+ * @file contiki.h
+ * @brief minimal Contiki replacement for the host (Linux) port
+ *
+ * Only the services used by the CASAN libraries are provided:
+ * clock, critical sections and standard C headers. Note that
+ * <stdlib.h> is not included, since it would define a time_t
+ * conflicting with the CASAN one (see Casan/time.h).
+ */
+
+#ifndef __HOST_CONTIKI_H__
+#define __HOST_CONTIKI_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stddef.h>
+
+void *malloc (size_t size) ;
+void *calloc (size_t nmemb, size_t size) ;
+void *realloc (void *ptr, size_t size) ;
+void free (void *ptr) ;
+void exit (int status) ;
+int atoi (const char *nptr) ;
+
+typedef unsigned long clock_time_t ;
+
+#define	CLOCK_SECOND	1000		// clock_time () is in milliseconds
+
+clock_time_t clock_time (void) ;
+
+// host only: time source (NULL: real time) or virtual time, so
+// that simulations do not wait
+typedef clock_time_t (*clock_source_t) (void *arg) ;
+
+void clock_set_source (clock_source_t src, void *arg) ;
+void clock_set_virtual (clock_time_t now) ;
+void clock_advance (clock_time_t delta) ;
+
+// no interrupt on the host: simulated radio events are synchronous
+#define	platform_enter_critical()
+#define	platform_exit_critical()
+
+// each simulated node runs in its own thread (see sched.h)
+#define	PLATFORM_THREAD_LOCAL	__thread
+
+#endif
@@ -0,0 +1,701 @@
+/**
+ * @file master.c
+ * @brief CASAN master stand-in implementation
+ */
+
+#include "master.h"
+
+#define	HELLO_FMT	"hello=%ld"
+#define	DISCOVER_SLAVE	"slave=%ld"
+#define	DISCOVER_AGG	"agg=%ld"
+#define	ASSOC_TTL	"ttl=%ld"		// in 50 ms units (see is_assoc)
+#define	ASSOC_MTU	"mtu=%ld"
+#define	ASSOC_AGG	"agg=%ld"
+
+#define	QUERY_LEN	32
+
+// deterministic pseudo-random generator (xorshift)
+static uint32_t rnd (Master *ms)
+{
+    ms->rnd_ ^= ms->rnd_ << 13 ;
+    ms->rnd_ ^= ms->rnd_ >> 17 ;
+    ms->rnd_ ^= ms->rnd_ << 5 ;
+    return ms->rnd_ ;
+}
+
+
+/**
+ * @brief Create a master on a L2 network
+ *
+ * The first Hello message is sent on the first call to `master_loop`.
+ *
+ * @param l2 L2 network (already started)
+ * @param hlid hello id
+ * @param seed seed for the choice of resources in the workload
+ */
+
+Master *initMaster (l2net *l2, long int hlid, uint32_t seed)
+{
+    Master *ms ;
+
+    ms = (Master *) calloc (1, sizeof *ms) ;
+    if (ms == NULL)
+	return NULL ;
+    ms->l2_ = l2 ;
+    ms->hlid_ = hlid ;
+    ms->id_ = 1 ;
+    ms->rnd_ = seed != 0 ? seed : 1 ;
+    ms->hello_ = MASTER_HELLO ;
+    ms->nexthello_ = clock_time () ;
+    ms->ttl_ = MASTER_TTL ;
+    ms->mtu_ = MASTER_MTU ;
+    ms->timeout_ = MASTER_TIMEOUT ;
+    ms->cur_ = -1 ;
+    return ms ;
+}
+
+
+/*
+ * The L2 network is not stopped
+ */
+
+void freeMaster (Master *ms)
+{
+    free (ms->slaves_) ;
+    free (ms->reqs_) ;
+    free (ms) ;
+}
+
+
+/**
+ * @brief Hello period (0: no Hello message)
+ */
+
+void master_set_hello (Master *ms, clock_time_t period)
+{
+    ms->hello_ = period ;
+    ms->nexthello_ = clock_time () ;
+}
+
+
+/**
+ * @brief Parameters given to slaves in Assoc messages
+ *
+ * @param ttl slave TTL (ms)
+ * @param mtu MTU
+ * @param agg accept frame aggregation, if the slave can do it
+ */
+
+void master_set_assoc (Master *ms, long int ttl, int mtu, bool agg)
+{
+    ms->ttl_ = ttl ;
+    ms->mtu_ = mtu ;
+    ms->agg_ = agg ;
+}
+
+
+/**
+ * @brief Add a resource to the workload mix
+ *
+ * @param path resource name (single Uri-Path)
+ * @param op COAP_CODE_GET or COAP_CODE_PUT
+ * @param payload payload of PUT requests (NULL: none)
+ * @param observe GET requests register an observation
+ * @param weight relative frequency in the mix
+ * @return resource index, or -1 if the mix is full
+ */
+
+int master_add_resource (Master *ms, const char *path, coap_code_t op,
+			    const char *payload, bool observe,
+			    unsigned int weight)
+{
+    MasterRes *r ;
+
+    if (ms->nres_ == MASTER_MAXRES)
+	return -1 ;
+    r = &ms->res_ [ms->nres_] ;
+    memset (r, 0, sizeof *r) ;
+    snprintf (r->path_, sizeof r->path_, "%s", path) ;
+    r->op_ = op ;
+    if (payload != NULL)
+	snprintf (r->payload_, sizeof r->payload_, "%s", payload) ;
+    r->observe_ = observe ;
+    r->weight_ = weight ;
+    ms->totweight_ += weight ;
+    return ms->nres_++ ;
+}
+
+
+/**
+ * @brief Start (or stop, with rate = 0) the workload
+ *
+ * Statistics of resources are not reset.
+ *
+ * @param rate requests per second, for all slaves
+ * @param concurrency maximum number of outstanding requests
+ * @param timeout request timeout (ms), 0 for the default
+ * @return false if memory cannot be allocated
+ */
+
+bool master_set_load (Master *ms, uint32_t rate, int concurrency,
+			    clock_time_t timeout)
+{
+    MasterReq *nr ;
+
+    if (concurrency < 1)
+	concurrency = 1 ;
+    if (concurrency != ms->maxreqs_)
+    {
+	if (ms->nout_ > 0)
+	    return false ;		// requests are still outstanding
+	nr = (MasterReq *) calloc (concurrency, sizeof *nr) ;
+	if (nr == NULL)
+	    return false ;
+	free (ms->reqs_) ;
+	ms->reqs_ = nr ;
+	ms->maxreqs_ = concurrency ;
+    }
+    ms->rate_ = rate ;
+    ms->timeout_ = timeout != 0 ? timeout : MASTER_TIMEOUT ;
+    ms->tstart_ = clock_time () ;
+    ms->nextreq_ = (uint64_t) ms->tstart_ * 1000 ;
+    return true ;
+}
+
+
+/******************************************************************************
+ * Messages
+ */
+
+static bool push_query (Msg *m, const char *fmt, long int val)
+{
+    char q [QUERY_LEN] ;
+    option *o ;
+    bool r ;
+
+    snprintf (q, sizeof q, fmt, val) ;
+    o = initOptionOpaque (MO_Uri_Query, q, strlen (q)) ;
+    if (o == NULL)
+	return false ;
+    r = push_option (m, o) ;
+    freeOption (o) ;
+    return r ;
+}
+
+static void send_hello (Master *ms)
+{
+    Msg *m ;
+
+    m = initMsg (ms->l2_) ;
+    if (m == NULL)
+	return ;
+    set_id (m, ms->id_++) ;
+    set_type (m, COAP_TYPE_NON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    push_query (m, HELLO_FMT, ms->hlid_) ;
+    if (sendMsg (m, bcastaddr ()))
+	ms->nhello_++ ;
+    freeMsg (m) ;
+}
+
+static void send_assoc (Master *ms, MasterSlave *sl, bool agg)
+{
+    Msg *m ;
+
+    m = initMsg (ms->l2_) ;
+    if (m == NULL)
+	return ;
+    sl->associd_ = ms->id_++ ;
+    set_id (m, sl->associd_) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    push_query (m, ASSOC_TTL, ms->ttl_ / 50) ;
+    push_query (m, ASSOC_MTU, ms->mtu_) ;
+    if (agg && ms->agg_)
+	push_query (m, ASSOC_AGG, 1) ;
+    if (sendMsg (m, &sl->addr_))
+	ms->nassocmsg_++ ;
+    freeMsg (m) ;
+}
+
+// empty ACK for a confirmable notification
+static void send_ack (Master *ms, MasterSlave *sl, Msg *in)
+{
+    Msg *m ;
+
+    m = initMsg (ms->l2_) ;
+    if (m == NULL)
+	return ;
+    set_id (m, get_id (in)) ;
+    set_type (m, COAP_TYPE_ACK) ;
+    set_code (m, COAP_CODE_EMPTY) ;
+    sendMsg (m, &sl->addr_) ;
+    freeMsg (m) ;
+}
+
+
+// is this a Discover message? (slave id and aggregation capability)
+static bool is_discover (Msg *in, long int *slaveid, bool *agg)
+{
+    option *o ;
+    long int n ;
+    bool found = false ;
+
+    *agg = false ;
+    if (get_type (in) != COAP_TYPE_NON || get_code (in) != COAP_CODE_POST)
+	return false ;
+    reset_next_option (in) ;
+    for (o = next_option (in) ; o != NULL ; o = next_option (in))
+    {
+	if (getOptcode (o) != MO_Uri_Query)
+	    continue ;
+	// the value is followed by a nul byte (see Casan/option.c)
+	if (sscanf ((const char *) getOptval (o, (int *) 0), DISCOVER_SLAVE,
+						slaveid) == 1)
+	    found = true ;
+	else if (sscanf ((const char *) getOptval (o, (int *) 0), DISCOVER_AGG,
+						&n) == 1)
+	    *agg = n != 0 ;
+    }
+    reset_next_option (in) ;
+    return found ;
+}
+
+
+static int find_slave (Master *ms, l2addr *a)
+{
+    int i ;
+
+    for (i = 0 ; i < ms->nslaves_ ; i++)
+	if (isEqualAddr (&ms->slaves_ [i].addr_, a))
+	    return i ;
+    return -1 ;
+}
+
+static MasterSlave *add_slave (Master *ms, l2addr *a, long int slaveid)
+{
+    MasterSlave *ns ;
+    int i ;
+
+    i = find_slave (ms, a) ;
+    if (i < 0)
+    {
+	if (ms->nslaves_ == ms->maxslaves_)
+	{
+	    ns = (MasterSlave *) realloc (ms->slaves_,
+				    (ms->maxslaves_ + 16) * sizeof *ns) ;
+	    if (ns == NULL)
+		return NULL ;
+	    ms->slaves_ = ns ;
+	    ms->maxslaves_ += 16 ;
+	}
+	i = ms->nslaves_++ ;
+	memset (&ms->slaves_ [i], 0, sizeof ms->slaves_ [i]) ;
+	copyAddr (&ms->slaves_ [i].addr_, a) ;
+	ms->slaves_ [i].obsres_ = -1 ;
+    }
+    ms->slaves_ [i].slaveid_ = slaveid ;
+    return &ms->slaves_ [i] ;
+}
+
+
+static uint16_t token_id (Msg *m)
+{
+    token *t = get_token_msg (m) ;
+
+    return t->toklen_ == 2 ? (t->token_ [0] << 8) | t->token_ [1] : 0 ;
+}
+
+static void count_code (MasterRes *r, uint8_t code)
+{
+    int i ;
+
+    for (i = 0 ; i < r->ncodes_ ; i++)
+    {
+	if (r->codes_ [i].code_ == code)
+	{
+	    r->codes_ [i].n_++ ;
+	    return ;
+	}
+    }
+    if (r->ncodes_ < MASTER_MAXCODES)
+    {
+	r->codes_ [i].code_ = code ;
+	r->codes_ [i].n_ = 1 ;
+	r->ncodes_++ ;
+    }
+}
+
+
+// answer to an outstanding request?
+static bool answer (Master *ms, int slave, Msg *in)
+{
+    MasterReq *rq ;
+    MasterRes *r ;
+    MasterSlave *sl ;
+    clock_time_t lat ;
+    int i ;
+
+    rq = NULL ;
+    for (i = 0 ; i < ms->maxreqs_ && rq == NULL ; i++)
+    {
+	if (ms->reqs_ [i].used_ && ms->reqs_ [i].slave_ == slave
+			&& ms->reqs_ [i].id_ == get_id (in))
+	    rq = &ms->reqs_ [i] ;
+    }
+    if (rq == NULL)
+	return false ;
+
+    r = &ms->res_ [rq->res_] ;
+    lat = clock_time () - rq->tsent_ ;
+    r->nanswer_++ ;
+    r->lat_ [lat < MASTER_MAXLAT ? lat : MASTER_MAXLAT]++ ;
+    count_code (r, get_code (in)) ;
+    if (r->observe_ && search_option (in, MO_Observe) != NULL)
+    {
+	sl = &ms->slaves_ [slave] ;
+	sl->obsres_ = rq->res_ ;
+	sl->obstok_ = rq->id_ ;
+    }
+    rq->used_ = false ;
+    ms->nout_-- ;
+    return true ;
+}
+
+
+static void process (Master *ms, Msg *in, l2addr *src)
+{
+    MasterSlave *sl ;
+    long int slaveid ;
+    bool agg ;
+    int i ;
+
+    i = find_slave (ms, src) ;
+    if (is_ctl_msg (in))
+    {
+	if (is_discover (in, &slaveid, &agg))
+	{
+	    ms->ndiscover_++ ;
+	    sl = add_slave (ms, src, slaveid) ;
+	    if (sl != NULL)
+	    {
+		if (sl->assoc_)
+		{
+		    sl->assoc_ = false ;	// until the new Assoc is acked
+		    ms->nassoc_-- ;
+		}
+		send_assoc (ms, sl, agg) ;
+	    }
+	}
+	return ;			// Hello from another master, etc.
+    }
+
+    if (i < 0)
+    {
+	ms->nunknown_++ ;
+	return ;
+    }
+    sl = &ms->slaves_ [i] ;
+
+    if (get_type (in) == COAP_TYPE_ACK && get_id (in) == sl->associd_)
+    {
+	if (! sl->assoc_ && get_code (in) == COAP_CODE_OK)
+	{
+	    sl->assoc_ = true ;
+	    ms->nassoc_++ ;
+	    if (sl->tassoc_ == 0)
+		sl->tassoc_ = clock_time () ;
+	}
+    }
+    else if (get_type (in) == COAP_TYPE_ACK && answer (ms, i, in))
+	;
+    else if (sl->obsres_ >= 0 && search_option (in, MO_Observe) != NULL
+		&& token_id (in) == sl->obstok_)
+    {
+	ms->res_ [sl->obsres_].nnotify_++ ;
+	if (get_type (in) == COAP_TYPE_CON)
+	    send_ack (ms, sl, in) ;
+    }
+    else ms->nunknown_++ ;
+}
+
+
+/******************************************************************************
+ * Workload
+ */
+
+static int pick_resource (Master *ms)
+{
+    unsigned int w ;
+    int i ;
+
+    if (ms->totweight_ == 0)
+	return -1 ;
+    w = rnd (ms) % ms->totweight_ ;
+    for (i = 0 ; w >= ms->res_ [i].weight_ ; i++)
+	w -= ms->res_ [i].weight_ ;
+    return i ;
+}
+
+static int pick_slave (Master *ms)
+{
+    int i, n ;
+
+    if (ms->nassoc_ == 0)
+	return -1 ;
+    for (n = 0 ; n < ms->nslaves_ ; n++)
+    {
+	i = (ms->cur_ + 1 + n) % ms->nslaves_ ;
+	if (ms->slaves_ [i].assoc_)
+	{
+	    ms->cur_ = i ;
+	    return i ;
+	}
+    }
+    return -1 ;
+}
+
+static void send_request (Master *ms)
+{
+    MasterReq *rq ;
+    MasterRes *r ;
+    option *o ;
+    token tok ;
+    Msg *m ;
+    int i, slave, res ;
+
+    if ((slave = pick_slave (ms)) < 0)
+    {
+	ms->nnoslave_++ ;
+	return ;
+    }
+    if (ms->nout_ == ms->maxreqs_ || (res = pick_resource (ms)) < 0)
+    {
+	ms->nskipped_++ ;
+	return ;
+    }
+    m = initMsg (ms->l2_) ;
+    if (m == NULL)
+    {
+	ms->nskipped_++ ;
+	return ;
+    }
+
+    r = &ms->res_ [res] ;
+    for (i = 0 ; ms->reqs_ [i].used_ ; i++)
+	;
+    rq = &ms->reqs_ [i] ;
+    rq->id_ = ms->id_++ ;
+    rq->slave_ = slave ;
+    rq->res_ = res ;
+    rq->tsent_ = clock_time () ;
+
+    set_id (m, rq->id_) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, r->op_) ;
+    tok.toklen_ = 2 ;			// the token is the message id
+    tok.token_ [0] = BYTE_HIGH (rq->id_) ;
+    tok.token_ [1] = BYTE_LOW (rq->id_) ;
+    set_token_msg (m, &tok) ;
+    o = initOptionOpaque (MO_Uri_Path, r->path_, strlen (r->path_)) ;
+    if (o != NULL)
+    {
+	push_option (m, o) ;
+	freeOption (o) ;
+    }
+    if (r->observe_)
+    {
+	o = initOptionInteger (MO_Observe, 0) ;
+	if (o != NULL)
+	{
+	    push_option (m, o) ;
+	    freeOption (o) ;
+	}
+    }
+    if (r->op_ == COAP_CODE_PUT && r->payload_ [0] != '\0')
+	set_payload_msg (m, (uint8_t *) r->payload_, strlen (r->payload_)) ;
+
+    if (sendMsg (m, &ms->slaves_ [slave].addr_))
+    {
+	rq->used_ = true ;
+	ms->nout_++ ;
+	r->nsent_++ ;
+    }
+    else ms->nskipped_++ ;
+    freeMsg (m) ;
+}
+
+
+// requests without answer
+static void expire (Master *ms)
+{
+    MasterReq *rq ;
+    int i ;
+
+    for (i = 0 ; i < ms->maxreqs_ && ms->nout_ > 0 ; i++)
+    {
+	rq = &ms->reqs_ [i] ;
+	if (rq->used_ && clock_time () - rq->tsent_ >= ms->timeout_)
+	{
+	    ms->res_ [rq->res_].ntimeout_++ ;
+	    rq->used_ = false ;
+	    ms->nout_-- ;
+	}
+    }
+}
+
+
+/**
+ * @brief Process received messages, send Hello messages and requests
+ */
+
+void master_loop (Master *ms)
+{
+    l2addr *src ;
+    uint64_t now ;
+    uint32_t period ;
+    Msg *in ;
+
+    in = initMsg (ms->l2_) ;
+    if (in != NULL)
+    {
+	while (recvMsg (in) == RECV_OK)
+	{
+	    src = get_src (ms->l2_) ;
+	    if (src != NULL)
+	    {
+		process (ms, in, src) ;
+		freel2addr (src) ;
+	    }
+	    resetMsg (in) ;
+	}
+	freeMsg (in) ;
+    }
+
+    expire (ms) ;
+
+    if (ms->hello_ != 0 && clock_time () >= ms->nexthello_)
+    {
+	send_hello (ms) ;
+	ms->nexthello_ = clock_time () + ms->hello_ ;
+    }
+
+    if (ms->rate_ > 0)
+    {
+	now = (uint64_t) clock_time () * 1000 ;
+	period = ms->rate_ < 1000000 ? 1000000 / ms->rate_ : 1 ;
+	for ( ; ms->nextreq_ <= now ; ms->nextreq_ += period)
+	    send_request (ms) ;
+    }
+
+    flush_send (ms->l2_) ;
+}
+
+
+/**
+ * @brief Time of the next Hello, request or request timeout
+ *
+ * @return false if there is nothing to do (until a message arrives)
+ */
+
+bool master_next (Master *ms, clock_time_t *next)
+{
+    clock_time_t t ;
+    bool found = false ;
+    int i ;
+
+#define	EARLIER(t)	do { if (! found || (t) < *next) \
+				{ *next = (t) ; found = true ; } } while (0)
+    if (ms->hello_ != 0)
+	EARLIER (ms->nexthello_) ;
+    if (ms->rate_ > 0)
+	EARLIER ((clock_time_t) ((ms->nextreq_ + 999) / 1000)) ;
+    for (i = 0 ; i < ms->maxreqs_ && ms->nout_ > 0 ; i++)
+    {
+	if (ms->reqs_ [i].used_)
+	{
+	    t = ms->reqs_ [i].tsent_ + ms->timeout_ ;
+	    EARLIER (t) ;
+	}
+    }
+#undef	EARLIER
+    return found ;
+}
+
+
+/******************************************************************************
+ * Statistics
+ */
+
+/**
+ * @brief Latency percentile of a resource (ms), from the histogram
+ *
+ * @param pct percentile (0..100), 100 for the maximum
+ */
+
+uint32_t master_percentile (MasterRes *r, int pct)
+{
+    uint64_t n, target, cum ;
+    uint32_t i ;
+
+    n = 0 ;
+    for (i = 0 ; i <= MASTER_MAXLAT ; i++)
+	n += r->lat_ [i] ;
+    if (n == 0)
+	return 0 ;
+    target = (n * pct + 99) / 100 ;
+    if (target == 0)
+	target = 1 ;
+    cum = 0 ;
+    for (i = 0 ; i < MASTER_MAXLAT ; i++)
+    {
+	cum += r->lat_ [i] ;
+	if (cum >= target)
+	    break ;
+    }
+    return i ;
+}
+
+
+void master_print_stat (Master *ms)
+{
+    MasterRes *r ;
+    clock_time_t elapsed ;
+    int i, j ;
+
+    printf ("master: slaves=%d associated=%d hello=%lu discover=%lu assoc=%lu\n",
+		ms->nslaves_, ms->nassoc_, (unsigned long int) ms->nhello_,
+		(unsigned long int) ms->ndiscover_,
+		(unsigned long int) ms->nassocmsg_) ;
+    printf ("master: skipped=%lu no-slave=%lu unexpected=%lu\n",
+		(unsigned long int) ms->nskipped_,
+		(unsigned long int) ms->nnoslave_,
+		(unsigned long int) ms->nunknown_) ;
+
+    elapsed = clock_time () - ms->tstart_ ;
+    for (i = 0 ; i < ms->nres_ ; i++)
+    {
+	r = &ms->res_ [i] ;
+	printf ("%-8s %s%s sent=%lu answered=%lu timeout=%lu notify=%lu"
+		" %.2f/s latency p50=%lu p90=%lu p99=%lu max=%lu ms\n",
+		r->path_, r->op_ == COAP_CODE_PUT ? "PUT" : "GET",
+		r->observe_ ? "+obs" : "",
+		(unsigned long int) r->nsent_,
+		(unsigned long int) r->nanswer_,
+		(unsigned long int) r->ntimeout_,
+		(unsigned long int) r->nnotify_,
+		elapsed == 0 ? 0.0 : r->nanswer_ * 1000.0 / elapsed,
+		(unsigned long int) master_percentile (r, 50),
+		(unsigned long int) master_percentile (r, 90),
+		(unsigned long int) master_percentile (r, 99),
+		(unsigned long int) master_percentile (r, 100)) ;
+	printf ("%-8s codes:", "") ;
+	for (j = 0 ; j < r->ncodes_ ; j++)
+	    printf (" %d.%02d=%lu", r->codes_ [j].code_ >> 5,
+				r->codes_ [j].code_ & 0x1f,
+				(unsigned long int) r->codes_ [j].n_) ;
+	printf ("\n") ;
+    }
+}
@@ -0,0 +1,140 @@
+/**
+ * @file master.h
+ * @brief CASAN master stand-in and request load generator for the host
+ *
+ * This is not a complete CASAN master: it only implements what is
+ * needed to run slaves and to load them, with the same CoAP codec
+ * as the slaves, on any L2 network (simulated medium or UDP):
+ * - a Hello message is broadcast periodically
+ * - each Discover message is answered with an Assoc message, and the
+ *   slave is considered associated when it acknowledges it
+ * - requests are sent to associated slaves (round-robin), following
+ *   an open-loop workload: a given rate (requests per second), which
+ *   does not depend on answers, with at most a given number of
+ *   outstanding requests (a request which would exceed this limit is
+ *   counted as skipped). Each request uses a resource drawn from a
+ *   weighted mix of GET, PUT and observe (GET with Observe = 0)
+ *   operations. Requests are never retransmitted: a request without
+ *   answer after the timeout is counted as such.
+ *
+ * For each resource of the mix, the master counts answers by CoAP
+ * code, timeouts and observe notifications, and keeps a histogram of
+ * latencies (ms) to give throughput and percentiles.
+ *
+ * `master_loop` must be called when a message is received, or at the
+ * time given by `master_next` (see sched.h).
+ */
+
+#ifndef __MASTER_H__
+#define __MASTER_H__
+
+#include "../libraries/Casan/casan.h"
+
+#define	MASTER_HELLO		30000	// default Hello period (ms)
+#define	MASTER_TTL		3600000	// default slave TTL (ms)
+#define	MASTER_MTU		127
+#define	MASTER_TIMEOUT		2000	// default request timeout (ms)
+
+#define	MASTER_MAXRES		8	// resources in the workload mix
+#define	MASTER_MAXCODES		8	// distinct answer codes per resource
+#define	MASTER_MAXLAT		2000	// latency histogram (ms)
+#define	MASTER_PATHLEN		16
+#define	MASTER_PAYLEN		32
+
+typedef struct masterres
+{
+    char path_ [MASTER_PATHLEN] ;
+    coap_code_t op_ ;			// GET or PUT
+    char payload_ [MASTER_PAYLEN] ;	// for PUT
+    bool observe_ ;			// GET with Observe = 0
+    unsigned int weight_ ;
+    /* statistics */
+    uint32_t nsent_ ;
+    uint32_t nanswer_ ;
+    uint32_t ntimeout_ ;
+    uint32_t nnotify_ ;			// observe notifications
+    struct
+    {
+	uint8_t code_ ;
+	uint32_t n_ ;
+    } codes_ [MASTER_MAXCODES] ;	// answers, by code
+    int ncodes_ ;
+    uint32_t lat_ [MASTER_MAXLAT + 1] ;	// last one: >= MASTER_MAXLAT
+} MasterRes ;
+
+typedef struct masterslave
+{
+    l2addr addr_ ;
+    long int slaveid_ ;
+    bool assoc_ ;			// Assoc acknowledged
+    uint16_t associd_ ;			// id of the last Assoc message
+    clock_time_t tassoc_ ;		// first association
+    int obsres_ ;			// observed resource (-1: none)
+    uint16_t obstok_ ;			// token of the observe request
+} MasterSlave ;
+
+typedef struct masterreq
+{
+    bool used_ ;
+    uint16_t id_ ;
+    int slave_ ;
+    int res_ ;
+    clock_time_t tsent_ ;
+} MasterReq ;
+
+typedef struct master
+{
+    l2net *l2_ ;
+    long int hlid_ ;
+    uint16_t id_ ;			// next message id
+    uint32_t rnd_ ;
+    /* Hello and Assoc */
+    clock_time_t hello_ ;		// period (0: no Hello)
+    clock_time_t nexthello_ ;
+    long int ttl_ ;			// slave TTL (ms)
+    int mtu_ ;
+    bool agg_ ;				// accept frame aggregation
+    MasterSlave *slaves_ ;
+    int nslaves_ ;
+    int maxslaves_ ;
+    int nassoc_ ;			// associated slaves
+    /* workload */
+    MasterRes res_ [MASTER_MAXRES] ;
+    int nres_ ;
+    unsigned int totweight_ ;
+    uint32_t rate_ ;			// requests per second (0: none)
+    uint64_t nextreq_ ;			// next request (us)
+    MasterReq *reqs_ ;			// outstanding requests
+    int maxreqs_ ;			// concurrency
+    int nout_ ;
+    clock_time_t timeout_ ;
+    int cur_ ;				// last slave used
+    clock_time_t tstart_ ;		// start of the workload
+    /* statistics */
+    uint32_t nhello_ ;
+    uint32_t ndiscover_ ;
+    uint32_t nassocmsg_ ;		// Assoc messages sent
+    uint32_t nskipped_ ;		// concurrency limit reached
+    uint32_t nnoslave_ ;		// no associated slave
+    uint32_t nunknown_ ;		// late or unexpected answers
+} Master ;
+
+Master *initMaster (l2net *l2, long int hlid, uint32_t seed) ;
+void freeMaster (Master *ms) ;
+
+void master_set_hello (Master *ms, clock_time_t period) ;
+void master_set_assoc (Master *ms, long int ttl, int mtu, bool agg) ;
+
+int master_add_resource (Master *ms, const char *path, coap_code_t op,
+			    const char *payload, bool observe,
+			    unsigned int weight) ;
+bool master_set_load (Master *ms, uint32_t rate, int concurrency,
+			    clock_time_t timeout) ;
+
+void master_loop (Master *ms) ;
+bool master_next (Master *ms, clock_time_t *next) ;
+
+uint32_t master_percentile (MasterRes *r, int pct) ;
+void master_print_stat (Master *ms) ;
+
+#endif
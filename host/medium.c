@@ -0,0 +1,626 @@
+/**
+ * @file medium.c
+ * @brief simulated IEEE 802.15.4 radio medium implementation
+ */
+
+#include <stdlib.h>
+#include "medium.h"
+
+#define	LINK_DEFAULT	0
+#define	LINK_SET	1
+#define	LINK_CUT	2
+
+#define	ACK_US		(MEDIUM_TURNAROUND + Z_AIRTIME_US (Z_ACK_LEN))
+
+static simtime_t now_us (void)
+{
+    return (simtime_t) clock_time () * 1000 ;
+}
+
+// deterministic pseudo-random generator (xorshift)
+static uint32_t xorshift (uint32_t *r)
+{
+    *r ^= *r << 13 ;
+    *r ^= *r >> 17 ;
+    *r ^= *r << 5 ;
+    return *r ;
+}
+
+static uint32_t rnd (Medium *m)
+{
+    return xorshift (&m->rnd_) ;
+}
+
+// random numbers drawn by a node, from its own generator if deferred
+static uint32_t node_rnd (SimNode *n)
+{
+    return n->m_->deferred_ ? xorshift (&n->rnd_) : rnd (n->m_) ;
+}
+
+
+Medium *initMedium (int maxnodes, uint32_t seed)
+{
+    Medium *m ;
+
+    m = (Medium *) calloc (1, sizeof *m) ;
+    if (m == NULL)
+	return NULL ;
+    m->nodes_ = (SimNode *) calloc (maxnodes, sizeof *m->nodes_) ;
+    m->pendq_ = (int *) calloc (maxnodes, sizeof *m->pendq_) ;
+    if (m->nodes_ == NULL || m->pendq_ == NULL)
+    {
+	freeMedium (m) ;
+	return NULL ;
+    }
+    m->maxnodes_ = maxnodes ;
+    m->lqi_ = MEDIUM_LQI ;
+    m->seed_ = seed ;
+    m->rnd_ = seed != 0 ? seed : 1 ;
+    return m ;
+}
+
+
+/*
+ * Nodes are not stopped: the ConMsg objects and the l2net objects
+ * are not freed.
+ */
+
+void freeMedium (Medium *m)
+{
+    sim_radio_select (NULL) ;
+    free (m->nodes_) ;
+    free (m->links_) ;
+    free (m->pendq_) ;
+    free (m->frames_) ;
+    free (m) ;
+}
+
+
+void medium_set_default (Medium *m, uint16_t loss, uint8_t lqi, uint32_t delay)
+{
+    m->loss_ = loss ;
+    m->lqi_ = lqi ;
+    m->delay_ = delay ;
+}
+
+
+/*
+ * The link table (maxnodes x maxnodes) is only allocated when a link
+ * is set explicitly: large simulations usually only use domains.
+ */
+
+static SimLink *setlink (Medium *m, int from, int to)
+{
+    if (m->links_ == NULL)
+    {
+	m->links_ = (SimLink *) calloc ((size_t) m->maxnodes_ * m->maxnodes_,
+					sizeof *m->links_) ;
+	if (m->links_ == NULL)
+	    return NULL ;
+    }
+    return &m->links_ [from * m->maxnodes_ + to] ;
+}
+
+
+void medium_set_link (Medium *m, int from, int to, uint16_t loss, uint8_t lqi)
+{
+    SimLink *l ;
+
+    if ((l = setlink (m, from, to)) != NULL)
+    {
+	l->state_ = LINK_SET ;
+	l->loss_ = loss ;
+	l->lqi_ = lqi ;
+    }
+}
+
+
+void medium_cut_link (Medium *m, int from, int to)
+{
+    SimLink *l ;
+
+    if ((l = setlink (m, from, to)) != NULL)
+	l->state_ = LINK_CUT ;
+}
+
+
+// does node `to` hear node `from`?
+static SimLink *getlink (Medium *m, int from, int to, SimLink *def)
+{
+    static const SimLink none = { LINK_DEFAULT, 0, 0 } ;
+    const SimLink *l ;
+
+    l = m->links_ != NULL ? &m->links_ [from * m->maxnodes_ + to] : &none ;
+    switch (l->state_)
+    {
+	case LINK_SET :
+	    return (SimLink *) l ;
+	case LINK_CUT :
+	    return NULL ;
+	default :
+	    if (m->nodes_ [from].domain_ != m->nodes_ [to].domain_
+		    || m->nodes_ [from].radio_.chan != m->nodes_ [to].radio_.chan)
+		return NULL ;
+	    def->loss_ = m->loss_ ;
+	    def->lqi_ = m->lqi_ ;
+	    return def ;
+    }
+}
+
+
+static bool overlap (SimFrame *f, SimFrame *g)
+{
+    return f->start_ < g->end_ && g->start_ < f->end_ ;
+}
+
+
+/******************************************************************************
+ * Radio hooks (the node is the current one)
+ */
+
+/*
+ * The CCA happens at a random time in the current millisecond, and
+ * the transmission (if any) starts at this time. In deferred mode,
+ * frames started in the current millisecond by other nodes are not
+ * committed yet, and are not detected: since a frame is only detected
+ * MEDIUM_TURNAROUND us after its start, this only differs for nodes
+ * whose CCA is late in the millisecond.
+ */
+
+static int medium_cca (void *arg)
+{
+    SimNode *n = (SimNode *) arg ;
+    Medium *m = n->m_ ;
+    SimLink def ;
+    SimFrame *f ;
+    int i ;
+
+    n->ccat_ = now_us () + node_rnd (n) % 1000 ;
+    for (i = 0 ; i < m->nframes_ ; i++)
+    {
+	f = &m->frames_ [i] ;
+	if (f->sender_ != n->idx_
+		&& f->start_ + MEDIUM_TURNAROUND <= n->ccat_
+		&& n->ccat_ < f->end_
+		&& getlink (m, f->sender_, n->idx_, &def) != NULL)
+	    return 0 ;
+    }
+    return 1 ;
+}
+
+
+// new frame in the air, or NULL
+static SimFrame *newframe (Medium *m)
+{
+    SimFrame *nf ;
+
+    if (m->nframes_ == m->maxframes_)
+    {
+	nf = (SimFrame *) realloc (m->frames_,
+				(m->maxframes_ + 16) * sizeof *nf) ;
+	if (nf == NULL)
+	    return NULL ;
+	m->frames_ = nf ;
+	m->maxframes_ += 16 ;
+    }
+    return &m->frames_ [m->nframes_++] ;
+}
+
+
+/*
+ * In deferred mode, nodes may be run by several threads: the frame
+ * is kept in the node until `medium_commit`.
+ */
+
+static void medium_tx (void *arg, const uint8_t *frame, uint8_t len)
+{
+    SimNode *n = (SimNode *) arg ;
+    Medium *m = n->m_ ;
+    SimFrame *f ;
+    simtime_t now ;
+
+    if (m->deferred_)
+    {
+	f = &n->pending_ ;
+	m->pendq_ [__atomic_fetch_add (&m->npend_, 1, __ATOMIC_RELAXED)]
+				= n->idx_ ;
+    }
+    else
+    {
+	f = newframe (m) ;
+	if (f == NULL)
+	    return ;			// TX will never complete
+	m->nsent_++ ;
+    }
+
+    now = now_us () ;
+    f->sender_ = n->idx_ ;
+    f->dst_ = CONST16 (frame [5], frame [6]) ;
+    f->start_ = n->ccat_ >= now ? n->ccat_ : now + node_rnd (n) % 1000 ;
+    f->end_ = f->start_ + Z_AIRTIME_US (len + 2) ;	// with FCS
+    f->done_ = f->end_ + m->delay_ ;
+    if (f->dst_ != CONST16 (0xff, 0xff))
+	f->done_ += ACK_US + m->delay_ ;
+    f->delivered_ = false ;
+    f->completed_ = false ;
+    f->acked_ = false ;
+    f->len_ = len ;
+    memcpy (f->data_, frame, len) ;
+    n->ntx_++ ;
+}
+
+
+/******************************************************************************
+ * Nodes
+ */
+
+/**
+ * @brief Add a node and start its L2 network
+ *
+ * The node is selected, and its ConMsg object is started with the
+ * default MAC parameters.
+ *
+ * @return node index, or -1 if the medium is full
+ */
+
+int medium_add_node (Medium *m, addr2_t addr, int domain,
+				channel_t chan, panid_t panid)
+{
+    SimNode *n ;
+    l2addr a ;
+
+    if (m->nnodes_ == m->maxnodes_)
+	return -1 ;
+    n = &m->nodes_ [m->nnodes_] ;
+    memset (n, 0, sizeof *n) ;
+    n->m_ = m ;
+    n->idx_ = m->nnodes_++ ;
+    n->addr_ = addr ;
+    n->domain_ = domain ;
+
+    n->rnd_ = (m->seed_ ^ (n->idx_ * 0x9e3779b9)) | 1 ;
+    sim_radio_init (&n->radio_) ;
+    sim_radio_select (&n->radio_) ;
+    sim_radio_set_sync (false, TX_OK) ;
+    sim_radio_set_tx_hook (medium_tx, n) ;
+    sim_radio_set_cca_hook (medium_cca, n) ;
+
+    a.addr_ = addr ;
+    n->l2_ = startL2_154 (&a, chan, panid) ;
+    n->conmsg_ = L2_154 (n->l2_)->cm_ ;
+    return n->idx_ ;
+}
+
+
+SimNode *medium_node (Medium *m, int node)
+{
+    return &m->nodes_ [node] ;
+}
+
+
+int medium_find (Medium *m, addr2_t addr)
+{
+    int i ;
+
+    for (i = 0 ; i < m->nnodes_ ; i++)
+	if (m->nodes_ [i].addr_ == addr)
+	    return i ;
+    return -1 ;
+}
+
+
+/**
+ * @brief Make the radio of a node current
+ *
+ * @param node node index, or -1 for the default radio
+ */
+
+void medium_select (Medium *m, int node)
+{
+    sim_radio_select (node >= 0 ? &m->nodes_ [node].radio_ : NULL) ;
+}
+
+
+/**
+ * @brief Choose the deferred mode, where nodes may be run in parallel
+ *
+ * In this mode, frames sent by nodes are only put in the air by
+ * `medium_commit`, which must be called when all nodes have been run
+ * for the current millisecond (see `sched_set_barrier`), and nodes
+ * use their own random generator. Also, the medium does not poll the
+ * transmit queue of nodes: each node must poll it when it is run,
+ * and the rx hook is called for the sender when a transmission
+ * completes, such that the node can be run again.
+ *
+ * The runner, if any, is used to deliver a frame to all nodes in
+ * parallel (see `sched_parallel_for`): the rx hook may then be called
+ * by several threads.
+ */
+
+void medium_set_deferred (Medium *m, bool deferred,
+				medium_runner_t runner, void *arg)
+{
+    medium_commit (m) ;
+    m->deferred_ = deferred ;
+    m->runner_ = runner ;
+    m->runarg_ = arg ;
+}
+
+
+static int cmpint (const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b ;
+}
+
+
+/**
+ * @brief Put frames sent by nodes in the air (deferred mode), in
+ *	node order
+ */
+
+void medium_commit (Medium *m)
+{
+    SimFrame *f ;
+    int i ;
+
+    qsort (m->pendq_, m->npend_, sizeof *m->pendq_, cmpint) ;
+    for (i = 0 ; i < m->npend_ ; i++)
+    {
+	f = newframe (m) ;
+	if (f == NULL)
+	    break ;			// TX will never complete
+	*f = m->nodes_ [m->pendq_ [i]].pending_ ;
+	m->nsent_++ ;
+    }
+    m->npend_ = 0 ;
+}
+
+
+/******************************************************************************
+ * Simulation
+ */
+
+/**
+ * @brief Set a function called each time a node receives a frame
+ */
+
+void medium_set_rx_hook (Medium *m, medium_rx_hook_t hook, void *arg)
+{
+    m->rxhook_ = hook ;
+    m->rxarg_ = arg ;
+}
+
+
+struct delivery
+{
+    Medium *m ;
+    SimFrame *f ;
+    bool coll ;				// a receiver got a collision
+} ;
+
+// deliver a frame to a node: only this node is modified
+static void deliver_to (void *arg, int i)
+{
+    struct delivery *d = arg ;
+    Medium *m = d->m ;
+    SimFrame *f = d->f ;
+    SimNode *r ;
+    SimLink def, gdef, *l ;
+    SimFrame *g ;
+    bool coll, busy ;
+    int j ;
+
+    r = &m->nodes_ [i] ;
+    if (i == f->sender_ || (l = getlink (m, f->sender_, i, &def)) == NULL)
+	return ;
+
+    coll = busy = false ;
+    for (j = 0 ; j < m->nframes_ ; j++)
+    {
+	g = &m->frames_ [j] ;
+	if (g == f || ! overlap (f, g))
+	    continue ;
+	if (g->sender_ == i)
+	    busy = true ;		// half-duplex
+	else if (getlink (m, g->sender_, i, &gdef) != NULL)
+	    coll = true ;
+    }
+
+    if (! r->radio_.on || busy)
+	r->noff_++ ;
+    else if (coll)
+    {
+	r->ncoll_++ ;
+	__atomic_store_n (&d->coll, true, __ATOMIC_RELAXED) ;
+	medium_select (m, i) ;
+	sim_radio_crcfail () ;
+    }
+    else if (node_rnd (r) % 1000 < l->loss_)
+	r->nlost_++ ;
+    else
+    {
+	medium_select (m, i) ;
+	if (sim_radio_receive (f->data_, f->len_, l->lqi_))
+	{
+	    r->nrx_++ ;
+	    if (r->addr_ == f->dst_)
+		f->acked_ = true ;	// only written by the destination
+	    if (m->rxhook_ != NULL)
+		(*m->rxhook_) (m->rxarg_, i) ;
+	}
+    }
+}
+
+
+static void deliver (Medium *m, SimFrame *f)
+{
+    struct delivery d ;
+    int i ;
+
+    d.m = m ;
+    d.f = f ;
+    d.coll = false ;
+    if (m->deferred_ && m->runner_ != NULL)
+	(*m->runner_) (m->runarg_, m->nnodes_, deliver_to, &d) ;
+    else
+    {
+	for (i = 0 ; i < m->nnodes_ ; i++)
+	    deliver_to (&d, i) ;
+    }
+    if (d.coll)
+	m->ncoll_++ ;
+    f->delivered_ = true ;
+}
+
+
+/*
+ * The frame must not be used after `sim_radio_complete`, which may
+ * start a new transmission (and thus reallocate frames_)
+ */
+
+static void complete (Medium *m, SimFrame *f)
+{
+    tx_status_t st ;
+
+    int sender = f->sender_ ;
+
+    st = f->dst_ == CONST16 (0xff, 0xff) || f->acked_ ? TX_OK : TX_NOACK ;
+    f->completed_ = true ;
+    medium_select (m, sender) ;
+    sim_radio_complete (st) ;
+    if (m->deferred_ && m->rxhook_ != NULL)
+	(*m->rxhook_) (m->rxarg_, sender) ;
+}
+
+
+// time of the next event of a frame
+static simtime_t next_event (Medium *m, SimFrame *f)
+{
+    return f->delivered_ ? f->done_ : f->end_ + m->delay_ ;
+}
+
+
+/**
+ * @brief Advance the simulation to the current time
+ *
+ * Frames whose transmission is over are delivered, transmissions
+ * are completed, then the transmit queue of each node is polled
+ * (this may start new transmissions), except in deferred mode.
+ * The current radio is kept.
+ */
+
+void medium_step (Medium *m)
+{
+    SimFrame *f, *first ;
+    SimRadio *cur ;
+    simtime_t now ;
+    int i ;
+
+    cur = sim_radio_current () ;
+    now = now_us () ;
+    medium_commit (m) ;
+
+    // process events in time order
+    for (;;)
+    {
+	first = NULL ;
+	for (i = 0 ; i < m->nframes_ ; i++)
+	{
+	    f = &m->frames_ [i] ;
+	    if (! f->completed_ && next_event (m, f) <= now
+		    && (first == NULL || next_event (m, f) < next_event (m, first)))
+		first = f ;
+	}
+	if (first == NULL)
+	    break ;
+	if (! first->delivered_)
+	    deliver (m, first) ;
+	else
+	    complete (m, first) ;
+    }
+
+    if (! m->deferred_)
+    {
+	for (i = 0 ; i < m->nnodes_ ; i++)
+	{
+	    medium_select (m, i) ;	// the radio may be used
+	    poll_tx (m->nodes_ [i].conmsg_) ;
+	}
+    }
+
+    // forget frames which cannot overlap a frame still in the air
+    i = 0 ;
+    while (i < m->nframes_)
+    {
+	f = &m->frames_ [i] ;
+	if (f->completed_ && f->end_ + MEDIUM_MAXAIRTIME + m->delay_ < now)
+	    *f = m->frames_ [--m->nframes_] ;
+	else i++ ;
+    }
+
+    sim_radio_select (cur) ;
+}
+
+
+/**
+ * @brief Time of the next event: end of a frame or of its ACK, or
+ *	transmission attempt of a node (except in deferred mode)
+ *
+ * `medium_step` need not be called before this time, unless a node
+ * sends a frame in between.
+ *
+ * @param next (out) time of the next event (ms)
+ * @return false if there is no pending event
+ */
+
+bool medium_next (Medium *m, clock_time_t *next)
+{
+    simtime_t t, first ;
+    clock_time_t tx ;
+    bool found ;
+    int i ;
+
+    found = false ;
+    first = 0 ;
+    for (i = 0 ; i < m->nframes_ ; i++)
+    {
+	if (m->frames_ [i].completed_)
+	    continue ;
+	t = next_event (m, &m->frames_ [i]) ;
+	if (! found || t < first)
+	    first = t ;
+	found = true ;
+    }
+    if (found)
+	*next = (clock_time_t) ((first + 999) / 1000) ;
+
+    for (i = 0 ; ! m->deferred_ && i < m->nnodes_ ; i++)
+    {
+	if (next_tx (m->nodes_ [i].conmsg_, &tx) && (! found || tx < *next))
+	{
+	    *next = tx ;
+	    found = true ;
+	}
+    }
+    return found ;
+}
+
+
+void medium_print_stat (Medium *m)
+{
+    uint32_t nrx = 0, nlost = 0, ncoll = 0, noff = 0 ;
+    int i ;
+
+    for (i = 0 ; i < m->nnodes_ ; i++)
+    {
+	nrx += m->nodes_ [i].nrx_ ;
+	nlost += m->nodes_ [i].nlost_ ;
+	ncoll += m->nodes_ [i].ncoll_ ;
+	noff += m->nodes_ [i].noff_ ;
+    }
+    printf ("medium: nodes=%d frames sent=%lu collided=%lu\n", m->nnodes_,
+		(unsigned long int) m->nsent_, (unsigned long int) m->ncoll_) ;
+    printf ("medium: received=%lu lost=%lu collision=%lu missed=%lu\n",
+		(unsigned long int) nrx, (unsigned long int) nlost,
+		(unsigned long int) ncoll, (unsigned long int) noff) ;
+}
@@ -0,0 +1,151 @@
+/**
+ * @file medium.h
+ * @brief simulated IEEE 802.15.4 radio medium with several nodes
+ *
+ * The medium runs many nodes (CASAN slaves, a master stand-in)
+ * in a single process. Each node has its own ConMsg object and its
+ * own simulated radio (see radio-sim.h): `medium_select` makes the
+ * radio current before the node is run, since the driver functions
+ * used by ConMsg have no radio argument.
+ *
+ * The medium models:
+ * - broadcast domains: nodes hear each other if they are in the
+ *   same domain and on the same channel, unless the link has been
+ *   set explicitly with `medium_set_link` or `medium_cut_link`
+ * - per-link loss (per mille) and LQI
+ * - airtime (see Z_AIRTIME_US) and an additional delay: a frame is
+ *   delivered at the end of its transmission, plus the delay
+ * - collisions: a receiver hearing two frames which overlap gets
+ *   none of them (CRC failure). A transmitting node does not
+ *   receive anything (half-duplex).
+ * - CCA: a frame is detected by other nodes MEDIUM_TURNAROUND us
+ *   after its start. Each transmission starts at a random time in
+ *   the current millisecond, such that nodes starting in the same
+ *   millisecond may collide.
+ * - acknowledgements: a unicast frame is acked if its destination
+ *   has received it (ACK frames are not lost)
+ *
+ * Time is read from `clock_time` (in ms), and `medium_step` must be
+ * called each time the clock advances, or at least at the time given
+ * by `medium_next` (see sched.h). A hook may be called when a node
+ * receives a frame, such that the node can be run.
+ *
+ * In deferred mode (`medium_set_deferred`), nodes may be run in
+ * parallel in the same millisecond: frames they send are put in the
+ * air by `medium_commit` at the end of the millisecond, in node order,
+ * and each node has its own random generator, such that results do
+ * not depend on the order nodes are run. A frame may also be delivered
+ * to all nodes in parallel.
+ */
+
+#ifndef __MEDIUM_H__
+#define __MEDIUM_H__
+
+#include "../libraries/L2-154/l2-154.h"
+#include "radio-sim.h"
+
+#define	MEDIUM_TURNAROUND	192		// RX/TX turnaround (us)
+#define	MEDIUM_MAXAIRTIME	Z_AIRTIME_US (127)
+#define	MEDIUM_LQI		200		// default link quality
+
+typedef unsigned long long int simtime_t ;	// us
+
+struct medium ;
+
+typedef struct simframe
+{
+    int sender_ ;
+    addr2_t dst_ ;
+    simtime_t start_ ;
+    simtime_t end_ ;			// end of frame
+    simtime_t done_ ;			// end of ACK, if any
+    bool delivered_ ;
+    bool completed_ ;			// sender notified
+    bool acked_ ;
+    uint8_t len_ ;
+    uint8_t data_ [MAX_PAYLOAD] ;
+} SimFrame ;
+
+typedef struct simnode
+{
+    struct medium *m_ ;
+    int idx_ ;
+    addr2_t addr_ ;
+    int domain_ ;
+    ConMsg *conmsg_ ;
+    SimRadio radio_ ;
+    uint32_t rnd_ ;			// random generator (deferred mode)
+    l2net *l2_ ;
+    void *app_ ;			// application data
+    simtime_t ccat_ ;			// time of last CCA
+    SimFrame pending_ ;			// not yet committed (deferred mode)
+    /* statistics */
+    uint32_t ntx_ ;			// transmitted frames
+    uint32_t nrx_ ;			// received frames
+    uint32_t nlost_ ;			// frames lost on a link
+    uint32_t ncoll_ ;			// frames lost by collision
+    uint32_t noff_ ;			// frames missed (radio off or busy)
+} SimNode ;
+
+typedef void (*medium_rx_hook_t) (void *arg, int node) ;
+typedef void (*medium_item_t) (void *arg, int i) ;
+typedef void (*medium_runner_t) (void *runarg, int n,
+					medium_item_t fn, void *arg) ;
+
+typedef struct simlink
+{
+    uint8_t state_ ;			// LINK_DEFAULT, LINK_SET, LINK_CUT
+    uint8_t lqi_ ;
+    uint16_t loss_ ;			// per mille
+} SimLink ;
+
+typedef struct medium
+{
+    int nnodes_ ;
+    int maxnodes_ ;
+    SimNode *nodes_ ;
+    SimLink *links_ ;			// maxnodes_ x maxnodes_ (from, to), or NULL
+    SimFrame *frames_ ;			// frames in the air, or recent ones
+    int nframes_ ;
+    int maxframes_ ;
+    uint16_t loss_ ;			// default link loss (per mille)
+    uint8_t lqi_ ;			// default link quality
+    uint32_t delay_ ;			// additional delay (us)
+    uint32_t seed_ ;
+    uint32_t rnd_ ;
+    bool deferred_ ;			// frames are committed at the end of ms
+    int *pendq_ ;			// nodes with a pending frame
+    int npend_ ;
+    medium_runner_t runner_ ;		// parallel delivery (deferred mode)
+    void *runarg_ ;
+    medium_rx_hook_t rxhook_ ;
+    void *rxarg_ ;
+    /* statistics */
+    uint32_t nsent_ ;			// frames sent
+    uint32_t ncoll_ ;			// frames involved in a collision
+} Medium ;
+
+Medium *initMedium (int maxnodes, uint32_t seed) ;
+void freeMedium (Medium *m) ;
+
+void medium_set_default (Medium *m, uint16_t loss, uint8_t lqi, uint32_t delay) ;
+void medium_set_link (Medium *m, int from, int to, uint16_t loss, uint8_t lqi) ;
+void medium_cut_link (Medium *m, int from, int to) ;
+
+int medium_add_node (Medium *m, addr2_t addr, int domain,
+				channel_t chan, panid_t panid) ;
+SimNode *medium_node (Medium *m, int node) ;
+int medium_find (Medium *m, addr2_t addr) ;
+void medium_select (Medium *m, int node) ;
+
+void medium_set_deferred (Medium *m, bool deferred,
+				medium_runner_t runner, void *arg) ;
+void medium_commit (Medium *m) ;
+
+void medium_set_rx_hook (Medium *m, medium_rx_hook_t hook, void *arg) ;
+void medium_step (Medium *m) ;
+bool medium_next (Medium *m, clock_time_t *next) ;
+
+void medium_print_stat (Medium *m) ;
+
+#endif
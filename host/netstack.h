@@ -0,0 +1,44 @@
+/**
+ * @file netstack.h
+ * @brief radio driver interface for the host (Linux) port
+ *
+ * The radio driver is the simulated radio (see radio-sim.h).
+ */
+
+#ifndef __HOST_NETSTACK_H__
+#define __HOST_NETSTACK_H__
+
+#include <stdint.h>
+
+struct radio_driver
+{
+    int (* init) (void) ;
+    int (* prepare) (const void *payload, unsigned short payload_len) ;
+    int (* transmit) (unsigned short transmit_len) ;
+    int (* send) (const void *payload, unsigned short payload_len) ;
+    int (* read) (void *buf, unsigned short buf_len) ;
+    int (* channel_clear) (void) ;
+    int (* receiving_packet) (void) ;
+    int (* pending_packet) (void) ;
+    int (* on) (void) ;
+    int (* off) (void) ;
+} ;
+
+enum
+{
+    RADIO_TX_OK,
+    RADIO_TX_ERR,
+    RADIO_TX_COLLISION,
+    RADIO_TX_NOACK,
+} ;
+
+extern const struct radio_driver sim_radio_driver ;
+
+#define	NETSTACK_RADIO	sim_radio_driver
+
+// rf2xx specific functions, used by ConMsg
+void setChannelRadio (int chan) ;
+void setAddrRadio (int panid, int addr, int promisc) ;
+void initBuf (uint8_t *rxbuf, uint8_t rxbufsz) ;
+
+#endif
@@ -0,0 +1,198 @@
+/**
+ * @file radio-sim.c
+ * @brief simulated IEEE 802.15.4 radio implementation
+ */
+
+#include "radio-sim.h"
+
+static SimRadio defradio = {
+    0, false, NULL, 0, true, TX_OK, false, 0, NULL, NULL, NULL, NULL
+} ;
+static __thread SimRadio *sim = &defradio ;	// current radio (per thread)
+
+
+/*
+ * Several radios (one for each simulated node, see medium.h) may
+ * exist: the current one is used by the driver functions. A radio
+ * is bound to a ConMsg object when this object starts it.
+ */
+
+void sim_radio_init (SimRadio *r)
+{
+    memset (r, 0, sizeof *r) ;
+    r->sync = true ;
+    r->syncstatus = TX_OK ;
+}
+
+void sim_radio_select (SimRadio *r)
+{
+    sim = r != NULL ? r : &defradio ;
+}
+
+SimRadio *sim_radio_current (void)
+{
+    return sim ;
+}
+
+void sim_radio_set_tx_hook (sim_tx_hook_t hook, void *arg)
+{
+    sim->hook = hook ;
+    sim->hookarg = arg ;
+}
+
+void sim_radio_set_cca_hook (sim_cca_hook_t hook, void *arg)
+{
+    sim->ccahook = hook ;
+    sim->ccaarg = arg ;
+}
+
+void sim_radio_set_sync (bool sync, tx_status_t status)
+{
+    sim->sync = sync ;
+    sim->syncstatus = status ;
+}
+
+void sim_radio_set_busy (int ncca)
+{
+    sim->ncca = ncca ;
+}
+
+bool sim_radio_busy (void)
+{
+    return sim->busy ;
+}
+
+bool sim_radio_on (void)
+{
+    return sim->on ;
+}
+
+int sim_radio_channel (void)
+{
+    return sim->chan ;
+}
+
+
+/*
+ * End of transmission of the current frame, as reported by the
+ * TX done interrupt
+ */
+
+bool sim_radio_complete (tx_status_t status)
+{
+    if (! sim->busy || sim->cm == NULL)
+	return false ;
+    sim->busy = false ;
+    it_tx_status (sim->cm, status) ;
+    return true ;
+}
+
+
+/*
+ * Reception of a frame, as done by the RX interrupt: the frame is
+ * copied in the buffer given by ConMsg, which returns the buffer
+ * for the next frame.
+ */
+
+bool sim_radio_receive (const uint8_t *frame, uint8_t len, uint8_t lqi)
+{
+    if (! sim->on || sim->cm == NULL || sim->rxbuf == NULL || len > sim->rxbufsz)
+	return false ;
+    memcpy (sim->rxbuf, frame, len) ;
+    sim->rxbuf = it_receive_frame_lqi (sim->cm, len, lqi, sim->rxbuf) ;
+    return true ;
+}
+
+
+/*
+ * Reception of a corrupted frame
+ */
+
+void sim_radio_crcfail (void)
+{
+    if (sim->on && sim->cm != NULL)
+	it_rx_crcfail (sim->cm) ;
+}
+
+
+/******************************************************************************
+ * Driver functions
+ */
+
+void setChannelRadio (int chan)
+{
+    sim->chan = chan ;
+}
+
+// the medium does the address filter and the ACKs
+void setAddrRadio (int panid, int addr, int promisc)
+{
+}
+
+void initBuf (uint8_t *rxbuf, uint8_t rxbufsz)
+{
+    sim->rxbuf = rxbuf ;
+    sim->rxbufsz = rxbufsz ;
+}
+
+static int sim_init (void)
+{
+    sim->cm = getRadioOwner () ;
+    sim->busy = false ;
+    return 1 ;
+}
+
+static int sim_send (const void *payload, unsigned short len)
+{
+    if (sim->busy)
+	return RADIO_TX_ERR ;
+    if (sim->hook != NULL)
+	(*sim->hook) (sim->hookarg, (const uint8_t *) payload, (uint8_t) len) ;
+    sim->busy = true ;
+    if (sim->sync)
+	sim_radio_complete (sim->syncstatus) ;
+    return RADIO_TX_OK ;
+}
+
+static int sim_channel_clear (void)
+{
+    if (sim->ncca > 0)
+    {
+	sim->ncca-- ;
+	return 0 ;
+    }
+    if (sim->ccahook != NULL)
+	return (*sim->ccahook) (sim->ccaarg) ;
+    return 1 ;
+}
+
+static int sim_on (void)
+{
+    sim->on = true ;
+    return 1 ;
+}
+
+static int sim_off (void)
+{
+    sim->on = false ;
+    return 1 ;
+}
+
+static int sim_zero (void)
+{
+    return 0 ;
+}
+
+const struct radio_driver sim_radio_driver =
+{
+    sim_init,
+    NULL,
+    NULL,
+    sim_send,
+    NULL,
+    sim_channel_clear,
+    sim_zero,
+    sim_zero,
+    sim_on,
+    sim_off,
+} ;
@@ -0,0 +1,65 @@
+/**
+ * @file radio-sim.h
+ * @brief simulated IEEE 802.15.4 radio for the host (Linux) port
+ *
+ * The simulated radio replaces the rf2xx driver. It calls ConMsg
+ * the same way the driver interrupt routines do:
+ * - frames sent by ConMsg are given to a hook (if any), and the
+ *   transmission completes either immediately (synchronous mode)
+ *   or when `sim_radio_complete` is called (asynchronous mode,
+ *   to simulate the airtime and the TX done interrupt)
+ * - frames are received by calling `sim_radio_receive`, which
+ *   simulates the RX interrupt
+ * - the channel is clear, unless `sim_radio_set_busy` is used to
+ *   make the next CCA fail, or unless the CCA hook (if any) says so
+ *
+ * All functions apply to the current radio. By default, there is
+ * only one radio: a simulation with several nodes (see medium.h)
+ * selects the radio of a node before running it. Each radio is bound
+ * to the ConMsg object which has started it (see `getRadioOwner`),
+ * and reports its interrupts to this object only.
+ */
+
+#ifndef __RADIO_SIM_H__
+#define __RADIO_SIM_H__
+
+#include "../libraries/ConMsg/ConMsg.h"
+
+typedef void (*sim_tx_hook_t) (void *arg, const uint8_t *frame, uint8_t len) ;
+typedef int (*sim_cca_hook_t) (void *arg) ;	// 1 if channel is clear
+
+typedef struct simradio
+{
+    int chan ;
+    bool on ;
+    uint8_t *rxbuf ;			// where the next frame is received
+    uint8_t rxbufsz ;
+    bool sync ;				// complete transmissions at once
+    tx_status_t syncstatus ;
+    bool busy ;				// a frame is being sent
+    int ncca ;				// # of next CCA to fail
+    sim_tx_hook_t hook ;
+    void *hookarg ;
+    sim_cca_hook_t ccahook ;
+    void *ccaarg ;
+    ConMsg *cm ;			// object which started the radio
+} SimRadio ;
+
+void sim_radio_init (SimRadio *r) ;
+void sim_radio_select (SimRadio *r) ;	// NULL: default radio
+SimRadio *sim_radio_current (void) ;
+
+void sim_radio_set_tx_hook (sim_tx_hook_t hook, void *arg) ;
+void sim_radio_set_cca_hook (sim_cca_hook_t hook, void *arg) ;
+void sim_radio_set_sync (bool sync, tx_status_t status) ;
+void sim_radio_set_busy (int ncca) ;
+
+bool sim_radio_busy (void) ;
+bool sim_radio_on (void) ;
+bool sim_radio_complete (tx_status_t status) ;
+bool sim_radio_receive (const uint8_t *frame, uint8_t len, uint8_t lqi) ;
+void sim_radio_crcfail (void) ;
+
+int sim_radio_channel (void) ;
+
+#endif
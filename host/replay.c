@@ -0,0 +1,304 @@
+/**
+ * @file replay.c
+ * @brief capture files and replay implementation
+ */
+
+#include <stdlib.h>
+#include "replay.h"
+
+#define	PCAP_MAGIC_US		0xa1b2c3d4
+#define	PCAP_MAGIC_NS		0xa1b23c4d
+#define	PCAP_LINKTYPE_154	195	// IEEE 802.15.4, with FCS
+#define	PCAP_HDRLEN		24
+#define	PCAP_RECHDRLEN		16
+#define	FCS_LEN			2
+
+#define	REPLAY_INITREC		256
+
+
+/******************************************************************************
+ * Save a capture
+ */
+
+static void write_file (void *arg, const uint8_t *data, int len)
+{
+    fwrite (data, 1, len, (FILE *) arg) ;
+}
+
+bool capture_save_pcap (ConMsg *cm, const char *file)
+{
+    FILE *fp ;
+    bool ok ;
+
+    fp = fopen (file, "wb") ;
+    if (fp == NULL)
+	return false ;
+    capture_write_pcap (cm, write_file, fp) ;
+    ok = ! ferror (fp) ;
+    if (fclose (fp) != 0)
+	ok = false ;
+    return ok ;
+}
+
+
+/******************************************************************************
+ * Frames to replay
+ */
+
+Replay *initReplay (void)
+{
+    return (Replay *) calloc (1, sizeof (Replay)) ;
+}
+
+void freeReplay (Replay *rp)
+{
+    free (rp->rec_) ;
+    free (rp) ;
+}
+
+
+/*
+ * Add a frame, keeping frames sorted by time (frames with the same
+ * time are kept in the order they were added). Frames are usually
+ * added in time order, so this is just an append.
+ */
+
+static bool add_frame (Replay *rp, clock_time_t time, const uint8_t *frame,
+				int len, uint8_t lqi)
+{
+    ConCapRec *r ;
+    int i ;
+
+    if (rp->nrec_ == rp->maxrec_)
+    {
+	int max = rp->maxrec_ == 0 ? REPLAY_INITREC : 2 * rp->maxrec_ ;
+
+	r = (ConCapRec *) realloc (rp->rec_, max * sizeof *r) ;
+	if (r == NULL)
+	    return false ;
+	rp->rec_ = r ;
+	rp->maxrec_ = max ;
+    }
+    for (i = rp->nrec_ ; i > 0 && rp->rec_ [i - 1].time > time ; i--)
+	rp->rec_ [i] = rp->rec_ [i - 1] ;
+    r = &rp->rec_ [i] ;
+    r->time = time ;
+    r->dir = CONCAP_RX ;
+    r->len = len ;
+    r->lqi = lqi ;
+    memcpy (r->frame, frame, len) ;
+    rp->nrec_++ ;
+    return true ;
+}
+
+
+static uint32_t get32 (const uint8_t *p, bool swap)
+{
+    if (swap)
+	return ((uint32_t) p [0] << 24) | ((uint32_t) p [1] << 16)
+		    | ((uint32_t) p [2] << 8) | p [3] ;
+    return ((uint32_t) p [3] << 24) | ((uint32_t) p [2] << 16)
+		    | ((uint32_t) p [1] << 8) | p [0] ;
+}
+
+
+/*
+ * Read a pcap file, in any byte order, with a time resolution of
+ * micro or nano seconds. Frames may have a FCS, which is removed.
+ * There is no LQI in these files: it is set to 0 (unknown, as for
+ * `it_receive_frame`).
+ */
+
+bool replay_load_pcap (Replay *rp, const char *file)
+{
+    uint8_t hdr [PCAP_HDRLEN], frame [MAX_PAYLOAD + FCS_LEN] ;
+    uint32_t magic, linktype, sec, frac, incl, orig ;
+    clock_time_t time ;
+    bool swap, ns, ok ;
+    int fcs ;
+    FILE *fp ;
+
+    fp = fopen (file, "rb") ;
+    if (fp == NULL)
+	return false ;
+    ok = false ;
+    if (fread (hdr, 1, PCAP_HDRLEN, fp) != PCAP_HDRLEN)
+	goto end ;
+
+    magic = get32 (hdr, false) ;
+    swap = false ;
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS)
+    {
+	magic = get32 (hdr, true) ;
+	swap = true ;
+    }
+    if (magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS)
+	goto end ;
+    ns = magic == PCAP_MAGIC_NS ;
+    linktype = get32 (hdr + 20, swap) ;
+    if (linktype == PCAP_LINKTYPE_154_NOFCS)
+	fcs = 0 ;
+    else if (linktype == PCAP_LINKTYPE_154)
+	fcs = FCS_LEN ;
+    else goto end ;
+
+    while (fread (hdr, 1, PCAP_RECHDRLEN, fp) == PCAP_RECHDRLEN)
+    {
+	sec = get32 (hdr, swap) ;
+	frac = get32 (hdr + 4, swap) ;
+	incl = get32 (hdr + 8, swap) ;
+	orig = get32 (hdr + 12, swap) ;
+	if (incl > sizeof frame)
+	{
+	    // too large for 802.15.4: skip it
+	    rp->nbadrec_++ ;
+	    if (fseek (fp, incl, SEEK_CUR) != 0)
+		goto end ;
+	    continue ;
+	}
+	if (fread (frame, 1, incl, fp) != incl)
+	    goto end ;
+	if (incl != orig || incl < (uint32_t) fcs)	// truncated frame
+	{
+	    rp->nbadrec_++ ;
+	    continue ;
+	}
+	time = (clock_time_t) sec * CLOCK_SECOND
+		    + (ns ? frac / 1000000 : frac / 1000) * CLOCK_SECOND / 1000 ;
+	if (! add_frame (rp, time, frame, incl - fcs, 0))
+	    goto end ;
+    }
+    ok = feof (fp) ;
+
+end:
+    fclose (fp) ;
+    return ok ;
+}
+
+
+/*
+ * Frames received by a node, from its capture ring
+ */
+
+bool replay_add_capture (Replay *rp, ConMsg *cm)
+{
+    const ConCapRec *r ;
+    int i, n ;
+
+    n = capture_count (cm) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	r = capture_get (cm, i) ;
+	if (r->dir == CONCAP_RX
+		&& ! add_frame (rp, r->time, r->frame, r->len, r->lqi))
+	    return false ;
+    }
+    return true ;
+}
+
+
+void replay_set_offset (Replay *rp, long int offset)
+{
+    rp->offset_ = offset ;
+}
+
+void replay_skip_source (Replay *rp, addr2_t src)
+{
+    rp->skip_ = true ;
+    rp->skipsrc_ = src ;
+}
+
+void replay_rewind (Replay *rp)
+{
+    rp->next_ = 0 ;
+    rp->nfed_ = 0 ;
+    rp->nmissed_ = 0 ;
+    rp->nskipped_ = 0 ;
+}
+
+
+/******************************************************************************
+ * Replay
+ */
+
+// short source address of a frame
+static bool frame_source (const ConCapRec *r, addr2_t *src)
+{
+    uint16_t fcf ;
+    int off ;
+
+    if (r->len < 3)
+	return false ;
+    fcf = r->frame [0] | (r->frame [1] << 8) ;
+    if (Z_GET_SRC_ADDR_MODE (fcf) != Z_ADDRMODE_ADDR2)
+	return false ;
+    off = 3 ;
+    switch (Z_GET_DST_ADDR_MODE (fcf))
+    {
+	case Z_ADDRMODE_ADDR2 : off += 2 + 2 ; break ;
+	case Z_ADDRMODE_ADDR8 : off += 2 + 8 ; break ;
+    }
+    if (! Z_GET_INTRA_PAN (fcf))
+	off += 2 ;
+    if (off + 2 > r->len)
+	return false ;
+    *src = r->frame [off] | (r->frame [off + 1] << 8) ;
+    return true ;
+}
+
+static clock_time_t replay_time (Replay *rp, const ConCapRec *r)
+{
+    return (clock_time_t) ((long int) r->time + rp->offset_) ;
+}
+
+
+bool replay_next (Replay *rp, clock_time_t *next)
+{
+    if (rp->next_ >= rp->nrec_)
+	return false ;
+    *next = replay_time (rp, &rp->rec_ [rp->next_]) ;
+    return true ;
+}
+
+
+/*
+ * Feed all frames whose time has come to the current radio. Returns
+ * the number of frames received.
+ */
+
+int replay_run (Replay *rp)
+{
+    clock_time_t now ;
+    ConCapRec *r ;
+    addr2_t src ;
+    int n = 0 ;
+
+    now = clock_time () ;
+    while (rp->next_ < rp->nrec_)
+    {
+	r = &rp->rec_ [rp->next_] ;
+	if ((long int) (replay_time (rp, r) - now) > 0)
+	    break ;
+	rp->next_++ ;
+	if (rp->skip_ && frame_source (r, &src) && src == rp->skipsrc_)
+	    rp->nskipped_++ ;
+	else if (! sim_radio_receive (r->frame, r->len, r->lqi))
+	    rp->nmissed_++ ;
+	else
+	{
+	    rp->nfed_++ ;
+	    n++ ;
+	}
+    }
+    return n ;
+}
+
+
+void replay_print_stat (Replay *rp)
+{
+    printf ("replay: frames=%d fed=%lu missed=%lu skipped=%lu bad=%lu\n",
+		rp->nrec_, (unsigned long int) rp->nfed_,
+		(unsigned long int) rp->nmissed_,
+		(unsigned long int) rp->nskipped_,
+		(unsigned long int) rp->nbadrec_) ;
+}
@@ -0,0 +1,61 @@
+/**
+ * @file replay.h
+ * @brief capture files and replay of captured frames on the host
+ *
+ * A capture (see ConCapRec in ConMsg.h) is saved as a pcap file,
+ * which can be read by Wireshark. A pcap file (saved by a node, a
+ * simulation or a sniffer) or the capture ring of a node can then be
+ * fed back to a node: each frame is received by the current radio
+ * (see radio-sim.h) at its capture time, as done by the RX interrupt.
+ * With a virtual clock (see sched.h), a replay gives the same results
+ * each time, and runs as fast as the node can decode and process the
+ * frames: this is the way to reproduce a field failure, or to measure
+ * the cost of a new build on real traffic.
+ *
+ * The pcap format does not tell whether a frame was received or sent
+ * by the capturing node: frames sent by a given address can be
+ * skipped (`replay_skip_source`). Frames of a capture ring are
+ * replayed only if they were received.
+ *
+ * Replay time is capture time plus an offset (0 by default).
+ * `replay_run` must be called at the time given by `replay_next`.
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "radio-sim.h"
+
+typedef struct replay
+{
+    ConCapRec *rec_ ;			// sorted by time
+    int nrec_ ;
+    int maxrec_ ;
+    int next_ ;				// next frame to feed
+    long int offset_ ;			// replay time - capture time
+    bool skip_ ;			// skip frames sent by skipsrc_
+    addr2_t skipsrc_ ;
+    /* statistics */
+    uint32_t nfed_ ;			// frames received by the radio
+    uint32_t nmissed_ ;			// radio off
+    uint32_t nskipped_ ;		// sent by skipsrc_
+    uint32_t nbadrec_ ;			// unusable pcap records
+} Replay ;
+
+bool capture_save_pcap (ConMsg *cm, const char *file) ;
+
+Replay *initReplay (void) ;
+void freeReplay (Replay *rp) ;
+
+bool replay_load_pcap (Replay *rp, const char *file) ;
+bool replay_add_capture (Replay *rp, ConMsg *cm) ;
+void replay_set_offset (Replay *rp, long int offset) ;
+void replay_skip_source (Replay *rp, addr2_t src) ;
+void replay_rewind (Replay *rp) ;
+
+bool replay_next (Replay *rp, clock_time_t *next) ;
+int replay_run (Replay *rp) ;
+
+void replay_print_stat (Replay *rp) ;
+
+#endif
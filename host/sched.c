@@ -0,0 +1,737 @@
+/**
+ * @file sched.c
+ * @brief discrete-event scheduler implementation
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sched.h"
+
+static clock_time_t sched_clock (void *arg)
+{
+    return ((Sched *) arg)->now_ ;
+}
+
+// real time, to measure the part of parallel steps
+static uint64_t realtime_ns (void)
+{
+    struct timespec ts ;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts) ;
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec ;
+}
+
+
+/******************************************************************************
+ * Agents, sorted in a binary heap
+ *
+ * Agents due at the same time are run by passes, in index order:
+ * an agent woken up during a pass is run in this pass if its index
+ * is after the running agent, else in the next pass. Serial agents
+ * are run before the other ones, in both modes.
+ */
+
+static bool before (Sched *s, int i, int j)
+{
+    SchedAgent *a = &s->agents_ [i] ;
+    SchedAgent *b = &s->agents_ [j] ;
+
+    if (a->due_ != b->due_)
+	return a->due_ < b->due_ ;
+    if (a->serial_ != b->serial_)
+	return a->serial_ ;
+    if (a->round_ != b->round_)
+	return a->round_ < b->round_ ;
+    return i < j ;
+}
+
+static void heap_set (Sched *s, int pos, int agent)
+{
+    s->heap_ [pos] = agent ;
+    s->agents_ [agent].pos_ = pos ;
+}
+
+static void heap_up (Sched *s, int pos)
+{
+    int agent = s->heap_ [pos] ;
+    int parent ;
+
+    while (pos > 0 && before (s, agent, s->heap_ [parent = (pos - 1) / 2]))
+    {
+	heap_set (s, pos, s->heap_ [parent]) ;
+	pos = parent ;
+    }
+    heap_set (s, pos, agent) ;
+}
+
+static void heap_down (Sched *s, int pos)
+{
+    int agent = s->heap_ [pos] ;
+    int child ;
+
+    while ((child = 2 * pos + 1) < s->nheap_)
+    {
+	if (child + 1 < s->nheap_
+			&& before (s, s->heap_ [child + 1], s->heap_ [child]))
+	    child++ ;
+	if (! before (s, s->heap_ [child], agent))
+	    break ;
+	heap_set (s, pos, s->heap_ [child]) ;
+	pos = child ;
+    }
+    heap_set (s, pos, agent) ;
+}
+
+// the key of an agent has changed
+static void heap_fix (Sched *s, SchedAgent *a)
+{
+    heap_up (s, a->pos_) ;
+    heap_down (s, a->pos_) ;
+}
+
+
+// ask an agent for its next deadline
+static clock_time_t deadline (Sched *s, SchedAgent *a)
+{
+    clock_time_t t ;
+
+    if (! (*a->next_) (a->arg_, &t))
+	t = SCHED_NEVER ;
+    if (t <= s->now_)
+	t = a->last_ == s->now_ ? s->now_ + 1 : s->now_ ;
+    return t ;
+}
+
+static void set_due (Sched *s, SchedAgent *a, clock_time_t t)
+{
+    a->due_ = t ;
+    if (t != s->now_)
+	a->round_ = 0 ;
+    else if (s->cur_ >= 0 && a - s->agents_ < s->cur_)
+	a->round_ = s->round_ + 1 ;	// too late for this pass
+    else a->round_ = s->round_ ;
+    heap_fix (s, a) ;
+}
+
+static void update (Sched *s, SchedAgent *a)
+{
+    set_due (s, a, deadline (s, a)) ;
+}
+
+
+/******************************************************************************
+ * Threads
+ */
+
+typedef struct schedworker
+{
+    Sched *s_ ;
+    int id_ ;
+    pthread_t thread_ ;
+    int next_ ;				// next item of the range (atomic)
+    int end_ ;				// end of the range
+    int *wakes_ ;			// deferred wake ups
+    int nwakes_ ;
+    int maxwakes_ ;
+    uint64_t nstolen_ ;
+} SchedWorker ;
+
+struct schedpool
+{
+    SchedWorker w_ [SCHED_MAXTHREADS] ;
+    sched_item_t fn_ ;			// current job
+    void *arg_ ;
+    pthread_mutex_t mtx_ ;
+    pthread_cond_t start_ ;		// a job must be run
+    pthread_cond_t done_ ;		// all threads are done
+    unsigned int gen_ ;			// job generation
+    int nbusy_ ;
+    bool stop_ ;
+} ;
+
+static __thread SchedWorker *curworker ;
+
+// run an agent of a parallel step, and get its next deadline
+static void run_item (void *arg, int i)
+{
+    Sched *s = arg ;
+    SchedAgent *a = &s->agents_ [s->batch_ [i]] ;
+
+    a->last_ = s->now_ ;
+    (*a->run_) (a->arg_) ;
+    a->nrun_++ ;
+    a->nextdue_ = deadline (s, a) ;
+}
+
+// run the own range of a thread, then steal from the other ones
+static void work (SchedWorker *w)
+{
+    Sched *s = w->s_ ;
+    struct schedpool *p = s->pool_ ;
+    SchedWorker *v ;
+    int i, e, k ;
+
+    curworker = w ;
+    for (k = 0 ; k < s->nthreads_ ; k++)
+    {
+	v = &p->w_ [(w->id_ + k) % s->nthreads_] ;
+	for (;;)
+	{
+	    i = __atomic_fetch_add (&v->next_, SCHED_CHUNK, __ATOMIC_RELAXED) ;
+	    if (i >= v->end_)
+		break ;
+	    e = i + SCHED_CHUNK < v->end_ ? i + SCHED_CHUNK : v->end_ ;
+	    if (v != w)
+		w->nstolen_ += e - i ;
+	    for ( ; i < e ; i++)
+		(*p->fn_) (p->arg_, i) ;
+	}
+    }
+}
+
+static void *worker_main (void *arg)
+{
+    SchedWorker *w = arg ;
+    struct schedpool *p = w->s_->pool_ ;
+    unsigned int gen = 0 ;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&p->mtx_) ;
+	while (p->gen_ == gen && ! p->stop_)
+	    pthread_cond_wait (&p->start_, &p->mtx_) ;
+	if (p->stop_)
+	{
+	    pthread_mutex_unlock (&p->mtx_) ;
+	    return NULL ;
+	}
+	gen = p->gen_ ;
+	pthread_mutex_unlock (&p->mtx_) ;
+
+	work (w) ;
+
+	pthread_mutex_lock (&p->mtx_) ;
+	if (--p->nbusy_ == 0)
+	    pthread_cond_signal (&p->done_) ;
+	pthread_mutex_unlock (&p->mtx_) ;
+    }
+}
+
+static void stop_threads (Sched *s)
+{
+    struct schedpool *p = s->pool_ ;
+    int i ;
+
+    if (p == NULL)
+	return ;
+    pthread_mutex_lock (&p->mtx_) ;
+    p->stop_ = true ;
+    pthread_cond_broadcast (&p->start_) ;
+    pthread_mutex_unlock (&p->mtx_) ;
+    for (i = 1 ; i < s->nthreads_ ; i++)
+	pthread_join (p->w_ [i].thread_, NULL) ;
+    for (i = 0 ; i < s->nthreads_ ; i++)
+	free (p->w_ [i].wakes_) ;
+    pthread_mutex_destroy (&p->mtx_) ;
+    pthread_cond_destroy (&p->start_) ;
+    pthread_cond_destroy (&p->done_) ;
+    free (p) ;
+    s->pool_ = NULL ;
+}
+
+
+/**
+ * @brief Choose the sequential mode (0) or the parallel mode with
+ *	the given number of threads (including the calling one)
+ *
+ * @return false if threads cannot be created (sequential mode)
+ */
+
+bool sched_set_threads (Sched *s, int nthreads)
+{
+    struct schedpool *p ;
+    int i ;
+
+    stop_threads (s) ;
+    s->nthreads_ = 0 ;
+    if (nthreads > SCHED_MAXTHREADS)
+	nthreads = SCHED_MAXTHREADS ;
+
+    if (nthreads > 0)
+    {
+	p = (struct schedpool *) calloc (1, sizeof *p) ;
+	if (p == NULL)
+	    return false ;
+	pthread_mutex_init (&p->mtx_, NULL) ;
+	pthread_cond_init (&p->start_, NULL) ;
+	pthread_cond_init (&p->done_, NULL) ;
+	s->pool_ = p ;
+	s->nthreads_ = nthreads ;
+	for (i = 0 ; i < nthreads ; i++)
+	{
+	    p->w_ [i].s_ = s ;
+	    p->w_ [i].id_ = i ;
+	    if (i > 0 && pthread_create (&p->w_ [i].thread_, NULL,
+					worker_main, &p->w_ [i]) != 0)
+	    {
+		s->nthreads_ = i ;
+		stop_threads (s) ;
+		s->nthreads_ = 0 ;
+		break ;
+	    }
+	}
+    }
+
+    return s->nthreads_ == nthreads ;
+}
+
+
+/**
+ * @brief Set a function called at the end of each step, in both
+ *	modes (see medium_commit)
+ */
+
+void sched_set_barrier (Sched *s, sched_run_t fn, void *arg)
+{
+    s->barrier_ = fn ;
+    s->barrierarg_ = arg ;
+}
+
+
+/******************************************************************************
+ * Scheduler
+ */
+
+/**
+ * @brief Create a scheduler, which becomes the time source
+ *
+ * @param maxagents maximum number of agents
+ * @param start initial time (ms)
+ */
+
+Sched *initSched (int maxagents, clock_time_t start)
+{
+    Sched *s ;
+
+    s = (Sched *) calloc (1, sizeof *s) ;
+    if (s == NULL)
+	return NULL ;
+    s->agents_ = (SchedAgent *) calloc (maxagents, sizeof *s->agents_) ;
+    s->heap_ = (int *) calloc (maxagents, sizeof *s->heap_) ;
+    s->batch_ = (int *) calloc (maxagents, sizeof *s->batch_) ;
+    if (s->agents_ == NULL || s->heap_ == NULL || s->batch_ == NULL)
+    {
+	freeSched (s) ;
+	return NULL ;
+    }
+    s->maxagents_ = maxagents ;
+    s->now_ = start ;
+    s->cur_ = -1 ;
+    clock_set_source (sched_clock, s) ;
+    return s ;
+}
+
+
+/*
+ * The clock keeps the current time (as a virtual time), and pending
+ * events are discarded.
+ */
+
+void freeSched (Sched *s)
+{
+    SchedEvent *e ;
+
+    clock_set_virtual (s->now_) ;
+    stop_threads (s) ;
+    while ((e = s->events_) != NULL)
+    {
+	s->events_ = e->next_ ;
+	free (e) ;
+    }
+    free (s->agents_) ;
+    free (s->heap_) ;
+    free (s->batch_) ;
+    free (s) ;
+}
+
+
+/**
+ * @brief Add an agent
+ *
+ * @param next function giving the next deadline of the agent
+ * @param run function running the agent
+ * @param arg argument given to both functions
+ * @return agent index, or -1 if there are too many agents
+ */
+
+int sched_add_agent (Sched *s, sched_next_t next, sched_run_t run, void *arg)
+{
+    SchedAgent *a ;
+
+    if (s->nagents_ == s->maxagents_)
+	return -1 ;
+    a = &s->agents_ [s->nagents_] ;
+    a->next_ = next ;
+    a->run_ = run ;
+    a->arg_ = arg ;
+    a->last_ = SCHED_NEVER ;
+    a->nrun_ = 0 ;
+    a->due_ = SCHED_NEVER ;
+    heap_set (s, s->nheap_++, s->nagents_) ;
+    update (s, a) ;
+    return s->nagents_++ ;
+}
+
+
+/**
+ * @brief Never run this agent in parallel with other ones
+ */
+
+void sched_set_serial (Sched *s, int agent)
+{
+    s->agents_ [agent].serial_ = true ;
+    heap_fix (s, &s->agents_ [agent]) ;
+}
+
+
+/**
+ * @brief Something happened to an agent: get its next deadline again
+ *
+ * During a parallel step, the request is kept until the end of
+ * the step.
+ */
+
+void sched_wake (Sched *s, int agent)
+{
+    SchedAgent *a = &s->agents_ [agent] ;
+    SchedWorker *w ;
+    int *nw ;
+
+    if (! s->inbatch_)
+    {
+	update (s, a) ;
+	return ;
+    }
+    if (__atomic_exchange_n (&a->woken_, true, __ATOMIC_RELAXED))
+	return ;			// already requested
+    w = curworker ;
+    if (w->nwakes_ == w->maxwakes_)
+    {
+	nw = (int *) realloc (w->wakes_, (w->maxwakes_ + 64) * sizeof *nw) ;
+	if (nw == NULL)
+	{
+	    a->woken_ = false ;		// lost
+	    return ;
+	}
+	w->wakes_ = nw ;
+	w->maxwakes_ += 64 ;
+    }
+    w->wakes_ [w->nwakes_++] = agent ;
+}
+
+
+/**
+ * @brief Run a function once at a given time
+ *
+ * @return false if the event cannot be allocated
+ */
+
+bool sched_at (Sched *s, clock_time_t t, sched_run_t fn, void *arg)
+{
+    SchedEvent *e, **p ;
+
+    e = (SchedEvent *) malloc (sizeof *e) ;
+    if (e == NULL)
+	return false ;
+    e->time_ = t < s->now_ ? s->now_ : t ;
+    e->fn_ = fn ;
+    e->arg_ = arg ;
+    for (p = &s->events_ ; *p != NULL && (*p)->time_ <= e->time_ ;
+						p = &(*p)->next_)
+	;
+    e->next_ = *p ;
+    *p = e ;
+    return true ;
+}
+
+
+clock_time_t sched_now (Sched *s)
+{
+    return s->now_ ;
+}
+
+
+// run the first agent alone
+static void run_one (Sched *s, SchedAgent *a)
+{
+    s->cur_ = a - s->agents_ ;
+    a->last_ = s->now_ ;
+    (*a->run_) (a->arg_) ;
+    a->nrun_++ ;
+    s->nruns_++ ;
+    update (s, a) ;
+    s->cur_ = -1 ;
+}
+
+
+static int cmpint (const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b ;
+}
+
+
+/*
+ * Run a job on the threads: sched_wake requests are kept until
+ * `apply_wakes`
+ */
+
+static void run_job (Sched *s, int n, sched_item_t fn, void *arg)
+{
+    struct schedpool *p = s->pool_ ;
+    uint64_t t0 ;
+    int i ;
+
+    t0 = realtime_ns () ;
+    p->fn_ = fn ;
+    p->arg_ = arg ;
+    s->inbatch_ = true ;
+    if (s->nthreads_ == 1 || n < SCHED_PAR_MIN)
+    {
+	for (i = 1 ; i < s->nthreads_ ; i++)
+	    p->w_ [i].next_ = p->w_ [i].end_ = 0 ;
+	p->w_ [0].next_ = 0 ;
+	p->w_ [0].end_ = n ;
+	work (&p->w_ [0]) ;
+    }
+    else
+    {
+	for (i = 0 ; i < s->nthreads_ ; i++)
+	{
+	    p->w_ [i].next_ = n * i / s->nthreads_ ;
+	    p->w_ [i].end_ = n * (i + 1) / s->nthreads_ ;
+	}
+	pthread_mutex_lock (&p->mtx_) ;
+	p->nbusy_ = s->nthreads_ - 1 ;
+	p->gen_++ ;
+	pthread_cond_broadcast (&p->start_) ;
+	pthread_mutex_unlock (&p->mtx_) ;
+
+	work (&p->w_ [0]) ;
+
+	pthread_mutex_lock (&p->mtx_) ;
+	while (p->nbusy_ > 0)
+	    pthread_cond_wait (&p->done_, &p->mtx_) ;
+	pthread_mutex_unlock (&p->mtx_) ;
+	s->nbatches_++ ;
+	s->nparruns_ += n ;
+	s->nspar_ += realtime_ns () - t0 ;
+    }
+    s->inbatch_ = false ;
+}
+
+
+// deadline of a woken agent (serial agents: see apply_wakes)
+static void wake_item (void *arg, int i)
+{
+    Sched *s = arg ;
+    SchedAgent *a = &s->agents_ [s->batch_ [i]] ;
+
+    if (! a->serial_)
+	a->nextdue_ = deadline (s, a) ;
+}
+
+
+/*
+ * Deferred wake ups, in index order. Each agent is in at most one
+ * list (see sched_wake), thus they fit in batch_. Deadlines of non
+ * serial agents only depend on their own state: they are computed
+ * with the threads.
+ */
+
+static void apply_wakes (Sched *s)
+{
+    struct schedpool *p = s->pool_ ;
+    SchedAgent *a ;
+    int i, nw ;
+
+    nw = 0 ;
+    for (i = 0 ; i < s->nthreads_ ; i++)
+    {
+	SchedWorker *w = &p->w_ [i] ;
+
+	memcpy (s->batch_ + nw, w->wakes_, w->nwakes_ * sizeof (int)) ;
+	nw += w->nwakes_ ;
+	w->nwakes_ = 0 ;
+	s->nstolen_ += w->nstolen_ ;
+	w->nstolen_ = 0 ;
+    }
+    qsort (s->batch_, nw, sizeof (int), cmpint) ;
+    run_job (s, nw, wake_item, s) ;
+    for (i = 0 ; i < nw ; i++)
+    {
+	a = &s->agents_ [s->batch_ [i]] ;
+	a->woken_ = false ;
+	if (a->serial_)
+	    update (s, a) ;
+	else set_due (s, a, a->nextdue_) ;
+    }
+}
+
+
+/**
+ * @brief Call fn (arg, i) for i in [0, n), with the threads
+ *
+ * This may be used by a serial agent, for example to deliver a frame
+ * to all nodes. The same rules as for parallel agents apply: each
+ * call must only modify its own item, and calls to `sched_wake` are
+ * deferred until all items are done. In sequential mode, items are
+ * run in order.
+ */
+
+void sched_parallel_for (Sched *s, int n, sched_item_t fn, void *arg)
+{
+    int i ;
+
+    if (s->nthreads_ == 0 || s->inbatch_)
+    {
+	for (i = 0 ; i < n ; i++)
+	    (*fn) (arg, i) ;
+	return ;
+    }
+    run_job (s, n, fn, arg) ;
+    apply_wakes (s) ;
+}
+
+
+/*
+ * Run all non serial agents due now, with the threads. Agents are
+ * removed from the heap during the step, and put back in the batch
+ * order, then deferred wake ups are processed.
+ */
+
+static void run_batch (Sched *s)
+{
+    SchedAgent *a ;
+    int i, n ;
+
+    n = 0 ;
+    while (s->nheap_ > 0)
+    {
+	a = &s->agents_ [s->heap_ [0]] ;
+	if (a->due_ > s->now_ || a->serial_)
+	    break ;
+	s->batch_ [n++] = s->heap_ [0] ;
+	a->pos_ = -1 ;
+	if (--s->nheap_ > 0)
+	{
+	    heap_set (s, 0, s->heap_ [s->nheap_]) ;
+	    heap_down (s, 0) ;
+	}
+    }
+
+    run_job (s, n, run_item, s) ;
+    s->nruns_ += n ;
+
+    // put agents back in the heap, with their new deadline
+    for (i = 0 ; i < n ; i++)
+    {
+	a = &s->agents_ [s->batch_ [i]] ;
+	a->due_ = a->nextdue_ ;
+	a->round_ = 0 ;			// run now, thus due later
+	heap_set (s, s->nheap_++, s->batch_ [i]) ;
+	heap_up (s, a->pos_) ;
+    }
+
+    apply_wakes (s) ;
+}
+
+
+/**
+ * @brief Run the simulation until a given time
+ *
+ * The current time jumps to each deadline in turn. At the end, the
+ * current time is `end`.
+ */
+
+void sched_run_until (Sched *s, clock_time_t end)
+{
+    SchedAgent *a ;
+    SchedEvent *e ;
+    clock_time_t t ;
+    uint64_t t0 ;
+
+    t0 = realtime_ns () ;
+    for (;;)
+    {
+	t = s->events_ != NULL ? s->events_->time_ : SCHED_NEVER ;
+	if (s->nheap_ > 0 && s->agents_ [s->heap_ [0]].due_ < t)
+	    t = s->agents_ [s->heap_ [0]].due_ ;
+	if (t > end)
+	    break ;
+	if (t > s->now_)
+	{
+	    s->now_ = t ;
+	    s->round_ = 0 ;
+	    s->nsteps_++ ;
+	}
+	else s->round_++ ;		// new pass at the same time
+
+	while ((e = s->events_) != NULL && e->time_ <= s->now_)
+	{
+	    s->events_ = e->next_ ;
+	    (*e->fn_) (e->arg_) ;
+	    free (e) ;
+	    s->nevents_++ ;
+	}
+
+	if (s->nthreads_ == 0)
+	{
+	    // a pass: agents due now, in index order
+	    while (s->nheap_ > 0
+		    && (a = &s->agents_ [s->heap_ [0]])->due_ <= s->now_
+		    && a->round_ <= s->round_)
+		run_one (s, a) ;
+	}
+	else
+	{
+	    while (s->nheap_ > 0
+		    && (a = &s->agents_ [s->heap_ [0]])->due_ <= s->now_)
+	    {
+		if (a->serial_)
+		    run_one (s, a) ;
+		else run_batch (s) ;
+	    }
+	}
+	if (s->barrier_ != NULL)
+	    (*s->barrier_) (s->barrierarg_) ;
+    }
+    if (end > s->now_)
+	s->now_ = end ;
+    s->nsrun_ += realtime_ns () - t0 ;
+}
+
+
+void sched_run_for (Sched *s, clock_time_t duration)
+{
+    sched_run_until (s, s->now_ + duration) ;
+}
+
+
+void sched_print_stat (Sched *s)
+{
+    printf ("sched: time=%lu ms agents=%d steps=%llu runs=%llu events=%llu\n",
+		(unsigned long int) s->now_, s->nagents_,
+		(unsigned long long int) s->nsteps_,
+		(unsigned long long int) s->nruns_,
+		(unsigned long long int) s->nevents_) ;
+    if (s->nthreads_ > 0)
+	printf ("sched: threads=%d parallel jobs=%llu items=%llu stolen=%llu time=%llu%%\n",
+		s->nthreads_,
+		(unsigned long long int) s->nbatches_,
+		(unsigned long long int) s->nparruns_,
+		(unsigned long long int) s->nstolen_,
+		(unsigned long long int) (s->nsrun_ == 0 ? 0
+				: s->nspar_ * 100 / s->nsrun_)) ;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file sched.h
+ * @brief discrete-event scheduler for simulations on the host
+ *
+ * The scheduler owns the current time (it becomes the time source
+ * of `clock_time`), and jumps directly from one deadline to the
+ * next one: a simulation of several hours with many nodes only
+ * takes the time needed to process its events.
+ *
+ * There are two kinds of activities:
+ * - agents (a CASAN slave, a master stand-in, the radio medium)
+ *   are run each time their deadline is reached. An agent gives its
+ *   next deadline with its `next` function, which is called after
+ *   each run of the agent, or when another agent wakes it up with
+ *   `sched_wake` (for example, when the medium delivers a frame to
+ *   a node). A deadline which is not in the future means "as soon
+ *   as possible": an agent is run at most once per millisecond.
+ * - one-shot events, run at a given time with `sched_at` (changes
+ *   of the topology, statistics, etc.). Events are run before the
+ *   agents, in time order, and in insertion order for the same time.
+ *
+ * Agents due at the same time are run in the order they were added.
+ * There is no other source of randomness: a simulation gives the
+ * same results each time it is run with the same seeds.
+ *
+ * Parallel mode (`sched_set_threads`): the agents due at the same
+ * time are run by several threads. The time window in which nodes
+ * are independent is given by the minimum latency of the radio (the
+ * CCA of other nodes detects a frame MEDIUM_TURNAROUND us after its
+ * start), which is below the clock resolution: a window is thus a
+ * single step (one millisecond), and the medium makes it conservative
+ * by committing the frames started during a step only at the end of
+ * the step (see `medium_set_deferred`). In this mode:
+ * - serial agents (`sched_set_serial`: the medium, a master stand-in
+ *   reading the state of other nodes) are run first, alone (as in
+ *   the sequential mode)
+ * - then, all other agents due at this time are run in parallel.
+ *   They must only modify their own node, and only call `sched_wake`
+ *   (which is deferred until all of them are done), never `sched_at`.
+ *   Their `next` function is called by the same thread, just after
+ *   the run.
+ * - the barrier function (`sched_set_barrier`) is called at the end
+ *   of each step (as in the sequential mode)
+ * - a serial agent may also use the threads for its own work, with
+ *   `sched_parallel_for` (the medium delivers a frame to all nodes
+ *   this way)
+ * Agents of a step are distributed over the threads by contiguous
+ * ranges, and a thread which has finished its range steals parts of
+ * the ranges of other threads. Results do not depend on the number
+ * of threads: provided the simulation uses the deferred medium and
+ * its commit as barrier in both modes, a sequential run (0 thread)
+ * gives the same results as a run with 1 or N threads.
+ *
+ * All times are expressed in milliseconds.
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include "contiki.h"
+#include "stdbool.h"
+
+#define	SCHED_NEVER	((clock_time_t) -1)
+
+#define	SCHED_MAXTHREADS	64
+#define	SCHED_PAR_MIN		16	// smaller steps are run by one thread
+#define	SCHED_CHUNK		4	// agents taken at once by a thread
+
+typedef bool (*sched_next_t) (void *arg, clock_time_t *next) ;
+typedef void (*sched_run_t) (void *arg) ;
+typedef void (*sched_item_t) (void *arg, int i) ;
+
+typedef struct schedagent
+{
+    sched_next_t next_ ;		// false: no deadline
+    sched_run_t run_ ;
+    void *arg_ ;
+    clock_time_t due_ ;			// next deadline
+    clock_time_t last_ ;		// last run (SCHED_NEVER: none)
+    uint32_t nrun_ ;
+    int pos_ ;				// position in the heap (-1: none)
+    int round_ ;			// pass in the current step
+    bool serial_ ;			// never run in parallel
+    bool woken_ ;			// deferred wake up pending
+    clock_time_t nextdue_ ;		// deadline after a parallel run
+} SchedAgent ;
+
+typedef struct schedevent
+{
+    clock_time_t time_ ;
+    sched_run_t fn_ ;
+    void *arg_ ;
+    struct schedevent *next_ ;
+} SchedEvent ;
+
+struct schedpool ;			// threads (see sched.c)
+
+typedef struct sched
+{
+    clock_time_t now_ ;
+    SchedAgent *agents_ ;
+    int nagents_ ;
+    int maxagents_ ;
+    int *heap_ ;			// agents, by deadline, pass, index
+    int nheap_ ;
+    int round_ ;			// current pass
+    int cur_ ;				// agent being run (-1: none)
+    SchedEvent *events_ ;		// sorted by time
+    sched_run_t barrier_ ;		// end of each step
+    void *barrierarg_ ;
+    /* parallel mode */
+    int nthreads_ ;			// 0: sequential mode
+    struct schedpool *pool_ ;
+    int *batch_ ;			// agents run in parallel
+    bool inbatch_ ;
+    /* statistics */
+    uint64_t nsteps_ ;			// distinct times processed
+    uint64_t nruns_ ;			// agent runs
+    uint64_t nevents_ ;			// one-shot events
+    uint64_t nbatches_ ;		// jobs run by several threads
+    uint64_t nparruns_ ;		// items (agent runs, etc.) in these jobs
+    uint64_t nstolen_ ;			// items stolen by a thread
+    uint64_t nsrun_ ;			// real time spent in sched_run_until
+    uint64_t nspar_ ;			// ... in these jobs (ns)
+} Sched ;
+
+Sched *initSched (int maxagents, clock_time_t start) ;
+void freeSched (Sched *s) ;
+
+bool sched_set_threads (Sched *s, int nthreads) ;
+void sched_set_barrier (Sched *s, sched_run_t fn, void *arg) ;
+
+int sched_add_agent (Sched *s, sched_next_t next, sched_run_t run, void *arg) ;
+void sched_set_serial (Sched *s, int agent) ;
+void sched_wake (Sched *s, int agent) ;
+bool sched_at (Sched *s, clock_time_t t, sched_run_t fn, void *arg) ;
+void sched_parallel_for (Sched *s, int n, sched_item_t fn, void *arg) ;
+
+clock_time_t sched_now (Sched *s) ;
+void sched_run_until (Sched *s, clock_time_t end) ;
+void sched_run_for (Sched *s, clock_time_t duration) ;
+
+void sched_print_stat (Sched *s) ;
+
+#endif
@@ -0,0 +1,290 @@
+/**
+ * @file tracedec.c
+ * @brief decoding of the binary event traces
+ */
+
+#include "tracedec.h"
+
+/*
+ * Description of each event: name and, for each argument, its name
+ * (NULL: not printed) and how to print its value
+ */
+
+enum { A_NUM, A_HEX, A_STATUS, A_TXSTATUS, A_CODE, A_TYPECODE, A_DROP } ;
+
+typedef struct evdesc
+{
+    const char *name ;
+    const char *arg [3] ;
+    uint8_t fmt [3] ;
+} EvDesc ;
+
+static const EvDesc evdesc [TR_NEVENTS] =
+{
+    [TR_NONE] =		{ "NONE", { NULL, NULL, NULL }, { 0 } },
+    [TR_RX] =		{ "RX", { "len", "src", "lqi" },
+				{ A_NUM, A_HEX, A_NUM } },
+    [TR_RX_DROP] =	{ "RX_DROP", { "len", "reason", NULL },
+				{ A_NUM, A_DROP, 0 } },
+    [TR_TX] =		{ "TX", { "len", "dst", "seq" },
+				{ A_NUM, A_HEX, A_NUM } },
+    [TR_TX_DONE] =	{ "TX_DONE", { "status", "retries", NULL },
+				{ A_TXSTATUS, A_NUM, 0 } },
+    [TR_STATUS] =	{ "STATUS", { "new", "old", NULL },
+				{ A_STATUS, A_STATUS, 0 } },
+    [TR_MASTER] =	{ "MASTER", { "addr", "hlid", "mtu" },
+				{ A_HEX, A_NUM, A_NUM } },
+    [TR_MASTER_RESET] =	{ "MASTER_RESET", { NULL, NULL, NULL }, { 0 } },
+    [TR_HELLO] =	{ "HELLO", { NULL, "hlid", NULL }, { 0, A_NUM, 0 } },
+    [TR_DISCOVER] =	{ "DISCOVER", { "mtu", "slaveid", NULL },
+				{ A_NUM, A_NUM, 0 } },
+    [TR_ASSOC] =	{ "ASSOC", { "mtu", "ttl", "agg" },
+				{ A_NUM, A_NUM, A_NUM } },
+    [TR_CTL_UNKNOWN] =	{ "CTL_UNKNOWN", { "id", NULL, NULL }, { A_NUM } },
+    [TR_REQUEST] =	{ "REQUEST", { "code", "id", "paylen" },
+				{ A_CODE, A_NUM, A_NUM } },
+    [TR_TOO_LARGE] =	{ "TOO_LARGE", { "id", NULL, NULL }, { A_NUM } },
+    [TR_SEND] =		{ "SEND", { "len", "id", "type.code" },
+				{ A_NUM, A_NUM, A_TYPECODE } },
+    [TR_SEND_ERR] =	{ "SEND_ERR", { "reason", "id", NULL },
+				{ A_NUM, A_NUM, 0 } },
+    [TR_DECODE_ERR] =	{ "DECODE_ERR", { "len", NULL, NULL }, { A_NUM } },
+} ;
+
+static const char *status_name [] =
+{
+    [SL_COLDSTART] = "SL_COLDSTART",
+    [SL_WAITING_UNKNOWN] = "SL_WAITING_UNKNOWN",
+    [SL_RUNNING] = "SL_RUNNING",
+    [SL_RENEW] = "SL_RENEW",
+    [SL_WAITING_KNOWN] = "SL_WAITING_KNOWN",
+} ;
+
+static const char *txstatus_name [] =
+{
+    [TX_OK] = "OK",
+    [TX_NOACK] = "NOACK",
+    [TX_CCA_FAIL] = "CCA_FAIL",
+    [TX_FAIL] = "FAIL",
+} ;
+
+static const char *type_name [] = { "CON", "NON", "ACK", "RST" } ;
+
+static const char *drop_name [] =
+{
+    [TR_DROP_FILTER] = "filter",
+    [TR_DROP_OVERRUN] = "overrun",
+} ;
+
+#define	NAME(tab,v)	((v) < NTAB (tab) && (tab) [v] != NULL ? (tab) [v] : "?")
+
+
+/******************************************************************************
+ * Save and load
+ */
+
+static void write_file (void *arg, const uint8_t *data, int len)
+{
+    fwrite (data, 1, len, (FILE *) arg) ;
+}
+
+bool trace_save (Trace *t, const char *file)
+{
+    FILE *fp ;
+    bool ok ;
+
+    fp = fopen (file, "wb") ;
+    if (fp == NULL)
+	return false ;
+    trace_write (t, write_file, fp) ;
+    ok = ! ferror (fp) ;
+    if (fclose (fp) != 0)
+	ok = false ;
+    return ok ;
+}
+
+
+static uint16_t get16 (const uint8_t *p)
+{
+    return p [0] | (p [1] << 8) ;
+}
+
+static uint32_t get32 (const uint8_t *p)
+{
+    return p [0] | (p [1] << 8) | (p [2] << 16) | ((uint32_t) p [3] << 24) ;
+}
+
+
+/*
+ * Decode an exported trace. Records larger than expected (from a
+ * newer version) are accepted, the extra bytes are ignored.
+ * Returns NULL if the data is not a valid trace.
+ */
+
+TraceFile *trace_decode (const uint8_t *data, int len)
+{
+    TraceFile *tf ;
+    uint32_t nrec ;
+    int reclen, i ;
+    const uint8_t *p ;
+
+    if (len < TRACE_HDRLEN || memcmp (data, TRACE_MAGIC, 4) != 0)
+	return NULL ;
+    reclen = get16 (data + 6) ;
+    nrec = get32 (data + 12) ;
+    if (get16 (data + 4) != TRACE_VERSION || reclen < TRACE_RECLEN
+		|| get32 (data + 8) == 0
+		|| nrec > (uint32_t) (len - TRACE_HDRLEN) / reclen)
+	return NULL ;
+
+    tf = (TraceFile *) calloc (1, sizeof *tf) ;
+    if (tf == NULL)
+	return NULL ;
+    tf->hz_ = get32 (data + 8) ;
+    tf->lost_ = get32 (data + 16) ;
+    tf->nrec_ = nrec ;
+    tf->rec_ = (TraceRec *) calloc (nrec + 1, sizeof (TraceRec)) ;
+    if (tf->rec_ == NULL)
+    {
+	free (tf) ;
+	return NULL ;
+    }
+
+    p = data + TRACE_HDRLEN ;
+    for (i = 0 ; i < tf->nrec_ ; i++)
+    {
+	tf->rec_ [i].time = get32 (p) ;
+	tf->rec_ [i].id = get16 (p + 4) ;
+	tf->rec_ [i].arg0 = get16 (p + 6) ;
+	tf->rec_ [i].arg1 = get32 (p + 8) ;
+	tf->rec_ [i].arg2 = get32 (p + 12) ;
+	p += reclen ;
+    }
+    return tf ;
+}
+
+
+TraceFile *trace_load (const char *file)
+{
+    TraceFile *tf ;
+    uint8_t *data ;
+    FILE *fp ;
+    long int len ;
+
+    fp = fopen (file, "rb") ;
+    if (fp == NULL)
+	return NULL ;
+    tf = NULL ;
+    if (fseek (fp, 0, SEEK_END) == 0 && (len = ftell (fp)) > 0
+		&& fseek (fp, 0, SEEK_SET) == 0)
+    {
+	data = (uint8_t *) malloc (len) ;
+	if (data != NULL && fread (data, 1, len, fp) == (size_t) len)
+	    tf = trace_decode (data, len) ;
+	free (data) ;
+    }
+    fclose (fp) ;
+    return tf ;
+}
+
+
+void freeTraceFile (TraceFile *tf)
+{
+    free (tf->rec_) ;
+    free (tf) ;
+}
+
+
+/******************************************************************************
+ * Print
+ */
+
+const char *trace_event_name (uint16_t id)
+{
+    if (id < TR_NEVENTS)
+	return evdesc [id].name ;
+    return id >= TR_USER ? "USER" : "?" ;
+}
+
+
+int trace_find (TraceFile *tf, int start, uint16_t id)
+{
+    int i ;
+
+    for (i = start < 0 ? 0 : start ; i < tf->nrec_ ; i++)
+	if (tf->rec_ [i].id == id)
+	    return i ;
+    return -1 ;
+}
+
+
+static void print_arg (FILE *fp, const char *name, int fmt, uint32_t v)
+{
+    fprintf (fp, " %s=", name) ;
+    switch (fmt)
+    {
+	case A_HEX :
+	    fprintf (fp, "%04lx", (unsigned long int) v) ;
+	    break ;
+	case A_STATUS :
+	    fprintf (fp, "%s", NAME (status_name, v)) ;
+	    break ;
+	case A_TXSTATUS :
+	    fprintf (fp, "%s", NAME (txstatus_name, v)) ;
+	    break ;
+	case A_CODE :
+	    fprintf (fp, "%lu.%02lu", (unsigned long int) (v >> 5) & 0x7,
+				(unsigned long int) v & 0x1f) ;
+	    break ;
+	case A_TYPECODE :
+	    fprintf (fp, "%s.%lu.%02lu", NAME (type_name, (v >> 8) & 0x3),
+				(unsigned long int) (v >> 5) & 0x7,
+				(unsigned long int) v & 0x1f) ;
+	    break ;
+	case A_DROP :
+	    fprintf (fp, "%s", NAME (drop_name, v)) ;
+	    break ;
+	default :
+	    fprintf (fp, "%ld", (long int) (int32_t) v) ;
+	    break ;
+    }
+}
+
+void trace_print_rec (TraceFile *tf, const TraceRec *r, FILE *fp)
+{
+    const EvDesc *e ;
+    uint32_t v [3] ;
+    int i ;
+
+    fprintf (fp, "%9lu.%03lu  ", (unsigned long int) (r->time / tf->hz_),
+		(unsigned long int) ((r->time % tf->hz_) * 1000 / tf->hz_)) ;
+    v [0] = r->arg0 ;
+    v [1] = r->arg1 ;
+    v [2] = r->arg2 ;
+    if (r->id >= TR_NEVENTS)
+    {
+	if (r->id >= TR_USER)
+	    fprintf (fp, "USER+%-7u", r->id - TR_USER) ;
+	else fprintf (fp, "EVENT%-7u", r->id) ;
+	fprintf (fp, " %lu %lu %lu\n", (unsigned long int) v [0],
+		    (unsigned long int) v [1], (unsigned long int) v [2]) ;
+	return ;
+    }
+    e = &evdesc [r->id] ;
+    fprintf (fp, "%-12s", e->name) ;
+    for (i = 0 ; i < 3 ; i++)
+	if (e->arg [i] != NULL)
+	    print_arg (fp, e->arg [i], e->fmt [i], v [i]) ;
+    fprintf (fp, "\n") ;
+}
+
+
+void trace_print (TraceFile *tf, FILE *fp)
+{
+    int i ;
+
+    fprintf (fp, "%d records, %lu lost\n", tf->nrec_,
+				(unsigned long int) tf->lost_) ;
+    for (i = 0 ; i < tf->nrec_ ; i++)
+	trace_print_rec (tf, &tf->rec_ [i], fp) ;
+}
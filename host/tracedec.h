@@ -0,0 +1,42 @@
+/**
+ * @file tracedec.h
+ * @brief decoding of the binary event traces on the host
+ *
+ * A trace (see Casan/trace.h) exported by a node with trace_write,
+ * either received on a serial line or saved by a simulation, is read
+ * back as a TraceFile. Records are printed one per line, with the
+ * time in seconds, the event name and its named arguments, for
+ * example:
+ *
+ *	   12.345  STATUS       new=SL_RUNNING old=SL_WAITING_UNKNOWN
+ *
+ * Events from TR_USER are printed with their numeric identifier and
+ * raw arguments.
+ */
+
+#ifndef __TRACEDEC_H__
+#define __TRACEDEC_H__
+
+#include "../libraries/Casan/casan.h"
+#include "../libraries/ConMsg/ConMsg.h"		// tx_status_t
+
+typedef struct tracefile
+{
+    uint32_t hz_ ;			// clock ticks per second
+    uint32_t lost_ ;			// records lost before the first one
+    int nrec_ ;
+    TraceRec *rec_ ;
+} TraceFile ;
+
+bool trace_save (Trace *t, const char *file) ;
+
+TraceFile *trace_decode (const uint8_t *data, int len) ;
+TraceFile *trace_load (const char *file) ;
+void freeTraceFile (TraceFile *tf) ;
+
+const char *trace_event_name (uint16_t id) ;
+int trace_find (TraceFile *tf, int start, uint16_t id) ;	// -1: not found
+void trace_print_rec (TraceFile *tf, const TraceRec *r, FILE *fp) ;
+void trace_print (TraceFile *tf, FILE *fp) ;
+
+#endif
@@ -12,6 +12,8 @@
 #define	CASAN_DISCOVER_MTU	"mtu=%ld"
 #define	CASAN_ASSOC_TTL		"ttl=%ld"
 #define	CASAN_ASSOC_MTU		CASAN_DISCOVER_MTU
+#define	CASAN_DISCOVER_AGG	"agg=%ld"
+#define	CASAN_ASSOC_AGG		CASAN_DISCOVER_AGG
 
 #define	CASAN_BUF_LEN		50	// > sizeof hello=.../slave=..../etc
 
@@ -49,34 +51,62 @@ Constructor and simili-destructor
  */
 
 
-Casan *initCasan (l2net_154 *l2, int mtu, long int slaveid)
+Casan *initCasan (l2net *l2, int mtu, long int slaveid)
 {
-    Casan *ca = (Casan *) malloc(sizeof (Casan));
+    Casan *ca = (Casan *) CASAN_MALLOC (ALLOC_CASAN, sizeof (Casan));
     if (ca == NULL)
-		printf("Memory allocation failed\n");
+    {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return NULL ;
+    }
     ca->l2_ = l2 ;
     ca->slaveid_ = slaveid ;
-    curtime = 0 ;			// global variable
+    ca->curtime_ = 0 ;			// each engine keeps its own time
     ca->master_ = NULL;
 
-    sync_time (&curtime) ;
+    sync_time (&ca->curtime_) ;
+    memset (&ca->dcycle_, 0, sizeof ca->dcycle_) ;	// always on
     ca->defmtu_ = getMTU (l2) ;		// get default L2 MTU
     if (mtu > 0 && mtu < ca->defmtu_)
 		ca->defmtu_ = mtu ;			// set a different default MTU
     reset_master (ca) ;			// master_ is reset (broadcast addr, mtu)
     ca->hlid_ = -1 ;
     ca->curid_ = 1 ;
-    ca->retrans_ = initRetrans();
+    ca->retrans_ = initRetrans (&ca->curtime_) ;
     master (ca->retrans_, &ca->master_) ;
+    // each slave must draw different retransmission delays
+    seed_random (&ca->retrans_->rto_, (uint32_t) l2->myaddr_ << 16 ^ (uint32_t) slaveid
+				^ (uint32_t) clock_time ()) ;
     ca->status_ = SL_COLDSTART ;
 
     ca->reslist_ = NULL;
-    
+    memset (ca->dedup_, 0, sizeof ca->dedup_) ;
+
+    // timers are allocated once and restarted on each state transition
+    ca->twait_ = initTwait (&ca->curtime_) ;
+    ca->trenew_ = initTrenew (&ca->curtime_, 0) ;
 
     return ca;
 }
 
 
+/**
+ * @brief Destructor
+ *
+ * Resources are not freed, since they belong to the application
+ * (they may be registered again with another engine).
+ */
+
+void freeCasan (Casan *ca)
+{
+    resetCasan (ca) ;			// resource list, dedup, master
+    freeRetrans (ca->retrans_) ;
+    freeTwait (ca->twait_) ;
+    freeTrenew (ca->trenew_) ;
+    CASAN_MFREE (ca) ;
+}
+
+
 
 /*
  * @brief Reset CASAN engine
@@ -98,11 +128,12 @@ void resetCasan (Casan *ca)
 		reslist *r ;
 
 		r = ca->reslist_->next ;
-		free(ca->reslist_) ;
+		CASAN_FREE (pool_reslist, ca->reslist_) ;
 		ca->reslist_ = r ;
     }
 
     resetRetrans (ca->retrans_) ;
+    reset_dedup (ca) ;
     reset_master (ca) ;
 }
 
@@ -144,6 +175,20 @@ void negociate_mtu (Casan *ca, int mtu)
     setMTU (ca->l2_, ca->curmtu_) ;		// notify L2 network
 }
 
+/**
+ * @brief Turn frame aggregation on or off
+ *
+ * Aggregation is proposed in each Discover message if the L2
+ * network supports it, and used only if the master accepts it in
+ * its Assoc message.
+ */
+
+void negociate_agg (Casan *ca, bool agg)
+{
+    setAggregation (ca->l2_, agg) ;		// notify L2 network
+    ca->agg_ = getAggregation (ca->l2_) ;	// if supported
+}
+
 
 
 /******************************************************************************
@@ -155,17 +200,25 @@ Master handling
  * * address is null
  * * hello-id is -1 (i.e. unknown hello-id)
  * * current MTU is reset to default (user initialized) MTU
+ * * frame aggregation is turned off
  */
 
 void reset_master (Casan *ca)
 {	
     if (ca->master_ != NULL)
-		freel2addr_154(ca->master_) ; 
+    {
+		// pending messages to the old master are useless
+		delRetransDest (ca->retrans_, ca->master_) ;
+		freel2addr(ca->master_) ; 
+    }
 
     ca->master_ = NULL ;
     ca->hlid_ = -1 ;
     reset_mtu (ca) ;			// reset MTU to default
-    printf ("Master reset to broadcast address and default MTU\n") ;
+    negociate_agg (ca, false) ;
+    resetDcycle (&ca->dcycle_) ;	// Hello period is no longer known
+    TRACE (TR_MASTER_RESET, 0, 0, 0) ;
+    CLOG_INFO ("Master reset to broadcast address and default MTU\n") ;
 }
 
 
@@ -175,7 +228,7 @@ void reset_master (Casan *ca)
  * NULL pointer)?
  */
 
-bool same_master (Casan *ca, l2addr_154 *a)
+bool same_master (Casan *ca, l2addr *a)
 {
     return ca->master_ != NULL && isEqualAddr(a, ca->master_ );
 }
@@ -190,20 +243,22 @@ bool same_master (Casan *ca, l2addr_154 *a)
 
 void change_master (Casan *ca, long int hlid, int mtu)
 {
-    l2addr_154 *newmaster ;
+    l2addr *newmaster ;
 
     newmaster = get_src (ca->l2_) ;	// get a new address
+    if (newmaster == NULL)
+		return ;
     if (ca->master_ != NULL)
     {
 		if (isEqualAddr(newmaster, ca->master_))
 		{
 		    if (hlid != -1)
 				ca->hlid_ = hlid ;
-		    freel2addr_154(newmaster) ;
+		    freel2addr(newmaster) ;
 		}
 		else
 		{
-		    freel2addr_154(ca->master_) ;
+		    freel2addr(ca->master_) ;
 		    ca->master_ = newmaster ;
 		    ca->hlid_ = hlid ;
 		}
@@ -217,11 +272,9 @@ void change_master (Casan *ca, long int hlid, int mtu)
     if (mtu != -1)
 		negociate_mtu (ca, mtu) ;
 
-    printf ("Master set to ") ;
-    printAddr (ca->master_) ;
-    printf (", helloid= %d", ca->hlid_) ;
-    printf (", mtu= %d", ca->curmtu_) ;
-    printf("\n");
+    TRACE (TR_MASTER, ca->master_->addr_, ca->hlid_, ca->curmtu_) ;
+    CLOG_INFO ("Master set to %04x, helloid= %ld, mtu= %d\n",
+			ca->master_->addr_, (long int) ca->hlid_, (int) ca->curmtu_) ;
 }
 
 
@@ -254,9 +307,12 @@ void register_resource (Casan *ca, Resource *res)
      * order provided by the application
      */
 
-    newr = (reslist *) malloc(sizeof (reslist)) ;
+    newr = (reslist *) CASAN_ALLOC (pool_reslist, sizeof (reslist)) ;
     if (newr == NULL)
-		printf("Memory allocation failed\n");
+    {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return ;
+    }
     newr->res = res ;
 
     prev = NULL ;
@@ -338,11 +394,13 @@ void process_request (Casan *ca, Msg *in, Msg *out)
 
 				    if (obs != NULL && obsval == 0)
 				    {
-						option *robs = initOption();
+						option *robs = initOptionInteger (MO_Observe, next_serial (res)) ;
 
-						setOptcode (robs, MO_Observe) ;
-						setOptvalInteger (robs,next_serial (res)) ;
-						push_option (out, robs) ;
+						if (robs != NULL)
+						{
+						    push_option (out, robs) ;
+						    freeOption (robs) ;
+						}
 				    }
 
 				    request_resource (in, out, res) ;
@@ -363,6 +421,100 @@ void process_request (Casan *ca, Msg *in, Msg *out)
 
 
 
+/******************************************************************************
+Duplicate requests handling
+******************************************************************************/
+
+/**
+ * @brief Find the answer to an already processed request
+ *
+ * Expired entries are released on the way.
+ *
+ * @param src address of requester
+ * @param id message id of the request
+ * @return encoded answer (do not release it) or NULL if not found
+ */
+
+Pktbuf *get_dedup (Casan *ca, l2addr *src, uint16_t id)
+{
+    Pktbuf *pb ;
+    int i ;
+
+    pb = NULL ;
+    for (i = 0 ; i < DEDUP_SIZE ; i++)
+    {
+		dedup *d = &ca->dedup_ [i] ;
+
+		if (d->resp == NULL)
+		    continue ;
+		if (d->expire <= ca->curtime_)
+		{
+		    releasePktbuf (d->resp) ;
+		    d->resp = NULL ;
+		}
+		else if (d->id == id && isEqualAddr (&d->src, src))
+		    pb = d->resp ;
+    }
+    return pb ;
+}
+
+
+/**
+ * @brief Keep the answer to a request
+ *
+ * A reference to the encoded answer is kept in the cache. If the
+ * cache is full, the entry which expires first is replaced.
+ *
+ * @param src address of requester
+ * @param id message id of the request
+ * @param resp encoded answer
+ */
+
+void add_dedup (Casan *ca, l2addr *src, uint16_t id, Pktbuf *resp)
+{
+    dedup *d ;
+    int i ;
+
+    if (resp == NULL)
+		return ;
+
+    d = &ca->dedup_ [0] ;
+    for (i = 0 ; i < DEDUP_SIZE ; i++)
+    {
+		if (ca->dedup_ [i].resp == NULL)
+		{
+		    d = &ca->dedup_ [i] ;
+		    break ;
+		}
+		if (ca->dedup_ [i].expire < d->expire)
+		    d = &ca->dedup_ [i] ;
+    }
+
+    releasePktbuf (d->resp) ;
+    copyAddr (&d->src, src) ;
+    d->id = id ;
+    d->resp = retainPktbuf (resp) ;
+    d->expire = ca->curtime_ + EXCHANGE_LIFETIME ;
+}
+
+
+/**
+ * @brief Forget all answers
+ */
+
+void reset_dedup (Casan *ca)
+{
+    int i ;
+
+    for (i = 0 ; i < DEDUP_SIZE ; i++)
+    {
+		releasePktbuf (ca->dedup_ [i].resp) ;
+		ca->dedup_ [i].resp = NULL ;
+    }
+}
+
+
+
 /**
  * Build a response message
  *
@@ -381,7 +533,9 @@ void request_resource (Msg *pin, Msg *pout, Resource *res)
     handler_res_t h ;
     uint8_t code ;
 
-    h = getHandlerResource (res, (coap_code_t) get_code (pin)) ;
+    // an observe notification (no request) is the answer to a GET
+    h = getHandlerResource (res, pin == NULL ? COAP_CODE_GET
+					: (coap_code_t) get_code (pin)) ;
     if (h == NULL)
     {
 		code = COAP_CODE_BAD_REQUEST ;
@@ -398,7 +552,8 @@ void request_resource (Msg *pin, Msg *pout, Resource *res)
 
 /**
  * Check all observed resources in order to detect changes and
- * send appropriate observe message.
+ * send appropriate observe message. A confirmable notification is
+ * retransmitted until the master acknowledges it.
  *
  * @param out an output message
  */
@@ -407,21 +562,32 @@ void check_observed_resources (Casan *ca, Msg *out)
 {
     Resource *res ;
     reslist *rl ;
+    uint32_t serial ;
 
     for (rl = ca->reslist_ ; rl != NULL ; rl = rl->next)
     {
 		res = rl->res ;
-		if (check_trigger (res))
+		if (get_observed (res) && check_trigger (res))
 		{
 		    resetMsg (out) ;
 
-		    set_type (out, COAP_TYPE_ACK) ;
+		    // a notification is not an answer: new message id
+		    serial = next_serial (res) ;
+		    set_type (out, serial % NOTIFY_CON == 0 ? COAP_TYPE_CON
+							: COAP_TYPE_NON) ;
+		    set_id (out, ca->curid_++) ;
 		    set_token_msg (out, get_token (res)) ;
 
-		    option *obs = initOptionInteger(MO_Observe, next_serial (res)) ;
-		    push_option (out, obs) ;
+		    option *obs = initOptionInteger(MO_Observe, serial) ;
+		    if (obs != NULL)
+		    {
+				push_option (out, obs) ;
+				freeOption (obs) ;
+		    }
 
 		    request_resource (NULL, out, res) ;
+		    if (ca->master_ != NULL && sendMsg (out, ca->master_))
+				check_msg_sent (ca->retrans_, out, ca->master_) ;
 		}
     }
 }
@@ -440,7 +606,9 @@ bool get_well_known (Casan *ca, Msg *out)
     set_content_format (out, reset, cf_text_plain) ;
     //printMsg(out );
     avail = avail_space (out) ;	
-    buf = (char *) malloc (avail) ;
+    buf = (char *) CASAN_ALLOC (pool_buf, avail) ;
+    if (buf == NULL)
+		return false ;
 
     size = 0 ;
     for (rl = ca->reslist_ ; rl != NULL ; rl = rl->next) 
@@ -465,7 +633,7 @@ bool get_well_known (Casan *ca, Msg *out)
     }
 
     set_payload_msg (out, (uint8_t *) buf, size) ;
-    free (buf) ;
+    CASAN_FREE (pool_buf, buf) ;
 
 
     /*
@@ -475,10 +643,8 @@ bool get_well_known (Casan *ca, Msg *out)
 
     if (rl != NULL)
     {
-		printf ("%s",B_RED "Resource '") ;
-		printf ("%s",get_name (rl->res)) ;
-		printf ("' do not fit in buffer of %d", avail) ;
-		printf (" bytes %s\n", C_RESET) ;
+		CLOG_WARN ("%sResource '%s' do not fit in buffer of %d bytes%s\n",
+				B_RED, get_name (rl->res), (int) avail, C_RESET) ;
     }
 
     return rl == NULL ;			// true if all res are in the message
@@ -515,60 +681,83 @@ Main CASAN loop
 void loop (Casan *ca)
 {
 	
-    Msg *in = initMsg(ca->l2_) ;
-    Msg *out = initMsg(ca->l2_) ;
+    Msg *in, *out ;
     l2_recv_t ret ;
     uint8_t oldstatus ;
     long int hlid = 0;
-    l2addr_154 *srcaddr ;
+    l2addr *srcaddr ;
     int mtu ;				// mtu announced by master in assoc msg
+    bool agg ;				// aggregation accepted in assoc msg
 
     oldstatus = ca->status_ ;		// keep old value for debug display
-    sync_time (&curtime) ;		// get current time
-    loopRetrans (ca->retrans_, ca->l2_, &curtime) ;	// check needed retransmissions
+    sync_time (&ca->curtime_) ;		// get current time
+    loopRetrans (ca->retrans_, ca->l2_, &ca->curtime_) ;	// check needed retransmissions
+
+    in = initMsg (ca->l2_) ;
+    out = initMsg (ca->l2_) ;
+    if (in == NULL || out == NULL)
+    {
+		// pool exhausted: try again on next loop
+		freeMsg (in) ;
+		freeMsg (out) ;
+		return ;
+    }
 
     srcaddr = NULL ;
 
     ret = recvMsg (in) ;			// get received message
     if (ret == RECV_OK)
+    {
 		srcaddr = get_src (ca->l2_) ;	// get a new address
+		if (srcaddr == NULL)
+		    ret = RECV_EMPTY ;		// pool exhausted: drop message
+		else
+		    lqiRetrans (ca->retrans_, srcaddr, get_lqi (ca->l2_)) ;
+		dcycle_activity (&ca->dcycle_, &ca->curtime_) ;
+    }
 
     switch (ca->status_)
     {
 	case SL_COLDSTART :
 	    send_discover (ca, out) ;
-	    ca->twait_ = initTwait (&curtime) ;
+	    resetTwait (ca->twait_, &ca->curtime_) ;
 	    ca->status_ = SL_WAITING_UNKNOWN ;
 	    break ;
 
 	case SL_WAITING_UNKNOWN :
 	    if (ret == RECV_OK)
 	    {	
-			check_msg_received (ca->retrans_, in) ;
+			check_msg_received (ca->retrans_, in, srcaddr) ;
 
 			if (is_ctl_msg (in))
-			{	printMsg(in);
+			{
 			    if (is_hello (in, &hlid))
 			    {
-					printf("Received a CTL HELLO msg\n") ;
+					CLOG_DBG ("Received a CTL HELLO msg\n") ;
+					dcycle_hello (&ca->dcycle_, &ca->curtime_) ;
 					change_master (ca, hlid, -1) ;	// don't change mtu
-					ca->twait_ = initTwait (&curtime) ;
+					resetTwait (ca->twait_, &ca->curtime_) ;
 					ca->status_ = SL_WAITING_KNOWN ;
 			    }
-			    else if (is_assoc (in, &ca->sttl_, &mtu))
+			    else if (is_assoc (in, &ca->sttl_, &mtu, &agg))
 			    {
 
-					printf ("Received a CTL ASSOC msg UNKNOWN\n") ;
+					CLOG_DBG ("Received a CTL ASSOC msg UNKNOWN\n") ;
 					change_master (ca, -1, mtu) ;	// "unknown" hlid
+					negociate_agg (ca, agg) ;
 					send_assoc_answer (ca, in, out) ;
-					ca->trenew_ = initTrenew (&curtime, ca->sttl_) ;
+					resetTrenew (ca->trenew_, &ca->curtime_, ca->sttl_) ;
 					ca->status_ = SL_RUNNING ;
 			    }
-			    else printf ("%s\n",RED ("Unkwnon CTL")) ;
+			    else
+			    {
+					TRACE (TR_CTL_UNKNOWN, get_id (in), 0, 0) ;
+					CLOG_WARN ("%s\n", RED ("Unknown CTL")) ;
+			    }
 			}
 
 	    }
-	    if (ca->status_ == SL_WAITING_UNKNOWN && nextTwait (ca->twait_, &curtime)){
+	    if (ca->status_ == SL_WAITING_UNKNOWN && nextTwait (ca->twait_, &ca->curtime_)){
 			send_discover (ca, out) ;
 		}
 	
@@ -577,37 +766,43 @@ void loop (Casan *ca)
 	case SL_WAITING_KNOWN :
 	    if (ret == RECV_OK)
 	    {		
-			check_msg_received (ca->retrans_, in) ;
+			check_msg_received (ca->retrans_, in, srcaddr) ;
 
 			if (is_ctl_msg (in))
 			{
 			    if (is_hello (in, &hlid))
 			    {
-					printf ("Received a CTL HELLO msg\n") ;
+					CLOG_DBG ("Received a CTL HELLO msg\n") ;
+					dcycle_hello (&ca->dcycle_, &ca->curtime_) ;
 					change_master (ca, hlid, -1) ;	// don't change mtu
 			    }
-			    else if (is_assoc (in, &ca->sttl_, &mtu))
+			    else if (is_assoc (in, &ca->sttl_, &mtu, &agg))
 			    {
-					printf ("Received a CTL ASSOC msg KNOWN\n") ;
+					CLOG_DBG ("Received a CTL ASSOC msg KNOWN\n") ;
 					change_master (ca, -1, mtu) ;	// unknown hlid
+					negociate_agg (ca, agg) ;
 					send_assoc_answer (ca, in, out) ;
-					ca->trenew_ = initTrenew (&curtime, ca->sttl_) ;
+					resetTrenew (ca->trenew_, &ca->curtime_, ca->sttl_) ;
 					ca->status_ = SL_RUNNING ;
 			    }
-			    else printf ("%s\n", RED ("Unkwnon CTL")) ;
+			    else
+			    {
+					TRACE (TR_CTL_UNKNOWN, get_id (in), 0, 0) ;
+					CLOG_WARN ("%s\n", RED ("Unknown CTL")) ;
+			    }
 			}
 	    }
 
 	    if (ca->status_ == SL_WAITING_KNOWN)
 	    {
-			if (expiredTwait (ca->twait_, &curtime))
+			if (expiredTwait (ca->twait_, &ca->curtime_))
 			{
 			    reset_master (ca) ;		// master_ is no longer known
 			    send_discover (ca, out) ;
-			    ca->twait_ = initTwait (&curtime) ;	// reset timer
+			    resetTwait (ca->twait_, &ca->curtime_) ;	// reset timer
 			    ca->status_ = SL_WAITING_UNKNOWN ;
 			}
-			else if (nextTwait (ca->twait_, &curtime))
+			else if (nextTwait (ca->twait_, &ca->curtime_))
 			{
 			    send_discover (ca, out) ;
 			}
@@ -619,102 +814,221 @@ void loop (Casan *ca)
 	case SL_RENEW :
 	    if (ret == RECV_OK)
 	    {	
-			check_msg_received (ca->retrans_, in) ;
+			check_msg_received (ca->retrans_, in, srcaddr) ;
 
 			if (is_ctl_msg (in))
 			{
 			    if (is_hello (in, &hlid))
 			    {
-					printf ("Received a CTL HELLO msg\n") ;
+					CLOG_DBG ("Received a CTL HELLO msg\n") ;
+					dcycle_hello (&ca->dcycle_, &ca->curtime_) ;
 					if (! same_master (ca, srcaddr) || hlid != ca->hlid_)
 					{
 					    int oldhlid = ca->hlid_ ;
 
 					    change_master (ca, hlid, 0) ;	// reset mtu
+					    negociate_agg (ca, false) ;
 					    if (oldhlid != -1)
 					    {
-							ca->twait_ = initTwait (&curtime) ;
+							resetTwait (ca->twait_, &ca->curtime_) ;
 							ca->status_ = SL_WAITING_KNOWN ;
 					    }
 					}
 			    }
-			    else if (is_assoc (in, &ca->sttl_, &mtu))
+			    else if (is_assoc (in, &ca->sttl_, &mtu, &agg))
 			    {
-					printf ("Received a CTL ASSOC msg RENEW\n") ;
+					CLOG_DBG ("Received a CTL ASSOC msg RENEW\n") ;
 					if (same_master (ca, srcaddr))
 					{
 					    negociate_mtu (ca, mtu) ;
+					    negociate_agg (ca, agg) ;
 					    send_assoc_answer (ca, in, out) ;
-					    ca->trenew_ = initTrenew (&curtime, ca->sttl_) ;
+					    resetTrenew (ca->trenew_, &ca->curtime_, ca->sttl_) ;
 					    ca->status_ = SL_RUNNING ;
 					}
 			    }
-			    else printf ("%s\n",RED ("Unkwnon CTL")) ;
+			    else
+			    {
+					TRACE (TR_CTL_UNKNOWN, get_id (in), 0, 0) ;
+					CLOG_WARN ("%s\n", RED ("Unknown CTL")) ;
+			    }
 			}
-			else		// request for a normal resource
+			else if (get_type (in) == COAP_TYPE_CON
+					|| get_type (in) == COAP_TYPE_NON)
 			{
-			    // deduplicate () ;
-			    process_request (ca, in, out) ;
-			    sendMsg (out, ca->master_) ;
+			    Pktbuf *dup ;
+
+			    // request for a normal resource (ACK and RST are
+			    // handled by check_msg_received)
+			    dup = get_dedup (ca, srcaddr, get_id (in)) ;
+			    if (dup != NULL)
+			    {
+					// our answer has been lost: send it again
+					send (ca->l2_, ca->master_, dup->data_, dup->len_) ;
+			    }
+			    else
+			    {
+					TRACE (TR_REQUEST, get_code (in), get_id (in),
+							get_paylen_msg (in)) ;
+					process_request (ca, in, out) ;
+					if (sendMsg (out, ca->master_)
+						&& get_type (in) == COAP_TYPE_CON)
+					    add_dedup (ca, srcaddr, get_id (in), out->encoded_) ;
+			    }
 			}
 	    }
 	    else if (ret == RECV_TRUNCATED)
 	    {
-			printf ("%s", RED ("Request too large")) ;
+			TRACE (TR_TOO_LARGE, get_id (in), 0, 0) ;
+			CLOG_WARN ("%s\n", RED ("Request too large")) ;
 			set_type (out, COAP_TYPE_ACK) ;
 			set_id (out, get_id (in)) ;
 			set_token_msg (out, get_token_msg (in)) ;
 			option *o = initOptionInteger(MO_Size1, getMTU (ca->l2_)) ;
-			push_option (out, o) ;
+			if (o != NULL)
+			{
+			    push_option (out, o) ;
+			    freeOption (o) ;
+			}
 			set_code (out, COAP_CODE_TOO_LARGE) ;
 			sendMsg (out, ca->master_) ;
 	    }
 
 	    check_observed_resources (ca, out) ;
-	    //printf("ici fin\n");
-	    //printf("%d   %d  \n",curtime , &curtime);
-	    if (ca->status_ == SL_RUNNING && renewTrenew (ca->trenew_, &curtime))
+	    if (ca->status_ == SL_RUNNING && renewTrenew (ca->trenew_, &ca->curtime_))
 	    {
 	    	
 			send_discover (ca, out) ;
 			ca->status_ = SL_RENEW ;
 	    }
 
-	    if (ca->status_ == SL_RENEW && nextTrenew (ca->trenew_, &curtime))
+	    if (ca->status_ == SL_RENEW && nextTrenew (ca->trenew_, &ca->curtime_))
 	    {
 	    	
 			send_discover (ca, out) ;
 	    }
 
-	    if (ca->status_ == SL_RENEW && expiredTrenew (ca->trenew_, &curtime))
+	    if (ca->status_ == SL_RENEW && expiredTrenew (ca->trenew_, &ca->curtime_))
 	    {
 			reset_master (ca) ;	// master_ is no longer known
 			send_discover (ca, out) ;
-			ca->twait_ = initTwait ( &curtime) ;	// reset timer
+			resetTwait (ca->twait_, &ca->curtime_) ;	// reset timer
 			ca->status_ = SL_WAITING_UNKNOWN ;
 	    }
 
 	    break ;
 
 	default :
-	    printf ("Error : casan status not known : ") ;
-	    printf ("%d\n",ca->status_) ;
+	    CLOG_ERR ("Error : casan status not known : %d\n", ca->status_) ;
 	    break ;
     }
 
     if (oldstatus != ca->status_)
     {
+		TRACE (TR_STATUS, ca->status_, oldstatus, 0) ;
+#if CASAN_LOG_LEVEL >= CLOG_LEVEL_INFO
 		printf ("Status: %s ", C_GREEN) ;
 		print_status(oldstatus);
 		printf ("%s -> %s", C_RESET, C_GREEN) ;
 		print_status (ca->status_) ;
 		printf("%s\n", C_RESET) ;
-		printf("\n");
+#endif
+    }
+
+    // messages sent during this loop share frames if possible
+    flush_send (ca->l2_) ;
+
+    // switch the receiver off if nothing is expected
+    {
+		time_t t ;
+
+		setRadio (ca->l2_, dcycle_update (&ca->dcycle_, &ca->curtime_,
+				ca->status_ != SL_RUNNING
+				|| nextRetrans (ca->retrans_, &t))) ;
     }
 
     if (srcaddr != NULL)
-		freel2addr_154(srcaddr) ;
+		freel2addr(srcaddr) ;
+
+    freeMsg (in) ;
+    freeMsg (out) ;
+}
+
+
+
+/******************************************************************************
+Duty cycling
+******************************************************************************/
+
+/**
+ * @brief Enable or disable the sleepy slave mode
+ *
+ * In sleepy mode, the receiver is switched off between listen
+ * windows synchronized with the master Hello messages (see
+ * dcycle.h).
+ *
+ * @param ca engine
+ * @param on true for sleepy mode
+ * @param maxlatency worst-case latency of a request from the master (ms)
+ * @param window length of listen windows (ms), 0 for the default
+ */
 
+void set_sleepy (Casan *ca, bool on, uint32_t maxlatency, uint32_t window)
+{
+    setDcycle (&ca->dcycle_, on, maxlatency, window) ;
+}
+
+
+/**
+ * @brief Next time the `loop` function must be called
+ *
+ * This is the next engine deadline: next Discover message, end of
+ * the waiting_known state, association renewal or expiration,
+ * retransmission, or (in sleepy mode) next receiver switch. The
+ * application may suspend the processor until this time, or until
+ * a frame is received if the receiver is on. A simulation may
+ * directly advance its clock to this time.
+ *
+ * @return next deadline (current time if `loop` must be called now)
+ */
+
+time_t next_wakeup (Casan *ca)
+{
+    time_t next, t ;
+
+    sync_time (&ca->curtime_) ;
+    switch (ca->status_)
+    {
+	case SL_COLDSTART :
+	    return ca->curtime_ ;
+	case SL_WAITING_UNKNOWN :
+	    next = ca->twait_->next_ ;
+	    break ;
+	case SL_WAITING_KNOWN :
+	    next = ca->twait_->next_ ;
+	    if (ca->twait_->limit_ < next)
+		next = ca->twait_->limit_ ;
+	    break ;
+	case SL_RUNNING :
+	    next = ca->trenew_->next_ ;
+	    break ;
+	case SL_RENEW :
+	    next = ca->trenew_->next_ ;
+	    if (ca->trenew_->limit_ < next)
+		next = ca->trenew_->limit_ ;
+	    break ;
+	default :
+	    next = ca->curtime_ ;
+	    break ;
+    }
+
+    t = dcycle_next (&ca->dcycle_, &ca->curtime_) ;
+    if (t < next)
+	next = t ;
+    // loopRetrans sends messages strictly after their time
+    if (nextRetrans (ca->retrans_, &t) && t + 1 < next)
+	next = t + 1 ;
+    return next < ca->curtime_ ? ca->curtime_ : next ;
 }
 
 
@@ -780,6 +1094,8 @@ bool is_hello (Msg *m, long int *hlid)
 		    }
 		}
     }
+    if (found)
+		TRACE (TR_HELLO, 0, *hlid, 0) ;
 
     return found ;
 }
@@ -788,14 +1104,17 @@ bool is_hello (Msg *m, long int *hlid)
 
 /**
  * Check if the control message is an Assoc message from the master
- * and returns the contained slave-ttl
+ * and returns the contained slave-ttl, mtu and aggregation flag
+ * (false if not present)
  */
 
-bool is_assoc (Msg *m, time_t *sttl, int *mtu)
+bool is_assoc (Msg *m, time_t *sttl, int *mtu, bool *agg)
 {
     bool found_ttl = false ;
     bool found_mtu = false ;
 
+    *agg = false ;
+
     if (get_type (m) == COAP_TYPE_CON && get_code (m) == COAP_CODE_POST)
     {
 		reset_next_option (m) ;
@@ -809,24 +1128,31 @@ bool is_assoc (Msg *m, time_t *sttl, int *mtu)
 				// we benefit from the added nul byte at the end of val
 				if (sscanf ((const char *) getOptval (o, (int *) 0), CASAN_ASSOC_TTL, &n) == 1)
 				{
-				    printf ("%s%d\n",BLUE ("TTL recv: "), n) ;
+				    CLOG_DBG ("%s%ld\n", BLUE ("TTL recv: "), n) ;
 				    *sttl = ((time_t) n) * 50 ;
 				    found_ttl = true ;
 				    // continue, just in case there are other query strings
 				}
 				else if (sscanf ((const char *) getOptval (o, (int *) 0), CASAN_ASSOC_MTU, &n) == 1)
 				{
-				    printf ("%s%d\n",BLUE ("MTU recv: "), n) ;
+				    CLOG_DBG ("%s%ld\n", BLUE ("MTU recv: "), n) ;
 				    *mtu = n ;
 				    found_mtu = true ;
 				    // continue, just in case there are other query strings
 				}
+				else if (sscanf ((const char *) getOptval (o, (int *) 0), CASAN_ASSOC_AGG, &n) == 1)
+				{
+				    *agg = n != 0 ;
+				}
 				else break ;
 		    }
 		}
     }
 
-    return found_ttl && found_mtu ;
+    if (! (found_ttl && found_mtu))
+		return false ;
+    TRACE (TR_ASSOC, *mtu, *sttl, *agg) ;
+    return true ;
 }
 
 
@@ -848,7 +1174,11 @@ void mk_ctl_msg (Msg *out)
     {
 		option *path = initOptionOpaque(MO_Uri_Path, (void *) casan_namespace [i].path,
 						casan_namespace [i].len) ;
-		push_option (out, path) ;
+		if (path != NULL)
+		{
+		    push_option (out, path) ;
+		    freeOption (path) ;
+		}
     }
 }
 
@@ -861,10 +1191,11 @@ void mk_ctl_msg (Msg *out)
 void send_discover (Casan *ca, Msg *out)
 {
     char tmpstr [CASAN_BUF_LEN] ;
-    l2addr_154 *dest ;
+    l2addr *dest ;
+
+    TRACE (TR_DISCOVER, ca->defmtu_, ca->slaveid_, 0) ;
+    CLOG_INFO ("Sending Discover\n") ;
 
-    printf ("Sending Discover\n") ;
-    
     resetMsg (out) ;
     set_id (out, ca->curid_++) ;
     set_type (out, COAP_TYPE_NON) ;
@@ -873,12 +1204,23 @@ void send_discover (Casan *ca, Msg *out)
 
     snprintf (tmpstr, sizeof tmpstr, CASAN_DISCOVER_SLAVEID, ca->slaveid_) ;
     option *o1 = initOptionOpaque(MO_Uri_Query, tmpstr, strlen (tmpstr)) ;
-    push_option (out, o1) ;
+    if (o1 != NULL)
+		push_option (out, o1) ;
 
 
     snprintf (tmpstr, sizeof tmpstr, CASAN_DISCOVER_MTU, (long int) ca->defmtu_) ;
     option *o2 = initOptionOpaque(MO_Uri_Query, tmpstr, strlen (tmpstr)) ;
-    push_option (out, o2) ;
+    if (o2 != NULL)
+		push_option (out, o2) ;
+
+    option *o3 = NULL ;
+    if (canAggregate (ca->l2_))
+    {
+		snprintf (tmpstr, sizeof tmpstr, CASAN_DISCOVER_AGG, 1L) ;
+		o3 = initOptionOpaque(MO_Uri_Query, tmpstr, strlen (tmpstr)) ;
+		if (o3 != NULL)
+		    push_option (out, o3) ;
+    }
 
     dest = (ca->master_ != NULL) ? ca->master_ : bcastaddr () ;
     //printMsg(out);
@@ -886,6 +1228,7 @@ void send_discover (Casan *ca, Msg *out)
 
     freeOption(o1);
     freeOption(o2);
+    freeOption(o3);
 
 }
 
@@ -897,9 +1240,11 @@ void send_discover (Casan *ca, Msg *out)
 
 void send_assoc_answer (Casan *ca, Msg *in, Msg *out)
 {
-    l2addr_154 *dest ;
+    l2addr *dest ;
 
     dest = get_src (ca->l2_) ;
+    if (dest == NULL)
+		return ;
 
     // send back an acknowledgement message
     set_type (out, COAP_TYPE_ACK) ;
@@ -911,9 +1256,9 @@ void send_assoc_answer (Casan *ca, Msg *in, Msg *out)
 
     // send the packet
     if (! sendMsg (out, dest))
-		printf ("%s", RED ("Cannot send the assoc answer message")) ;
+		CLOG_WARN ("%s\n", RED ("Cannot send the assoc answer message")) ;
 
-    freel2addr_154(dest) ;
+    freel2addr(dest) ;
 }
 
 
@@ -8,6 +8,7 @@
 
 #include "resource.h"		// => msg.h => l2.h + option.h
 #include "retrans.h"		// => time.h
+#include "dcycle.h"
 
 
 
@@ -75,20 +76,38 @@
 	} reslist;
 
 
+	/*
+	 * Deduplication cache: the encoded answer to a CON request is
+	 * kept (as a shared packet buffer) in order to be sent again if
+	 * the same request is received again (i.e. our ACK was lost).
+	 */
+
+	typedef struct dedup
+	{
+	    l2addr src ;		// requester address
+	    uint16_t id ;		// request message id
+	    Pktbuf *resp ;		// encoded answer, or NULL if free
+	    time_t expire ;		// entry expiration time
+	} dedup;
+
+
 	typedef struct casan {
 		reslist *reslist_ ;
 
 		time_t curtime_ ;
 		Retrans *retrans_ ;
-		l2addr_154 *master_ ;		// NULL <=> broadcast
-		l2net_154 *l2_ ;
+		l2addr *master_ ;		// NULL <=> broadcast
+		l2net *l2_ ;
 		int defmtu_ ;			// default (user specified) MTU
 		int curmtu_ ;			// current (negociated) MTU
+		bool agg_ ;			// frame aggregation (negociated)
 		long int slaveid_ ;		// slave id, manually config'd
 		slave_status status_ ;
 		time_t sttl_ ;			// slave ttl, given in assoc msg
 		long int hlid_ ;		// hello ID
 		int curid_ ;			// current message id
+		dedup dedup_ [DEDUP_SIZE] ;	// answers to recent requests
+		Dcycle dcycle_ ;		// radio duty cycling
 
 		// various timers handled by function
 		Twait  *twait_ ;
@@ -96,7 +115,9 @@
 	}Casan;
 
 
-	Casan *initCasan (l2net_154 *l2, int mtu, long int slaveid);
+	Casan *initCasan (l2net *l2, int mtu, long int slaveid);
+
+	void freeCasan (Casan *ca);
 
 	void resetCasan (Casan *ca);
 
@@ -104,9 +125,11 @@
 
 	void negociate_mtu (Casan *ca, int mtu);
 
+	void negociate_agg (Casan *ca, bool agg);
+
 	void reset_master (Casan *ca);
 
-	bool same_master (Casan *ca, l2addr_154 *a);
+	bool same_master (Casan *ca, l2addr *a);
 
 	void change_master (Casan *ca, long int hlid, int mtu);
 
@@ -114,6 +137,12 @@
 
 	void process_request (Casan *ca, Msg *in, Msg *out);
 
+	Pktbuf *get_dedup (Casan *ca, l2addr *src, uint16_t id);
+
+	void add_dedup (Casan *ca, l2addr *src, uint16_t id, Pktbuf *resp);
+
+	void reset_dedup (Casan *ca);
+
 	void request_resource (Msg *pin, Msg *pout, Resource *res);
 
 	void check_observed_resources (Casan *ca, Msg *out);
@@ -124,11 +153,15 @@
 
 	void loop (Casan *ca);
 
+	void set_sleepy (Casan *ca, bool on, uint32_t maxlatency, uint32_t window);
+
+	time_t next_wakeup (Casan *ca);
+
 	bool is_ctl_msg (Msg *m);
 
 	bool is_hello (Msg *m, long int *hlid);
 
-	bool is_assoc (Msg *m, time_t *sttl, int *mtu);
+	bool is_assoc (Msg *m, time_t *sttl, int *mtu, bool *agg);
 
 	void mk_ctl_msg (Msg *out);
 
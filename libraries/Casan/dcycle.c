@@ -0,0 +1,196 @@
+/**
+ * @file dcycle.c
+ * @brief radio duty cycling implementation
+ */
+
+#include "dcycle.h"
+
+#define	MAX_TIME(a,b)	((a) > (b) ? (a) : (b))
+
+
+void resetDcycle (Dcycle *d)
+{
+    bool on = d->on_ ;
+    uint32_t maxlatency = d->maxlatency_ ;
+    uint32_t window = d->window_ ;
+
+    memset (d, 0, sizeof *d) ;
+    d->on_ = on ;
+    d->maxlatency_ = maxlatency ;
+    d->window_ = window ;
+}
+
+
+/**
+ * @brief Configure duty cycling
+ *
+ * @param d duty cycle state
+ * @param on true to switch the receiver off between windows
+ * @param maxlatency worst-case latency of a request (ms)
+ * @param window length of listen windows (ms), 0 for DCYCLE_WINDOW
+ */
+
+void setDcycle (Dcycle *d, bool on, uint32_t maxlatency, uint32_t window)
+{
+    d->on_ = on ;
+    d->maxlatency_ = maxlatency ;
+    d->window_ = window > 0 ? window : DCYCLE_WINDOW ;
+    d->nextwin_ = 0 ;
+}
+
+
+// current margin around an expected Hello: widened after each miss
+static uint32_t guard (Dcycle *d)
+{
+    return DCYCLE_GUARD * (1 + d->nmiss_) + d->hlperiod_ / 100 ;
+}
+
+
+/**
+ * @brief A Hello has been received from the master
+ *
+ * The Hello period is estimated with an exponential average. An
+ * interval covering missed Hellos is divided by the number of
+ * periods it contains. The receiver stays on for a window after
+ * the Hello.
+ */
+
+void dcycle_hello (Dcycle *d, time_t *cur)
+{
+    uint32_t interval, n ;
+
+    if (d->lasthello_ != 0 && *cur > d->lasthello_)
+    {
+	interval = (uint32_t) (*cur - d->lasthello_) ;
+	if (d->hlperiod_ == 0)
+	    d->hlperiod_ = interval ;
+	else
+	{
+	    n = (interval + d->hlperiod_ / 2) / d->hlperiod_ ;
+	    if (n >= 1)
+		d->hlperiod_ = (3 * d->hlperiod_ + interval / n) / 4 ;
+	}
+    }
+    d->lasthello_ = *cur ;
+    d->nexthello_ = *cur + d->hlperiod_ ;
+    d->nmiss_ = 0 ;
+    d->nhello_++ ;
+    if (d->inhello_)
+	d->awake_ = *cur ;		// Hello window is over
+    d->inhello_ = false ;
+    d->awake_ = MAX_TIME (d->awake_, *cur + d->window_) ;
+    d->nextwin_ = *cur + d->maxlatency_ ;
+}
+
+
+/**
+ * @brief A message has been received: stay on for a while, since
+ * other messages (retransmissions, next requests) may follow.
+ */
+
+void dcycle_activity (Dcycle *d, time_t *cur)
+{
+    d->awake_ = MAX_TIME (d->awake_, *cur + DCYCLE_LINGER) ;
+}
+
+
+/**
+ * @brief Decide if the receiver must be on
+ *
+ * Must be called on each loop. The result must be given to the L2
+ * network.
+ *
+ * @param d duty cycle state
+ * @param cur current time
+ * @param busy true if the engine needs the receiver (not associated,
+ *	or waiting for an ACK)
+ * @return true if the receiver is on
+ */
+
+bool dcycle_update (Dcycle *d, time_t *cur, bool busy)
+{
+    bool on ;
+
+    if (! d->on_ || busy)
+    {
+	d->nextwin_ = *cur + d->maxlatency_ ;
+	d->radio_ = true ;
+	return true ;
+    }
+
+    if (d->hlperiod_ > 0)
+    {
+	if (! d->inhello_ && *cur + guard (d) >= d->nexthello_)
+	{
+	    d->inhello_ = true ;
+	    d->awake_ = MAX_TIME (d->awake_, d->nexthello_ + guard (d)) ;
+	    d->nextwin_ = *cur + d->maxlatency_ ;
+	    d->nwin_++ ;
+	}
+	else if (d->inhello_ && *cur >= d->awake_)
+	{
+	    // window is over without any Hello
+	    d->inhello_ = false ;
+	    d->nmissed_++ ;
+	    d->nexthello_ += d->hlperiod_ ;
+	    if (++d->nmiss_ > DCYCLE_MAXMISS)
+	    {
+		d->hlperiod_ = 0 ;		// resynchronize
+		d->lasthello_ = 0 ;
+		d->nmiss_ = 0 ;
+	    }
+	}
+    }
+
+    if (*cur >= d->nextwin_)
+    {
+	d->awake_ = MAX_TIME (d->awake_, *cur + d->window_) ;
+	d->nextwin_ = *cur + d->maxlatency_ ;
+	d->nwin_++ ;
+    }
+
+    on = d->hlperiod_ == 0 || *cur < d->awake_ ;
+    d->radio_ = on ;
+    return on ;
+}
+
+
+/**
+ * @brief Next time `dcycle_update` must be called
+ *
+ * This is the next time the receiver must be switched on (if it is
+ * off) or off (if it is on). The application may suspend the
+ * processor until this time (or until the next engine deadline, or
+ * until a frame is received if the receiver is on).
+ *
+ * @return next time, or TIME_NEVER if not in sleepy mode
+ */
+
+time_t dcycle_next (Dcycle *d, time_t *cur)
+{
+    time_t next ;
+
+    if (! d->on_)
+	return TIME_NEVER ;
+    next = d->nextwin_ ;
+    if (d->awake_ > *cur && d->awake_ < next)
+	next = d->awake_ ;		// end of current window
+    if (d->hlperiod_ > 0 && ! d->inhello_
+		&& d->nexthello_ < next + guard (d))
+	next = d->nexthello_ > guard (d) ? d->nexthello_ - guard (d) : 0 ;
+    return next ;
+}
+
+
+void print_dcycle (Dcycle *d)
+{
+    printf ("dcycle: %s maxlatency=%lu window=%lu hello period=%lu\n",
+		d->on_ ? "on" : "off",
+		(unsigned long int) d->maxlatency_,
+		(unsigned long int) d->window_,
+		(unsigned long int) d->hlperiod_) ;
+    printf ("dcycle: windows=%lu hellos=%lu missed=%lu\n",
+		(unsigned long int) d->nwin_,
+		(unsigned long int) d->nhello_,
+		(unsigned long int) d->nmissed_) ;
+}
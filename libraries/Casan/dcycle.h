@@ -0,0 +1,75 @@
+/**
+ * @file dcycle.h
+ * @brief radio duty cycling for sleepy slaves
+ *
+ * By default, the receiver is always on. In sleepy mode, the
+ * receiver is switched off between listen windows:
+ * - a window is opened around each expected Hello from the master.
+ *   The Hello period is estimated from received Hellos. A Hello
+ *   which is not received in its window is counted as missed, and
+ *   the next windows are widened. After DCYCLE_MAXMISS consecutive
+ *   missed Hellos, the slave is no longer synchronized and listens
+ *   continuously until the next Hello.
+ * - the receiver stays on for `window` ms after each Hello, so that
+ *   the master can send its pending requests just after a Hello
+ * - a window of `window` ms is opened at least every `maxlatency` ms,
+ *   which is the worst-case latency of a request from the master
+ *   (provided the master retransmits its request at least every
+ *   `window` ms, or waits for the next Hello)
+ * - the receiver stays on for a while after each received message,
+ *   and while a sent CON message waits for its ACK (i.e. until the
+ *   retransmission queue is empty)
+ * - the receiver stays on while the slave is not associated
+ *
+ * `dcycle_update` returns the receiver state, which is given to the
+ * L2 network with `setRadio`. Frames can be sent while the receiver
+ * is off.
+ *
+ * All times are expressed in milliseconds.
+ */
+
+#ifndef __DCYCLE_H__
+#define __DCYCLE_H__
+
+#include "time.h"
+
+#ifndef DCYCLE_WINDOW
+#define	DCYCLE_WINDOW		50	// default listen window
+#endif
+#ifndef DCYCLE_GUARD
+#define	DCYCLE_GUARD		20	// margin around an expected Hello
+#endif
+#ifndef DCYCLE_LINGER
+#define	DCYCLE_LINGER		50	// stay on after a received message
+#endif
+#define	DCYCLE_MAXMISS		3	// missed Hellos before resync
+
+typedef struct dcycle {
+	bool on_ ;			// sleepy mode
+	uint32_t maxlatency_ ;		// max time between two windows
+	uint32_t window_ ;		// listen window length
+	uint32_t hlperiod_ ;		// estimated Hello period (0: unknown)
+	time_t lasthello_ ;		// time of last Hello (0: none)
+	time_t nexthello_ ;		// next expected Hello
+	time_t nextwin_ ;		// next periodic window
+	time_t awake_ ;			// receiver on until this time
+	bool inhello_ ;			// current window waits for a Hello
+	uint8_t nmiss_ ;		// consecutive missed Hellos
+	bool radio_ ;			// receiver state (last update)
+	/* statistics */
+	uint32_t nwin_ ;		// windows opened
+	uint32_t nhello_ ;		// Hellos received
+	uint32_t nmissed_ ;		// Hello windows without Hello
+} Dcycle;
+
+void resetDcycle (Dcycle *d) ;
+void setDcycle (Dcycle *d, bool on, uint32_t maxlatency, uint32_t window) ;
+
+void dcycle_hello (Dcycle *d, time_t *cur) ;
+void dcycle_activity (Dcycle *d, time_t *cur) ;
+bool dcycle_update (Dcycle *d, time_t *cur, bool busy) ;
+time_t dcycle_next (Dcycle *d, time_t *cur) ;
+
+void print_dcycle (Dcycle *d) ;
+
+#endif
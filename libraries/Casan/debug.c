@@ -5,8 +5,6 @@
 
 #include "debug.h"
 
-int freeMemory () ;
-
 /**
  * @brief Initializes the debug facility
  *
@@ -18,8 +16,13 @@ int freeMemory () ;
 
 Debug *startDebug (int interval)	// in seconds
 {
-	Debug *de = (Debug *) malloc(sizeof(Debug));
-    printf ("%s",B_BLUE ("start") ) ;
+	Debug *de = (Debug *) CASAN_MALLOC (ALLOC_CASAN, sizeof(Debug));
+    if (de == NULL)
+    {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return NULL ;
+    }
+    printf ("%s\n", BLUE ("start")) ;
     de->interv_ = interval * 1000 ;		// in milliseconds
     de->next_ = clock_time() ;			// perform action immediately
     return de;
@@ -31,27 +34,29 @@ Debug *startDebug (int interval)	// in seconds
  *
  * This method is designed to be called in the application `loop`
  * function. When the heartbeat interval has been reached, it
- * displays a message including the amount of free memory
- * in order to detect memory leaks, and returns `true` so that
- * the application `loop` can perform additional (periodic) tasks.
+ * displays the memory in use (see pool.h: pool usage with static
+ * pools, or bytes allocated by each subsystem when allocations are
+ * tracked) in order to detect memory leaks, and returns `true` so
+ * that the application `loop` can perform additional (periodic)
+ * tasks.
  *
  * @return true if the heartbeat interval has been reached
  */
 
-bool heartbeatDebug (Debuf *de)
+bool heartbeatDebug (Debug *de)
 {
     bool action = false ;
 
     if (clock_time() > de->next_)
     {
 		printf ("-------------------------------------------------------------------") ;
-		printf ("%s free mem = ",B_BLUE ("loop ")) ;
-		DBG1 (freeMemory ()) ;
-		printf("\n");
+		printf ("%s mem = %ld\n", BLUE ("loop"), alloc_bytes ()) ;
+		print_pools () ;
+		print_allocs () ;
 
 		de->next_ += de->interv_ ;
 		action = true ;
     }
 
     return action ;
-}
\ No newline at end of file
+}
@@ -7,6 +7,7 @@
 #define __DEBUG_H__
 
 #include "defs.h"
+#include "pool.h"
 
 /**
  * @brief Debug facility
@@ -14,7 +15,7 @@
  * This class give some handy methods to ease debugging.
  *
  * At this moment, the only facility is to display, at fixed intervals,
- * a heartbeat type message containing the amount of free memory. This
+ * a heartbeat type message containing the amount of memory in use. This
  * allows to monitor the application, provided that the method be called
  * in the `loop` function of the application.
  */
@@ -27,6 +28,6 @@ typedef struct debug {
 
 
 Debug *startDebug (int interval) ;	// interval between actions, in seconds
-bool heartbeat (void) ;		// true if action done
+bool heartbeatDebug (Debug *de) ;	// true if action done
 
 #endif
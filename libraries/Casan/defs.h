@@ -50,7 +50,25 @@
 #define	ACK_RANDOM_FACTOR	1.5
  // CoAP maximum number of retransmissions
 #define MAX_RETRANSMIT	4
+// CoAP exchange lifetime (milliseconds), for duplicate detection
+#define	EXCHANGE_LIFETIME	247000
 
-#define ALEA(x) x
+// Number of answers kept to handle duplicated CON requests
+#define	DEDUP_SIZE	4
+
+// One observe notification in NOTIFY_CON is confirmable, to check
+// that the master is still there (RFC 7641, section 4.5)
+#ifndef NOTIFY_CON
+#define	NOTIFY_CON	8
+#endif
+
+// Largest datagram (bytes), sent in fragments over 802.15.4 (see
+// L2-154/frag.h). Only the reassembly buffers and a few dedicated
+// buffers (see pool.h) have this size. 0 removes fragmentation.
+#ifndef I154_DGRAM_MAX
+#define	I154_DGRAM_MAX	320
+#endif
+
+#include "trace.h"		// log levels and event trace
 
 #endif
\ No newline at end of file
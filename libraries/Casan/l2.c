@@ -0,0 +1,315 @@
+/**
+ * @file l2.c
+ * @brief l2addr methods and l2net generic methods
+ *
+ * Generic methods only call the method of the specialization,
+ * if it exists.
+ */
+
+#include "l2.h"
+#include "pool.h"
+
+static l2addr l2addr_broadcast = { L2ADDR_BROADCAST } ;
+
+
+/******************************************************************************
+ * l2addr methods
+ */
+
+void freel2addr (l2addr *addr)
+{
+    CASAN_FREE (pool_l2addr, addr) ;
+}
+
+
+l2addr *init_l2addr_char (const char *a)
+{
+    l2addr *addr ;
+    int i = 0 ;
+    uint8_t b = 0 ;
+    uint8_t buf [L2ADDR_LEN] ;
+
+    addr = (l2addr *) CASAN_ALLOC (pool_l2addr, sizeof (struct l2addr)) ;
+    if (addr == NULL)
+    {
+	CLOG_ERR ("Memory allocation failed\n") ;
+	return NULL ;
+    }
+
+    /*
+     * General loop, when 8-byte addresses will be supported
+     */
+
+    while (*a != '\0' && i < L2ADDR_LEN)
+    {
+	if (*a == ':')
+	{
+	    buf [i++] = b ;
+	    b = 0 ;
+	}
+	else if (isxdigit (*a))
+	{
+	    uint8_t x ;
+	    char c ;
+
+	    c = tolower (*a) ;
+	    x = isdigit (c) ? (c - '0') : (c - 'a' + 10) ;
+	    b = (b << 4) + x ;
+	}
+	else
+	{
+	    for (i = 0 ; i < L2ADDR_LEN ; i++)
+		buf [i] = 0 ;
+	    break ;
+	}
+	a++ ;
+    }
+    if (i < L2ADDR_LEN)
+	buf [i] = b ;
+
+    addr->addr_ = (buf [1] << 8) | buf [0] ;
+    return addr ;
+}
+
+
+l2addr *init_l2addr_addr (const l2addr *x)
+{
+    l2addr *addr ;
+
+    addr = (l2addr *) CASAN_ALLOC (pool_l2addr, sizeof (struct l2addr)) ;
+    if (addr == NULL)
+	CLOG_ERR ("Memory allocation failed\n") ;
+    else
+	addr->addr_ = x->addr_ ;
+    return addr ;
+}
+
+
+void copyAddr (l2addr *x, const l2addr *y)
+{
+    x->addr_ = y->addr_ ;
+}
+
+
+bool isEqualAddr (const l2addr *x, const l2addr *y)
+{
+    return x->addr_ == y->addr_ ;
+}
+
+
+void printAddr (const l2addr *x)
+{
+    printf ("%x", BYTE_LOW (x->addr_)) ;
+    printf (" : ") ;
+    printf ("%x", BYTE_HIGH (x->addr_)) ;
+}
+
+
+/**
+ * @brief Returns the broadcast address
+ *
+ * @return address of an existing l2addr object (do not free it)
+ */
+
+l2addr *bcastaddr (void)
+{
+    return &l2addr_broadcast ;
+}
+
+
+/******************************************************************************
+ * l2net methods
+ */
+
+size_t maxpayload (l2net *l2)
+{
+    return l2->ops_->maxpayload (l2) ;
+}
+
+
+/**
+ * @brief Set the current MTU
+ *
+ * The MTU is limited to the maximum MTU of the specialization.
+ */
+
+void setMTU (l2net *l2, size_t mtu)
+{
+    if (mtu > l2->maxmtu_)
+	mtu = l2->maxmtu_ ;
+    l2->mtu_ = mtu ;
+}
+
+
+size_t getMTU (l2net *l2)
+{
+    return l2->mtu_ ;
+}
+
+
+/**
+ * @brief Send a message
+ *
+ * @return true if the message has been queued
+ */
+
+bool send (l2net *l2, l2addr *dest, const uint8_t *data, size_t len)
+{
+    return l2->ops_->send (l2, dest, data, len) ;
+}
+
+
+/**
+ * @brief Is aggregation of small messages supported by this network?
+ */
+
+bool canAggregate (l2net *l2)
+{
+    return l2->ops_->setagg != NULL ;
+}
+
+
+/**
+ * @brief Turn aggregation of sent messages on or off
+ *
+ * This method does nothing if aggregation is not supported.
+ */
+
+void setAggregation (l2net *l2, bool on)
+{
+    if (l2->ops_->setagg != NULL)
+    {
+	l2->ops_->setagg (l2, on) ;
+	l2->agg_ = on ;
+    }
+}
+
+
+bool getAggregation (l2net *l2)
+{
+    return l2->agg_ ;
+}
+
+
+/**
+ * @brief Send all messages kept for aggregation
+ *
+ * @return false if a frame could not be queued
+ */
+
+bool flush_send (l2net *l2)
+{
+    return l2->ops_->flush != NULL ? l2->ops_->flush (l2) : true ;
+}
+
+
+/**
+ * @brief Switch the receiver on or off (see dcycle.h)
+ */
+
+void setRadio (l2net *l2, bool on)
+{
+    if (l2->ops_->radio != NULL)
+	l2->ops_->radio (l2, on) ;
+}
+
+
+/**
+ * @brief Receive a message
+ *
+ * The received message is kept by the specialization until the
+ * next call.
+ *
+ * See the `l2_recv_t` enumeration for return values.
+ */
+
+l2_recv_t recv (l2net *l2)
+{
+    return l2->ops_->recv (l2) ;
+}
+
+
+/**
+ * @brief Returns the source address of the received message
+ *
+ * @return address of a new l2addr object (to delete after use)
+ */
+
+l2addr *get_src (l2net *l2)
+{
+    l2addr *a ;
+
+    a = (l2addr *) CASAN_ALLOC (pool_l2addr, sizeof (struct l2addr)) ;
+    if (a == NULL)
+	CLOG_ERR ("Memory allocation failed\n") ;
+    else
+	l2->ops_->src (l2, a) ;
+    return a ;
+}
+
+
+/**
+ * @brief Returns the destination address of the received message
+ *
+ * @return address of a new l2addr object (to delete after use)
+ */
+
+l2addr *get_dst (l2net *l2)
+{
+    l2addr *a ;
+
+    a = (l2addr *) CASAN_ALLOC (pool_l2addr, sizeof (struct l2addr)) ;
+    if (a == NULL)
+	CLOG_ERR ("Memory allocation failed\n") ;
+    else
+	l2->ops_->dst (l2, a) ;
+    return a ;
+}
+
+
+/**
+ * @brief Returns the address of the received payload
+ *
+ * @return address inside an existing buffer (do not free it)
+ */
+
+uint8_t *get_payload (l2net *l2, int offset)
+{
+    return l2->ops_->payload (l2) + offset ;
+}
+
+
+/**
+ * @brief Returns the payload length
+ *
+ * If the message has been truncated on reception, this is the
+ * length of the received part.
+ */
+
+size_t get_paylen (l2net *l2)
+{
+    return l2->ops_->paylen (l2) ;
+}
+
+
+/**
+ * @brief Returns the Link Quality Indicator of the received message
+ *
+ * @return LQI, or 0 if the network does not provide it
+ */
+
+uint8_t get_lqi (l2net *l2)
+{
+    return l2->ops_->lqi != NULL ? l2->ops_->lqi (l2) : 0 ;
+}
+
+
+/**
+ * @brief Dump some parts of the received message (debug)
+ */
+
+void dump_packet (l2net *l2, size_t start, size_t maxlen)
+{
+    if (l2->ops_->dump != NULL)
+	l2->ops_->dump (l2, start, maxlen) ;
+}
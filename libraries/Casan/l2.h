@@ -1,11 +1,31 @@
 /**
  * @file l2.h
  * @brief l2addr and l2net virtual class interfaces
+ *
+ * The CASAN engine does not depend on a particular network: it
+ * uses an `l2net` object, whose methods are given by a table of
+ * function pointers (`l2ops`) filled by each specialization
+ * (or backend):
+ * - IEEE 802.15.4 with the ConMsg library (see L2-154/l2-154.h)
+ * - UDP on localhost, for Linux hosts (see L2-UDP/l2-udp.h)
+ *
+ * Each specialization structure starts with an `l2net` structure,
+ * and its constructor returns the address of this structure.
+ *
+ * All backends use 16-bit node addresses (`l2addr`), the address
+ * 0xffff being the broadcast address.
  */
 
 #ifndef	L2_H
 #define	L2_H
 
+#include "defs.h"
+#include "contiki.h"
+#include "stdbool.h"
+#include <stddef.h>
+
+#define	L2ADDR_LEN		2		// Address length (bytes)
+#define	L2ADDR_BROADCAST	0xffff
 
  	typedef enum
 	{
@@ -16,5 +36,95 @@
 	    RECV_OK			///< Message received successfully
 	} l2_recv_t ;
 
+	typedef struct l2addr {
+		uint16_t addr_ ;
+	} l2addr ;
+
+	typedef struct l2net l2net ;
+
+	/**
+	 * Methods of a specialization. Optional methods may be NULL.
+	 */
+
+	typedef struct l2ops {
+		const char *name ;
+		// payload available with the current MTU
+		size_t (*maxpayload) (l2net *l2) ;
+		bool (*send) (l2net *l2, const l2addr *dest,
+					const uint8_t *data, size_t len) ;
+		// the following methods refer to the last received message
+		l2_recv_t (*recv) (l2net *l2) ;
+		void (*src) (l2net *l2, l2addr *a) ;
+		void (*dst) (l2net *l2, l2addr *a) ;
+		uint8_t *(*payload) (l2net *l2) ;
+		size_t (*paylen) (l2net *l2) ;
+		uint8_t (*lqi) (l2net *l2) ;			// optional
+		void (*dump) (l2net *l2, size_t start, size_t maxlen) ; // opt.
+		// aggregation of small messages (optional)
+		void (*setagg) (l2net *l2, bool on) ;
+		bool (*flush) (l2net *l2) ;
+		// switch the receiver on or off (optional)
+		void (*radio) (l2net *l2, bool on) ;
+	} l2ops ;
+
+	struct l2net {
+		const l2ops *ops_ ;
+		uint16_t myaddr_ ;
+
+		/** Current MTU value
+		 *
+		 * Specializations must initialize this value to the network
+		 * default MTU after object creation. It can be modified
+		 * afterwards by the calling program, for example to reflect
+		 * the result of an MTU negociation, up to `maxmtu_`.
+		 * Maximum payload length is derived from this value.
+		 */
+		size_t mtu_ ;
+		size_t maxmtu_ ;
+		bool agg_ ;		// aggregation is on
+	} ;
+
+	/*
+	 * Addresses
+	 */
+
+	l2addr *init_l2addr_char (const char *a) ;	// "xx:xx"
+	l2addr *init_l2addr_addr (const l2addr *x) ;
+	void freel2addr (l2addr *addr) ;
+	void copyAddr (l2addr *x, const l2addr *y) ;
+	bool isEqualAddr (const l2addr *a1, const l2addr *a2) ;
+	void printAddr (const l2addr *x) ;
+	l2addr *bcastaddr (void) ;	// return a static variable
+
+	/*
+	 * Network
+	 */
+
+	size_t maxpayload (l2net *l2) ;
+	void setMTU (l2net *l2, size_t mtu) ;
+	size_t getMTU (l2net *l2) ;
+
+	bool send (l2net *l2, l2addr *dest, const uint8_t *data, size_t len) ;
+
+	// aggregation of small messages
+	bool canAggregate (l2net *l2) ;
+	void setAggregation (l2net *l2, bool on) ;
+	bool getAggregation (l2net *l2) ;
+	bool flush_send (l2net *l2) ;	// send aggregated messages
+
+	void setRadio (l2net *l2, bool on) ;
+
+	l2_recv_t recv (l2net *l2) ;
+
+	l2addr *get_src (l2net *l2) ;	// get a new l2addr
+	l2addr *get_dst (l2net *l2) ;	// get a new l2addr
+
+	// Payload (not including MAC header, of course)
+	uint8_t *get_payload (l2net *l2, int offset) ;
+	size_t get_paylen (l2net *l2) ;	// if truncated pkt: truncated payload
+	uint8_t get_lqi (l2net *l2) ;	// link quality (0: unknown)
+
+	// debug usage
+	void dump_packet (l2net *l2, size_t start, size_t maxlen) ;
 
-#endif
\ No newline at end of file
+#endif
@@ -26,11 +26,13 @@
 Constructor, destructor, operators
 ******************************************************************************/
 
-/* free Msg */
+/* free Msg, including its options and token */
 void freeMsg(Msg *m){
-	free(m->payload_);
-	free(m->encoded_);
-	free(m);
+	if (m != NULL) {
+		resetMsg (m);
+		freeToken (m->token_);
+		CASAN_FREE (pool_msg, m);
+	}
 }
 
 
@@ -42,11 +44,18 @@ void freeMsg(Msg *m){
  * @param l2 pointer to the l2 network associated to this message
  */
 
-Msg *initMsg(l2net_154 *l2) {
-	Msg *m = (Msg *)malloc (sizeof( Msg));
-	if (m == NULL)
-		printf("Memory allocation failed\n");
+Msg *initMsg(l2net *l2) {
+	Msg *m = (Msg *) CASAN_ALLOC (pool_msg, sizeof( Msg));
+	if (m == NULL) {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return NULL;
+	}
 
+	m->token_= initToken();
+	if (m->token_ == NULL) {
+		CASAN_FREE (pool_msg, m);
+		return NULL;
+	}
 	m->l2_ = l2;
 	m->paylen_ = 0;
 	m->type_ = 0;
@@ -55,7 +64,7 @@ Msg *initMsg(l2net_154 *l2) {
 	m->payload_ = NULL;
 	m->optlist_ = NULL;
 	m->encoded_ = NULL;
-	m->token_= initToken();
+	m->curopt_initialized_ = false;
 	return m;
 }
 
@@ -68,9 +77,9 @@ Msg *initMsg(l2net_154 *l2) {
 
 Msg *initMsgMsg (const Msg *m2) 
 {
-	Msg *m = (Msg *)malloc (sizeof(struct msg));
+	Msg *m = initMsg (m2->l2_) ;
 	if (m == NULL)
-		printf("Memory allocation failed\n");
+		return NULL;
     msgcopy (m, m2) ;
     return m;
 }
@@ -89,13 +98,14 @@ void initMsgDes (Msg *m)
  * Reset function: free memory, etc.
  */
 void resetMsg(Msg *m) {
-	l2net_154 *l2;
+	l2net *l2;
 
 	l2 = m->l2_;
-	if(m->payload_ != NULL)
-		free (m->payload_);
-	if (m->encoded_ != NULL)
-		free (m->encoded_);
+	CASAN_FREE (pool_buf, m->payload_);
+	m->payload_ = NULL;
+	m->paylen_ = 0;
+	releasePktbuf (m->encoded_);
+	m->encoded_ = NULL;
 	while (m->optlist_ != NULL)
 		freeOption(pop_option(m));
 	m->l2_ = l2;
@@ -129,7 +139,7 @@ uint8_t *get_payload_msg (Msg *m)	{ return m->payload_ ; }
 void set_type    (Msg *m, uint8_t t)	{ m->type_ = t ; }
 void set_code    (Msg *m, uint8_t c)	{ m->code_ = c ; }
 void set_id      (Msg *m, uint16_t id)	{ m->id_ = id ; }
-void set_token_msg   (Msg *m, token *tok)	{ m->token_ = tok ; }
+void set_token_msg   (Msg *m, token *tok)	{ *m->token_ = *tok ; }	// copy
 
 
 
@@ -168,7 +178,10 @@ l2_recv_t recvMsg (Msg *m) {
 		bool trunc = (r == RECV_TRUNCATED) ;
 		
 		if (! coap_decode (m, get_payload (m->l2_,0), get_paylen (m->l2_), trunc))
+		{
+			TRACE (TR_DECODE_ERR, get_paylen (m->l2_), 0, 0) ;
 	    	r = RECV_EMPTY ;
+		}
 	    // printMsg(m);
 	}
 	
@@ -177,6 +190,15 @@ l2_recv_t recvMsg (Msg *m) {
 
 
 
+/*
+ * Number of bytes following the option header byte for each value
+ * of a delta or length nibble, -1 for the reserved value 15
+ */
+
+static const int8_t extlen [16] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 2, -1
+} ;
+
 /**
  * @brief Decode a message according to CoAP specification.
  *
@@ -184,6 +206,11 @@ l2_recv_t recvMsg (Msg *m) {
  * If message has been truncated, decoding is done only for
  * CoAP header and token (and considered as a success).
  *
+ * The received buffer is never read past `len` bytes, whatever
+ * its content: all lengths are checked once, before the bytes they
+ * cover are read, such that the extraction code does not need any
+ * further test.
+ *
  * @param rbuf	L2 payload as received by the L2 network
  * @param len	Length of L2 payload
  * @param truncated true if the message has been truncated at reception
@@ -193,115 +220,118 @@ l2_recv_t recvMsg (Msg *m) {
 bool coap_decode (Msg *m, uint8_t rbuf [], size_t len, bool truncated)
 {
 	bool success ;
+	size_t i ;
+	int toklen ;
+	int opt_nb ;
 
 	resetMsg(m);
-	success = true;
 
-	if (COAP_VERSION (rbuf) != CASAN_VERSION)
-    {
-    	success = false;
-    } else {
-    	size_t i ;
-		int opt_nb ;
-
-		m->type_ = COAP_TYPE (rbuf) ;
-		m->token_->toklen_ = COAP_TOKLEN (rbuf) ;
-		m->code_ = COAP_CODE (rbuf) ;
-		m->id_ = COAP_ID (rbuf) ;
-		i = 4 ;
-
-		if (m->token_->toklen_ > 0) {
-			memcpy (m->token_->token_, rbuf + i, m->token_->toklen_) ;
-			i += m->token_->toklen_ ;
-		}
+	/* fixed header and token */
+	if (len < 4 || COAP_VERSION (rbuf) != CASAN_VERSION)
+		return false ;
+	toklen = COAP_TOKLEN (rbuf) ;
+	if (toklen > COAP_MAX_TOKLEN || 4 + (size_t) toklen > len)
+		return false ;
+
+	m->type_ = COAP_TYPE (rbuf) ;
+	m->token_->toklen_ = toklen ;
+	m->code_ = COAP_CODE (rbuf) ;
+	m->id_ = COAP_ID (rbuf) ;
+	i = 4 ;
+
+	if (toklen > 0) {
+		memcpy (m->token_->token_, rbuf + i, toklen) ;
+		i += toklen ;
+	}
 
-		/*
-		 * Options analysis
-		 */
+	if (truncated)
+		return true ;
 
-		opt_nb = 0 ;
-		
-		while (! truncated && success && i < len && rbuf [i] != 0xff)
-		{	//printf("%lu\n",rbuf [i]  );
-			int opt_delta = 0;
-			int opt_len = 0 ;
-			option *o = initOption();
-
-			opt_delta = (rbuf [i] >> 4) & 0x0f ;
-		    opt_len   = (rbuf [i]     ) & 0x0f ;
-		    i++ ;
-		    switch (opt_delta)
-		    {
-			case 13 :
-				opt_delta = rbuf [i] + 13 ;
-			    i += 1 ;
-			    break ;
-			case 14 :
-			    opt_delta = (rbuf [i] << 8) + rbuf [i+1] + 269 ;
-			    i += 2 ;
-			    break ;
-			case 15 :
-			    success = false ;			// recv failed
-			    break ;
-			}
-			opt_nb += opt_delta ;
+	/*
+	 * Options analysis
+	 */
 
-			switch (opt_len)
-		    {
-			case 13 :
-			    opt_len = rbuf [i] + 13 ;
-			    i += 1 ;
-			    break ;
-			case 14 :
-			    opt_len = (rbuf [i] << 8) + rbuf [i+1] + 269 ;
-			    i += 2 ;
-			    break ;
-			case 15 :
-			    success = false ;			// recv failed
-			    break ;
-		    }
+	success = true ;
+	opt_nb = 0 ;
 
-		    /* register option */
-		    if (success)
-		    {	
-				setOptcode (o,(optcode_t)opt_nb) ;
-				setOptvalOpaque (o, (void *)(rbuf + i), (int) opt_len) ;
-				push_option (m, o) ;
-				
-				i += opt_len ;
-		    }
-		    else
-		    {
-				success = false ;
-				printf  ("%s",RED ("Option unrecognized")) ;
-				printf (" opt_delta = %d", opt_delta) ;
-				printf (" opt_len = %d", opt_len) ;
-				printf ("\n");
-		    }
-		    
-		    
+	while (i < len && rbuf [i] != 0xff)
+	{
+		int opt_delta, opt_len ;
+		int dext, lext ;
+		option *o ;
+
+		opt_delta = (rbuf [i] >> 4) & 0x0f ;
+		opt_len   = (rbuf [i]     ) & 0x0f ;
+		dext = extlen [opt_delta] ;
+		lext = extlen [opt_len] ;
+		i++ ;
+
+		/* single check for both extended fields */
+		if (dext < 0 || lext < 0 || (size_t) (dext + lext) > len - i)
+		{
+			success = false ;
+			CLOG_WARN ("%s opt_delta = %d opt_len = %d\n",
+					RED ("Option unrecognized"), opt_delta, opt_len) ;
+			break ;
 		}
-		
 
-		m->paylen_ = len - i ;
-		
-		if (! truncated && success && m->paylen_ > 0) {
-			if (rbuf [i] != 0xff)
-		    {
-				success = false ;
-		    }
-		    else
-		    {
-				i++ ;
-				set_payload_msg (m, rbuf + i, m->paylen_) ;
+		if (dext == 1)
+			opt_delta = rbuf [i] + 13 ;
+		else if (dext == 2)
+			opt_delta = (rbuf [i] << 8) + rbuf [i+1] + 269 ;
+		i += dext ;
 
-		    }
-		} else m->paylen_ = 0 ;			// protect further operations
+		if (lext == 1)
+			opt_len = rbuf [i] + 13 ;
+		else if (lext == 2)
+			opt_len = (rbuf [i] << 8) + rbuf [i+1] + 269 ;
+		i += lext ;
 
-    }
+		/* option value must be in the buffer */
+		if ((size_t) opt_len > len - i)
+		{
+			success = false ;
+			break ;
+		}
 
-    return success;
+		opt_nb += opt_delta ;
+
+		/* register option */
+		o = initOption () ;
+		if (o == NULL)
+		{
+			success = false ;
+			break ;
+		}
+		setOptcode (o,(optcode_t)opt_nb) ;
+		setOptvalOpaque (o, (void *)(rbuf + i), opt_len) ;
+		if (! push_option (m, o))
+			success = false ;
+		freeOption (o) ;
+		if (! success)
+			break ;
 
+		i += opt_len ;
+	}
+
+	m->paylen_ = 0 ;			// protect further operations
+
+	/* i <= len here: payload (if any) starts with the 0xff marker */
+	if (success && i < len)
+	{
+		i++ ;				// 0xff is not in the payload
+		if (i == len)
+			success = false ;	// marker without payload
+		else
+		{
+			m->paylen_ = len - i ;
+			set_payload_msg (m, rbuf + i, m->paylen_) ;
+			if (m->payload_ == NULL)
+				success = false ;
+		}
+	}
+
+	return success;
 }
 
 
@@ -320,9 +350,12 @@ bool coap_decode (Msg *m, uint8_t rbuf [], size_t len, bool truncated)
  * send the result to the given L2 address on the given
  * L2 network.
  *
- * Memory is allocated for the encoded message. It will
- * be freed when the object will be destroyed (the encoded
- * message is kept since it may have to be retransmitted).
+ * A packet buffer is allocated for the encoded message. It will
+ * be released when the object will be destroyed. Since the encoded
+ * message may have to be retransmitted, other parts of the engine
+ * (retransmission queue, deduplication cache) may retain a
+ * reference to this buffer (see Pktbuf) instead of copying the
+ * message.
  * If the encoded message does not fit in this buffer, this
  * method reports an error (false value)
  *
@@ -335,25 +368,47 @@ bool coap_decode (Msg *m, uint8_t rbuf [], size_t len, bool truncated)
  * @return true if encoding was successfull
  */
 
-bool sendMsg (Msg *m, l2addr_154 *dest) 
+bool sendMsg (Msg *m, l2addr *dest) 
 {
 	int success ;
 	if (m->encoded_ == NULL)
     {
-    	m->enclen_ = maxpayload (m->l2_) ;// exploitable size
-		m->encoded_ = (uint8_t *) malloc (m->enclen_) ;
-		success = coap_encode (m, m->encoded_, &m->enclen_) ;
+		uint16_t len ;
+
+    	len = maxpayload (m->l2_) ;	// exploitable size
+		if (len > PKTBUF_MAXSIZE)
+			len = PKTBUF_MAXSIZE ;
+		// a large buffer only for a message sent in fragments
+		if (len > PKTBUF_SIZE && coap_size (m, false) <= PKTBUF_SIZE)
+			len = PKTBUF_SIZE ;
+		m->encoded_ = initPktbuf (len) ;
+		if (m->encoded_ == NULL)
+			success = false ;
+		else
+		{
+			success = coap_encode (m, m->encoded_->data_, &len) ;
+			m->encoded_->len_ = len ;
+		}
 		if (! success)
-	   		printf ("%s",RED ("Cannot encode the message\n")) ;
+		{
+			TRACE (TR_SEND_ERR, 1, m->id_, 0) ;
+	   		CLOG_WARN ("%s",RED ("Cannot encode the message\n")) ;
+		}
 	} else success = true ;			// if msg is already encoded
 
 	if (success)
     {	
-		success = send (m->l2_, dest, m->encoded_, m->enclen_) ;
-		if (! success)
-		    printf ("%s",RED ("Cannot L2-send the message\n")) ;	
+		success = send (m->l2_, dest, m->encoded_->data_, m->encoded_->len_) ;
+		if (success)
+		    TRACE (TR_SEND, m->encoded_->len_, m->id_,
+				(m->type_ << 8) | m->code_) ;
+		else
+		{
+		    TRACE (TR_SEND_ERR, 2, m->id_, 0) ;
+		    CLOG_WARN ("%s",RED ("Cannot L2-send the message\n")) ;
+		}
     } else {
-    	free (m->encoded_) ;
+    	releasePktbuf (m->encoded_) ;
 		m->encoded_ = NULL ;
     }
     return success;
@@ -400,8 +455,7 @@ bool coap_encode (Msg *m, uint8_t sbuf [], uint16_t *sbuflen)
 		sbuf [i++] = m->code_ ;
 		sbuf [i++] = BYTE_HIGH (m->id_) ;
 		sbuf [i++] = BYTE_LOW  (m->id_) ;
-		
-	printf("\n");
+
 		// token
 		if (m->token_->toklen_ > 0)
 		{
@@ -473,7 +527,7 @@ bool coap_encode (Msg *m, uint8_t sbuf [], uint16_t *sbuflen)
 	} 
 	else
     {
-		printf ("Message truncated on CoAP encoding") ;
+		CLOG_WARN ("Message truncated on CoAP encoding\n") ;
 		success = false ;
     }
 
@@ -563,12 +617,20 @@ size_t avail_space (Msg *m)
 
 void set_payload_msg (Msg *m, uint8_t *payload, uint16_t paylen) 
 {
-    m->paylen_ = paylen ;
-    if (m->payload_ != NULL)
-		free (m->payload_) ;
-    m->payload_ = (uint8_t *) malloc (m->paylen_) ;
-    
-    memcpy (m->payload_, payload, m->paylen_) ;
+    CASAN_FREE (pool_buf, m->payload_) ;
+    m->payload_ = NULL ;
+    m->paylen_ = 0 ;
+    if (paylen > 0)
+    {
+		m->payload_ = (uint8_t *) CASAN_ALLOC (pool_buf, paylen) ;
+		if (m->payload_ == NULL)
+		    CLOG_ERR ("%s", RED ("Cannot allocate payload\n")) ;
+		else
+		{
+		    m->paylen_ = paylen ;
+		    memcpy (m->payload_, payload, m->paylen_) ;
+		}
+    }
 
 }
 
@@ -593,7 +655,7 @@ option *pop_option (Msg *m)
 
 		r = m->optlist_->o;
 		next = m->optlist_->next;
-		free(m->optlist_);
+		CASAN_FREE (pool_optlist, m->optlist_);
 		m->optlist_ = next;
 	}
 	return r;
@@ -605,17 +667,26 @@ option *pop_option (Msg *m)
  *
  * The option list is kept sorted according to option values
  * in order to optimally encode CoAP options.
+ * The option is copied: the caller keeps ownership of `o`.
+ *
+ * @return false if memory for the copy cannot be allocated
  */
 
-void push_option (Msg *m, option *o) 
+bool push_option (Msg *m, option *o) 
 {
 
     optlist *newo, *prev, *cur ;
 
-    newo = (optlist *) malloc (sizeof (struct optlist));
-    if (newo == NULL)
-		printf("Memory allocation failed\n");
+    newo = (optlist *) CASAN_ALLOC (pool_optlist, sizeof (struct optlist));
+    if (newo == NULL) {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return false;
+    }
     newo->o = initOptionOption(o);
+    if (newo->o == NULL) {
+		CASAN_FREE (pool_optlist, newo);
+		return false;
+    }
 
     prev = NULL ;
     cur = m->optlist_ ;
@@ -630,7 +701,7 @@ void push_option (Msg *m, option *o)
 		m->optlist_ = newo ;
     else
 		prev->next = newo ;
-
+    return true ;
 }
 
 
@@ -705,38 +776,42 @@ option *search_option (Msg *m, optcode_t c)
 
 
 /*
- * Copy a whole message, including payload and option list
+ * Copy a whole message, including payload and option list.
+ * The destination must be an initialized message. The encoded
+ * message, if any, is not copied: the packet buffer is shared
+ * between both messages.
  */
 
 void msgcopy (Msg *m1, const Msg *m2) {
 	optlist *ol1, *ol2 ;
 
-	memcpy(m1, &m2, sizeof m2);
-
-	if (m1->payload_)
-		free(m1 -> payload_);
+	resetMsg (m1);
 
-	m1->payload_ = (uint8_t *) malloc (m1->paylen_) ;
-	if (m1->payload_ == NULL)
-		printf("Memory allocation failed\n");
-	memcpy (m1->payload_, m2->payload_, m1->paylen_);
+	m1->l2_ = m2->l2_;
+	m1->type_ = m2->type_;
+	m1->code_ = m2->code_;
+	m1->id_ = m2->id_;
+	*m1->token_ = *m2->token_;
+	m1->curopt_initialized_ = false;
 
-	m1->enclen_ = 0;
-	if (m1->encoded_ != NULL) 
-		free(m1->encoded_);
-	m1->encoded_ = NULL;
+	set_payload_msg (m1, m2->payload_, m2->paylen_);
 
-	m1->optlist_ = NULL;
-	m1->curopt_ = NULL;
-	m1->curopt_initialized_ = false;
+	m1->encoded_ = retainPktbuf (m2->encoded_);
 
+	// option list is already sorted: append options in the same order
 	ol1 = NULL;
 	for (ol2 = m2->optlist_; ol2 != NULL ; ol2 = ol2->next) {
 		optlist *newo;
-		newo = (optlist *) malloc (sizeof (struct optlist));
-		if (newo == NULL)
-			printf("Memory allocation failed\n");
+		newo = (optlist *) CASAN_ALLOC (pool_optlist, sizeof (struct optlist));
+		if (newo == NULL) {
+			CLOG_ERR ("Memory allocation failed\n") ;
+			break;
+		}
 		newo->o = initOptionOption(ol2->o);
+		if (newo->o == NULL) {
+			CASAN_FREE (pool_optlist, newo);
+			break;
+		}
 		newo->next = NULL;
 		if (ol1 == NULL)
 			m1->optlist_ = newo;
@@ -765,7 +840,7 @@ content_format get_content_format (Msg *m)
     cf = cf_none ;		// not found by default ;
     for (ol = m->optlist_ ; ol != NULL ; ol = ol->next)
     {
-		if (getOptCode (ol->o) == MO_Content_Format)
+		if (getOptcode (ol->o) == MO_Content_Format)
 		{
 		    cf = (content_format) getOptvalInteger (ol->o) ;
 		    break ;
@@ -808,8 +883,11 @@ void set_content_format (Msg *m, bool reset, content_format cf)
 		option *ocf ;
 
 		ocf = initOptionInteger (MO_Content_Format, cf_text_plain) ;
-		push_option (m, ocf) ;
-		freeOption(ocf) ;
+		if (ocf != NULL)
+		{
+		    push_option (m, ocf) ;
+		    freeOption(ocf) ;
+		}
     }
 }
 
@@ -875,8 +953,11 @@ void set_max_age (Msg *m, bool reset, time_t dur)
 		option *ocf ;
 
 		ocf = initOptionInteger (MO_Max_Age, (long int) dur) ;
-		push_option (m, ocf) ;
-		free(ocf) ;
+		if (ocf != NULL)
+		{
+		    push_option (m, ocf) ;
+		    freeOption(ocf) ;
+		}
     }
 }
 
@@ -6,9 +6,10 @@
 #ifndef __MSG_H__
 #define __MSG_H__
 
-#include "../L2-154/l2-154.h"
+#include "l2.h"
 #include "option.h"
 #include "token.h"
+#include "pktbuf.h"
 #include "stdbool.h"
 #include "time.h"
 
@@ -73,9 +74,8 @@ typedef enum coap_type {
 
 
 	typedef struct msg {
-		l2net_154   *l2_ ;
-		uint8_t *encoded_ ;	// encoded message to send
-		uint16_t enclen_ ;	// real size of msg (encoded_ may be larger)
+		l2net   *l2_ ;
+		Pktbuf *encoded_ ;	// encoded message to send (may be shared)
 		
 		uint8_t  type_ ;
 		uint8_t  code_ ;
@@ -93,7 +93,7 @@ typedef enum coap_type {
 
 	void freeMsg(Msg *m);
 
-	Msg *initMsg(l2net_154 *l2);
+	Msg *initMsg(l2net *l2);
 	Msg *initMsgMsg (const Msg *m2);
 	void initMsgDes (Msg *m);
 
@@ -120,7 +120,7 @@ typedef enum coap_type {
 
 	bool coap_decode (Msg *m, uint8_t rbuf [], size_t len, bool truncated);
 
-	bool sendMsg (Msg *m, l2addr_154 *dest);
+	bool sendMsg (Msg *m, l2addr *dest);
 
 	bool coap_encode (Msg *m, uint8_t sbuf [], uint16_t *sbuflen);
 
@@ -128,7 +128,7 @@ typedef enum coap_type {
 	size_t avail_space (Msg *m);
 	
 	option *pop_option (Msg *m);
-	void push_option (Msg *m, option *o);
+	bool push_option (Msg *m, option *o);
 
 	void reset_next_option (Msg *m);
 	option *next_option (Msg *m);
@@ -6,19 +6,19 @@
 #include "option.h"
 
 
-static uint8_t errno_ = 0 ;
-
-
 #define RESET(op)       do {                    \
                 op->optcode_ = MO_None ;        \
                 op->optlen_ = 0 ;           \
                 op->optval_ = 0 ;           \
+                op->errno_ = 0 ;            \
             } while (false)             // no " ;"
 #define COPY_VAL(op,p) do {                    \
                 byte *b ;               \
                 if (op->optlen_ + 1 > (int) sizeof op->staticval_) { \
-                op->optval_ = (uint8_t*) malloc (op->optlen_+ 1) ; \
-                b = op->optval_ ;           \
+                op->optval_ = (uint8_t*) CASAN_ALLOC (pool_buf, op->optlen_+ 1) ; \
+                if (op->optval_ == 0)           \
+                    op->optlen_ = 0 ;           \
+                b = op->optval_ ? op->optval_ : op->staticval_ ; \
                 }                   \
                 else                \
                 {                   \
@@ -56,7 +56,7 @@ static uint8_t errno_ = 0 ;
             } while (false)             // no " ;"
 
 
-static optdesc optdesc_ [] =
+static const optdesc optdesc_ [] =
 {
     { MO_Content_Format,	OF_OPAQUE,	0, 8	},
     { MO_Etag,			OF_OPAQUE,	1, 8	},
@@ -80,29 +80,30 @@ static optdesc optdesc_ [] =
  * Utilities
  */
 
-byte uint_to_byte (uint val, int *len) {
-
-    byte stbin [sizeof (uint)] ;
-    int shft ;
+// translate in network byte order, without leading null bytes
+int uint_to_byte (uint val, byte stbin [])
+{
+    int shft, len ;
 
-    // translate in network byte order, without leading null bytes
-    *len = 0 ;
+    len = 0 ;
     for (shft = sizeof val - 1 ; shft >= 0 ; shft--)
     {
         byte b ;
 
         b = (val >> (shft * 8)) & 0xff ;
         if (len != 0 || b != 0)
-            stbin [*len++] = b ;
+            stbin [len++] = b ;
     }
-    return *stbin ;
+    return len ;
 }
 
 
 //free option
 void freeOption( option *op) {
-    free(op->optval_);
-    free(op);
+    if (op != NULL) {
+        CASAN_FREE (pool_buf, op->optval_) ;
+        CASAN_FREE (pool_option, op) ;
+    }
 }
 
 
@@ -114,9 +115,11 @@ void freeOption( option *op) {
 
 option *initOption ()
 {
-    option *op = (option *)malloc (sizeof(struct option));
-    if (op == NULL)
-        printf("Memory allocation failed\n");
+    option *op = (option *) CASAN_ALLOC (pool_option, sizeof(struct option));
+    if (op == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
     op->optlen_ = 0;
     RESET(op) ;
     return op;
@@ -132,17 +135,19 @@ option *initOption ()
  */
 
 option *initOptionEmpty (optcode_t optcode) {
-    option *op = (option *) malloc (sizeof(struct option));
-    if (op == NULL)
-        printf("Memory allocation failed\n");
+    option *op = (option *) CASAN_ALLOC (pool_option, sizeof(struct option));
+    if (op == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
     op->optlen_ = 0;
+    RESET(op);
     bool err = false ;
     CHK_OPTCODE (optcode, err) ;
     if (err) {
-        printf("option::optval err: CHK_OPTCODE 1\n" );
-        errno_ = OPT_ERR_OPTCODE ;
+        CLOG_ERR ("option::optval err: CHK_OPTCODE 1\n") ;
+        op->errno_ = OPT_ERR_OPTCODE ;
     }
-    RESET(op);
     op->optcode_ = optcode;
     return op;
 }
@@ -161,21 +166,23 @@ option *initOptionEmpty (optcode_t optcode) {
 
  option *initOptionOpaque(optcode_t optcode, const void *optval, int optlen) {
     
-    option *op = (option *)malloc (sizeof(struct option));
-    if (op == NULL)
-        printf("Memory allocation failed\n");
+    option *op = (option *) CASAN_ALLOC (pool_option, sizeof(struct option));
+    if (op == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
+    RESET(op) ;
     bool err = false ;
     CHK_OPTCODE (optcode, err) ;
     if (err) {
-        printf("option::optval err: CHK_OPTCODE 2") ;
-        errno_ = OPT_ERR_OPTCODE ;
+        CLOG_ERR ("option::optval err: CHK_OPTCODE 2\n") ;
+        op->errno_ = OPT_ERR_OPTCODE ;
     }
     CHK_OPTLEN (optcode, optlen, err) ;
     if (err) {
-        printf("option::optval err: CHK_OPTLEN 2") ;
-        errno_ = OPT_ERR_OPTLEN ;
+        CLOG_ERR ("option::optval err: CHK_OPTLEN 2\n") ;
+        op->errno_ = OPT_ERR_OPTLEN ;
     }
-    RESET(op) ;
     op->optcode_ = optcode ;
     op->optlen_ = optlen ;
     COPY_VAL(op, optval);   
@@ -196,26 +203,28 @@ option *initOptionEmpty (optcode_t optcode) {
 
 option *initOptionInteger (optcode_t optcode, uint optval)
 {
-    option *op = (option *)malloc (sizeof(struct option));
-    if (op == NULL)
-        printf("Memory allocation failed\n");
+    option *op = (option *) CASAN_ALLOC (pool_option, sizeof(struct option));
+    if (op == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
     bool err ;
-    byte stbin ; 
+    byte stbin [sizeof (uint)] ;
     int len;
 
-    stbin = uint_to_byte (optval, &len) ;
+    len = uint_to_byte (optval, stbin) ;
+    RESET(op) ;
     err = false ;
     CHK_OPTCODE (optcode, err) ;
     if (err) {
-        printf("option::optval err: CHK_OPTCODE 3\n") ;
-        errno_ = OPT_ERR_OPTCODE ;
+        CLOG_ERR ("option::optval err: CHK_OPTCODE 3\n") ;
+        op->errno_ = OPT_ERR_OPTCODE ;
     }
     CHK_OPTLEN (optcode, len, err) ;
     if (err) {
-        printf ("option::optval err: CHK_OPTLEN 3\n") ;
-        errno_ = OPT_ERR_OPTLEN ;
+        CLOG_ERR ("option::optval err: CHK_OPTLEN 3\n") ;
+        op->errno_ = OPT_ERR_OPTLEN ;
     }       
-    RESET(op) ;
     op->optcode_ = optcode ;
     op->optlen_ = len ;
     COPY_VAL (op,stbin) ;
@@ -234,6 +243,8 @@ option *initOptionOption (const option *o)
 {
 
     option *op =initOption();
+    if (op == NULL)
+        return NULL;
     memcpy (op, o, sizeof *o) ; 
     
     if (op->optval_) {
@@ -253,7 +264,7 @@ option *initOptionOption (const option *o)
 void copyOption(option *o1, const option *o2 ){
     if (isDifferentOption(o1, o2)) {
         if(o1->optval_) {
-            free(o1->optval_);
+            CASAN_FREE (pool_buf, o1->optval_);
             o1->optval_ = NULL;
         }
 
@@ -348,7 +359,7 @@ uint getOptvalInteger (option *o)
     v = 0 ;
     b = (o->optval_ == 0) ? o->staticval_ : o->optval_ ;
     for (i = 0 ; i < o->optlen_ ; i++)
-        v = (v << 8) & b [i] ;
+        v = (v << 8) | b [i] ;
     return v ;
 }
 
@@ -393,16 +404,16 @@ void setOptvalOpaque (option *o, void *val, int len)
 void setOptvalInteger (option *o, uint val)
 {
     bool err ;
-    byte stbin ;
+    byte stbin [sizeof (uint)] ;
     int len ;
 
-    stbin = uint_to_byte (val, &len) ;
+    len = uint_to_byte (val, stbin) ;
     err = false ;
     CHK_OPTLEN (o->optcode_, len, err) ;
     if (err)
     {
-        printf("option::optval err: CHK_OPTLEN\n") ;
-        errno_ = OPT_ERR_OPTLEN ;
+        CLOG_ERR ("option::optval err: CHK_OPTLEN\n") ;
+        o->errno_ = OPT_ERR_OPTLEN ;
         return ;
     }
     o->optlen_ = len ;
@@ -425,12 +436,12 @@ int getOptlen (const option *o)
 
 
 /**
- * Returns the last error encountered during an option assignment
+ * Returns the last error encountered during an assignment of this option
  */
 
-uint8_t get_errno (void)
+uint8_t get_errno (const option *o)
 {
-    return errno_ ;
+    return o->errno_ ;
 }
 
 void printOption (const option *o)
@@ -464,26 +475,18 @@ void printOption (const option *o)
     if (o->optval_)
     {
     printf ("%s=",BLUE (" optval") ) ;
-    char *buf = (char *) malloc (sizeof (char) * o->optlen_ + 1) ;
-    memcpy (buf, o->optval_, o->optlen_) ;
-    buf[o->optlen_] = '\0' ;
-    printf(buf) ;
-    free (buf) ;
+    printf ("%.*s", o->optlen_, (char *) o->optval_) ;
     }
     else if (o->optlen_ > 0 )
     {
     printf ("%s=",BLUE (" staticval") ) ;
-    char *buf = (char *) malloc (sizeof (char) * o->optlen_ + 1) ;
-    memcpy (buf, o->staticval_, o->optlen_) ;
-    buf[o->optlen_] = '\0' ;
-    printf (buf) ;
-    free (buf) ;
+    printf ("%.*s", o->optlen_, (char *) o->staticval_) ;
     }
     printf("\n") ;
 }
 
 
-void reset_errno (void)
+void reset_errno (option *o)
 {
-    errno_ = 0 ;
+    o->errno_ = 0 ;
 }
\ No newline at end of file
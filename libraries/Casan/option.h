@@ -7,6 +7,7 @@
 #define CASAN_OPTION_H
 
 #include "defs.h"
+#include "pool.h"
 #include "contiki.h"
 #include "stdbool.h" 
 
@@ -88,10 +89,9 @@
 		int optlen_ ;
 		byte *optval_ ;			// 0 if staticval is used
 		byte staticval_ [8 + 1] ;	// keep a \0 after, just in case
+		uint8_t errno_ ;		// last error on this option
 	} option;
 
-	static uint8_t errno_ ;
-
 	typedef enum
 	{
 	    OF_NONE		 = 0,
@@ -108,9 +108,8 @@
 	    int minlen ;
 	    int maxlen ;
 	} optdesc;
-	static optdesc optdesc_ [] ;
 
-	byte uint_to_byte (uint val, int *len) ;
+	int uint_to_byte (uint val, byte stbin []) ;
 
 	void freeOption( option *op);
 
@@ -152,10 +151,10 @@
 
 	int getOptlen (const option *o);
 
-	uint8_t get_errno (void);
+	uint8_t get_errno (const option *o);
 
 	void printOption (const option *o);
 
-	void reset_errno (void);
+	void reset_errno (option *o);
 
 #endif
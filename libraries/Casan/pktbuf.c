@@ -0,0 +1,58 @@
+/**
+ * @file pktbuf.c
+ * @brief reference-counted packet buffers implementation
+ */
+
+#include "pktbuf.h"
+
+
+/**
+ * @brief Allocate a new (empty) packet buffer
+ *
+ * The caller owns the only reference to this buffer.
+ *
+ * @param size size of data (at most PKTBUF_MAXSIZE)
+ * @return address of a new buffer or NULL if memory is exhausted
+ */
+
+Pktbuf *initPktbuf (size_t size)
+{
+    Pktbuf *pb ;
+
+    pb = (Pktbuf *) CASAN_ALLOC (pool_pktbuf, sizeof (Pktbuf) + size) ;
+    if (pb == NULL)
+	CLOG_ERR ("Memory allocation failed\n") ;
+    else
+    {
+	pb->refcnt_ = 1 ;
+	pb->len_ = 0 ;
+    }
+    return pb ;
+}
+
+
+/**
+ * @brief Add a reference to an existing packet buffer
+ *
+ * @return the same buffer, for convenience
+ */
+
+Pktbuf *retainPktbuf (Pktbuf *pb)
+{
+    if (pb != NULL)
+	pb->refcnt_++ ;
+    return pb ;
+}
+
+
+/**
+ * @brief Drop a reference to a packet buffer
+ *
+ * The buffer is freed when its last reference is dropped.
+ */
+
+void releasePktbuf (Pktbuf *pb)
+{
+    if (pb != NULL && --pb->refcnt_ == 0)
+	CASAN_FREE (pool_pktbuf, pb) ;
+}
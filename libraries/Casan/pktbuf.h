@@ -0,0 +1,48 @@
+/**
+ * @file pktbuf.h
+ * @brief reference-counted packet buffers
+ */
+
+#ifndef __PKTBUF_H__
+#define __PKTBUF_H__
+
+#include "defs.h"
+#include "pool.h"
+
+/** Size of a packet buffer: large enough for any 802.15.4 payload */
+#ifndef PKTBUF_SIZE
+#define	PKTBUF_SIZE	120
+#endif
+
+/** Largest packet buffer: a datagram sent in fragments, if larger */
+#if I154_DGRAM_MAX > PKTBUF_SIZE
+#define	PKTBUF_MAXSIZE	I154_DGRAM_MAX
+#else
+#define	PKTBUF_MAXSIZE	PKTBUF_SIZE
+#endif
+
+/**
+ * @brief An object of class Pktbuf holds an encoded frame
+ *
+ * A packet buffer is created by the encoder (see `sendMsg`), and
+ * may be retained by other parts of the engine which need the same
+ * bytes later (retransmission queue, deduplication cache). Each
+ * holder owns one reference, and the buffer is released when the
+ * last reference is dropped. The content must not be modified once
+ * the buffer is shared.
+ *
+ * Buffers are usually PKTBUF_SIZE bytes long: only messages sent in
+ * fragments need a larger one (see pool.h).
+ */
+
+typedef struct pktbuf {
+	uint8_t refcnt_ ;		// number of holders
+	uint16_t len_ ;			// length of encoded message
+	uint8_t data_ [] ;		// size given to initPktbuf
+} Pktbuf;
+
+Pktbuf *initPktbuf (size_t size) ;	// new buffer, with one reference
+Pktbuf *retainPktbuf (Pktbuf *pb) ;	// add a reference
+void releasePktbuf (Pktbuf *pb) ;	// drop a reference
+
+#endif
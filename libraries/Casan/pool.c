@@ -0,0 +1,275 @@
+/**
+ * @file pool.c
+ * @brief static memory pools implementation
+ */
+
+#include "casan.h"
+
+#ifdef CASAN_STATIC_POOLS
+
+/*
+ * A pool is declared with a static array of unions in order to
+ * get a correct alignment for each block.
+ */
+
+#define	POOL_DEFINE_LARGE(name,type,nb,large)				\
+	static union { type t ; void *p ; uint64_t u ; } name##_mem_ [nb] ; \
+	Pool name = { #name, sizeof name##_mem_ [0], nb,		\
+			(uint8_t *) name##_mem_, NULL, 0, 0, 0, 0, large }
+#define	POOL_DEFINE(name,type,nb)	POOL_DEFINE_LARGE (name, type, nb, NULL)
+
+typedef uint8_t poolbuf_t [POOL_BUFSIZE] ;
+typedef uint8_t poolpkt_t [sizeof (Pktbuf) + PKTBUF_SIZE] ;
+
+#if POOL_NB_DGRAM > 0
+typedef uint8_t pooldgram_t [sizeof (Pktbuf) + I154_DGRAM_MAX] ;
+POOL_DEFINE (pool_dgram,	pooldgram_t,	POOL_NB_DGRAM) ;
+#define	POOL_LARGE	(&pool_dgram)
+#else
+#define	POOL_LARGE	NULL
+#endif
+
+POOL_DEFINE (pool_msg,		Msg,		POOL_NB_MSG) ;
+POOL_DEFINE (pool_token,	token,		POOL_NB_TOKEN) ;
+POOL_DEFINE (pool_option,	option,		POOL_NB_OPTION) ;
+POOL_DEFINE (pool_optlist,	optlist,	POOL_NB_OPTLIST) ;
+POOL_DEFINE (pool_retransq,	retransq,	POOL_NB_RETRANSQ) ;
+POOL_DEFINE (pool_reslist,	reslist,	POOL_NB_RESLIST) ;
+POOL_DEFINE (pool_l2addr,	l2addr,	POOL_NB_L2ADDR) ;
+POOL_DEFINE_LARGE (pool_pktbuf,	poolpkt_t,	POOL_NB_PKTBUF,	POOL_LARGE) ;
+POOL_DEFINE_LARGE (pool_buf,	poolbuf_t,	POOL_NB_BUF,	POOL_LARGE) ;
+
+static Pool *pools [] =
+{
+    &pool_msg, &pool_token, &pool_option, &pool_optlist,
+    &pool_retransq, &pool_reslist, &pool_l2addr, &pool_pktbuf, &pool_buf,
+#if POOL_NB_DGRAM > 0
+    &pool_dgram,
+#endif
+} ;
+
+#endif
+
+
+/**
+ * @brief Allocate a block from a pool
+ *
+ * Released blocks are reused first. Blocks which have never been
+ * allocated are then taken in sequence, so that no initialization
+ * of the pool is needed. A block larger than the pool block size
+ * is taken from the pool for larger blocks, if any.
+ *
+ * @param p pool
+ * @param size requested size
+ * @return address of block, or NULL if pool is exhausted or size is
+ *	too large
+ */
+
+void *pool_alloc (Pool *p, size_t size)
+{
+    void *b ;
+
+    if (size > p->size_ && p->large_ != NULL)
+	return pool_alloc (p->large_, size) ;
+    if (size > p->size_)
+	b = NULL ;
+    else if (p->free_ != NULL)
+    {
+	b = p->free_ ;
+	p->free_ = * (void **) b ;
+    }
+    else if (p->top_ < p->nblocks_)
+	b = p->mem_ + p->size_ * p->top_++ ;
+    else
+	b = NULL ;
+
+    if (b == NULL)
+	p->fail_++ ;
+    else
+    {
+	p->used_++ ;
+	if (p->used_ > p->maxused_)
+	    p->maxused_ = p->used_ ;
+    }
+    return b ;
+}
+
+
+/**
+ * @brief Release a block to its pool
+ *
+ * @param p pool
+ * @param b address of block (may be NULL)
+ */
+
+void pool_free (Pool *p, void *b)
+{
+    Pool *l = p->large_ ;
+
+    if (l != NULL && (uint8_t *) b >= l->mem_
+		&& (uint8_t *) b < l->mem_ + l->size_ * l->nblocks_)
+	p = l ;
+    if (b != NULL)
+    {
+	* (void **) b = p->free_ ;
+	p->free_ = b ;
+	p->used_-- ;
+    }
+}
+
+
+/**
+ * @brief Print pool usage, for debugging purpose
+ */
+
+void print_pools (void)
+{
+#ifdef CASAN_STATIC_POOLS
+    int i ;
+
+    for (i = 0 ; i < NTAB (pools) ; i++)
+    {
+	printf ("%s : used=%d", pools [i]->name_, pools [i]->used_) ;
+	printf (" max=%d/%d", pools [i]->maxused_, pools [i]->nblocks_) ;
+	printf (" fail=%d\n", pools [i]->fail_) ;
+    }
+#endif
+}
+
+
+/******************************************************************************
+ * Allocation accounting
+ */
+
+#ifdef CASAN_TRACK_ALLOC
+
+/*
+ * Each block is preceded by a header giving its tag and size. The
+ * union keeps the alignment given by malloc. Counters are updated
+ * atomically, since engines may run in parallel threads (sched.h).
+ */
+
+typedef union allochdr {
+	struct {
+	    alloc_tag_t tag_ ;
+	    size_t size_ ;
+	} h_ ;
+	long double align_ ;
+} allochdr ;
+
+static AllocStat allocstat [ALLOC_NTAGS] =
+{
+    { "msg" }, { "option" }, { "retrans" }, { "casan" }, { "l2" },
+} ;
+
+#define	ATOMIC_ADD(v,n)		__atomic_add_fetch (&(v), (n), __ATOMIC_RELAXED)
+
+void *alloc_tagged (alloc_tag_t tag, size_t size)
+{
+    AllocStat *st = &allocstat [tag] ;
+    allochdr *h ;
+    long int bytes, peak ;
+
+    h = (allochdr *) malloc (sizeof *h + size) ;
+    if (h == NULL)
+    {
+	ATOMIC_ADD (st->fail_, 1) ;
+	return NULL ;
+    }
+    h->h_.tag_ = tag ;
+    h->h_.size_ = size ;
+
+    ATOMIC_ADD (st->nalloc_, 1) ;
+    ATOMIC_ADD (st->nblocks_, 1) ;
+    bytes = ATOMIC_ADD (st->bytes_, (long int) size) ;
+    peak = __atomic_load_n (&st->peak_, __ATOMIC_RELAXED) ;
+    while (bytes > peak
+	    && ! __atomic_compare_exchange_n (&st->peak_, &peak, bytes, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    return h + 1 ;
+}
+
+void free_tagged (void *b)
+{
+    allochdr *h ;
+    AllocStat *st ;
+
+    if (b != NULL)
+    {
+	h = (allochdr *) b - 1 ;
+	st = &allocstat [h->h_.tag_] ;
+	ATOMIC_ADD (st->nblocks_, -1) ;
+	ATOMIC_ADD (st->bytes_, - (long int) h->h_.size_) ;
+	free (h) ;
+    }
+}
+
+#endif
+
+
+/**
+ * @brief Get the counters of a tag
+ *
+ * All counters are 0 if allocations are not tracked.
+ */
+
+void alloc_stat (alloc_tag_t tag, AllocStat *st)
+{
+#ifdef CASAN_TRACK_ALLOC
+    *st = allocstat [tag] ;
+#else
+    memset (st, 0, sizeof *st) ;
+#endif
+}
+
+
+/**
+ * @brief Bytes currently allocated, for all tags
+ */
+
+long int alloc_bytes (void)
+{
+    long int n = 0 ;
+#ifdef CASAN_TRACK_ALLOC
+    int i ;
+
+    for (i = 0 ; i < ALLOC_NTAGS ; i++)
+	n += __atomic_load_n (&allocstat [i].bytes_, __ATOMIC_RELAXED) ;
+#endif
+    return n ;
+}
+
+
+/**
+ * @brief Start a new high-water mark for each tag
+ */
+
+void reset_alloc_peak (void)
+{
+#ifdef CASAN_TRACK_ALLOC
+    int i ;
+
+    for (i = 0 ; i < ALLOC_NTAGS ; i++)
+	allocstat [i].peak_ = allocstat [i].bytes_ ;
+#endif
+}
+
+
+/**
+ * @brief Print allocations by tag, for debugging purpose
+ */
+
+void print_allocs (void)
+{
+#ifdef CASAN_TRACK_ALLOC
+    int i ;
+
+    for (i = 0 ; i < ALLOC_NTAGS ; i++)
+    {
+	printf ("%s : blocks=%ld", allocstat [i].name_, allocstat [i].nblocks_) ;
+	printf (" bytes=%ld peak=%ld", allocstat [i].bytes_, allocstat [i].peak_) ;
+	printf (" allocs=%lu fail=%lu\n", allocstat [i].nalloc_, allocstat [i].fail_) ;
+    }
+#endif
+}
@@ -0,0 +1,190 @@
+/**
+ * @file pool.h
+ * @brief static memory pools
+ *
+ * By default, CASAN objects (messages, options, tokens, etc.) are
+ * allocated with malloc. When the library is compiled with
+ * CASAN_STATIC_POOLS defined, these objects are taken from fixed-size
+ * static pools instead, and no dynamic allocation occurs after
+ * `initCasan`. All pool sizes are declared in this file and may be
+ * overridden on the compiler command line (-DPOOL_NB_MSG=6 for
+ * example).
+ *
+ * When a pool is exhausted, the allocation returns NULL and the
+ * `fail_` counter of the pool is incremented: callers must handle
+ * this case as a clean error.
+ *
+ * Pools are shared by all CASAN engines of the program. They are
+ * meant for the firmware, which runs a single engine: simulations
+ * running many engines in the same process use malloc.
+ *
+ * Objects allocated once (engine, timers, resources, L2 network) do
+ * not come from pools: they use CASAN_MALLOC and CASAN_MFREE.
+ *
+ * When the library is compiled with CASAN_TRACK_ALLOC defined (and
+ * without CASAN_STATIC_POOLS), each allocation is tagged with the
+ * subsystem which owns the object (see alloc_tag_t), and the number
+ * of blocks and bytes currently allocated, with their high-water
+ * mark, are kept for each tag: a leak shows as the growth of a tag.
+ * Buffers internal to ConMsg are not counted.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "defs.h"
+#include "contiki.h"
+#include "stdbool.h"
+
+/*
+ * Pool sizes (number of blocks)
+ */
+
+#ifndef POOL_NB_MSG
+#define	POOL_NB_MSG		4	// 2 per loop + pending retransmissions
+#endif
+#ifndef POOL_NB_TOKEN
+#define	POOL_NB_TOKEN		POOL_NB_MSG	// one token per message
+#endif
+#ifndef POOL_NB_OPTION
+#define	POOL_NB_OPTION		24
+#endif
+#ifndef POOL_NB_OPTLIST
+#define	POOL_NB_OPTLIST		POOL_NB_OPTION	// one node per option
+#endif
+#ifndef POOL_NB_RETRANSQ
+#define	POOL_NB_RETRANSQ	4
+#endif
+#ifndef POOL_NB_RESLIST
+#define	POOL_NB_RESLIST		8	// max number of registered resources
+#endif
+#ifndef POOL_NB_L2ADDR
+#define	POOL_NB_L2ADDR		8
+#endif
+#ifndef POOL_NB_PKTBUF
+#define	POOL_NB_PKTBUF		6	// encoded msgs, shared by retrans/dedup
+#endif
+
+/*
+ * Variable length buffers (payloads, option values larger than
+ * option::staticval_) are taken from a pool of fixed size
+ * buffers, large enough to hold a complete 802.15.4 frame.
+ *
+ * Only a few payloads and encoded messages are larger than a frame,
+ * when fragmentation is used: they are taken from a separate pool of
+ * POOL_NB_DGRAM blocks of I154_DGRAM_MAX bytes (plus the Pktbuf
+ * header), such that the frame-sized pools do not grow. The default
+ * allows a datagram being built (payload and encoded message) and
+ * one kept for retransmission.
+ */
+
+#ifndef POOL_NB_BUF
+#define	POOL_NB_BUF		8
+#endif
+#ifndef POOL_BUFSIZE
+#define	POOL_BUFSIZE		128
+#endif
+#ifndef POOL_NB_DGRAM
+#if I154_DGRAM_MAX > 0
+#define	POOL_NB_DGRAM		3
+#else
+#define	POOL_NB_DGRAM		0
+#endif
+#endif
+
+
+typedef struct pool {
+	const char *name_ ;
+	size_t size_ ;			// size of a block
+	int nblocks_ ;			// number of blocks
+	uint8_t *mem_ ;			// nblocks_ * size_ bytes
+	void *free_ ;			// list of released blocks
+	int top_ ;			// blocks never allocated start here
+	int used_ ;			// blocks currently allocated
+	int maxused_ ;			// high-water mark
+	int fail_ ;			// number of failed allocations
+	struct pool *large_ ;		// pool for larger blocks, or NULL
+} Pool;
+
+void *pool_alloc (Pool *p, size_t size) ;
+void pool_free (Pool *p, void *b) ;
+void print_pools (void) ;
+
+/*
+ * Allocation accounting
+ */
+
+typedef enum alloc_tag
+{
+    ALLOC_MSG = 0,		// messages, tokens, payloads
+    ALLOC_OPTION,		// options and option lists
+    ALLOC_RETRANS,		// retransmission queue, encoded messages
+    ALLOC_CASAN,		// engine, timers, resources
+    ALLOC_L2,			// L2 networks and addresses
+    ALLOC_NTAGS
+} alloc_tag_t ;
+
+// owner of objects taken from each pool
+#define	ALLOC_TAG_pool_msg	ALLOC_MSG
+#define	ALLOC_TAG_pool_token	ALLOC_MSG
+#define	ALLOC_TAG_pool_buf	ALLOC_MSG
+#define	ALLOC_TAG_pool_option	ALLOC_OPTION
+#define	ALLOC_TAG_pool_optlist	ALLOC_OPTION
+#define	ALLOC_TAG_pool_retransq	ALLOC_RETRANS
+#define	ALLOC_TAG_pool_pktbuf	ALLOC_RETRANS
+#define	ALLOC_TAG_pool_reslist	ALLOC_CASAN
+#define	ALLOC_TAG_pool_l2addr	ALLOC_L2
+
+typedef struct allocstat {
+	const char *name_ ;
+	long int nblocks_ ;		// blocks currently allocated
+	long int bytes_ ;		// bytes currently allocated
+	long int peak_ ;		// high-water mark of bytes_
+	unsigned long int nalloc_ ;	// allocations since start
+	unsigned long int fail_ ;	// failed allocations
+} AllocStat ;
+
+void *alloc_tagged (alloc_tag_t tag, size_t size) ;
+void free_tagged (void *b) ;
+void alloc_stat (alloc_tag_t tag, AllocStat *st) ;
+long int alloc_bytes (void) ;		// bytes allocated, all tags
+void reset_alloc_peak (void) ;
+void print_allocs (void) ;
+
+#ifdef CASAN_STATIC_POOLS
+
+extern Pool pool_msg ;
+extern Pool pool_token ;
+extern Pool pool_option ;
+extern Pool pool_optlist ;
+extern Pool pool_retransq ;
+extern Pool pool_reslist ;
+extern Pool pool_l2addr ;
+extern Pool pool_pktbuf ;
+extern Pool pool_buf ;
+#if POOL_NB_DGRAM > 0
+extern Pool pool_dgram ;
+#endif
+
+#define	CASAN_ALLOC(p,size)	pool_alloc (&(p), (size))
+#define	CASAN_FREE(p,b)		pool_free (&(p), (b))
+#define	CASAN_MALLOC(tag,size)	malloc (size)
+#define	CASAN_MFREE(b)		free (b)
+
+#elif defined (CASAN_TRACK_ALLOC)
+
+#define	CASAN_ALLOC(p,size)	alloc_tagged (ALLOC_TAG_##p, (size))
+#define	CASAN_FREE(p,b)		free_tagged (b)
+#define	CASAN_MALLOC(tag,size)	alloc_tagged ((tag), (size))
+#define	CASAN_MFREE(b)		free_tagged (b)
+
+#else
+
+#define	CASAN_ALLOC(p,size)	malloc (size)
+#define	CASAN_FREE(p,b)		free (b)
+#define	CASAN_MALLOC(tag,size)	malloc (size)
+#define	CASAN_MFREE(b)		free (b)
+
+#endif
+
+#endif
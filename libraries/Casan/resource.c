@@ -6,7 +6,7 @@
 #include "resource.h"
 
 #define	ALLOC_COPY(d,s)		do {				\
-				    (d) = (char *) malloc (strlen (s) + 1) ; \
+				    (d) = (char *) CASAN_MALLOC (ALLOC_CASAN, strlen (s) + 1) ; \
 				    strcpy ((d), (s)) ;		\
 				} while (false)			// no ";"
 
@@ -14,16 +14,16 @@
 char *get_name (Resource *rs)       { return rs->name_ ; }
 bool get_observed (Resource *rs)        { return rs->observed_ ; }
 uint32_t next_serial (Resource *rs)     { return ++rs->obs_serial_ ; }
-token *get_token (Resource *rs)     { return rs->obs_token_ ; }
+token *get_token (Resource *rs)     { return &rs->obs_token_ ; }
 
 /** @brief Copy constructor
  */
 Resource *initResource (const char *name, const char *title, const char *rt)
 {
     int i;
-	Resource *rs = (Resource *) malloc (sizeof (Resource));
+	Resource *rs = (Resource *) CASAN_MALLOC (ALLOC_CASAN, sizeof (Resource));
     if (rs == NULL)
-        printf("Memory allocation failed\n");
+        CLOG_ERR ("Memory allocation failed\n") ;
     ALLOC_COPY (rs->name_, name) ;
     ALLOC_COPY (rs->title_, title) ;
     ALLOC_COPY (rs->rt_, rt) ;
@@ -33,6 +33,7 @@ Resource *initResource (const char *name, const char *title, const char *rt)
     rs->obs_trig_ = NULL ;
     rs->obs_reg_ = NULL ;
     rs->obs_dereg_ = NULL ;
+    resetToken (&rs->obs_token_) ;
     return rs;
 }
 
@@ -42,10 +43,10 @@ Resource *initResource (const char *name, const char *title, const char *rt)
  */
 
 void freeResource (Resource *rs) {
-	free(rs->name_);
-	free(rs->title_);
-	free(rs->rt_);
-	free(rs);
+	CASAN_MFREE (rs->name_);
+	CASAN_MFREE (rs->title_);
+	CASAN_MFREE (rs->rt_);
+	CASAN_MFREE (rs);
 }
 
 
@@ -64,12 +65,14 @@ void setHandlerResource (Resource *rs, coap_code_t op, handler_res_t h)
 
 /** @brief Get resource handler
  *
- * @param op CoAP operation (see coap_code_t type)
- * @return Handler for this operation
+ * @param op CoAP operation (see coap_code_t type), as received
+ * @return Handler for this operation, or NULL for an unknown operation
  */
 
 handler_res_t getHandlerResource (Resource *rs, coap_code_t op)
 {
+    if ((unsigned int) op >= (unsigned int) NTAB (rs->handler_))
+	return NULL ;
     return rs->handler_ [op] ;
 }
 
@@ -111,7 +114,7 @@ void observedResource (Resource *rs, bool onoff, Msg *m)
 		    if (rs->obs_reg_ != NULL)
 			(*rs->obs_reg_) (m) ;
 		    rs->obs_serial_ = 2 ;			/* starting value */
-		    rs->obs_token_ = get_token_msg (m) ;
+		    rs->obs_token_ = *get_token_msg (m) ;
 		}
     }
 }
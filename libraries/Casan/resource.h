@@ -75,7 +75,7 @@
 		obs_deregister_t obs_dereg_ ;		// unregister an observer
 		obs_trigger_t obs_trig_ ;		// detect observe event
 		uint32_t obs_serial_ ;			// increasing value for option
-		token *obs_token_ ;
+		token obs_token_ ;			// copy of the observer token
 	} Resource;
 
 
@@ -1,17 +1,27 @@
 #include "retrans.h"
 
+#define	HASH(id)	((id) & (RETRANS_HASH - 1))
+
 /*Destructor*/
 void freeRetrans(Retrans *rt) {
-	free(rt->retransq_);
-	free(rt);
+	resetRetrans (rt);
+	CASAN_MFREE (rt);
 }
 
-Retrans *initRetrans (void) 
+Retrans *initRetrans (time_t *cur)
 {
-	Retrans *rt = (Retrans *) malloc (sizeof(Retrans));
+	Retrans *rt = (Retrans *) CASAN_MALLOC (ALLOC_RETRANS, sizeof(Retrans));
 	if (rt == NULL)
-		printf("Memory allocation failed\n");
+	{
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return NULL ;
+	}
     rt->retransq_ = NULL ;
+    memset (rt->hash_, 0, sizeof rt->hash_) ;
+    rt->master_addr_ = NULL ;
+    rt->cur_ = cur ;
+    resetRto (&rt->rto_) ;
+    seed_random (&rt->rto_, 0) ;
     return rt;
 }
 
@@ -19,92 +29,179 @@ Retrans *initRetrans (void)
 void resetRetrans (Retrans *rt) 
 {
     while (rt->retransq_ != NULL)
-		delRetransIntern2 (rt, NULL, rt->retransq_) ;
+		delRetransIntern (rt, rt->retransq_) ;
 }
 
 
-void master (Retrans *rt, l2addr_154 **master)
+// default destination (current master) when none is given
+void master (Retrans *rt, l2addr **master)
 {
     rt->master_addr_ = master ;
 }
 
 
+// for internal use only: insert an entry in the queue, by timenext
+static void insert_sorted (Retrans *rt, retransq *n)
+{
+    retransq *cur, *prev ;
+
+    prev = NULL ;
+    for (cur = rt->retransq_ ; cur != NULL ; cur = cur->next)
+    {
+		if (n->timenext < cur->timenext)
+		    break ;
+		prev = cur ;
+    }
+    n->prev = prev ;
+    n->next = cur ;
+    if (cur != NULL)
+		cur->prev = n ;
+    if (prev != NULL)
+		prev->next = n ;
+    else
+		rt->retransq_ = n ;
+}
+
+
+// for internal use only: remove an entry from the queue
+static void unlink_sorted (Retrans *rt, retransq *r)
+{
+    if (r->prev != NULL)
+		r->prev->next = r->next ;
+    else
+		rt->retransq_ = r->next ;
+    if (r->next != NULL)
+		r->next->prev = r->prev ;
+}
+
+
 // insert a new message in the retransmission list
-void addRetrans (Retrans *rt, Msg *msg) 
+// the message must already be encoded (i.e. sent once)
+void addRetrans (Retrans *rt, Msg *msg, l2addr *dest) 
 {
     retransq *n ;
+    rtopeer *p ;
+    int h ;
 
-    sync_time (&curtime) ;		// synchronize curtime
+    if (msg->encoded_ == NULL)
+		return ;
+    if (dest == NULL)
+		dest = *rt->master_addr_ ;
+    if (dest == NULL)
+		return ;
 
-    n = (retransq *) malloc (sizeof (retransq)) ;
+    sync_time (rt->cur_) ;		// synchronize current time
+
+    n = (retransq *) CASAN_ALLOC (pool_retransq, sizeof (retransq)) ;
     if (n == NULL)
-		printf("Memory allocation failed\n");
-    n->msg = msg ;
-    n->timelast = curtime ;
-    n->timenext = curtime + ALEA (ACK_TIMEOUT * ACK_RANDOM_FACTOR) ;
+    {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return ;
+    }
+    n->pkt = retainPktbuf (msg->encoded_) ;
+    copyAddr (&n->dest, dest) ;
+    n->id = get_id (msg) ;
+    n->tok = *get_token_msg (msg) ;
+    p = getRtoPeer (&rt->rto_, dest, rt->cur_) ;
+    n->timeout = initial_timeout (&rt->rto_, p, rt->cur_) ;
+    n->timeout0 = n->timeout ;
+    n->timefirst = *rt->cur_ ;
+    n->timenext = *rt->cur_ + n->timeout ;
     n->ntrans = 0 ;
-    n->next = rt->retransq_ ;
-    rt->retransq_ = n ;
+    insert_sorted (rt, n) ;
+
+    h = HASH (n->id) ;
+    n->hnext = rt->hash_ [h] ;
+    rt->hash_ [h] = n ;
 }
 
 
-void delRetrans (Retrans *rt, Msg *msg) 
+void delRetrans (Retrans *rt, Msg *msg, l2addr *src) 
 {
-    delRetransIntern1 (rt, getRetrans (rt, msg)) ;
+    retransq *r ;
+
+    r = getRetrans (rt, msg, src) ;
+    if (r != NULL)
+		delRetransIntern (rt, r) ;
 }
 
 
-// TODO
-void loopRetrans (Retrans *rt, l2net_154 *l2, time_t *curtime)
+// remove all messages sent to a given destination
+void delRetransDest (Retrans *rt, l2addr *dest)
 {
-    // DBGLN1 (F ("retransmit loop")) ;
+    retransq *cur, *next ;
 
-    if (*rt->master_addr_ == NULL)
+    for (cur = rt->retransq_ ; cur != NULL ; cur = next)
     {
-		// master has been reset by the CASAN engine (waiting-unknown state)
-		resetRetrans (rt) ;
-		return ;
+		next = cur->next ;
+		if (isEqualAddr (&cur->dest, dest))
+		    delRetransIntern (rt, cur) ;
     }
-    else
-    {
-		retransq *cur, *prev ;
+}
+
+
+/**
+ * @brief Time of the next retransmission
+ *
+ * @param next (out) time of the next retransmission
+ * @return false if no message is waiting for an ACK
+ */
 
-		prev = NULL ;
-		cur = rt->retransq_ ;
-		while (cur != NULL)
+bool nextRetrans (Retrans *rt, time_t *next)
+{
+    if (rt->retransq_ == NULL)
+		return false ;
+    *next = rt->retransq_->timenext ;
+    return true ;
+}
+
+
+// only entries at the head of the queue (i.e. due entries) are examined
+void loopRetrans (Retrans *rt, l2net *l2, time_t *curtime)
+{
+    retransq *cur ;
+
+    while ((cur = rt->retransq_) != NULL && cur->timenext < *curtime)
+    {
+		if (cur->ntrans >= MAX_RETRANSMIT)
 		{
-		    retransq *next ;
-
-		    next = cur->next ;
-		    if (cur->ntrans >= MAX_RETRANSMIT)
-		    {
-				// remove the message from the queue
-				delRetransIntern2 (rt, prev, cur) ;
-				// prev is not modified
-		    }
-		    else
-		    {
-				if (cur->timenext < *curtime)
-				{
-				    sendMsg (cur->msg, *rt->master_addr_) ;
-				    cur->ntrans++ ;
-				    cur->timenext = cur->timenext + (2* (cur->timenext - cur->timelast));
-				    sync_time (&cur->timelast) ;
-				}
-				prev = cur ;
-		    }
-		    cur = next ;
+		    // last timeout expired: remove the message from the queue
+		    delRetransIntern (rt, cur) ;
+		}
+		else
+		{
+		    send (l2, &cur->dest, cur->pkt->data_, cur->pkt->len_) ;
+		    cur->ntrans++ ;
+		    cur->timeout = backoff_timeout (cur->timeout, cur->timeout0) ;
+		    cur->timenext = *curtime + cur->timeout ;
+
+		    // move the entry to its new place in the queue
+		    unlink_sorted (rt, cur) ;
+		    insert_sorted (rt, cur) ;
 		}
     }
 }
 
 
-void check_msg_received (Retrans *rt, Msg *in) 
+// an acknowledged message gives a RTT measure for its destination
+void check_msg_received (Retrans *rt, Msg *in, l2addr *src) 
 {
+    retransq *r ;
+    rtopeer *p ;
+
     switch (get_type (in))
     {
 	case COAP_TYPE_ACK :
-	    delRetrans (rt, in) ;
+	case COAP_TYPE_RST :
+	    r = getRetrans (rt, in, src) ;
+	    if (r != NULL)
+	    {
+		sync_time (rt->cur_) ;
+		p = getRtoPeer (&rt->rto_, &r->dest, rt->cur_) ;
+		update_rtt (p, (uint32_t) (*rt->cur_ - r->timefirst), r->ntrans,
+				    rt->cur_) ;
+		delRetransIntern (rt, r) ;
+	    }
 	    break ;
 	default :
 	    break ;
@@ -113,12 +210,12 @@ void check_msg_received (Retrans *rt, Msg *in)
 
 
 
-void check_msg_sent (Retrans *rt, Msg *in) 
+void check_msg_sent (Retrans *rt, Msg *out, l2addr *dest) 
 {
-    switch (get_type (in))
+    switch (get_type (out))
     {
 	case COAP_TYPE_CON :
-	    addRetrans (rt, in) ;
+	    addRetrans (rt, out, dest) ;
 	    break ;
 	default :
 	    break ;
@@ -126,49 +223,54 @@ void check_msg_sent (Retrans *rt, Msg *in)
 }
 
 
+// link quality of a frame received from a peer
+void lqiRetrans (Retrans *rt, l2addr *src, uint8_t lqi)
+{
+    update_lqi (getRtoPeer (&rt->rto_, src, rt->cur_), lqi) ;
+}
+
+
 // for internal use only
-void delRetransIntern1 (Retrans *rt, retransq *r) 
+void delRetransIntern (Retrans *rt, retransq *r) 
 {
-    retransq *cur, *prev ;
+    retransq **pp ;
 
-    prev = NULL ;
-    for (cur = rt->retransq_ ; cur != NULL ; cur = cur->next)
+    for (pp = &rt->hash_ [HASH (r->id)] ; *pp != NULL ; pp = &(*pp)->hnext)
     {
-		if (cur == r)
+		if (*pp == r)
+		{
+		    *pp = r->hnext ;
 		    break ;
-		prev = cur ;
+		}
     }
-
-    if (cur != NULL)
-	delRetransIntern2 (rt, prev, cur) ;
+    unlink_sorted (rt, r) ;
+    releasePktbuf (r->pkt) ;
+    CASAN_FREE (pool_retransq, r) ;
 }
 
 
 
-// for internal use only
-void delRetransIntern2 (Retrans *rt, retransq *prev, retransq *cur) 
-{
-    if (prev == NULL)
-		rt->retransq_ = cur->next ;
-    else
-		prev->next = cur->next ;
-    if (cur->msg != NULL)
-		freeMsg (cur->msg) ;
-    free (cur) ;
-}
-
-
+/*
+ * Get the message acknowledged by an incoming message, given the
+ * peer address, the message id and the token. An empty ACK (or RST)
+ * does not carry any token, thus token is only checked for a
+ * piggy-backed answer.
+ */
 
-// get a message to retransmit, given its message id
-retransq *getRetrans (Retrans *rt, Msg *msg) 
+retransq *getRetrans (Retrans *rt, Msg *msg, l2addr *src) 
 {
     retransq *cur ;
+    uint16_t id ;
+    bool empty ;
 
-    for (cur = rt->retransq_ ; cur != NULL ; cur = cur->next)
+    id = get_id (msg) ;
+    empty = get_code (msg) == COAP_CODE_EMPTY ;
+    for (cur = rt->hash_ [HASH (id)] ; cur != NULL ; cur = cur->hnext)
     {
-	// TODO : maybe check the token too
-	if (get_id (cur->msg) == get_id (msg))
-	    break ;
+		if (cur->id == id
+			&& (src == NULL || isEqualAddr (&cur->dest, src))
+			&& (empty || isEqualToken (cur->tok, *get_token_msg (msg))))
+		    break ;
     }
     return cur ;
-}
\ No newline at end of file
+}
@@ -7,53 +7,84 @@
  * This class provides support for a list of messages to retransmit
  * The loop function must be called periodically in order to
  * retransmit and/or expire messages.
+ *
+ * The queue does not keep the messages themselves, but only a
+ * reference to their encoded form (see Pktbuf): a retransmission
+ * just hands the same bytes back to the L2 network.
+ *
+ * Entries are kept sorted by time of next transmission, such that
+ * the loop function only touches entries which are due. Entries are
+ * also chained in a small hash table indexed by message id, in order
+ * to quickly find the entry acknowledged by an incoming message.
+ * An entry is identified by (peer address, message id, token).
+ *
+ * Timeouts are not fixed: they are computed for each peer from the
+ * measured ACK latency (see rto.h).
  */
 
 #include "msg.h"
 #include "time.h"
+#include "rto.h"
 
 #define DEFAULT_TIMER 4000
 
+// number of hash buckets (must be a power of 2)
+#define	RETRANS_HASH	8
+
 
 typedef struct retransq
 {
-    Msg *msg ;
-    time_t timelast ;		// time of last transmission
+    Pktbuf *pkt ;		// encoded message (shared reference)
+    l2addr dest ;		// destination of message
+    uint16_t id ;		// message id
+    token tok ;			// message token
+    time_t timefirst ;		// time of first transmission
     time_t timenext ;		// time of next transmission
+    uint32_t timeout ;		// current timeout
+    uint32_t timeout0 ;		// initial timeout
     uint8_t ntrans ;		// # of retransmissions 
-    struct retransq *next ;		// next in queue
+    struct retransq *prev ;	// previous in queue
+    struct retransq *next ;	// next in queue (later timenext)
+    struct retransq *hnext ;	// next in hash bucket
 } retransq;
 
 
 typedef struct retrans {
-	retransq *retransq_ ;
-	l2addr_154 **master_addr_ ;
+	retransq *retransq_ ;		// sorted by timenext
+	retransq *hash_ [RETRANS_HASH] ;	// indexed by message id
+	l2addr **master_addr_ ;	// default destination
+	time_t *cur_ ;		// current time, kept by the engine
+	Rto rto_ ;			// per-peer timeout estimation
 }Retrans;
 
 
 void freeRetrans(Retrans *rt);
 
-Retrans *initRetrans (void);
+Retrans *initRetrans (time_t *cur) ;
 
 void resetRetrans (Retrans *rt) ;
 
-void master (Retrans *rt, l2addr_154 **master);
+void master (Retrans *rt, l2addr **master);
+
+void addRetrans (Retrans *rt, Msg *msg, l2addr *dest) ;
+
+void delRetrans (Retrans *rt, Msg *msg, l2addr *src);
 
-void addRetrans (Retrans *rt, Msg *msg) ;
+void delRetransDest (Retrans *rt, l2addr *dest);
 
-void delRetrans (Retrans *rt, Msg *msg);
+void loopRetrans (Retrans *rt, l2net *l2, time_t *curtime);
 
-void loopRetrans (Retrans *rt, l2net_154 *l2, time_t *curtime);
+bool nextRetrans (Retrans *rt, time_t *next) ;
 
-void check_msg_received (Retrans *rt, Msg *in);
+void check_msg_received (Retrans *rt, Msg *in, l2addr *src);
 
-void check_msg_sent (Retrans *rt, Msg *in) ;
+void check_msg_sent (Retrans *rt, Msg *out, l2addr *dest) ;
 
-void delRetransIntern1 (Retrans *rt, retransq *r);
+void lqiRetrans (Retrans *rt, l2addr *src, uint8_t lqi) ;
 
-void delRetransIntern2 (Retrans *rt, retransq *prev, retransq *cur);
+void delRetransIntern (Retrans *rt, retransq *r);
 
-retransq *getRetrans (Retrans *rt, Msg *msg);
+retransq *getRetrans (Retrans *rt, Msg *msg, l2addr *src);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,220 @@
+/**
+ * @file rto.c
+ * @brief retransmission timeout estimation implementation
+ */
+
+#include "rto.h"
+
+/*
+ * Pseudo-random generator (xorshift32). The seed must be different
+ * on each node (see initCasan), else random delays are identical.
+ * The state is kept in the Rto object, such that several engines
+ * in the same process draw independent sequences.
+ */
+
+void seed_random (Rto *r, uint32_t seed)
+{
+    if (seed == 0)			// xorshift is stuck on 0
+	seed = 0x2545f491 ;
+    r->rnd_ = seed ;
+}
+
+uint32_t next_random (Rto *r)
+{
+    uint32_t x = r->rnd_ ;
+
+    x ^= x << 13 ;
+    x ^= x >> 17 ;
+    x ^= x << 5 ;
+    r->rnd_ = x ;
+    return x ;
+}
+
+
+/******************************************************************************
+ * Per-peer estimators
+ */
+
+void resetRto (Rto *r)
+{
+    memset (r->peer_, 0, sizeof r->peer_) ;
+}
+
+
+/**
+ * @brief Find the estimator for a peer
+ *
+ * If the peer is not known, the least recently used entry
+ * is recycled and initialized with default values.
+ *
+ * @param r estimator table
+ * @param a peer address
+ * @param cur current time
+ * @return estimator (never NULL)
+ */
+
+rtopeer *getRtoPeer (Rto *r, l2addr *a, time_t *cur)
+{
+    rtopeer *p, *lru ;
+    int i ;
+
+    lru = &r->peer_ [0] ;
+    for (i = 0 ; i < RTO_NPEERS ; i++)
+    {
+	p = &r->peer_ [i] ;
+	if (p->used_ && isEqualAddr (&p->addr_, a))
+	{
+	    p->lastuse_ = *cur ;
+	    return p ;
+	}
+	if (! p->used_ || (lru->used_ && p->lastuse_ < lru->lastuse_))
+	    lru = p ;
+    }
+
+    memset (lru, 0, sizeof *lru) ;
+    copyAddr (&lru->addr_, a) ;
+    lru->used_ = true ;
+    lru->rto_ = ACK_TIMEOUT ;
+    lru->lastupd_ = *cur ;
+    lru->lastuse_ = *cur ;
+    return lru ;
+}
+
+
+/*
+ * RTO aging (CoCoA): a small RTO which has not been updated for a
+ * long time is doubled, a large one is moved back towards the
+ * default value.
+ */
+
+static void age_rto (rtopeer *p, time_t *cur)
+{
+    time_t idle = *cur - p->lastupd_ ;
+
+    if (p->rto_ < 1000 && idle > 16 * (time_t) p->rto_)
+    {
+	p->rto_ *= 2 ;
+	p->lastupd_ = *cur ;
+    }
+    else if (p->rto_ > 3000 && idle > 4 * (time_t) p->rto_)
+    {
+	p->rto_ = (ACK_TIMEOUT + p->rto_) / 2 ;
+	p->lastupd_ = *cur ;
+    }
+}
+
+
+/**
+ * @brief Initial timeout for a new CON message sent to a peer
+ *
+ * The timeout is randomly chosen between RTO and
+ * RTO * ACK_RANDOM_FACTOR, then inflated if the link to the peer
+ * is poor.
+ */
+
+uint32_t initial_timeout (Rto *r, rtopeer *p, time_t *cur)
+{
+    uint32_t t, spread ;
+
+    age_rto (p, cur) ;
+    t = p->rto_ ;
+    spread = (uint32_t) (t * (ACK_RANDOM_FACTOR - 1)) ;
+    if (spread > 0)
+	t += next_random (r) % spread ;
+    if (p->lqi_ != 0 && p->lqi_ < RTO_LQI_LOW)
+	t += t * (RTO_LQI_LOW - p->lqi_) / RTO_LQI_LOW ;
+    return t ;
+}
+
+
+/**
+ * @brief Timeout for the next retransmission
+ *
+ * The backoff factor depends on the initial timeout of the
+ * exchange (CoCoA variable backoff factor): a short timeout
+ * grows faster, a long one grows slower.
+ *
+ * @param timeout current timeout
+ * @param initial initial timeout of the exchange
+ */
+
+uint32_t backoff_timeout (uint32_t timeout, uint32_t initial)
+{
+    if (initial < 1000)
+	timeout *= 3 ;
+    else if (initial > 3000)
+	timeout += timeout / 2 ;
+    else
+	timeout *= 2 ;
+    return timeout ;
+}
+
+
+// one RFC 6298 estimator step, returns SRTT + k*RTTVAR
+static uint32_t estimate (uint32_t *srtt, uint32_t *rttvar, bool *init,
+				uint32_t rtt, int k)
+{
+    uint32_t delta ;
+
+    if (! *init)
+    {
+	*srtt = rtt ;
+	*rttvar = rtt / 2 ;
+	*init = true ;
+    }
+    else
+    {
+	delta = *srtt > rtt ? *srtt - rtt : rtt - *srtt ;
+	*rttvar = (3 * *rttvar + delta) / 4 ;		// beta = 1/4
+	*srtt = (7 * *srtt + rtt) / 8 ;			// alpha = 1/8
+    }
+    return *srtt + k * *rttvar ;
+}
+
+
+/**
+ * @brief Give a RTT measure to the estimator
+ *
+ * @param p peer
+ * @param rtt time between the first transmission and the ACK
+ * @param ntrans number of retransmissions of the message: 0 feeds
+ *	the strong estimator, 1 or 2 feed the weak one, more are
+ *	ignored since the measure is too ambiguous
+ * @param cur current time
+ */
+
+void update_rtt (rtopeer *p, uint32_t rtt, uint8_t ntrans, time_t *cur)
+{
+    uint32_t e ;
+
+    if (ntrans == 0)
+    {
+	e = estimate (&p->ssrtt_, &p->srttvar_, &p->strong_, rtt, 4) ;
+	p->rto_ = (e + p->rto_) / 2 ;
+    }
+    else if (ntrans <= 2)
+    {
+	e = estimate (&p->wsrtt_, &p->wrttvar_, &p->weak_, rtt, 1) ;
+	p->rto_ = (e + 3 * p->rto_) / 4 ;
+    }
+    else return ;
+
+    if (p->rto_ < RTO_MIN)
+	p->rto_ = RTO_MIN ;
+    if (p->rto_ > RTO_MAX)
+	p->rto_ = RTO_MAX ;
+    p->lastupd_ = *cur ;
+}
+
+
+/**
+ * @brief Give the LQI of a frame received from the peer
+ */
+
+void update_lqi (rtopeer *p, uint8_t lqi)
+{
+    if (p->lqi_ == 0)
+	p->lqi_ = lqi ;
+    else
+	p->lqi_ = (uint8_t) ((3 * (uint16_t) p->lqi_ + lqi) / 4) ;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file rto.h
+ * @brief retransmission timeout estimation
+ *
+ * This file provides:
+ * - a small seeded pseudo-random generator (one per estimator), used
+ *   to randomize initial timeouts (RFC 7252, section 4.2) such that slaves do
+ *   not retransmit in lockstep, for example after a master outage
+ * - a per-peer RTT estimator, following the CoCoA proposal
+ *   (draft-ietf-core-cocoa): a "strong" estimator fed with RTT
+ *   measured on messages acknowledged without retransmission, and
+ *   a "weak" estimator fed with RTT measured on messages which
+ *   needed 1 or 2 retransmissions. Both estimators are combined
+ *   in a single RTO per peer.
+ *
+ * The link quality (LQI) of frames received from a peer can also
+ * be given to the estimator: a poor link inflates the initial
+ * timeout.
+ *
+ * All times are expressed in milliseconds.
+ */
+
+#ifndef __RTO_H__
+#define __RTO_H__
+
+#include "time.h"
+#include "l2.h"
+
+// number of peers for which an estimation is kept
+#define	RTO_NPEERS	4
+
+// bounds for the RTO
+#define	RTO_MIN		100
+#define	RTO_MAX		32000
+
+// LQI below which the initial timeout is inflated (up to 2 times)
+#define	RTO_LQI_LOW	128
+
+typedef struct rtopeer {
+	l2addr addr_ ;
+	bool used_ ;
+	bool strong_ ;			// strong estimator initialized
+	bool weak_ ;			// weak estimator initialized
+	uint8_t lqi_ ;			// smoothed LQI (0 if unknown)
+	uint32_t ssrtt_, srttvar_ ;	// strong estimator
+	uint32_t wsrtt_, wrttvar_ ;	// weak estimator
+	uint32_t rto_ ;			// combined RTO
+	time_t lastupd_ ;		// last update of rto_
+	time_t lastuse_ ;		// for replacement
+} rtopeer;
+
+typedef struct rto {
+	rtopeer peer_ [RTO_NPEERS] ;
+	uint32_t rnd_ ;			// pseudo-random generator state
+} Rto;
+
+
+void seed_random (Rto *r, uint32_t seed) ;
+uint32_t next_random (Rto *r) ;
+
+void resetRto (Rto *r) ;
+rtopeer *getRtoPeer (Rto *r, l2addr *a, time_t *cur) ;
+
+uint32_t initial_timeout (Rto *r, rtopeer *p, time_t *cur) ;
+uint32_t backoff_timeout (uint32_t timeout, uint32_t initial) ;
+void update_rtt (rtopeer *p, uint32_t rtt, uint8_t ntrans, time_t *cur) ;
+void update_lqi (rtopeer *p, uint8_t lqi) ;
+
+#endif
@@ -4,6 +4,7 @@
  */
 
 #include "time.h"
+#include "pool.h"
 
 /*
  * Timers values (expressed in ms)
@@ -30,10 +31,8 @@
  * Current time
  */
 
-time_t curtime ;			// global variable
-
-// synchronize current time with help of millis ()
-// Should be used on curtime global variable, but can also be used on any var
+// synchronize current time with help of clock_time ()
+// Used on the current time of each engine, but can also be used on any var
 void sync_time (time_t *cur)		
 {
     unsigned long int ms ;
@@ -66,18 +65,37 @@ void print_time (time_t *t)
  *      states
  */
 
-/** @brief Initialize the timer with the current time
+/** @brief Allocate the timer and initialize it with the current time
  */
 
 Twait *initTwait (time_t *cur)
 {
-	Twait *tw = (Twait *) malloc(sizeof(Twait));
+	Twait *tw = (Twait *) CASAN_MALLOC (ALLOC_CASAN, sizeof(Twait));
     if (tw == NULL)
-        printf("Memory allocation failed\n");
+        CLOG_ERR ("Memory allocation failed\n") ;
+    else
+        resetTwait (tw, cur) ;
+    return tw;
+}
+
+
+/** @brief Release the timer
+ */
+
+void freeTwait (Twait *tw)
+{
+    CASAN_MFREE (tw) ;
+}
+
+
+/** @brief Restart an existing timer with the current time
+ */
+
+void resetTwait (Twait *tw, time_t *cur)
+{
     tw->limit_ = *cur + TIMER_WAIT_MAX ;
     tw->inc_ = TIMER_WAIT_START ;
     tw->next_ = *cur + tw->inc_ ;
-    return tw;
 }
 
 
@@ -109,20 +127,40 @@ bool expiredTwait (Twait *tw, time_t *cur)
 }
 
 
-/** @brief Initialize the timer with the current time and the Slave TTL
- *	returned by the master in its Assoc message.
+/** @brief Allocate the timer and initialize it with the current time
+ *	and the Slave TTL returned by the master in its Assoc message.
  */
 
 Trenew *initTrenew ( time_t *cur, time_t sttl)
 {
-	Trenew *tr = (Trenew *) malloc (sizeof(Trenew));
+	Trenew *tr = (Trenew *) CASAN_MALLOC (ALLOC_CASAN, sizeof(Trenew));
     if (tr == NULL)
-        printf("Memory allocation failed\n");
+        CLOG_ERR ("Memory allocation failed\n") ;
+    else
+        resetTrenew (tr, cur, sttl) ;
+    return tr;
+}
+
+
+/** @brief Release the timer
+ */
+
+void freeTrenew (Trenew *tr)
+{
+    CASAN_MFREE (tr) ;
+}
+
+
+/** @brief Restart an existing timer with the current time and the
+ *	Slave TTL returned by the master in its Assoc message.
+ */
+
+void resetTrenew (Trenew *tr, time_t *cur, time_t sttl)
+{
     tr->inc_ = sttl / 2 ;
 
     tr->next_ = *cur + tr->inc_ ;
     tr->limit_ = *cur + sttl ;
-    return tr;
 }
 
 
@@ -29,22 +29,19 @@ typedef uint64_t time_t ;
 
 typedef uint64_t timediff_t ;
 
-/** @brief Current time
- *
- * This variable is globally declared, such as every application
- * can make use of it.
+/** @brief Time value meaning "no deadline"
  */
 
-extern time_t curtime ;
+#define	TIME_NEVER	((time_t) -1)
 
 /** @brief Synchronize current time
  *
  * This function synchronizes time in a variable with the help of
  * the `millis()` function (standard Arduino library).
  *
- * It is meant to be used with the `curtime` global variable, but can
- * be used with any variable of type `time_t` (provided that it is
- * correctly initialized).
+ * Each CASAN engine keeps its own current time (see casan.h), but
+ * this function can be used with any variable of type `time_t`
+ * (provided that it is correctly initialized).
  *
  * Note that time synchronization cannot work if calls to this function
  * are spaced with more than ~50 days. As such, this function should be
@@ -80,6 +77,10 @@ typedef struct twait {
 
 Twait *initTwait(time_t *cur);
 
+void freeTwait (Twait *tw);
+
+void resetTwait (Twait *tw, time_t *cur);
+
 bool nextTwait (Twait *tw, time_t *cur);
 
 bool expiredTwait (Twait *tw, time_t *cur);
@@ -104,6 +105,8 @@ typedef struct trenew {
 }	Trenew;
 
 Trenew *initTrenew (time_t *cur, time_t sttl) ;
+void freeTrenew (Trenew *tr) ;
+void resetTrenew (Trenew *tr, time_t *cur, time_t sttl) ;
 bool renewTrenew (Trenew *tr, time_t *cur) ;		// time to enter renew state
 bool nextTrenew (Trenew *tr, time_t *cur) ;		// next discover
 bool expiredTrenew (Trenew *tr, time_t *cur) ;		// time to enter waiting_known
@@ -11,7 +11,7 @@
 
 
 void freeToken(token *to) {
-    free(to);
+    CASAN_FREE (pool_token, to) ;
 }
 
 /**
@@ -22,10 +22,11 @@ void freeToken(token *to) {
 
 token *initToken(void)
 {
-    token *to = (token *) malloc (sizeof (struct Token));
+    token *to = (token *) CASAN_ALLOC (pool_token, sizeof (struct Token));
     if (to == NULL)
-        printf("Memory allocation failed\n");
-    to->toklen_ = 0 ;
+        CLOG_ERR ("Memory allocation failed\n") ;
+    else
+        to->toklen_ = 0 ;
     return to;
 }
 
@@ -36,9 +37,11 @@ token *initToken(void)
  */
 
 token *initTokenChar(char *str) {
- 	token *to = (token *) malloc (sizeof (struct Token));
-    if (to == NULL)
-        printf("Memory allocation failed\n");
+ 	token *to = (token *) CASAN_ALLOC (pool_token, sizeof (struct Token));
+    if (to == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
     to->toklen_ = 0 ;
  	int i =0;
 
@@ -64,9 +67,11 @@ token *initTokenChar(char *str) {
  */
 
 token *initTokenToken(uint8_t *val, size_t len) {
- 	token *to = (token *) malloc (sizeof (struct Token));
-    if (to == NULL)
-        printf("Memory allocation failed\n");
+ 	token *to = (token *) CASAN_ALLOC (pool_token, sizeof (struct Token));
+    if (to == NULL) {
+        CLOG_ERR ("Memory allocation failed\n") ;
+        return NULL;
+    }
  	if (len > 0 && len < NTAB (to->token_)) {
  		to->toklen_ = len;
  		memcpy( to->token_, val, len);
@@ -8,6 +8,7 @@
 
 #include "contiki.h"
 #include "defs.h"
+#include "pool.h"
 #include <stddef.h> 
 #include "stdbool.h"
 
@@ -26,6 +27,8 @@ typedef struct Token {
 
 token *initToken (void);
 
+void freeToken (token *to);
+
 token *initTokenChar(char *str) ;
 
 token *initTokenToken(uint8_t *val, size_t len);
@@ -0,0 +1,137 @@
+/**
+ * @file trace.c
+ * @brief binary event trace implementation
+ */
+
+#include "trace.h"
+
+// the host port runs one node per thread (see host/contiki.h)
+#ifndef PLATFORM_THREAD_LOCAL
+#define	PLATFORM_THREAD_LOCAL
+#endif
+
+static PLATFORM_THREAD_LOCAL Trace *curtrace ;
+
+
+bool initTrace (Trace *t, TraceRec *rec, int nrec)
+{
+    unsigned int n ;
+
+    if (rec == NULL || nrec < 1)
+	return false ;
+    for (n = 1 ; 2 * n <= (unsigned int) nrec ; n *= 2)
+	;
+    t->rec_ = rec ;
+    t->mask_ = n - 1 ;
+    t->next_ = 0 ;
+    return true ;
+}
+
+
+void trace_select (Trace *t)
+{
+    curtrace = t ;
+}
+
+
+Trace *trace_selected (void)
+{
+    return curtrace ;
+}
+
+
+/*
+ * Hot path: only the reservation of the record is done with
+ * interrupts disabled, an interrupt may then record its own event
+ * in the next record.
+ */
+
+void trace_event (uint16_t id, uint16_t a0, uint32_t a1, uint32_t a2)
+{
+    Trace *t ;
+    TraceRec *r ;
+    unsigned int i ;
+
+    t = curtrace ;
+    if (t == NULL)
+	return ;
+    platform_enter_critical () ;
+    i = t->next_++ ;
+    platform_exit_critical () ;
+    r = &t->rec_ [i & t->mask_] ;
+    r->time = (uint32_t) clock_time () ;
+    r->id = id ;
+    r->arg0 = a0 ;
+    r->arg1 = a1 ;
+    r->arg2 = a2 ;
+}
+
+
+int trace_count (Trace *t)
+{
+    return t->next_ <= t->mask_ ? t->next_ : t->mask_ + 1 ;
+}
+
+
+uint32_t trace_lost (Trace *t)
+{
+    return t->next_ - trace_count (t) ;
+}
+
+
+const TraceRec *trace_get (Trace *t, int i)
+{
+    if (i < 0 || i >= trace_count (t))
+	return NULL ;
+    return &t->rec_ [(trace_lost (t) + i) & t->mask_] ;
+}
+
+
+void trace_clear (Trace *t)
+{
+    t->next_ = 0 ;
+}
+
+
+static uint8_t *put16 (uint8_t *p, uint16_t v)
+{
+    *p++ = v >> 0 ;
+    *p++ = v >> 8 ;
+    return p ;
+}
+
+static uint8_t *put32 (uint8_t *p, uint32_t v)
+{
+    *p++ = v >> 0 ;
+    *p++ = v >> 8 ;
+    *p++ = v >> 16 ;
+    *p++ = v >> 24 ;
+    return p ;
+}
+
+void trace_write (Trace *t, trace_write_t fn, void *arg)
+{
+    uint8_t buf [TRACE_HDRLEN], *p ;
+    const TraceRec *r ;
+    int i, n ;
+
+    n = trace_count (t) ;
+    memcpy (buf, TRACE_MAGIC, 4) ;
+    p = put16 (buf + 4, TRACE_VERSION) ;
+    p = put16 (p, TRACE_RECLEN) ;
+    p = put32 (p, CLOCK_SECOND) ;
+    p = put32 (p, n) ;
+    p = put32 (p, trace_lost (t)) ;
+    (*fn) (arg, buf, p - buf) ;
+
+    for (i = 0 ; i < n ; i++)
+    {
+	r = trace_get (t, i) ;
+	p = put32 (buf, r->time) ;
+	p = put16 (p, r->id) ;
+	p = put16 (p, r->arg0) ;
+	p = put32 (p, r->arg1) ;
+	p = put32 (p, r->arg2) ;
+	(*fn) (arg, buf, p - buf) ;
+    }
+}
@@ -0,0 +1,172 @@
+/**
+ * @file trace.h
+ * @brief log levels and binary event trace
+ *
+ * Messages printed by the libraries are sorted by level. Only the
+ * levels up to CASAN_LOG_LEVEL (CLOG_LEVEL_ERROR by default) are
+ * compiled in: the others cost nothing, not even the evaluation of
+ * their arguments. For example, -DCASAN_LOG_LEVEL=CLOG_LEVEL_INFO
+ * prints the state changes of the engine, as older versions did.
+ *
+ * Printing on a serial line takes milliseconds, which is enough to
+ * miss a radio frame or a duty-cycle deadline. Events on the hot
+ * paths (state changes, frames sent and received, requests) are
+ * rather recorded in a binary trace: each event is a fixed-size
+ * record (timestamp, event identifier and three arguments) written
+ * in a RAM ring, where the oldest records are overwritten when the
+ * ring is full. Recording an event costs a few tens of cycles. The
+ * trace is exported (trace_write) as a compact file, which is decoded
+ * off-node by a host tool (see host/tracedec.h).
+ *
+ * Events are recorded in the trace selected with `trace_select`
+ * (NULL, the default, disables the recording at run time). The
+ * selected trace is per-thread on the host: the scheduler does not
+ * select any, so a simulation which wants a trace per node must
+ * select it in the run function of the node agent (see
+ * host/sched.h) before running the node. The TRACE macro
+ * is only compiled in when the libraries are compiled with
+ * CASAN_TRACE defined: otherwise, tracing is free.
+ *
+ * Exported file (integers are little-endian):
+ *	header (20 bytes): "CTRC", version (2 bytes), record size
+ *		(2 bytes), clock ticks per second (4 bytes), number of
+ *		records (4 bytes), number of records lost (overwritten)
+ *		before the first one (4 bytes)
+ *	records (oldest first): see TraceRec
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "contiki.h"
+#include "stdbool.h"
+
+/*
+ * Log levels
+ */
+
+#define	CLOG_LEVEL_NONE		0
+#define	CLOG_LEVEL_ERROR	1	// allocation failures, broken invariants
+#define	CLOG_LEVEL_WARN		2	// unexpected input from the network
+#define	CLOG_LEVEL_INFO		3	// engine state changes
+#define	CLOG_LEVEL_DEBUG	4	// every message
+
+#ifndef CASAN_LOG_LEVEL
+#define	CASAN_LOG_LEVEL		CLOG_LEVEL_ERROR
+#endif
+
+#define	CLOG_NOP(...)		do { } while (0)
+
+#if CASAN_LOG_LEVEL >= CLOG_LEVEL_ERROR
+#define	CLOG_ERR(...)		printf (__VA_ARGS__)
+#else
+#define	CLOG_ERR		CLOG_NOP
+#endif
+
+#if CASAN_LOG_LEVEL >= CLOG_LEVEL_WARN
+#define	CLOG_WARN(...)		printf (__VA_ARGS__)
+#else
+#define	CLOG_WARN		CLOG_NOP
+#endif
+
+#if CASAN_LOG_LEVEL >= CLOG_LEVEL_INFO
+#define	CLOG_INFO(...)		printf (__VA_ARGS__)
+#else
+#define	CLOG_INFO		CLOG_NOP
+#endif
+
+#if CASAN_LOG_LEVEL >= CLOG_LEVEL_DEBUG
+#define	CLOG_DBG(...)		printf (__VA_ARGS__)
+#else
+#define	CLOG_DBG		CLOG_NOP
+#endif
+
+/*
+ * Events. Arguments not listed are 0.
+ */
+
+typedef enum trace_id
+{
+    TR_NONE = 0,
+    /* ConMsg */
+    TR_RX,		// frame stored: a0 = length, a1 = source, a2 = lqi
+    TR_RX_DROP,		// frame heard, not stored: a0 = length, a1 = reason
+    TR_TX,		// frame given to the radio: a0 = length, a1 = dest,
+			//	a2 = MAC sequence number
+    TR_TX_DONE,		// end of a frame: a0 = tx_status_t, a1 = tries
+    /* CASAN engine */
+    TR_STATUS,		// a0 = new status, a1 = old status
+    TR_MASTER,		// master set: a0 = address, a1 = hello id, a2 = mtu
+    TR_MASTER_RESET,
+    TR_HELLO,		// Hello received: a1 = hello id
+    TR_DISCOVER,	// Discover sent: a0 = mtu, a1 = slave id
+    TR_ASSOC,		// Assoc received: a0 = mtu, a1 = slave ttl (ms),
+			//	a2 = aggregation
+    TR_CTL_UNKNOWN,	// unrecognized control message: a0 = message id
+    TR_REQUEST,		// request: a0 = code, a1 = message id,
+			//	a2 = payload length
+    TR_TOO_LARGE,	// answer does not fit: a0 = message id
+    /* CoAP codec */
+    TR_SEND,		// message sent: a0 = length, a1 = message id,
+			//	a2 = type << 8 | code
+    TR_SEND_ERR,	// a0 = reason (1: encoding, 2: L2), a1 = message id
+    TR_DECODE_ERR,	// a0 = length
+    TR_NEVENTS,
+    TR_USER = 0x100	// first event available to applications
+} trace_id_t ;
+
+#define	TR_DROP_FILTER		1	// not for us (or malformed)
+#define	TR_DROP_OVERRUN		2	// ring full
+
+typedef struct tracerec
+{
+    uint32_t time ;			// clock_time ()
+    uint16_t id ;			// trace_id_t
+    uint16_t arg0 ;
+    uint32_t arg1 ;
+    uint32_t arg2 ;
+} TraceRec ;
+
+#define	TRACE_MAGIC		"CTRC"
+#define	TRACE_VERSION		1
+#define	TRACE_HDRLEN		20
+#define	TRACE_RECLEN		16	// size of a record in the file
+
+typedef struct trace
+{
+    TraceRec *rec_ ;			// ring (provided by the caller)
+    unsigned int mask_ ;		// number of records - 1
+    volatile unsigned int next_ ;	// number of events recorded
+} Trace ;
+
+typedef void (*trace_write_t) (void *arg, const uint8_t *data, int len) ;
+
+/*
+ * `nrec` is rounded down to a power of 2. The ring may be a static
+ * array: no allocation is done.
+ */
+
+bool initTrace (Trace *t, TraceRec *rec, int nrec) ;
+void trace_select (Trace *t) ;			// NULL: stop recording
+Trace *trace_selected (void) ;
+
+void trace_event (uint16_t id, uint16_t a0, uint32_t a1, uint32_t a2) ;
+
+/*
+ * `trace_get` returns the records from the oldest (0) to the newest
+ * (trace_count-1).
+ */
+
+int trace_count (Trace *t) ;
+uint32_t trace_lost (Trace *t) ;		// records overwritten
+const TraceRec *trace_get (Trace *t, int i) ;
+void trace_clear (Trace *t) ;
+void trace_write (Trace *t, trace_write_t fn, void *arg) ;
+
+#ifdef CASAN_TRACE
+#define	TRACE(id,a0,a1,a2)	trace_event ((id), (a0), (a1), (a2))
+#else
+#define	TRACE(id,a0,a1,a2)	do { } while (0)
+#endif
+
+#endif
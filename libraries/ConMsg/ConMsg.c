@@ -1,4 +1,5 @@
 #include "ConMsg.h"
+#include "../Casan/trace.h"
 
 
 
@@ -12,128 +13,665 @@
 #define I154_ADDRLEN 2
 
 
-ConMsg *conmsg ;
+/*
+ * The radio driver calls the usr_radio_* functions from its interrupt
+ * routines, without any context: they apply to the ConMsg object
+ * which has started the radio (there is only one radio on a node).
+ */
+
+static ConMsg *radio_owner ;
+
+ConMsg *getRadioOwner (void) { return radio_owner ; }
+
+
+
+int getMsgbufsize (ConMsg *cm) { return cm->msgbufsize_ ; }
+
+addr2_t getAddr2 (ConMsg *cm) { return cm->addr2_ ; }
+
+addr8_t getAddr8 (ConMsg *cm) { return cm->addr8_ ; }
 
+panid_t getPanid (ConMsg *cm) { return cm->panid_ ; }
 
-ConStat *getstat () { return &conmsg->stat_ ; }
+channel_t getChannel (ConMsg *cm) { return cm->chan_ ; }
 
-int getMsgbufsize () { return conmsg->msgbufsize_ ; }
+bool getPromiscuous (ConMsg *cm) { return cm->promisc_ ; }
 
-addr2_t getAddr2 () { return conmsg->addr2_ ; }
+void setMsgbufsize (ConMsg *cm, int msgbufsize) { cm->msgbufsize_ = msgbufsize ; }
 
-addr8_t getAddr8 () { return conmsg->addr8_ ; }
+void setAddr2 (ConMsg *cm, addr2_t addr) { cm->addr2_ = addr ; }
 
-panid_t getPanid () { return conmsg->panid_ ; }
+void setAddr8 (ConMsg *cm, addr8_t addr) { cm->addr8_ = addr ; }
 
-channel_t getChannel () { return conmsg->chan_ ; }
+void setPanid (ConMsg *cm, panid_t panid) { cm->panid_ = panid ; }
 
-void setMsgbufsize ( int msgbufsize) { conmsg->msgbufsize_ = msgbufsize ; }
+void setChannel (ConMsg *cm, channel_t chan) {  cm->chan_ = chan ; }
 
-void setAddr2 ( addr2_t addr) { conmsg->addr2_ = addr ; }
+void setPromiscuous (ConMsg *cm, bool promisc)
+{
+    cm->promisc_ = promisc ;
+    if (radio_owner == cm)		// radio already started
+	setAddrRadio (cm->panid_, cm->addr2_, promisc) ;
+}
 
-void setAddr8 ( addr8_t addr) { conmsg->addr8_ = addr ; }
+bool getRadioOn (ConMsg *cm) { return cm->radioon_ ; }
 
-void setPanid ( panid_t panid) { conmsg->panid_ = panid ; }
 
-void setChannel ( channel_t chan) {  conmsg->chan_ = chan ; }
+/*
+ * Switch the receiver on or off, and account for the time it
+ * stays on (which dominates the energy budget).
+ */
+
+void setRadioOn (ConMsg *cm, bool on)
+{
+    clock_time_t now ;
+
+    if (on == cm->radioon_)
+	return ;
+    now = clock_time () ;
+    if (on)
+    {
+	NETSTACK_RADIO.on () ;
+	cm->onsince_ = now ;
+	cm->stat_.radio_wakeups++ ;
+    }
+    else
+    {
+	NETSTACK_RADIO.off () ;
+	cm->stat_.radio_on += now - cm->onsince_ ;
+    }
+    cm->radioon_ = on ;
+}
 
 
 uint8_t *usr_radio_receive_frame (uint8_t len, uint8_t *frm) {
-	return it_receive_frame( len, frm);
+	return it_receive_frame (radio_owner, len, frm);
 }
 
-uint8_t *it_receive_frame ( uint8_t len, uint8_t *frm)
+uint8_t *usr_radio_receive_frame_lqi (uint8_t len, uint8_t lqi, uint8_t *frm) {
+	return it_receive_frame_lqi (radio_owner, len, lqi, frm);
+}
+
+#define	Z_BROADCAST	CONST16 (0xff, 0xff)
+#define	Z_MINLEN	(2+1+2+2+2+2)	// fcf, seq, pan, dst, src, fcs
+
+/*
+ * Decode the MAC header of a received frame into the descriptor.
+ * Called by the producer (interrupt routine).
+ */
+
+static void decode_frame (ConFrameDesc *d, uint8_t *frame, uint8_t len,
+				uint8_t lqi)
 {
-	//printf ("reçu\n");
-	int newlast = (conmsg->rbuflast_ + 1) % conmsg->msgbufsize_ ;
+    uint8_t *p = frame ;
+    int intrapan ;
 
-	if (newlast == conmsg->rbuffirst_)
-	    conmsg->stat_.rx_overrun++ ;
-	else
-	{
-	    /*
-	     * There is room for a new frame:
-	     * - update the message with length and lqi
-	     * - update the frame buffer pointer
-	     */
-	    conmsg->rbuffer_ [conmsg->rbuflast_].len = len ;
+    d->rawlen = len ;
+    d->lqi = lqi ;
 
-	    conmsg->rbuflast_ = newlast ;
+    /* decode Frame Control Field */
+    d->fcf = Z_GET_INT16 (p) ;
+    p += 2 ;
 
-	    frm = (uint8_t *) conmsg->rbuffer_ [newlast].frame ;
-	}
-	//printf("%d   :   %d\n", conmsg->rbuffirst_, conmsg->rbuflast_);
-    return frm;
+    /* Sequence Number */
+    d->seq = *p++ ;
+
+    /* Dest & Src address */
+    intrapan = Z_GET_INTRA_PAN (d->fcf) ;
+    switch (Z_GET_DST_ADDR_MODE (d->fcf))
+    {
+	case Z_ADDRMODE_NOADDR :
+	    break ;
+	case Z_ADDRMODE_RESERVED :
+	    break ;
+	case Z_ADDRMODE_ADDR2 :
+	    d->dstpan = Z_GET_INT16 (p) ;
+	    p += 2 ;
+	    d->dstaddr = Z_GET_INT16 (p) ;
+	    p += 2 ;
+	    break ;
+	case Z_ADDRMODE_ADDR8 :
+	    p += 8+2 ;
+	    break ;
+    }
+    switch (Z_GET_SRC_ADDR_MODE (d->fcf))
+    {
+	case Z_ADDRMODE_NOADDR :
+	    break ;
+	case Z_ADDRMODE_RESERVED :
+	    break ;
+	case Z_ADDRMODE_ADDR2 :
+	    if (intrapan != 0)
+		d->srcpan = d->dstpan ;
+	    else
+	    {
+		d->srcpan = Z_GET_INT16 (p) ;
+		p += 2 ;
+	    }
+	    d->srcaddr = Z_GET_INT16 (p) ;
+	    p += 2 ;
+	    break ;
+	case Z_ADDRMODE_ADDR8 :
+	    if (intrapan == 0)
+		p += 2 ;
+	    p += 8 ;
+	    break ;
+    }
+    d->payoff = p - frame ;
 }
 
 
 /*
- * Called by interrupt routine (see radio_rfa.c) when a transmission
- * is done. Update statistics.
+ * Check if a decoded frame must be kept. Return false (and update
+ * the drop counters) if the frame is not for us.
  */
 
-void usr_radio_tx_done ()
+static bool accept_frame (ConMsg *cm, ConFrameDesc *d)
 {
-	it_tx_done();
+    if (cm->promisc_)
+	return true ;
+    if (d->rawlen < Z_MINLEN)
+    {
+	cm->stat_.rx_drop_short++ ;
+	return false ;
+    }
+    if (Z_GET_FRAMETYPE (d->fcf) != Z_FT_DATA
+	    || Z_GET_DST_ADDR_MODE (d->fcf) != Z_ADDRMODE_ADDR2
+	    || Z_GET_SRC_ADDR_MODE (d->fcf) != Z_ADDRMODE_ADDR2
+	    || ! Z_GET_INTRA_PAN (d->fcf))
+    {
+	cm->stat_.rx_drop_type++ ;
+	return false ;
+    }
+    if (d->dstpan != cm->panid_ && d->dstpan != Z_BROADCAST)
+    {
+	cm->stat_.rx_drop_pan++ ;
+	return false ;
+    }
+    if (d->dstaddr != cm->addr2_ && d->dstaddr != Z_BROADCAST)
+    {
+	cm->stat_.rx_drop_dest++ ;
+	return false ;
+    }
+    return true ;
 }
 
 
-void it_tx_done ()
+/*
+ * Duplicate detection, by the producer. is_duplicate checks the
+ * frame against the table, and record_frame updates the table once
+ * the frame is stored (a frame dropped for lack of room must not
+ * prevent its retransmission from being accepted).
+ */
+
+static ConDup *find_dup (ConMsg *cm, addr2_t src)
 {
-	
-    conmsg->writing_ = false ;
+    int i ;
+
+    for (i = 0 ; i < CONMSG_DUPTAB ; i++)
+	if (cm->dup_ [i].used && cm->dup_ [i].src == src)
+	    return &cm->dup_ [i] ;
+    return NULL ;
 }
 
+static bool is_duplicate (ConMsg *cm, ConFrameDesc *d, clock_time_t now)
+{
+    ConDup *e ;
 
+    if (cm->promisc_)
+	return false ;
+    e = find_dup (cm, d->srcaddr) ;
+    if (e != NULL && e->seq == d->seq && now - e->time < CONMSG_DUP_LIFETIME)
+    {
+	cm->stat_.rx_duplicate++ ;
+	return true ;
+    }
+    return false ;
+}
+
+static void record_frame (ConMsg *cm, ConFrameDesc *d, clock_time_t now)
+{
+    ConDup *e ;
 
-void init() {
-	conmsg->chan_ = 13;
-	conmsg->writing_ = false;
+    e = find_dup (cm, d->srcaddr) ;
+    if (e == NULL)
+    {
+	e = &cm->dup_ [cm->dupnext_] ;
+	cm->dupnext_ = (cm->dupnext_ + 1) % CONMSG_DUPTAB ;
+	e->src = d->srcaddr ;
+	e->used = true ;
+    }
+    e->seq = d->seq ;
+    e->time = now ;
 }
 
 
-void start() {
+/*
+ * Occupancy of the receive buffer, in bytes (including the unused
+ * space before a wrap marker) and in frames
+ */
+
+int getRxOccupancy (ConMsg *cm, int *nframes)
+{
+    unsigned int head, tail ;
+
+    head = cm->rbufhead_ ;
+    tail = cm->rbuftail_ ;
+    if (nframes != NULL)
+	*nframes = cm->rbufnin_ - cm->rbufnout_ ;
+    return head >= tail ? head - tail : cm->rbufsize_ - tail + head ;
+}
+
+
+/*
+ * Frame capture: a record is reserved in the ring (the TX path may
+ * be interrupted by the RX interrupt routine), then filled.
+ */
+
+static void capture_frame (ConMsg *cm, uint8_t dir, const uint8_t *frame,
+				uint8_t len, uint8_t lqi)
+{
+    ConCapRec *r ;
+    unsigned int i ;
+
+    platform_enter_critical () ;
+    i = cm->cap_.next++ ;
+    platform_exit_critical () ;
+    if (len > MAX_PAYLOAD)
+	len = MAX_PAYLOAD ;
+    r = &cm->cap_.rec [i % cm->cap_.size] ;
+    r->time = clock_time () ;
+    r->dir = dir ;
+    r->len = len ;
+    r->lqi = lqi ;
+    memcpy (r->frame, frame, len) ;
+}
+
+
+uint8_t *it_receive_frame (ConMsg *cm, uint8_t len, uint8_t *frm)
+{
+    return it_receive_frame_lqi (cm, len, 0, frm) ;		// lqi unknown
+}
+
+
+/*
+ * Producer side of the receive ring: the frame has been received
+ * in the free area at head. The frame is kept if it is for us and
+ * if a new free area can be found for the next frame, either just
+ * after this record or at the beginning of the buffer.
+ */
+
+uint8_t *it_receive_frame_lqi (ConMsg *cm, uint8_t len, uint8_t lqi, uint8_t *frm)
+{
+    unsigned int head, tail, next, size ;
+    ConFrameDesc *d ;
+    clock_time_t now ;
+    bool wrap, ok ;
+    int n ;
+
+    head = cm->rbufhead_ ;
+    tail = cm->rbuftail_ ;
+    size = cm->rbufsize_ ;
+    d = (ConFrameDesc *) (cm->rbuffer_ + head) ;
+
+    decode_frame (d, cm->rbuffer_ + head + CONMSG_DESCSZ, len, lqi) ;
+    now = clock_time () ;
+    if (cm->cap_.size > 0)
+	capture_frame (cm, CONCAP_RX, cm->rbuffer_ + head + CONMSG_DESCSZ, len, lqi) ;
+    cm->stat_.rx_heard++ ;
+    cm->stat_.rx_airtime += Z_AIRTIME_US (len + 2) ;	// with FCS
+    cm->stat_.rx_lqi [lqi / (256 / CONSTAT_LQI_BUCKETS)]++ ;
+    if (! accept_frame (cm, d) || is_duplicate (cm, d, now))
+    {
+	TRACE (TR_RX_DROP, len, TR_DROP_FILTER, 0) ;
+	return frm ;			// already counted
+    }
+
+    d->reclen = CONMSG_DESCSZ + CONMSG_ALIGN (len) ;
+    next = head + d->reclen ;
+    wrap = next + CONMSG_MAXREC > size ;
+    if (tail <= head)			// stored records are contiguous
+	ok = ! wrap || CONMSG_MAXREC <= tail ;
+    else				// stored records wrap around
+	ok = ! wrap && next + CONMSG_MAXREC <= tail ;
+
+    if (! ok)
+    {
+	cm->stat_.rx_overrun++ ;
+	TRACE (TR_RX_DROP, len, TR_DROP_OVERRUN, 0) ;
+	return frm ;
+    }
+
+    if (wrap)
+    {
+	if (next < size)
+	    ((ConFrameDesc *) (cm->rbuffer_ + next))->reclen = 0 ;
+	next = 0 ;
+    }
+    record_frame (cm, d, now) ;
+    CONMSG_BARRIER () ;			// publish record before index
+    cm->rbufhead_ = next ;
+    cm->rbufnin_++ ;
+    cm->stat_.rx_stored++ ;
+    TRACE (TR_RX, len, d->srcaddr, lqi) ;
+
+    n = getRxOccupancy (cm, NULL) ;
+    if (n > cm->stat_.rx_hwm_bytes)
+	cm->stat_.rx_hwm_bytes = n ;
+    n = cm->rbufnin_ - cm->rbufnout_ ;
+    if (n > cm->stat_.rx_hwm_frames)
+	cm->stat_.rx_hwm_frames = n ;
+
+    return cm->rbuffer_ + next + CONMSG_DESCSZ ;
+}
+
+
+// driver result (RADIO_TX_*) to ConMsg status
+static tx_status_t radio_tx_status (int r)
+{
+    switch (r)
+    {
+	case RADIO_TX_OK :		return TX_OK ;
+	case RADIO_TX_NOACK :		return TX_NOACK ;
+	case RADIO_TX_COLLISION :	return TX_CCA_FAIL ;
+	default :			return TX_FAIL ;
+    }
+}
+
+
+/*
+ * Called by interrupt routine (see radio-rf2xx.c) when a transmission
+ * is done, with the result reported by the radio (RADIO_TX_*).
+ */
+
+void usr_radio_tx_done (int status)
+{
+	it_tx_status (radio_owner, radio_tx_status (status)) ;
+}
+
+
+void it_tx_done (ConMsg *cm)
+{
+    it_tx_status (cm, TX_OK) ;
+}
+
+
+void it_tx_status (ConMsg *cm, tx_status_t status)
+{
+    cm->txstatus_ = status ;
+    cm->writing_ = false ;
+}
+
+
+/*
+ * Called by the radio driver when a frame is received with a bad CRC
+ */
+
+void usr_radio_rx_crcfail ()
+{
+	it_rx_crcfail (radio_owner) ;
+}
+
+
+void it_rx_crcfail (ConMsg *cm)
+{
+    cm->stat_.rx_crcfail++ ;
+}
+
+
+
+void init (ConMsg *cm) {
+	cm->chan_ = 13;
+	cm->writing_ = false;
+	cm->promisc_ = false;
+	cm->mac_.minbe = 3;
+	cm->mac_.maxbe = 5;
+	cm->mac_.maxbackoffs = 4;
+	cm->mac_.maxretries = 3;
+	cm->cap_.rec = NULL;
+	cm->cap_.size = 0;
+	cm->cap_.next = 0;
+}
+
+
+void start (ConMsg *cm) {
 	
-	if (conmsg->msgbufsize_ == 0)		// prevent stupid errors...
-		conmsg->msgbufsize_ = DEFAULT_MSGBUF_SIZE ;
+	if (cm->msgbufsize_ < 2)		// prevent stupid errors...
+		cm->msgbufsize_ = DEFAULT_MSGBUF_SIZE ;
 
-	if (conmsg->rbuffer_ != NULL) {
-		conmsg->rbuffer_ =NULL ;	
+	if (cm->rbuffer_ != NULL) {
+		cm->rbuffer_ =NULL ;	
 	}
 	
-    conmsg->rbuffer_ = (ConBuf *)malloc(sizeof(struct ConBuf)*conmsg->msgbufsize_) ;
-    if (conmsg->rbuffer_ == NULL)
-    	printf("Memory allocation failed\n");
-
-    conmsg->rbuffirst_ = 0 ;
-    conmsg->rbuflast_ = 0 ;
+    cm->rbufsize_ = cm->msgbufsize_ * CONMSG_MAXREC ;
+    cm->rbuffer_ = (uint8_t *)malloc(cm->rbufsize_) ;
+    if (cm->rbuffer_ == NULL)
+    	CLOG_ERR ("Memory allocation failed\n") ;
+
+    cm->rbufhead_ = 0 ;
+    cm->rbuftail_ = 0 ;
+    cm->rbufnin_ = 0 ;
+    cm->rbufnout_ = 0 ;
+    memset (cm->dup_, 0, sizeof cm->dup_) ;
+    cm->dupnext_ = 0 ;
     
-    conmsg->writing_ = false;
-    conmsg->seqnum_ = 0;
-
-    setChannelRadio(conmsg->chan_);
+    cm->writing_ = false;
+    cm->seqnum_ = 0;
+    cm->inflight_ = false ;
+    cm->txfirst_ = 0 ;
+    cm->txlast_ = 0 ;
+    cm->txcb_ = NULL ;
+    cm->txlast_status_ = TX_OK ;
+    cm->rnd_ = cm->addr2_ ;		// different on each node
+    resetstat (cm) ;
+
+    radio_owner = cm ;
+    setChannelRadio(cm->chan_);
+    setAddrRadio (cm->panid_, cm->addr2_, cm->promisc_) ;
     NETSTACK_RADIO.init();
-    initBuf((uint8_t *) conmsg->rbuffer_ [conmsg->rbuflast_].frame, MAX_PAYLOAD);
+    initBuf(cm->rbuffer_ + CONMSG_DESCSZ, MAX_PAYLOAD);
     NETSTACK_RADIO.on();
+    cm->radioon_ = true ;
+    cm->onsince_ = cm->stat_.since ;
 
 }
 
 
 
-bool sendto (  addr2_t a,  const uint8_t payload[], uint8_t len ) {
-	uint8_t frame[MAX_PAYLOAD];
+/*
+ * Start a random backoff of [0, 2^BE-1] unit periods
+ */
+
+static void start_backoff (ConMsg *cm)
+{
+    unsigned long int us ;
+
+    cm->rnd_ = cm->rnd_ * 1103515245 + 12345 ;
+    us = ((cm->rnd_ >> 16) & ((1 << cm->txbe_) - 1)) * Z_BACKOFF_US ;
+    cm->txnext_ = clock_time ()
+		+ (us * CLOCK_SECOND + 999999) / 1000000 ;
+}
+
+
+// new frame at the head of the TX queue: start a CSMA/CA procedure
+static void new_head (ConMsg *cm)
+{
+    cm->txnb_ = 0 ;
+    cm->txbe_ = cm->mac_.minbe ;
+    cm->txretries_ = 0 ;
+    start_backoff (cm) ;
+}
+
+
+/*
+ * Give the frame at the head of the TX queue to the radio, if the
+ * channel is clear. If the channel is busy or if the driver reports
+ * an error immediately, the completion is recorded as if it came
+ * from the interrupt routine.
+ */
+
+static void start_tx (ConMsg *cm)
+{
+    ConTxBuf *b ;
+    int r ;
+
+    b = &cm->txbuffer_ [cm->txfirst_ & (CONMSG_TXQ_SIZE - 1)] ;
+    cm->inflight_ = true ;
+    cm->writing_ = true ;
+    if (NETSTACK_RADIO.channel_clear != NULL
+		&& ! NETSTACK_RADIO.channel_clear ())
+    {
+	it_tx_status (cm, TX_CCA_FAIL) ;
+	return ;
+    }
+    if (cm->cap_.size > 0)
+	capture_frame (cm, CONCAP_TX, b->frame, b->len, 0) ;
+    TRACE (TR_TX, b->len, Z_GET_INT16 (&b->frame [5]), b->frame [2]) ;
+    r = NETSTACK_RADIO.send (b->frame, b->len) ;
+    if (r != RADIO_TX_OK)
+	it_tx_status (cm, radio_tx_status (r)) ;
+}
+
+
+// report the final status of the frame at the head of the queue
+static void complete_tx (ConMsg *cm, ConTxBuf *b, tx_status_t st)
+{
+    switch (st)
+    {
+	case TX_OK :		cm->stat_.tx_sent++ ; break ;
+	case TX_NOACK :		cm->stat_.tx_error_noack++ ; break ;
+	case TX_CCA_FAIL :	cm->stat_.tx_error_cca++ ; break ;
+	default :		cm->stat_.tx_error_fail++ ; break ;
+    }
+    TRACE (TR_TX_DONE, st, cm->txretries_, 0) ;
+    cm->txlast_status_ = st ;
+    cm->txfirst_++ ;
+    if (cm->txfirst_ != cm->txlast_)
+	new_head (cm) ;
+    if (cm->txcb_ != NULL)
+	(*cm->txcb_) (cm->txcbarg_, b->frame [2],
+				(addr2_t) Z_GET_INT16 (&b->frame [5]), st) ;
+}
+
+
+/*
+ * Process the result of the current attempt (if any): retry after
+ * a backoff, or report completion. Then, start the next attempt if
+ * the backoff is over. Must be called regularly: this is done by
+ * sendto and get_received.
+ */
+
+void poll_tx (ConMsg *cm)
+{
+    ConTxBuf *b ;
+    tx_status_t st ;
+
+    if (cm->inflight_ && ! cm->writing_)
+    {
+	b = &cm->txbuffer_ [cm->txfirst_ & (CONMSG_TXQ_SIZE - 1)] ;
+	st = (tx_status_t) cm->txstatus_ ;
+	cm->inflight_ = false ;
+	if (st != TX_CCA_FAIL)
+	    cm->stat_.tx_airtime += Z_AIRTIME_US (b->len + 2) ;	// with FCS
+	if (st == TX_OK && Z_GET_ACK_REQUEST (Z_GET_INT16 (b->frame)))
+	    cm->stat_.rx_airtime += Z_AIRTIME_US (Z_ACK_LEN) ;
+
+	if (st == TX_CCA_FAIL && cm->txnb_ < cm->mac_.maxbackoffs)
+	{
+	    cm->stat_.tx_backoff++ ;
+	    cm->txnb_++ ;
+	    if (cm->txbe_ < cm->mac_.maxbe)
+		cm->txbe_++ ;
+	    start_backoff (cm) ;
+	}
+	else if (st == TX_NOACK && cm->txretries_ < cm->mac_.maxretries)
+	{
+	    cm->stat_.tx_retry++ ;
+	    cm->txretries_++ ;
+	    cm->txnb_ = 0 ;
+	    cm->txbe_ = cm->mac_.minbe ;
+	    start_backoff (cm) ;
+	}
+	else complete_tx (cm, b, st) ;
+    }
+
+    if (! cm->inflight_ && cm->txfirst_ != cm->txlast_
+		&& (long int) (clock_time () - cm->txnext_) >= 0)
+	start_tx (cm) ;
+}
+
+
+int tx_pending (ConMsg *cm)
+{
+    return (uint8_t) (cm->txlast_ - cm->txfirst_) ;
+}
+
+
+/*
+ * Next time `poll_tx` has something to do: now if the result of an
+ * attempt is waiting, or the end of the current backoff. Returns
+ * false if the TX queue is empty or if the radio is sending a frame
+ * (its completion will come from the driver).
+ */
+
+bool next_tx (ConMsg *cm, clock_time_t *next)
+{
+    if (cm->inflight_)
+    {
+	if (cm->writing_)
+	    return false ;
+	*next = clock_time () ;
+	return true ;
+    }
+    if (cm->txfirst_ == cm->txlast_)
+	return false ;
+    *next = cm->txnext_ ;
+    return true ;
+}
+
+
+void set_tx_callback (ConMsg *cm, tx_callback_t cb, void *arg)
+{
+    cm->txcb_ = cb ;
+    cm->txcbarg_ = arg ;
+}
+
+
+tx_status_t last_tx_status (ConMsg *cm) { return cm->txlast_status_ ; }
+
+void setMacParam (ConMsg *cm, const ConMacParam *p) { cm->mac_ = *p ; }
+
+void getMacParam (ConMsg *cm, ConMacParam *p) { *p = cm->mac_ ; }
+
+
+/*
+ * Queue a frame for transmission. Returns false if the frame is
+ * too large or if the TX queue is full. The sequence number of
+ * the frame is given to the completion callback.
+ */
+
+bool sendto (ConMsg *cm, addr2_t a, const uint8_t payload[], uint8_t len ) {
+	ConTxBuf *b ;
+	uint8_t *frame ;
 	uint16_t fcf ;
 	int frmlen ;
 	frmlen = 9 + len ;
 	if(frmlen > MAX_PAYLOAD)
 		return false;
 
-
+	poll_tx (cm) ;
+	if (tx_pending (cm) >= CONMSG_TXQ_SIZE)
+	{
+	    cm->stat_.tx_overrun++ ;
+	    return false ;
+	}
+	b = &cm->txbuffer_ [cm->txlast_ & (CONMSG_TXQ_SIZE - 1)] ;
+	frame = b->frame ;
 
 	fcf = Z_SET_FRAMETYPE (Z_FT_DATA)
 	    | Z_SET_SEC_ENABLED (0)
 	    | Z_SET_FRAME_PENDING (0)
-	    | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_ACK_REQUEST (a != Z_BROADCAST)
 	    | Z_SET_INTRA_PAN (1)
 	    | Z_SET_RESERVED (0)
 	    | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
@@ -142,118 +680,280 @@ bool sendto (  addr2_t a,  const uint8_t payload[], uint8_t len ) {
 	    ;
 
 	Z_SET_INT16 (&frame [0], fcf) ;		// fcf
-    frame [2] = ++conmsg->seqnum_ ; ;			// seq
-    Z_SET_INT16 (&frame [3], conmsg->panid_) ;		// dst panid
+    frame [2] = ++cm->seqnum_ ; ;			// seq
+    Z_SET_INT16 (&frame [3], cm->panid_) ;		// dst panid
     Z_SET_INT16 (&frame [5], a) ;		// dst addr
-    Z_SET_INT16 (&frame [7], conmsg->addr2_) ;		// src addr
+    Z_SET_INT16 (&frame [7], cm->addr2_) ;		// src addr
 
     memcpy (frame + 9, payload, len) ;
-
-    // int i;
-    // for (i = 0; i < frmlen; ++i)
-    // {
-    // 	printf("%d",frame[i] );
-    // }
-    // printf("\n");
-    //printf("envoyé\n" );
-    conmsg->writing_ = true ;
-    NETSTACK_RADIO.send (frame, frmlen) ;
-
-    while (conmsg->writing_);
+    b->len = frmlen ;
+
+    if (cm->txfirst_ == cm->txlast_)
+	new_head (cm) ;
+    cm->txlast_++ ;
+    if (tx_pending (cm) > cm->stat_.tx_hwm_frames)
+	cm->stat_.tx_hwm_frames = tx_pending (cm) ;
+    poll_tx (cm) ;			// start now if radio is idle
 	return true;
 }
 
 
-ConReceivedFrame *get_received () {
-	ConReceivedFrame *r ;
-    ConBuf *b ;
+/*
+ * Consumer side of the receive ring
+ */
 
-    platform_enter_critical();
-    if (conmsg->rbuffirst_ == conmsg->rbuflast_) {
-		b = NULL ;
-	}
-    else  b = &conmsg->rbuffer_ [conmsg->rbuffirst_] ;
-    platform_exit_critical();
-    if (b == NULL){
-		r = NULL ;
-	}
-    else
+// first record to read, after a possible wrap marker
+static ConFrameDesc *first_record (ConMsg *cm)
+{
+    unsigned int tail ;
+    ConFrameDesc *d ;
+
+    tail = cm->rbuftail_ ;
+    if (tail == cm->rbufhead_)
+		return NULL ;
+    CONMSG_BARRIER () ;			// read record after index
+    d = (ConFrameDesc *) (cm->rbuffer_ + tail) ;
+    if (d->reclen == 0)
+    {
+		cm->rbuftail_ = tail = 0 ;
+		if (tail == cm->rbufhead_)
+		    return NULL ;
+		d = (ConFrameDesc *) cm->rbuffer_ ;
+    }
+    return d ;
+}
+
+
+ConReceivedFrame *get_received (ConMsg *cm) {
+    ConReceivedFrame *r ;
+    ConFrameDesc *d ;
+
+    poll_tx (cm) ;			// let TX drain while we receive
+    d = first_record (cm) ;
+    if (d == NULL)
+		return NULL ;
+
+    r = &cm->rframe_ ;
+    r->frametype = Z_GET_FRAMETYPE (d->fcf) ;
+    r->rawframe = (uint8_t *) d + CONMSG_DESCSZ ;
+    r->rawlen = d->rawlen ;
+    r->lqi = d->lqi ;
+    r->payload = r->rawframe + d->payoff ;
+    r->paylen = d->payoff > d->rawlen ? 0 : d->rawlen - d->payoff ;	// skip FCS
+    r->fcf = d->fcf ;
+    r->seq = d->seq ;
+    r->dstaddr = d->dstaddr ;
+    r->dstpan = d->dstpan ;
+    r->srcaddr = d->srcaddr ;
+    r->srcpan = d->srcpan ;
+    return r ;
+}
+
+
+
+void skip_received (ConMsg *cm)
+{
+    ConFrameDesc *d ;
+    unsigned int tail ;
+
+    d = first_record (cm) ;
+    if (d != NULL)
     {
+		tail = (uint8_t *) d - cm->rbuffer_ + d->reclen ;
+		if (tail >= cm->rbufsize_)
+		    tail = 0 ;
+		CONMSG_BARRIER () ;		// done with record before release
+		cm->rbuftail_ = tail ;
+		cm->rbufnout_++ ;
+    }
+}
 
-    	uint8_t *p = (uint8_t *) b->frame ;
-		int intrapan ;
 
-		r = & conmsg->rframe_ ;
-		r->rawframe = (uint8_t *) b->frame ;
-		r->rawlen = b->len ;
-		r->lqi = b->lqi;
 
-		/* decode Frame Control Field */
-		r->fcf = Z_GET_INT16 (p) ;
-		p += 2 ;
+/*
+ * Statistics
+ */
 
-		r->frametype = Z_GET_FRAMETYPE (r->fcf) ;
-
-		/* Sequence Number */
-		r->seq = *p++ ;
-
-		/* Dest & Src address */
-		intrapan = Z_GET_INTRA_PAN (r->fcf) ;
-		switch (Z_GET_DST_ADDR_MODE (r->fcf))
-		{
-		    case Z_ADDRMODE_NOADDR :
-			break ;
-		    case Z_ADDRMODE_RESERVED :
-			break ;
-		    case Z_ADDRMODE_ADDR2 :
-			r->dstpan = Z_GET_INT16 (p) ;
-			p += 2 ;
-			r->dstaddr = Z_GET_INT16 (p) ;
-			p += 2 ;
-			break ;
-		    case Z_ADDRMODE_ADDR8 :
-			p += 8+2 ;
-			break ;
-		}
-		switch (Z_GET_SRC_ADDR_MODE (r->fcf))
-		{
-		    case Z_ADDRMODE_NOADDR :
-			break ;
-		    case Z_ADDRMODE_RESERVED :
-			break ;
-		    case Z_ADDRMODE_ADDR2 :
-			if (intrapan != 0)
-			    r->srcpan = r->dstpan ;
-			else
-			{
-			    r->srcpan = Z_GET_INT16 (p) ;
-			    p += 2 ;
-			}
-			r->srcaddr = Z_GET_INT16 (p) ;
-			p += 2 ;
-			break ;
-		    case Z_ADDRMODE_ADDR8 :
-			if (intrapan == 0)
-			    p += 2 ;
-			p += 8 ;
-			break ;
-		}
-		r->payload = p ;
-		r->paylen = r->rawlen - (p - r->rawframe)  ;	// skip FCS
+ConStat *getstat (ConMsg *cm) { return &cm->stat_ ; }
 
+
+// consistent copy of statistics (which are updated by interrupts)
+void getstat_snapshot (ConMsg *cm, ConStat *snap)
+{
+    platform_enter_critical () ;
+    *snap = cm->stat_ ;
+    platform_exit_critical () ;
+}
+
+
+void resetstat (ConMsg *cm)
+{
+    platform_enter_critical () ;
+    memset (&cm->stat_, 0, sizeof cm->stat_) ;
+    cm->stat_.since = clock_time () ;
+    cm->onsince_ = cm->stat_.since ;
+    platform_exit_critical () ;
+}
+
+
+/*
+ * Estimation of channel occupancy since last reset: airtime of all
+ * frames heard or sent (including MAC ACKs for our frames),
+ * relative to the elapsed time.
+ */
+
+int chan_busy_permille (const ConStat *st, clock_time_t now)
+{
+    uint64_t elapsed ;
+    uint64_t busy ;
+
+    elapsed = (uint64_t) (now - st->since) * (1000000 / CLOCK_SECOND) ;
+    if (elapsed == 0)
+	return 0 ;
+    busy = st->rx_airtime + st->tx_airtime ;
+    if (busy >= elapsed)
+	return 1000 ;
+    return (int) (busy * 1000 / elapsed) ;
+}
+
+
+// time with the radio on since last reset
+clock_time_t radio_on_time (ConMsg *cm, const ConStat *st, clock_time_t now)
+{
+    clock_time_t t = st->radio_on ;
+
+    if (cm->radioon_)
+	t += now - cm->onsince_ ;
+    return t ;
+}
+
+
+void print_stat (ConMsg *cm, const ConStat *st)
+{
+    int i ;
+
+    printf ("rx: heard=%d stored=%d overrun=%d crcfail=%d dup=%d\n",
+		st->rx_heard, st->rx_stored, st->rx_overrun, st->rx_crcfail,
+		st->rx_duplicate) ;
+    printf ("rx drop: short=%d type=%d pan=%d dest=%d\n",
+		st->rx_drop_short, st->rx_drop_type, st->rx_drop_pan,
+		st->rx_drop_dest) ;
+    printf ("rx hwm: bytes=%d frames=%d airtime=%lu ms\n",
+		st->rx_hwm_bytes, st->rx_hwm_frames,
+		(unsigned long int) (st->rx_airtime / 1000)) ;
+    printf ("rx lqi:") ;
+    for (i = 0 ; i < CONSTAT_LQI_BUCKETS ; i++)
+	printf (" %d", st->rx_lqi [i]) ;
+    printf ("\n") ;
+    printf ("tx: sent=%d cca=%d noack=%d fail=%d overrun=%d hwm=%d\n",
+		st->tx_sent, st->tx_error_cca, st->tx_error_noack,
+		st->tx_error_fail, st->tx_overrun, st->tx_hwm_frames) ;
+    printf ("tx airtime=%lu ms, channel busy=%d/1000\n",
+		(unsigned long int) (st->tx_airtime / 1000),
+		chan_busy_permille (st, clock_time ())) ;
+    printf ("radio: on=%lu ms wakeups=%d\n",
+		(unsigned long int) (radio_on_time (cm, st, clock_time ())
+					* 1000 / CLOCK_SECOND),
+		st->radio_wakeups) ;
+}
+
+
+/*
+ * Frame capture
+ */
+
+bool setCapture (ConMsg *cm, int nrec)
+{
+    ConCapRec *rec = NULL ;
+
+    if (nrec > 0)
+    {
+	rec = (ConCapRec *) malloc (nrec * sizeof *rec) ;
+	if (rec == NULL)
+	    return false ;
     }
-    return r ;
+    platform_enter_critical () ;
+    if (cm->cap_.rec != NULL)
+	free (cm->cap_.rec) ;
+    cm->cap_.rec = rec ;
+    cm->cap_.size = nrec > 0 ? nrec : 0 ;
+    cm->cap_.next = 0 ;
+    platform_exit_critical () ;
+    return true ;
+}
+
+
+int capture_count (ConMsg *cm)
+{
+    return cm->cap_.next < cm->cap_.size ? cm->cap_.next : cm->cap_.size ;
+}
+
 
+int capture_lost (ConMsg *cm)
+{
+    return cm->cap_.next - capture_count (cm) ;
 }
 
 
+const ConCapRec *capture_get (ConMsg *cm, int i)
+{
+    if (i < 0 || i >= capture_count (cm))
+	return NULL ;
+    i += capture_lost (cm) ;
+    return &cm->cap_.rec [i % cm->cap_.size] ;
+}
 
-void skip_received ()
+
+void capture_clear (ConMsg *cm)
 {
+    cm->cap_.next = 0 ;
+}
 
-    platform_enter_critical();
-    if (conmsg->rbuffirst_ != conmsg->rbuflast_)
-		conmsg->rbuffirst_ = (conmsg->rbuffirst_ + 1) % conmsg->msgbufsize_ ;
-    platform_exit_critical();
+
+/*
+ * pcap file format: a global header, then a header before each
+ * frame, all fields in the byte order of the writer (little endian
+ * here). Time is split in seconds and microseconds.
+ */
+
+#define	PCAP_MAGIC	0xa1b2c3d4
+#define	PCAP_SNAPLEN	128
+
+static uint8_t *put32 (uint8_t *p, uint32_t v)
+{
+    *p++ = v >> 0 ;
+    *p++ = v >> 8 ;
+    *p++ = v >> 16 ;
+    *p++ = v >> 24 ;
+    return p ;
 }
 
+void capture_write_pcap (ConMsg *cm, capture_write_t fn, void *arg)
+{
+    uint8_t hdr [24], *p ;
+    const ConCapRec *r ;
+    uint32_t ms ;
+    int i, n ;
+
+    p = put32 (hdr, PCAP_MAGIC) ;
+    *p++ = 2 ; *p++ = 0 ;			// version 2.4
+    *p++ = 4 ; *p++ = 0 ;
+    p = put32 (p, 0) ;				// GMT
+    p = put32 (p, 0) ;				// accuracy
+    p = put32 (p, PCAP_SNAPLEN) ;
+    p = put32 (p, PCAP_LINKTYPE_154_NOFCS) ;
+    (*fn) (arg, hdr, p - hdr) ;
+
+    n = capture_count (cm) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	r = capture_get (cm, i) ;
+	ms = (uint32_t) (r->time * 1000 / CLOCK_SECOND) ;
+	p = put32 (hdr, ms / 1000) ;
+	p = put32 (p, (ms % 1000) * 1000) ;
+	p = put32 (p, r->len) ;
+	p = put32 (p, r->len) ;
+	(*fn) (arg, hdr, p - hdr) ;
+	(*fn) (arg, r->frame, r->len) ;
+    }
+}
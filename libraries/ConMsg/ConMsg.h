@@ -14,7 +14,8 @@
 #include "netstack.h"
 
 
-#define	DEFAULT_MSGBUF_SIZE	10
+#define	DEFAULT_MSGBUF_SIZE	8
+#define	CONMSG_TXQ_SIZE		4	// must be a power of 2
 #define MAX_PAYLOAD 125
 
 /** Macro to help write uint16_t (such as addr2 or panid) constants */
@@ -90,26 +91,203 @@
 
 
 
+	/*
+	 * Airtime of a frame on a 2.4 GHz O-QPSK PHY: each byte lasts
+	 * 2 symbols of 16 us, and each frame is preceded by a 4 bytes
+	 * preamble, the SFD and the PHR (length).
+	 */
+
+#define	Z_BYTE_US		32
+#define	Z_AIRTIME_US(len)	((uint32_t) ((len) + 6) * Z_BYTE_US)
+#define	Z_ACK_LEN		5	// fcf, seq, fcs
+
+#define	CONSTAT_LQI_BUCKETS	8	// LQI histogram, 32 values per bucket
+
 	typedef struct ConStat
 	{
+	    clock_time_t since ;	///< Time of last reset
+	    /* reception */
+	    int rx_heard ;		///< Frames with a valid CRC (even dropped)
+	    int rx_stored ;		///< Frames stored for the upper layer
 	    int rx_overrun ;
 	    int rx_crcfail ;
+	    int rx_drop_short ;		///< Frames too short for a MAC header
+	    int rx_drop_type ;		///< Not a data frame with 16 bits addresses
+	    int rx_drop_pan ;		///< Frames for another PAN
+	    int rx_drop_dest ;		///< Frames for another node
+	    int rx_duplicate ;		///< MAC retransmissions suppressed
+	    int rx_hwm_bytes ;		///< Receive ring high-water mark (bytes)
+	    int rx_hwm_frames ;		///< Receive ring high-water mark (frames)
+	    uint64_t rx_airtime ;	///< Airtime of frames heard (us)
+	    int rx_lqi [CONSTAT_LQI_BUCKETS] ;	///< LQI histogram of heard frames
+	    /* transmission */
+	    int tx_overrun ;		///< Frames rejected (TX queue full)
+	    int tx_hwm_frames ;		///< TX queue high-water mark
 	    int tx_sent ;
 	    int tx_error_cca ;
 	    int tx_error_noack ;
 	    int tx_error_fail ;
+	    int tx_backoff ;		///< CCA failures followed by a backoff
+	    int tx_retry ;		///< Frames sent again (missing ACK)
+	    uint64_t tx_airtime ;	///< Airtime of frames sent (us)
+	    /* radio power */
+	    clock_time_t radio_on ;	///< Time with radio on, until last switch off
+	    int radio_wakeups ;		///< Number of switch on
 	} ConStat;
 
 
+	/**
+	 * Transmission is asynchronous: `sendto` copies the frame in
+	 * the TX queue and returns immediately. Frames are given to the
+	 * radio one after the other, and the completion status of each
+	 * frame is reported through an optional callback, called from
+	 * `poll_tx` (i.e. never from an interrupt routine).
+	 */
+
+	typedef enum
+	{
+	    TX_OK,			///< Frame sent (and acked if requested)
+	    TX_NOACK,			///< No ACK received
+	    TX_CCA_FAIL,		///< Channel busy
+	    TX_FAIL			///< Other error
+	} tx_status_t ;
+
+	typedef void (*tx_callback_t) (void *arg, uint8_t seq, addr2_t dst,
+						tx_status_t status) ;
+
+	/*
+	 * MAC transmission (unslotted CSMA/CA, as in 802.15.4): before
+	 * each attempt, wait for a random number of backoff periods in
+	 * [0, 2^BE-1] and check that the channel is clear. BE starts at
+	 * minbe and grows on each busy channel up to maxbe; after
+	 * maxbackoffs busy channels, the frame fails with TX_CCA_FAIL.
+	 * A frame which is not acknowledged is sent again (with a new
+	 * CSMA/CA procedure) up to maxretries times before failing with
+	 * TX_NOACK.
+	 */
+
+#define	Z_BACKOFF_US		320	// unit backoff period (20 symbols)
+
+	typedef struct ConMacParam
+	{
+	    uint8_t minbe ;		///< default 3
+	    uint8_t maxbe ;		///< default 5
+	    uint8_t maxbackoffs ;	///< default 4
+	    uint8_t maxretries ;	///< default 3
+	} ConMacParam ;
+
+	typedef struct ConTxBuf
+	{
+	    uint8_t frame [MAX_PAYLOAD] ;
+	    uint8_t len ;
+	} ConTxBuf ;
+
+
 	
 
 
-	typedef struct ConBuf
+	/*
+	 * Receive ring: a single-producer (interrupt routine) /
+	 * single-consumer (get_received/skip_received) ring of bytes,
+	 * without any critical section. Each received frame is stored
+	 * in a record: a compact descriptor, decoded by the producer
+	 * as soon as the frame lands, followed by the raw frame. Records
+	 * are packed contiguously (4 bytes aligned), such that short
+	 * frames (Hello, ACK, etc.) do not waste a full frame buffer.
+	 *
+	 * The radio always writes the next frame in a free area of
+	 * CONMSG_MAXREC bytes at rbufhead_. When there is not enough
+	 * room before the end of the buffer for such an area, a wrap
+	 * marker (record length = 0) is written and the next record
+	 * starts at the beginning of the buffer. When no free area is
+	 * available, the frame just received is dropped (rx_overrun)
+	 * and the radio gets the same area again.
+	 *
+	 * Unless promiscuous mode is set, only intra-PAN data frames
+	 * with 16 bits addresses, sent to our PAN and to our address
+	 * (or broadcast) are kept in the ring. Other frames are dropped
+	 * by the producer, and counted by reason in ConStat. Duplicated
+	 * frames (see below) are dropped as well.
+	 */
+
+	typedef struct ConFrameDesc
+	{
+	    uint16_t reclen ;		///< Record length (0 : wrap marker)
+	    uint16_t fcf ;
+	    addr2_t dstaddr ;
+	    addr2_t dstpan ;
+	    addr2_t srcaddr ;
+	    addr2_t srcpan ;
+	    uint8_t rawlen ;
+	    uint8_t lqi ;
+	    uint8_t seq ;
+	    uint8_t payoff ;		///< Offset of payload in frame
+	} ConFrameDesc ;
+
+	/*
+	 * Duplicate suppression: a frame whose MAC ACK has been lost is
+	 * sent again by its sender with the same sequence number. The
+	 * last sequence number received from each recent neighbour is
+	 * kept, and a frame with the same (source, sequence number) is
+	 * dropped if it arrives less than CONMSG_DUP_LIFETIME ms later.
+	 */
+
+#define	CONMSG_DUPTAB		8	// number of neighbours
+#define	CONMSG_DUP_LIFETIME	500	// ms
+
+	typedef struct ConDup
+	{
+	    addr2_t src ;
+	    uint8_t seq ;
+	    bool used ;
+	    clock_time_t time ;
+	} ConDup ;
+
+#define	CONMSG_ALIGN(n)		(((n) + 3) & ~3)
+#define	CONMSG_DESCSZ		CONMSG_ALIGN (sizeof (ConFrameDesc))
+#define	CONMSG_MAXREC		(CONMSG_DESCSZ + CONMSG_ALIGN (MAX_PAYLOAD))
+
+	// memory barrier between producer and consumer
+#define	CONMSG_BARRIER()	__sync_synchronize ()
+
+
+	/*
+	 * Frame capture: when enabled (setCapture), each frame heard
+	 * by the radio (before any filtering, as a sniffer would see
+	 * it) and each frame given to the radio for transmission (each
+	 * attempt) is copied, with its time, in a ring of records. When
+	 * the ring is full, the oldest records are overwritten: the
+	 * ring always holds the last frames, for post-mortem analysis.
+	 *
+	 * The capture can be exported as a pcap file (link type
+	 * IEEE 802.15.4 without FCS, read by Wireshark) through a write
+	 * function, such that a node without file system can send it
+	 * on a serial line. On the host, see host/replay.h to save a
+	 * capture or to feed it back to a node.
+	 */
+
+#define	CONCAP_RX		0
+#define	CONCAP_TX		1
+
+#define	PCAP_LINKTYPE_154_NOFCS	230	// IEEE 802.15.4 frames, without FCS
+
+	typedef struct ConCapRec
+	{
+	    clock_time_t time ;		///< Time of reception or transmission
+	    uint8_t dir ;		///< CONCAP_RX or CONCAP_TX
+	    uint8_t len ;		///< Frame length (without FCS)
+	    uint8_t lqi ;
+	    uint8_t frame [MAX_PAYLOAD] ;
+	} ConCapRec ;
+
+	typedef struct ConCapture
 	{
-	    volatile uint8_t frame [MAX_PAYLOAD] ;
-	    volatile uint8_t len ;
-	    volatile uint8_t lqi ;
-	} ConBuf ;
+	    ConCapRec *rec ;
+	    unsigned int size ;		///< Number of records
+	    volatile unsigned int next ;	///< Free-running index of next record
+	} ConCapture ;
+
+	typedef void (*capture_write_t) (void *arg, const uint8_t *data, int len) ;
 
 
 	typedef struct ConMsg {
@@ -119,91 +297,152 @@
 		panid_t panid_ ;
 		addr2_t addr2_ ;
 		addr8_t addr8_ ;
-
-		ConBuf *rbuffer_ ;		// with msgbufsize_ entries
-		volatile int rbuffirst_ ;
-		volatile int rbuflast_ ;
-		int msgbufsize_ ;
-		ConReceivedFrame rframe_ ;	// decoded received frame
+		bool promisc_ ;			// don't filter received frames
+		bool radioon_ ;			// receiver is on
+		clock_time_t onsince_ ;		// last switch on (or stat reset)
+
+		uint8_t *rbuffer_ ;		// msgbufsize_ * CONMSG_MAXREC bytes
+		unsigned int rbufsize_ ;	// size in bytes
+		volatile unsigned int rbufhead_ ;	// written by producer only
+		volatile unsigned int rbuftail_ ;	// written by consumer only
+		volatile unsigned int rbufnin_ ;	// # of frames stored
+		volatile unsigned int rbufnout_ ;	// # of frames consumed
+		int msgbufsize_ ;		// RAM budget, in full frames
+		ConReceivedFrame rframe_ ;	// current frame, for consumer
+		ConDup dup_ [CONMSG_DUPTAB] ;	// used by producer only
+		uint8_t dupnext_ ;		// next entry to replace
 
 			/*
 		 * Transmission
 		 */
 
 		uint8_t seqnum_ ;		// to be placed in MAC header
-		volatile bool writing_ ;
+		volatile bool writing_ ;	// cleared by interrupt routine
+		volatile uint8_t txstatus_ ;	// set by interrupt routine
+		bool inflight_ ;		// head of TX queue given to radio
+		ConTxBuf txbuffer_ [CONMSG_TXQ_SIZE] ;
+		uint8_t txfirst_ ;		// free-running indexes
+		uint8_t txlast_ ;
+		tx_callback_t txcb_ ;
+		void *txcbarg_ ;
+		ConMacParam mac_ ;
+		uint8_t txnb_ ;			// # of busy channels (head frame)
+		uint8_t txbe_ ;			// current backoff exponent
+		uint8_t txretries_ ;		// # of retransmissions
+		clock_time_t txnext_ ;		// end of current backoff
+		tx_status_t txlast_status_ ;	// status of last completed frame
+		uint32_t rnd_ ;			// backoff random generator
+
+		ConCapture cap_ ;		// frame capture (size 0: disabled)
 	}ConMsg;
 
 
-	ConStat *getstat () ; 
-
-	void init();
+	void init (ConMsg *cm);
 
 	/** Accessor method to get the size (in number of frames) of the receive buffer */
-	int getMsgbufsize () ; 
+	int getMsgbufsize (ConMsg *cm) ; 
+
+	/** Current occupancy of the receive buffer (bytes and frames) */
+	int getRxOccupancy (ConMsg *cm, int *nframes) ;
 
 	/** Accessor method to get the channel id (11 ... 26) */
-	channel_t getChannel () ;
+	channel_t getChannel (ConMsg *cm) ;
 
 	/** Accessor method to get our 802.15.4 hardware address (16 bits) */
-	addr2_t getAddr2 ()  ; 
+	addr2_t getAddr2 (ConMsg *cm)  ; 
 
 	/** Accessor method to get our 802.15.4 hardware address (64 bits) */
-	addr8_t getAddr8 () ; 
+	addr8_t getAddr8 (ConMsg *cm) ; 
 
 	/** Accessor method to get our 802.15.4 PAN id */
-	panid_t getPanid (); 
+	panid_t getPanid (ConMsg *cm); 
 
 	/** Accessor method to get the TX power (-17 ... +3 dBM) */
 	//txpwr_t txpower (void) { return txpower_ ; }	// -17 .. +3 dBm
 
 	/** Accessor method to get promiscuous status */
-	//bool promiscuous (void) { return promisc_ ; }
+	bool getPromiscuous (ConMsg *cm) ;
 
-	/** Mutator method to set the size (in number of frames) of the receive buffer */
-	void setMsgbufsize ( int msgbufsize) ; 
+	/** Mutator method to set the size of the receive buffer, expressed
+	 * in number of maximum size frames (more short frames fit in) */
+	void setMsgbufsize (ConMsg *cm, int msgbufsize) ; 
 
 	/** Mutator method to set the channel id (11 ... 26) */
-	void setChannel ( channel_t chan) ;	// 11..26
+	void setChannel (ConMsg *cm, channel_t chan) ;	// 11..26
 
 	/** Mutator method to set our 802.15.4 hardware address (16 bits) */
-	void setAddr2 ( addr2_t addr) ; 
+	void setAddr2 (ConMsg *cm, addr2_t addr) ; 
 
 	/** Mutator method to set our 802.15.4 hardware address (16 bits) */
-	void setAddr8 ( addr8_t addr)  ; 
+	void setAddr8 (ConMsg *cm, addr8_t addr)  ; 
 
 	/** Mutator method to set our 802.15.4 PAN id */
-	void setPanid ( panid_t panid)  ; 
+	void setPanid (ConMsg *cm, panid_t panid)  ; 
 
 	/** Mutator method to set the TX power (-17 ... +3 dBM) */
 	//void txpower (txpwr_t txpower) { txpower_ = txpower ; }
 
-	/** Mutator method to set promiscuous status */
-	//void promiscuous (bool promisc) { promisc_ = promisc ; }
+	/** Mutator method to set promiscuous status (no filtering on reception) */
+	void setPromiscuous (ConMsg *cm, bool promisc) ;
+
+	/** Switch the receiver on or off (frames can be sent in both
+	 * cases). The radio is on after `start`. */
+	void setRadioOn (ConMsg *cm, bool on) ;
+	bool getRadioOn (ConMsg *cm) ;
 
 	// Start radio processing
 
-	void start () ;
+	void start (ConMsg *cm) ;
 
 
 		// Not really public: interrupt functions are designed to
 	// be called outside of an interrupt
-	uint8_t *it_receive_frame ( uint8_t len, uint8_t *frm) ;
-	void it_tx_done () ;
+	uint8_t *it_receive_frame (ConMsg *cm, uint8_t len, uint8_t *frm) ;
+	uint8_t *it_receive_frame_lqi (ConMsg *cm, uint8_t len, uint8_t lqi, uint8_t *frm) ;
+	void it_tx_done (ConMsg *cm) ;
+	void it_tx_status (ConMsg *cm, tx_status_t status) ;
+	void it_rx_crcfail (ConMsg *cm) ;
 
 	// Send and receive frames
 
-	bool sendto ( addr2_t a,  const uint8_t payload [], uint8_t len) ;
-	ConReceivedFrame *get_received () ;	// get current frame (or NULL)
-	void skip_received () ;	// skip to next read frame
+	bool sendto (ConMsg *cm, addr2_t a,  const uint8_t payload [], uint8_t len) ;	// queue frame
+	void poll_tx (ConMsg *cm) ;		// report completions, feed the radio
+	int tx_pending (ConMsg *cm) ;		// # of frames queued or being sent
+	bool next_tx (ConMsg *cm, clock_time_t *next) ;	// next time poll_tx has work
+	void set_tx_callback (ConMsg *cm, tx_callback_t cb, void *arg) ;
+	tx_status_t last_tx_status (ConMsg *cm) ;	// final status of last frame
+	void setMacParam (ConMsg *cm, const ConMacParam *p) ;
+	void getMacParam (ConMsg *cm, ConMacParam *p) ;
+	ConReceivedFrame *get_received (ConMsg *cm) ;	// get current frame (or NULL)
+	void skip_received (ConMsg *cm) ;	// skip to next read frame
 
 	/**
 	 * Return operational statistics
 	 *
-	 * Note that returned ZigMsg::ZigStat structure may still be
-	 * modified by an interrupt routine.
+	 * Note that returned ConStat structure may still be
+	 * modified by an interrupt routine: use getstat_snapshot
+	 * to get a consistent copy.
 	 */
+
+	ConStat *getstat (ConMsg *cm) ;
+	void getstat_snapshot (ConMsg *cm, ConStat *snap) ;
+	void resetstat (ConMsg *cm) ;
+	int chan_busy_permille (const ConStat *st, clock_time_t now) ;
+	clock_time_t radio_on_time (ConMsg *cm, const ConStat *st, clock_time_t now) ;
+	void print_stat (ConMsg *cm, const ConStat *st) ;
 	
-	extern ConMsg *conmsg;
+	/**
+	 * Frame capture (see ConCapRec). `capture_get` returns the
+	 * records from the oldest (0) to the newest (capture_count-1).
+	 */
+
+	bool setCapture (ConMsg *cm, int nrec) ;	// 0: stop capture
+	int capture_count (ConMsg *cm) ;
+	int capture_lost (ConMsg *cm) ;		// records overwritten
+	const ConCapRec *capture_get (ConMsg *cm, int i) ;
+	void capture_clear (ConMsg *cm) ;
+	void capture_write_pcap (ConMsg *cm, capture_write_t fn, void *arg) ;
+
+	ConMsg *getRadioOwner (void) ;	// object which has started the radio
 
 #endif
\ No newline at end of file
@@ -0,0 +1,188 @@
+/**
+ * @file agg.c
+ * @brief aggregation implementation
+ */
+
+#include "agg.h"
+
+
+void initAgg (Agg *a, ConMsg *cm)
+{
+    memset (a, 0, sizeof *a) ;
+    a->cm_ = cm ;
+}
+
+
+/*
+ * Send the content of a buffer and release it. A single message
+ * does not need the aggregation header.
+ */
+
+static bool send_buf (Agg *a, aggbuf *b)
+{
+    bool success ;
+
+    if (b->nmsg_ == 1)
+	success = sendto (a->cm_, b->dest_, b->data_ + AGG_HLEN + 1,
+				b->len_ - AGG_HLEN - 1) ;
+    else
+    {
+	success = sendto (a->cm_, b->dest_, b->data_, b->len_) ;
+	if (success)
+	{
+	    a->nframe_++ ;
+	    a->nmsg_ += b->nmsg_ ;
+	}
+    }
+    b->used_ = false ;
+    return success ;
+}
+
+
+/**
+ * @brief Append a message to the buffer of its destination
+ *
+ * The buffer is sent first if the message does not fit. If all
+ * buffers are in use by other destinations, the first one is sent
+ * to make room.
+ *
+ * @param a aggregation state
+ * @param dest destination address
+ * @param data message
+ * @param len message length
+ * @param framelen maximum frame payload
+ * @return false if aggregation is off or if the message is too
+ *	large to be aggregated: the message must then be sent by
+ *	the caller, after `agg_flush` to keep the order
+ */
+
+bool agg_add (Agg *a, addr2_t dest, const uint8_t *data, size_t len,
+				size_t framelen)
+{
+    aggbuf *b, *freeb ;
+    int i ;
+
+    if (! a->on_ || AGG_HLEN + 1 + len > framelen || len == 0)
+	return false ;
+
+    b = freeb = NULL ;
+    for (i = 0 ; i < I154_AGG_NDEST ; i++)
+    {
+	if (! a->buf_ [i].used_)
+	{
+	    if (freeb == NULL)
+		freeb = &a->buf_ [i] ;
+	}
+	else if (a->buf_ [i].dest_ == dest)
+	    b = &a->buf_ [i] ;
+    }
+
+    if (b != NULL && b->len_ + 1 + len > framelen)
+    {
+	send_buf (a, b) ;
+	freeb = b ;
+	b = NULL ;
+    }
+    if (b == NULL)
+    {
+	if (freeb == NULL)
+	{
+	    freeb = &a->buf_ [0] ;
+	    send_buf (a, freeb) ;
+	}
+	b = freeb ;
+	b->used_ = true ;
+	b->dest_ = dest ;
+	b->nmsg_ = 0 ;
+	b->data_ [0] = AGG_DISPATCH ;
+	b->len_ = AGG_HLEN ;
+    }
+
+    b->data_ [b->len_++] = len ;
+    memcpy (b->data_ + b->len_, data, len) ;
+    b->len_ += len ;
+    b->nmsg_++ ;
+    return true ;
+}
+
+
+/**
+ * @brief Send the pending messages for a destination
+ *
+ * @return false if the frame could not be queued
+ */
+
+bool agg_flush (Agg *a, addr2_t dest)
+{
+    bool success = true ;
+    int i ;
+
+    for (i = 0 ; i < I154_AGG_NDEST ; i++)
+	if (a->buf_ [i].used_ && a->buf_ [i].dest_ == dest)
+	    success = send_buf (a, &a->buf_ [i]) ;
+    return success ;
+}
+
+
+/**
+ * @brief Send the pending messages for all destinations
+ *
+ * @return false if a frame could not be queued
+ */
+
+bool agg_flush_all (Agg *a)
+{
+    bool success = true ;
+    int i ;
+
+    for (i = 0 ; i < I154_AGG_NDEST ; i++)
+	if (a->buf_ [i].used_ && ! send_buf (a, &a->buf_ [i]))
+	    success = false ;
+    return success ;
+}
+
+
+/**
+ * @brief Start unpacking a received payload
+ *
+ * @return true if the payload is an aggregated frame, whose
+ *	messages are then returned by `agg_next`
+ */
+
+bool agg_start (Agg *a, uint8_t *pay, size_t len)
+{
+    a->rxleft_ = 0 ;
+    if (len < AGG_HLEN || ! AGG_IS_AGG (pay))
+	return false ;
+    a->rxnext_ = pay + AGG_HLEN ;
+    a->rxleft_ = len - AGG_HLEN ;
+    return true ;
+}
+
+
+/**
+ * @brief Get the next message from the received aggregated frame
+ *
+ * A malformed length ends the frame.
+ *
+ * @return false if there is no more message
+ */
+
+bool agg_next (Agg *a, uint8_t **msg, size_t *len)
+{
+    size_t n ;
+
+    if (a->rxleft_ == 0)
+	return false ;
+    n = a->rxnext_ [0] ;
+    if (n == 0 || n + 1 > a->rxleft_)
+    {
+	a->rxleft_ = 0 ;
+	return false ;
+    }
+    *msg = a->rxnext_ + 1 ;
+    *len = n ;
+    a->rxnext_ += n + 1 ;
+    a->rxleft_ -= n + 1 ;
+    return true ;
+}
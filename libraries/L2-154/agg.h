@@ -0,0 +1,62 @@
+/**
+ * @file agg.h
+ * @brief aggregation of several small messages in one frame
+ *
+ * When aggregation is on (it is negociated with the master, see
+ * `negociate_agg`), small messages sent to the same destination
+ * are not sent at once but appended to a per-destination buffer.
+ * Buffers are sent when `flush_send` is called (at the end of each
+ * Casan loop), or when they are full. A buffer holding a single
+ * message is sent as is, else the frame payload is:
+ *
+ *	AGG_DISPATCH, len1, msg1, len2, msg2, ...
+ *
+ * AGG_DISPATCH starts with 10, which is neither a CoAP message
+ * (01) nor a fragment (11, see frag.h).
+ *
+ * Aggregated frames are always unpacked on reception, even if
+ * aggregation is off for sending.
+ */
+
+#ifndef AGG_H
+#define	AGG_H
+
+#include "../ConMsg/ConMsg.h"
+
+#ifndef I154_AGG_NDEST
+#define	I154_AGG_NDEST	2		// destinations buffered in parallel
+#endif
+
+#define	AGG_DISPATCH	0xa0
+#define	AGG_HLEN	1		// dispatch byte
+#define	AGG_IS_AGG(p)	((p) [0] == AGG_DISPATCH)
+
+	typedef struct aggbuf {
+		bool used_ ;
+		addr2_t dest_ ;
+		uint8_t nmsg_ ;		// number of messages in data_
+		uint8_t len_ ;		// including dispatch byte
+		uint8_t data_ [MAX_PAYLOAD] ;
+	} aggbuf;
+
+	typedef struct agg {
+		ConMsg *cm_ ;		// MAC used to send frames
+		bool on_ ;		// aggregate sent messages
+		aggbuf buf_ [I154_AGG_NDEST] ;
+		uint8_t *rxnext_ ;	// next message in received frame
+		size_t rxleft_ ;	// remaining bytes in received frame
+		uint16_t nmsg_ ;	// messages sent in aggregated frames
+		uint16_t nframe_ ;	// aggregated frames sent
+	} Agg;
+
+	void initAgg (Agg *a, ConMsg *cm) ;
+
+	bool agg_add (Agg *a, addr2_t dest, const uint8_t *data, size_t len,
+				size_t framelen) ;
+	bool agg_flush (Agg *a, addr2_t dest) ;
+	bool agg_flush_all (Agg *a) ;
+
+	bool agg_start (Agg *a, uint8_t *pay, size_t len) ;
+	bool agg_next (Agg *a, uint8_t **msg, size_t *len) ;
+
+#endif
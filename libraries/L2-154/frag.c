@@ -0,0 +1,233 @@
+/**
+ * @file frag.c
+ * @brief fragmentation and reassembly implementation
+ */
+
+#include "frag.h"
+
+#define	BLK_ISSET(r,b)	((r)->map_ [(b) / 8] & (1 << ((b) % 8)))
+#define	BLK_SET(r,b)	((r)->map_ [(b) / 8] |= (1 << ((b) % 8)))
+
+
+void initFrag (Frag *f, ConMsg *cm)
+{
+    memset (f, 0, sizeof *f) ;
+    f->cm_ = cm ;
+}
+
+
+/**
+ * @brief Send a datagram as a sequence of fragments
+ *
+ * All fragments but the last one carry a multiple of 8 bytes, as
+ * required by the offset encoding. Fragments are queued in the
+ * ConMsg transmit queue, which must have room for all of them:
+ * since a lost fragment makes the whole datagram useless, nothing
+ * is sent if the queue is too full (the message will be sent again
+ * by the retransmission mechanism).
+ *
+ * @param f fragmentation state
+ * @param dest destination address
+ * @param data datagram
+ * @param len datagram length (at most I154_DGRAM_MAX)
+ * @param framelen maximum frame payload
+ * @return true if all fragments have been queued
+ */
+
+bool frag_send (Frag *f, addr2_t dest, const uint8_t *data, size_t len,
+				size_t framelen)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    size_t first, next, off, n ;
+    int nfrag ;
+
+    first = ((framelen - FRAG1_HLEN) / 8) * 8 ;
+    next = ((framelen - FRAGN_HLEN) / 8) * 8 ;
+    if (len > I154_DGRAM_MAX || len <= first || framelen > sizeof frame)
+	return false ;
+
+    nfrag = 1 + (len - first + next - 1) / next ;
+    if (nfrag > CONMSG_TXQ_SIZE - tx_pending (f->cm_))
+	return false ;
+
+    f->tag_++ ;
+    frame [0] = FRAG1_DISPATCH | ((len >> 8) & 0x07) ;
+    frame [1] = len & 0xff ;
+    frame [2] = f->tag_ >> 8 ;
+    frame [3] = f->tag_ & 0xff ;
+    memcpy (frame + FRAG1_HLEN, data, first) ;
+    if (! sendto (f->cm_, dest, frame, FRAG1_HLEN + first))
+	return false ;
+
+    frame [0] = FRAGN_DISPATCH | ((len >> 8) & 0x07) ;
+    for (off = first ; off < len ; off += n)
+    {
+	n = len - off ;
+	if (n > next)
+	    n = next ;
+	frame [4] = off / 8 ;
+	memcpy (frame + FRAGN_HLEN, data + off, n) ;
+	if (! sendto (f->cm_, dest, frame, FRAGN_HLEN + n))
+	    return false ;
+    }
+    f->nsent_++ ;
+    return true ;
+}
+
+
+/*
+ * Release delivered datagrams and datagrams which are not
+ * complete in time
+ */
+
+static void expire_reass (Frag *f, clock_time_t now)
+{
+    fragreass *r ;
+    int i ;
+
+    for (i = 0 ; i < FRAG_NREASS ; i++)
+    {
+	r = &f->reass_ [i] ;
+	if (r->used_ && r->done_)
+	    r->used_ = false ;
+	else if (r->used_ && (long int) (now - r->expire_) >= 0)
+	{
+	    r->used_ = false ;
+	    f->ntimeout_++ ;
+	}
+    }
+}
+
+
+static fragreass *get_reass (Frag *f, addr2_t src, uint16_t tag,
+				uint16_t size, clock_time_t now)
+{
+    fragreass *r, *freer ;
+    int i ;
+
+    freer = NULL ;
+    for (i = 0 ; i < FRAG_NREASS ; i++)
+    {
+	r = &f->reass_ [i] ;
+	if (! r->used_)
+	{
+	    if (freer == NULL)
+		freer = r ;
+	}
+	else if (r->src_ == src && r->tag_ == tag && r->size_ == size)
+	    return r ;
+    }
+
+    if (freer != NULL)
+    {
+	r = freer ;
+	memset (r->map_, 0, sizeof r->map_) ;
+	r->used_ = true ;
+	r->done_ = false ;
+	r->src_ = src ;
+	r->tag_ = tag ;
+	r->size_ = size ;
+	r->expire_ = now + FRAG_TIMEOUT ;
+    }
+    return freer ;
+}
+
+
+/**
+ * @brief Process a received frame
+ *
+ * The datagram returned in `dgram` (complete datagram, or first
+ * fragment of a too large datagram) stays valid until the next
+ * call.
+ *
+ * @param f fragmentation state
+ * @param src source address of the frame
+ * @param pay frame payload
+ * @param len frame payload length
+ * @param dgram (out) datagram
+ * @param dglen (out) datagram length
+ * @return FRAG_NONE if the frame is not a fragment, FRAG_COMPLETE
+ *	if the frame completes a datagram, FRAG_TOOBIG if it is the
+ *	first fragment of a datagram larger than I154_DGRAM_MAX,
+ *	FRAG_PENDING or FRAG_DROPPED if there is nothing to deliver
+ */
+
+frag_status_t frag_input (Frag *f, addr2_t src, const uint8_t *pay,
+				size_t len, uint8_t **dgram, size_t *dglen)
+{
+    fragreass *r ;
+    clock_time_t now ;
+    size_t hlen, size, off, n, b, first, last, nset ;
+
+    now = clock_time () ;
+    expire_reass (f, now) ;
+
+    if (len < 1 || ! (FRAG_IS_FRAG1 (pay) || FRAG_IS_FRAGN (pay)))
+	return FRAG_NONE ;
+
+    hlen = FRAG_IS_FRAG1 (pay) ? FRAG1_HLEN : FRAGN_HLEN ;
+    if (len <= hlen)
+    {
+	f->ndrop_++ ;
+	return FRAG_DROPPED ;
+    }
+    size = FRAG_SIZE (pay) ;
+    off = hlen == FRAG1_HLEN ? 0 : FRAG_OFFSET (pay) ;
+    n = len - hlen ;
+
+    if (size > I154_DGRAM_MAX && hlen == FRAG1_HLEN)
+    {
+	*dgram = (uint8_t *) pay + hlen ;
+	*dglen = n ;
+	f->ndrop_++ ;
+	return FRAG_TOOBIG ;
+    }
+    // all fragments but the last one cover whole 8-byte blocks
+    if (size > I154_DGRAM_MAX || off + n > size
+		|| (n % 8 != 0 && off + n != size))
+    {
+	f->ndrop_++ ;
+	return FRAG_DROPPED ;
+    }
+
+    r = get_reass (f, src, FRAG_TAG (pay), size, now) ;
+    if (r == NULL)
+    {
+	f->ndrop_++ ;
+	return FRAG_DROPPED ;
+    }
+
+    /*
+     * A fragment is either new or a duplicate: a fragment which
+     * overlaps some received blocks cannot be sent by a correct
+     * peer, it is dropped. The datagram is complete when all its
+     * blocks are received.
+     */
+
+    first = off / 8 ;
+    last = (off + n - 1) / 8 ;
+    nset = 0 ;
+    for (b = first ; b <= last ; b++)
+	if (BLK_ISSET (r, b))
+	    nset++ ;
+    if (nset == last - first + 1)		// already received
+	return FRAG_PENDING ;
+    if (nset > 0)
+    {
+	f->ndrop_++ ;
+	return FRAG_DROPPED ;
+    }
+    for (b = first ; b <= last ; b++)
+	BLK_SET (r, b) ;
+    memcpy (r->data_ + off, pay + hlen, n) ;
+
+    for (b = 0 ; b <= (size - 1) / 8 ; b++)
+	if (! BLK_ISSET (r, b))
+	    return FRAG_PENDING ;
+
+    r->done_ = true ;
+    f->nreass_++ ;
+    *dgram = r->data_ ;
+    *dglen = r->size_ ;
+    return FRAG_COMPLETE ;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file frag.h
+ * @brief fragmentation and reassembly of datagrams larger than a frame
+ *
+ * A CoAP message which does not fit in a single IEEE 802.15.4
+ * frame is sent as a sequence of fragments. The fragment headers
+ * are those of RFC 4944 (section 5.3):
+ *
+ * - first fragment: 11000 + datagram size (11 bits), tag (16 bits)
+ * - next fragments: 11100 + datagram size (11 bits), tag (16 bits),
+ *	offset (8 bits, in units of 8 bytes)
+ *
+ * A CoAP message always starts with 01 (version 1), so a fragment
+ * cannot be mistaken for an unfragmented message.
+ *
+ * The largest datagram is I154_DGRAM_MAX bytes (see Casan/defs.h).
+ * It is also the size of each of the FRAG_NREASS reassembly buffers,
+ * so that no memory is allocated during reception. A datagram which is not complete
+ * FRAG_TIMEOUT ms after its first received fragment is dropped.
+ *
+ * Fragmentation is used only when the MTU of the L2 network is
+ * larger than a frame, which is the result of the MTU negociation
+ * with the master (see `negociate_mtu`). Compile with
+ * -DI154_DGRAM_MAX=0 to remove the fragmentation layer.
+ */
+
+#ifndef FRAG_H
+#define	FRAG_H
+
+#include "../ConMsg/ConMsg.h"
+#include "../Casan/defs.h"		// I154_DGRAM_MAX
+
+#ifndef FRAG_NREASS
+#define	FRAG_NREASS	2		// datagrams reassembled in parallel
+#endif
+#ifndef FRAG_TIMEOUT
+#define	FRAG_TIMEOUT	2000		// ms
+#endif
+
+#define	FRAG1_HLEN	4		// first fragment header
+#define	FRAGN_HLEN	5		// next fragments header
+
+#define	FRAG_DISPATCH_MASK	0xf8
+#define	FRAG1_DISPATCH		0xc0
+#define	FRAGN_DISPATCH		0xe0
+#define	FRAG_IS_FRAG1(p)	(((p) [0] & FRAG_DISPATCH_MASK) == FRAG1_DISPATCH)
+#define	FRAG_IS_FRAGN(p)	(((p) [0] & FRAG_DISPATCH_MASK) == FRAGN_DISPATCH)
+#define	FRAG_SIZE(p)		((((p) [0] & 0x07) << 8) | (p) [1])
+#define	FRAG_TAG(p)		(((p) [2] << 8) | (p) [3])
+#define	FRAG_OFFSET(p)		((p) [4] * 8)
+
+#define	FRAG_NBLK	((I154_DGRAM_MAX + 7) / 8)	// 8-byte blocks
+
+	typedef enum
+	{
+	    FRAG_NONE,			///< not a fragment
+	    FRAG_PENDING,		///< fragment stored, datagram incomplete
+	    FRAG_COMPLETE,		///< datagram complete
+	    FRAG_TOOBIG,		///< first fragment of a too large datagram
+	    FRAG_DROPPED		///< invalid fragment or no buffer
+	} frag_status_t ;
+
+	typedef struct fragreass {
+		bool used_ ;
+		bool done_ ;		// delivered, released on next input
+		addr2_t src_ ;
+		uint16_t tag_ ;
+		uint16_t size_ ;	// datagram size
+		clock_time_t expire_ ;
+		uint8_t map_ [(FRAG_NBLK + 7) / 8] ;	// received blocks
+		uint8_t data_ [I154_DGRAM_MAX] ;
+	} fragreass;
+
+	typedef struct frag {
+		ConMsg *cm_ ;		// MAC used to send fragments
+		uint16_t tag_ ;		// tag of the next sent datagram
+		fragreass reass_ [FRAG_NREASS] ;
+		uint16_t nsent_ ;	// datagrams sent in fragments
+		uint16_t nreass_ ;	// datagrams reassembled
+		uint16_t ntimeout_ ;	// datagrams dropped on timeout
+		uint16_t ndrop_ ;	// fragments dropped
+	} Frag;
+
+	void initFrag (Frag *f, ConMsg *cm) ;
+
+	bool frag_send (Frag *f, addr2_t dest, const uint8_t *data, size_t len,
+				size_t framelen) ;
+
+	frag_status_t frag_input (Frag *f, addr2_t src, const uint8_t *pay,
+				size_t len, uint8_t **dgram, size_t *dglen) ;
+
+#endif
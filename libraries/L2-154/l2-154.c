@@ -1,8 +1,8 @@
 #include "l2-154.h"
+#include "../Casan/pool.h"
 
 
-l2addr_154 *l2addr_154_broadcast;
-addr2_t addr2_broadcast = CONST16 (0xff, 0xff) ;
+static const addr2_t addr2_broadcast = CONST16 (0xff, 0xff) ;
 
 
 /*
@@ -22,160 +22,105 @@ addr2_t addr2_broadcast = CONST16 (0xff, 0xff) ;
 #define	I154_SIZE_HEADER	(2+1+2+2+2)
 #define	I154_SIZE_FCS		2		// CRC-16 checksum at the end
 
+/*
+ * With fragmentation, the MTU may be raised up to the size of the
+ * largest datagram (plus header and FCS, to keep the same meaning
+ * as an unfragmented MTU).
+ */
 
-
-void freel2addr_154(l2addr_154 *addr) {
-	free(addr);
-}
+#if I154_DGRAM_MAX + I154_SIZE_HEADER + I154_SIZE_FCS > I154_MTU
+#define	I154_MAXMTU	(I154_DGRAM_MAX + I154_SIZE_HEADER + I154_SIZE_FCS)
+#else
+#define	I154_MAXMTU	I154_MTU
+#endif
 
 
-l2addr_154 *init_l2addr_154_char(const char *a)
-{
-	l2addr_154 *addr = (l2addr_154 *)malloc(sizeof(struct l2addr_154));
-	if (addr == NULL)
-		printf("Memory allocation failed\n");
-    int i = 0 ;
-    uint8_t b = 0 ;
-    uint8_t buf [I154_ADDRLEN] ;
-
-    /*
-     * General loop, when 8-byte addresses will be supported
-     */
-
-    while (*a != '\0' && i < I154_ADDRLEN)
-    {
-	if (*a == ':')
-	{
-	    buf [i++] = b ;
-	    b = 0 ;
-	}
-	else if (isxdigit (*a))
-	{
-	    uint8_t x ;
-	    char c ;
-
-	    c = tolower (*a) ;
-	    x = isdigit (c) ? (c - '0') : (c - 'a' + 10) ;
-	    b = (b << 4) + x ;
-	}
-	else
-	{
-	    for (i = 0 ; i < I154_ADDRLEN ; i++)
-		buf [i] = 0 ;
-	    break ;
-	}
-	a++ ;
-    }
-    if (i < I154_ADDRLEN)
-	buf [i] = b ;
-	
-	addr-> addr_ = CONST16 (buf [0], buf [1]) ;
-    return addr;
-}
 
+/******************************************************************************
+ * l2net_154 methods
+ */
 
-void setBroasdcastAddr(void) {
-	l2addr_154_broadcast = init_l2addr_154_char("ff:ff");	
+// payload with the current MTU (which may be too small for a frame)
+static size_t maxpayload_154 (l2net *l2) {
+	if (l2->mtu_ <= I154_SIZE_HEADER + I154_SIZE_FCS)
+		return 0 ;
+	return l2->mtu_ - (I154_SIZE_HEADER + I154_SIZE_FCS) ;
 }
 
 
+// payload of a single frame
+static size_t maxframepayload (l2net *l2) {
+	size_t mtu = l2->mtu_ < I154_MTU ? l2->mtu_ : I154_MTU ;
 
-
-
-l2addr_154 *init_l2addr_154_addr(const l2addr_154 *x){
-	l2addr_154 *addr =(l2addr_154 *)malloc(sizeof(struct l2addr_154));
-	if (addr == NULL)
-		printf("Memory allocation failed\n");
-	addr -> addr_ = x->addr_ ;
-	return addr;
-}
-
-void copyAddr(l2addr_154 *x, const l2addr_154 *y) {
-	x->addr_ = y->addr_;
+	if (mtu <= I154_SIZE_HEADER + I154_SIZE_FCS)
+		return 0 ;
+	return mtu - (I154_SIZE_HEADER + I154_SIZE_FCS) ;
 }
 
 
-bool isEqualAddr(const l2addr_154 *x, const l2addr_154 *y) {
-	l2addr_154 *oe = (l2addr_154 *)y;
-	return x->addr_ == oe->addr_;
-}
-
-void printAddr (const l2addr_154 *x)  {
-	printf("%x",BYTE_LOW(x->addr_));
-	printf(" : " );
-	printf("%x",BYTE_HIGH(x->addr_) );
-}
+/**
+ * @brief Send a message
+ *
+ * If aggregation is on, a small message is kept in order to be sent
+ * with other messages to the same destination by `flush_send` (see
+ * agg.h). A message larger than a frame is fragmented (see frag.h),
+ * if the current MTU allows it.
+ *
+ * @return true if the message (or all its fragments) has been queued
+ */
 
+static bool send_154 (l2net *l2, const l2addr *dest, const uint8_t *data, size_t len) {
+	l2net_154 *l = L2_154 (l2) ;
+	bool success = false;
 
-void printAddr_2 (const addr2_t x)  {
-	printf("%x",BYTE_LOW(x));
-	printf(" : " );
-	printf("%x",BYTE_HIGH(x) );
+#if I154_AGG_NDEST > 0
+	if (agg_add (&l->agg_, dest->addr_, data, len, maxframepayload (l2)))
+		return true ;
+	agg_flush (&l->agg_, dest->addr_) ;	// keep the order
+#endif
+	if (len <= maxframepayload (l2))
+		success = sendto (l->cm_, dest->addr_, data, len) ;
+#if I154_DGRAM_MAX > 0
+	else if (len <= maxpayload_154 (l2))
+		success = frag_send (&l->frag_, dest->addr_, data, len,
+						maxframepayload (l2)) ;
+#endif
+	(void) l ;
+	return success;
 }
 
 
-
-
-/******************************************************************************
- * l2net_154 methods
+#if I154_AGG_NDEST > 0
+/**
+ * @brief Turn aggregation of sent messages on or off
+ *
+ * Pending messages are sent when aggregation is turned off.
  */
 
-// void startL2_154 (l2net_154 *l2, l2addr_154 *a, channel_t chan, panid_t panid) {
-	
-// 	l2->myaddr_ = a ->addr_;
-// 	conmsg = (ConMsg * ) malloc (sizeof(ConMsg));
-//     setAddr2 ( l2->myaddr_) ;
-//     setChannel ( chan) ;
-//     setPanid ( panid) ;
-//     setMsgbufsize(10);
-//     setBroasdcastAddr();
-//     l2->mtu_ = I154_MTU ;
-
-//     l2->curframe_ = NULL;   // no currently received frame
-
-//     start () ;
-
-// }
-
-
-l2net_154* startL2_154 ( l2addr_154 *a, channel_t chan, panid_t panid) {
-	l2net_154 *l2 = (l2net_154 *) malloc (sizeof(l2net_154));
-	if (l2 == NULL)
-		printf("Memory allocation failed\n");
-	l2->myaddr_ = a ->addr_;
-
-	conmsg = (ConMsg * ) malloc (sizeof(ConMsg));
-	if (conmsg == NULL)
-		printf("Memory allocation failed\n");
-    setAddr2 ( l2->myaddr_) ;
-    setChannel ( chan) ;
-    setPanid ( panid) ;
-    setMsgbufsize(10);
-    setBroasdcastAddr();
-    l2->mtu_ = I154_MTU ;
-
-    l2->curframe_ = NULL;   // no currently received frame
+static void setagg_154 (l2net *l2, bool on) {
+	if (! on)
+		agg_flush_all (&L2_154 (l2)->agg_) ;
+	L2_154 (l2)->agg_.on_ = on ;
+}
 
-    start () ;
-    return l2;
 
-}
+/**
+ * @brief Send all messages kept for aggregation
+ *
+ * @return false if a frame could not be queued
+ */
 
-size_t maxpayload (l2net_154 *l2) {
-	return l2->mtu_ - (I154_SIZE_HEADER + I154_SIZE_FCS) ;
+static bool flush_154 (l2net *l2) {
+	return agg_flush_all (&L2_154 (l2)->agg_) ;
 }
+#endif
 
 
-bool send (l2net_154 *l2, l2addr_154 *dest, const uint8_t *data, size_t len) {
-	bool success = false;
-
-	if (len <= l2->mtu_ - (I154_SIZE_HEADER + I154_SIZE_FCS))
-		success = sendto ( ( dest)->addr_, data, len) ;
-	return success;
+static void radio_154 (l2net *l2, bool on) {
+	setRadioOn (L2_154 (l2)->cm_, on) ;
 }
 
 
-
 /**
  * @brief Receive a packet from the IEEE 802.15.4 network
  *	
@@ -185,119 +130,109 @@ bool send (l2net_154 *l2, l2addr_154 *dest, const uint8_t *data, size_t len) {
  * a valid packet (i.e. uses only 16-bits address and an Intra-PAN
  * bit).
  *
- * See the `l2net::l2_recv_t` enumeration for return values.
+ * Fragments are given to the reassembly layer, and are consumed
+ * until a datagram is complete. The first fragment of a datagram
+ * too large to be reassembled is returned as a truncated message.
+ * Messages of an aggregated frame are returned one at a time.
+ *
+ * See the `l2_recv_t` enumeration for return values.
  */
 
-l2_recv_t recv (l2net_154 *l2) 
+static l2_recv_t recv_154 (l2net *l2n) 
 {
+    l2net_154 *l2 = L2_154 (l2n) ;
     l2_recv_t r ;
-    if (l2->curframe_ != NULL) {
-    	skip_received();
-    }
+    bool again ;
 
-    l2->curframe_ = get_received();
+    // next message of the current aggregated frame
     if (l2->curframe_ != NULL
-	    && l2->curframe_->frametype == Z_FT_DATA
-	    && Z_GET_DST_ADDR_MODE (l2->curframe_->fcf) == Z_ADDRMODE_ADDR2
-	    && Z_GET_SRC_ADDR_MODE (l2->curframe_->fcf) == Z_ADDRMODE_ADDR2
-	    && Z_GET_INTRA_PAN (l2->curframe_->fcf)
-	    )
+		&& agg_next (&l2->agg_, &l2->payload_, &l2->paylen_))
+	return RECV_OK ;
+
+    do
     {
-    		
-    	if (l2->curframe_->dstaddr != l2->myaddr_ && l2->curframe_->dstaddr != addr2_broadcast)
-	    	r = RECV_WRONG_DEST ;
+	again = false ;
+	if (l2->curframe_ != NULL) {
+	    skip_received (l2->cm_) ;
+	}
+
+	l2->curframe_ = get_received (l2->cm_) ;
+	if (l2->curframe_ != NULL
+		&& l2->curframe_->frametype == Z_FT_DATA
+		&& Z_GET_DST_ADDR_MODE (l2->curframe_->fcf) == Z_ADDRMODE_ADDR2
+		&& Z_GET_SRC_ADDR_MODE (l2->curframe_->fcf) == Z_ADDRMODE_ADDR2
+		&& Z_GET_INTRA_PAN (l2->curframe_->fcf)
+		)
+	{
+		    
+	    if (l2->curframe_->dstaddr != l2n->myaddr_ && l2->curframe_->dstaddr != addr2_broadcast)
+		r = RECV_WRONG_DEST ;
 	    else{
-	    	r = RECV_OK ;
+		r = RECV_OK ;
+		l2->payload_ = l2->curframe_->payload ;
+		l2->paylen_ = l2->curframe_->paylen ;
+#if I154_DGRAM_MAX > 0
+		switch (frag_input (&l2->frag_, l2->curframe_->srcaddr,
+			    l2->curframe_->payload, l2->curframe_->paylen,
+			    &l2->payload_, &l2->paylen_))
+		{
+		    case FRAG_NONE :
+		    case FRAG_COMPLETE :
+			break ;
+		    case FRAG_TOOBIG :
+			r = RECV_TRUNCATED ;
+			break ;
+		    default :		// fragment consumed
+			r = RECV_EMPTY ;
+			again = true ;
+			break ;
+		}
+#endif
+		if (r == RECV_OK
+			&& agg_start (&l2->agg_, l2->payload_, l2->paylen_)
+			&& ! agg_next (&l2->agg_, &l2->payload_, &l2->paylen_))
+		{
+		    r = RECV_EMPTY ;	// malformed aggregated frame
+		    again = true ;
+		}
 	    }
-    }else r = RECV_EMPTY ;
+	}else r = RECV_EMPTY ;
+    } while (again) ;
 
     return r;
 }
 
 
-/**
- * @brief Returns the broadcast IEEE 802.15.4 address
- *
- * The broadcast IEEE 802.15.4 address is located in a global variable.
- * This method returns its address.
- *
- * @return address of an existing l2addr_154 object (do not free it)
- */
-
-l2addr_154 *bcastaddr (void) {
-	return l2addr_154_broadcast;
+// source address of the received frame
+static void src_154 (l2net *l2, l2addr *a)
+{
+    a->addr_ = L2_154 (l2)->curframe_->srcaddr ;
 }
 
 
-/**
- * @brief Returns the source address of the received frame
- *
- * This methods creates a new l2addr_154 and initializes it with
- * the source address from the currently received frame.
- *
- * @return address of a new l2addr_154 object (to delete after use)
- */
-
-l2addr_154 *get_src (l2net_154 *l2)
+// destination address of the received frame
+static void dst_154 (l2net *l2, l2addr *a)
 {
-    l2addr_154 *a = (l2addr_154 *)malloc(sizeof(struct l2addr_154));
-    if (a == NULL)
-		printf("Memory allocation failed\n");
-    a->addr_ = l2->curframe_->srcaddr ;
-    return a ;
+    a->addr_ = L2_154 (l2)->curframe_->dstaddr ;
 }
 
 
-
-/**
- * @brief Returns the destination address of the received frame
- *
- * This methods creates a new l2addr_154 and initializes it with
- * the destination address from the currently received frame.
- *
- * @return address of a new l2addr_154 object (to delete after use)
- */
-
-l2addr_154 *get_dst (l2net_154 *l2)
+// received payload: frame payload or reassembled datagram
+static uint8_t *payload_154 (l2net *l2) 
 {
-    l2addr_154 *a = (l2addr_154 *)malloc(sizeof(struct l2addr_154));
-    if (a == NULL)
-		printf("Memory allocation failed\n");
-    a->addr_ = l2->curframe_->dstaddr ;
-    return a ;
+    return L2_154 (l2)->payload_ ;
 }
 
 
-
-/**
- * @brief Returns the address of the received payload
- *
- * This methods returns the address of the payload inside the
- * received frame (payload is not copied).
- *
- * @return address inside an existing buffer (do not free it)
- */
-
-uint8_t *get_payload (l2net_154 *l2, int offset) 
+static size_t paylen_154 (l2net *l2) 
 {
-    return l2->curframe_->payload ;
+    return L2_154 (l2)->paylen_ ;
 }
 
 
-
-/**
- * @brief Returns the payload length
- *
- * This methods returns the original length of the received
- * frame. Even if the frame has been truncated on reception,
- * the payload returned is the true payload.
- *
- * @return original length
- */
-
-size_t get_paylen (l2net_154 *l2) 
+static uint8_t lqi_154 (l2net *l2)
 {
-    return l2->curframe_->paylen ;
+    return L2_154 (l2)->curframe_->lqi ;
 }
 
 
@@ -308,8 +243,9 @@ size_t get_paylen (l2net_154 *l2)
  * This methods prints a part of the received frame.
  */
 
-void dump_packet (l2net_154 *l2, size_t start, size_t maxlen)
+static void dump_154 (l2net *l2n, size_t start, size_t maxlen)
 {
+    l2net_154 *l2 = L2_154 (l2n) ;
     size_t i, n ;
 
     n = start + maxlen ;
@@ -319,7 +255,7 @@ void dump_packet (l2net_154 *l2, size_t start, size_t maxlen)
     for (i = start ; i < n ; i++)
     {
 		if (i > start)
-		    printf (' ') ;
+		    printf (" ") ;
 		printf("%x", (l2->curframe_->rawframe [i] >> 4) & 0xf) ;
 		printf("%x", (l2->curframe_->rawframe [i]) & 0xf) ;
     }
@@ -327,10 +263,62 @@ void dump_packet (l2net_154 *l2, size_t start, size_t maxlen)
 }
 
 
-void setMTU(l2net_154 *l2, size_t mtu) {
-	l2->mtu_ = mtu;
-}
+const l2ops l2ops_154 = {
+    .name = "802.15.4",
+    .maxpayload = maxpayload_154,
+    .send = send_154,
+    .recv = recv_154,
+    .src = src_154,
+    .dst = dst_154,
+    .payload = payload_154,
+    .paylen = paylen_154,
+    .lqi = lqi_154,
+    .dump = dump_154,
+#if I154_AGG_NDEST > 0
+    .setagg = setagg_154,
+    .flush = flush_154,
+#endif
+    .radio = radio_154,
+} ;
+
 
-size_t getMTU(l2net_154 *l2) {
-	return l2->mtu_;
-}
\ No newline at end of file
+/**
+ * @brief Start the IEEE 802.15.4 network
+ *
+ * @return the l2net object, to give to `initCasan`
+ */
+
+l2net *startL2_154 ( l2addr_154 *a, channel_t chan, panid_t panid) {
+	l2net_154 *l2 = (l2net_154 *) CASAN_MALLOC (ALLOC_L2, sizeof(l2net_154));
+	if (l2 == NULL) {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		return NULL ;
+	}
+	memset (l2, 0, sizeof *l2) ;
+	l2->base_.ops_ = &l2ops_154 ;
+	l2->base_.myaddr_ = a ->addr_;
+
+	l2->cm_ = (ConMsg *) CASAN_MALLOC (ALLOC_L2, sizeof (ConMsg)) ;
+	if (l2->cm_ == NULL) {
+		CLOG_ERR ("Memory allocation failed\n") ;
+		CASAN_MFREE (l2) ;
+		return NULL ;
+	}
+    init (l2->cm_) ;
+    setAddr2 (l2->cm_, l2->base_.myaddr_) ;
+    setChannel (l2->cm_, chan) ;
+    setPanid (l2->cm_, panid) ;
+    setMsgbufsize (l2->cm_, DEFAULT_MSGBUF_SIZE) ;
+    l2->base_.mtu_ = I154_MAXMTU ;
+    l2->base_.maxmtu_ = I154_MAXMTU ;
+
+    l2->curframe_ = NULL;   // no currently received frame
+    l2->payload_ = NULL ;
+    l2->paylen_ = 0 ;
+    initFrag (&l2->frag_, l2->cm_) ;
+    initAgg (&l2->agg_, l2->cm_) ;
+
+    start (l2->cm_) ;
+    return &l2->base_;
+
+}
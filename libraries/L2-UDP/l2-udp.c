@@ -0,0 +1,206 @@
+/**
+ * @file l2-udp.c
+ * @brief l2net specialization for UDP on a Linux host
+ */
+
+#include "l2-udp.h"
+#include "udpsock.h"
+#include "../Casan/pool.h"
+
+#define	GET16(p)	((p) [0] | ((p) [1] << 8))
+#define	PUT16(p,v)	((p) [0] = BYTE_LOW (v), (p) [1] = BYTE_HIGH (v))
+
+
+/*
+ * UDP port of a node (base port for broadcast, i.e. the multicast group)
+ */
+
+static bool udpport (l2net_udp *l, uint16_t a, uint16_t *port)
+{
+    if (a == L2ADDR_BROADCAST)
+	*port = l->port_ ;
+    else if (a == 0 || (uint32_t) l->port_ + a > 65535)
+	return false ;
+    else
+	*port = l->port_ + a ;
+    return true ;
+}
+
+
+static size_t maxpayload_udp (l2net *l2)
+{
+    if (l2->mtu_ <= L2UDP_OVERHEAD)	// tiny MTU from an Assoc
+	return 0 ;
+    return l2->mtu_ - L2UDP_OVERHEAD ;
+}
+
+
+static bool send_udp (l2net *l2, const l2addr *dest, const uint8_t *data,
+				size_t len)
+{
+    l2net_udp *l = L2_UDP (l2) ;
+    uint8_t buf [L2UDP_HLEN + PKTBUF_SIZE] ;
+    uint16_t port ;
+
+    if (len > maxpayload_udp (l2) || len > PKTBUF_SIZE
+		|| ! udpport (l, dest->addr_, &port))
+	return false ;
+
+    PUT16 (buf, dest->addr_) ;
+    PUT16 (buf + 2, l2->myaddr_) ;
+    memcpy (buf + L2UDP_HLEN, data, len) ;
+    if (! udpsock_send (l->ufd_, port,
+			dest->addr_ == L2ADDR_BROADCAST ? L2UDP_GROUP : NULL,
+			buf, L2UDP_HLEN + len))
+    {
+	l->nerr_++ ;
+	return false ;
+    }
+    l->nsent_++ ;
+    return true ;
+}
+
+
+/*
+ * Read a datagram from a socket, without waiting
+ */
+
+static l2_recv_t read_udp (l2net_udp *l, int fd)
+{
+    int n ;
+    uint16_t dst, src ;
+
+    n = udpsock_recv (fd, l->rbuf_, sizeof l->rbuf_) ;
+    if (n < 0)
+	return RECV_EMPTY ;
+    if (n < L2UDP_HLEN)
+	return RECV_WRONG_TYPE ;
+
+    dst = GET16 (l->rbuf_) ;
+    src = GET16 (l->rbuf_ + 2) ;
+    if (src == l->base_.myaddr_)
+	return RECV_EMPTY ;		// our own broadcast
+    if (dst != l->base_.myaddr_ && dst != L2ADDR_BROADCAST)
+	return RECV_WRONG_DEST ;
+
+    l->nrecv_++ ;
+    if ((size_t) n > sizeof l->rbuf_)
+    {
+	l->rlen_ = sizeof l->rbuf_ - L2UDP_HLEN ;
+	return RECV_TRUNCATED ;
+    }
+    l->rlen_ = n - L2UDP_HLEN ;
+    return RECV_OK ;
+}
+
+
+/**
+ * @brief Receive a message
+ *
+ * Unicast messages are processed before broadcast ones. The
+ * received message stays in the buffer until the next call.
+ */
+
+static l2_recv_t recv_udp (l2net *l2)
+{
+    l2net_udp *l = L2_UDP (l2) ;
+    l2_recv_t r ;
+
+    r = read_udp (l, l->ufd_) ;
+    if (r == RECV_EMPTY)
+	r = read_udp (l, l->mfd_) ;
+    return r ;
+}
+
+
+static void src_udp (l2net *l2, l2addr *a)
+{
+    a->addr_ = GET16 (L2_UDP (l2)->rbuf_ + 2) ;
+}
+
+
+static void dst_udp (l2net *l2, l2addr *a)
+{
+    a->addr_ = GET16 (L2_UDP (l2)->rbuf_) ;
+}
+
+
+static uint8_t *payload_udp (l2net *l2)
+{
+    return L2_UDP (l2)->rbuf_ + L2UDP_HLEN ;
+}
+
+
+static size_t paylen_udp (l2net *l2)
+{
+    return L2_UDP (l2)->rlen_ ;
+}
+
+
+const l2ops l2ops_udp = {
+    .name = "udp",
+    .maxpayload = maxpayload_udp,
+    .send = send_udp,
+    .recv = recv_udp,
+    .src = src_udp,
+    .dst = dst_udp,
+    .payload = payload_udp,
+    .paylen = paylen_udp,
+} ;
+
+
+/**
+ * @brief Start a node on the UDP network
+ *
+ * @param a node address (neither 0 nor broadcast)
+ * @param baseport base port of the network, 0 for L2UDP_PORT
+ * @return the l2net object, to give to `initCasan`, or NULL if
+ *	the sockets cannot be opened (address already in use, etc.)
+ */
+
+l2net *startL2_udp (l2addr *a, uint16_t baseport)
+{
+    l2net_udp *l ;
+    uint16_t port ;
+
+    l = (l2net_udp *) CASAN_MALLOC (ALLOC_L2, sizeof (l2net_udp)) ;
+    if (l == NULL)
+    {
+	CLOG_ERR ("Memory allocation failed\n") ;
+	return NULL ;
+    }
+    memset (l, 0, sizeof *l) ;
+    l->base_.ops_ = &l2ops_udp ;
+    l->base_.myaddr_ = a->addr_ ;
+    l->base_.mtu_ = L2UDP_MTU ;
+    l->base_.maxmtu_ = L2UDP_MAXMTU ;
+    l->port_ = baseport != 0 ? baseport : L2UDP_PORT ;
+
+    l->ufd_ = l->mfd_ = -1 ;
+    if (udpport (l, a->addr_, &port) && a->addr_ != L2ADDR_BROADCAST)
+    {
+	l->ufd_ = udpsock_open (port, NULL) ;
+	l->mfd_ = udpsock_open (l->port_, L2UDP_GROUP) ;
+    }
+    if (l->ufd_ < 0 || l->mfd_ < 0)
+    {
+	CLOG_ERR ("Cannot start UDP node %x\n", (unsigned int) a->addr_) ;
+	stopL2_udp (&l->base_) ;
+	return NULL ;
+    }
+    return &l->base_ ;
+}
+
+
+/**
+ * @brief Close the sockets and free the l2net object
+ */
+
+void stopL2_udp (l2net *l2)
+{
+    l2net_udp *l = L2_UDP (l2) ;
+
+    udpsock_close (l->ufd_) ;
+    udpsock_close (l->mfd_) ;
+    CASAN_MFREE (l) ;
+}
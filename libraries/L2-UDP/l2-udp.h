@@ -0,0 +1,62 @@
+/**
+ * @file l2-udp.h
+ * @brief l2net specialization for UDP on a Linux host
+ *
+ * This specialization allows the engine to run as a native Linux
+ * process, talking to other processes (a master for example) on
+ * the same host:
+ * - each node is a UDP socket bound to 127.0.0.1, port
+ *   `port` + node address
+ * - broadcast is emulated with a multicast group (L2UDP_GROUP) on
+ *   port `port`, looped back on the host: all nodes of the same
+ *   network (i.e. using the same `port`) join it
+ *
+ * Each datagram starts with a header holding the destination and
+ * source addresses (2 bytes each, least significant byte first),
+ * such that a node can ignore its own broadcast messages.
+ *
+ * The MTU has the same meaning as for IEEE 802.15.4 (it includes
+ * the MAC header and trailer): with the default MTU, the engine
+ * sends the same messages as on the radio. It may be raised up to
+ * L2UDP_MAXMTU by MTU negociation, and messages are never
+ * fragmented.
+ */
+
+#ifndef L2_UDP_H
+#define	L2_UDP_H
+
+#include "../Casan/l2.h"
+#include "../Casan/pktbuf.h"
+
+#define	L2UDP_PORT	20000		// default base port
+#define	L2UDP_GROUP	"239.255.21.54"
+
+#define	L2UDP_HLEN	4		// dst + src
+#define	L2UDP_OVERHEAD	11		// MAC header + FCS of 802.15.4
+#define	L2UDP_MTU	127
+#define	L2UDP_MAXMTU	(PKTBUF_SIZE + L2UDP_OVERHEAD)
+
+	typedef struct l2net_udp {
+		l2net base_ ;		// must be the first member
+
+		uint16_t port_ ;	// base port
+		int ufd_ ;		// unicast socket
+		int mfd_ ;		// broadcast (multicast) socket
+
+		uint8_t rbuf_ [L2UDP_HLEN + PKTBUF_SIZE] ;
+		size_t rlen_ ;		// received length (without header)
+
+		/* statistics */
+		uint32_t nsent_ ;
+		uint32_t nrecv_ ;
+		uint32_t nerr_ ;	// send errors
+	} l2net_udp ;
+
+#define	L2_UDP(l2)	((l2net_udp *) (l2))
+
+	extern const l2ops l2ops_udp ;
+
+	l2net *startL2_udp (l2addr *a, uint16_t port) ;	// 0: L2UDP_PORT
+	void stopL2_udp (l2net *l2) ;
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file udpsock.c
+ * @brief UDP sockets on the loopback interface
+ */
+
+#include "udpsock.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+static void sockaddr (struct sockaddr_in *sin, uint16_t port, const char *group)
+{
+    memset (sin, 0, sizeof *sin) ;
+    sin->sin_family = AF_INET ;
+    sin->sin_port = htons (port) ;
+    if (group != NULL)
+	sin->sin_addr.s_addr = inet_addr (group) ;
+    else
+	sin->sin_addr.s_addr = htonl (INADDR_LOOPBACK) ;
+}
+
+
+/**
+ * @brief Open a socket
+ *
+ * A node socket (`group` == NULL) is bound to 127.0.0.1:`port`,
+ * and sends multicast datagrams on the loopback interface, looped
+ * back to the sockets of the host. A group socket is bound to
+ * `port` (shared with other group sockets) and joins `group`.
+ *
+ * @return file descriptor, or -1 (with a message)
+ */
+
+int udpsock_open (uint16_t port, const char *group)
+{
+    struct sockaddr_in sin ;
+    struct in_addr lo ;
+    struct ip_mreq mreq ;
+    unsigned char loop = 1 ;
+    int fd, on = 1, r ;
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0) ;
+    if (fd < 0)
+    {
+	perror ("socket") ;
+	return -1 ;
+    }
+
+    lo.s_addr = htonl (INADDR_LOOPBACK) ;
+    sockaddr (&sin, port, NULL) ;
+    if (group == NULL)
+    {
+	r = bind (fd, (struct sockaddr *) &sin, sizeof sin) ;
+	if (r == 0)
+	    r = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof lo) ;
+	if (r == 0)
+	    r = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_LOOP,
+				&loop, sizeof loop) ;
+    }
+    else
+    {
+	sin.sin_addr.s_addr = htonl (INADDR_ANY) ;
+	mreq.imr_multiaddr.s_addr = inet_addr (group) ;
+	mreq.imr_interface = lo ;
+	r = setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on) ;
+	if (r == 0)
+	    r = bind (fd, (struct sockaddr *) &sin, sizeof sin) ;
+	if (r == 0)
+	    r = setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				&mreq, sizeof mreq) ;
+    }
+    if (r < 0)
+    {
+	perror ("udp port") ;
+	close (fd) ;
+	return -1 ;
+    }
+    return fd ;
+}
+
+
+void udpsock_close (int fd)
+{
+    if (fd >= 0)
+	close (fd) ;
+}
+
+
+/**
+ * @brief Send a datagram to 127.0.0.1:`port`, or to `group`:`port`
+ */
+
+bool udpsock_send (int fd, uint16_t port, const char *group,
+				const uint8_t *buf, size_t len)
+{
+    struct sockaddr_in sin ;
+    struct iovec iov ;
+    struct msghdr mh ;
+
+    sockaddr (&sin, port, group) ;
+    iov.iov_base = (void *) buf ;
+    iov.iov_len = len ;
+    memset (&mh, 0, sizeof mh) ;
+    mh.msg_name = &sin ;
+    mh.msg_namelen = sizeof sin ;
+    mh.msg_iov = &iov ;
+    mh.msg_iovlen = 1 ;
+    return sendmsg (fd, &mh, 0) == (ssize_t) len ;
+}
+
+
+/**
+ * @brief Receive a datagram, without waiting
+ *
+ * @return real datagram length (larger than `size` if the datagram
+ *	has been truncated), or -1 if there is no datagram
+ */
+
+int udpsock_recv (int fd, uint8_t *buf, size_t size)
+{
+    struct iovec iov ;
+    struct msghdr mh ;
+
+    iov.iov_base = buf ;
+    iov.iov_len = size ;
+    memset (&mh, 0, sizeof mh) ;
+    mh.msg_iov = &iov ;
+    mh.msg_iovlen = 1 ;
+    return recvmsg (fd, &mh, MSG_DONTWAIT | MSG_TRUNC) ;
+}
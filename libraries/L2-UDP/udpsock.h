@@ -0,0 +1,24 @@
+/**
+ * @file udpsock.h
+ * @brief UDP sockets on the loopback interface, for l2-udp.c
+ *
+ * The socket calls are kept in this file, which does not include
+ * any CASAN header: the names send and recv (see Casan/l2.h) and
+ * sendto (see ConMsg.h) are also used by the C library. For the
+ * same reason, only sendmsg and recvmsg are used here.
+ */
+
+#ifndef UDPSOCK_H
+#define	UDPSOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+int udpsock_open (uint16_t port, const char *group) ;
+void udpsock_close (int fd) ;
+bool udpsock_send (int fd, uint16_t port, const char *group,
+				const uint8_t *buf, size_t len) ;
+int udpsock_recv (int fd, uint8_t *buf, size_t size) ;
+
+#endif
@@ -0,0 +1,501 @@
+#include "../../host/bench.h"
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Micro-benchmarks of the CoAP codec and of the CASAN engine, on the
+ * host, with a corpus of representative messages:
+ * - Hello and Assoc control messages (sent by the master)
+ * - GET requests with 1 to 6 options
+ * - an observe notification (sent by a slave)
+ * Operations measured: coap_decode, coap_encode, coap_size (for each
+ * message of the corpus), push_option, get_resource, get_well_known
+ * and a full iteration of loop (idle, and with a GET request to
+ * answer). Results (ns, allocations and bytes allocated per
+ * operation) are printed and written as JSON.
+ *
+ * Usage: bench [iterations [json-file]]
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVE		0x0001
+#define	MASTER		0x00fe
+#define	SLAVEID		1000
+#define	HLID		42
+
+#define	NRES		8		// resources registered in the slave
+#define	STEP		4		// ms between two loop iterations
+#define	MAXMSG		MAX_PAYLOAD
+
+#define	JSONFILE	"/tmp/bench.json"
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * Allocations are counted for the benchmark harness
+ */
+
+void *__libc_malloc (size_t size) ;
+void *__libc_calloc (size_t nmemb, size_t size) ;
+void *__libc_realloc (void *ptr, size_t size) ;
+void __libc_free (void *ptr) ;
+
+void *malloc (size_t size)
+{
+    bench_nallocs++ ;
+    bench_nbytes += size ;
+    return __libc_malloc (size) ;
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+    bench_nallocs++ ;
+    bench_nbytes += nmemb * size ;
+    return __libc_calloc (nmemb, size) ;
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    bench_nallocs++ ;
+    bench_nbytes += size ;
+    return __libc_realloc (ptr, size) ;
+}
+
+void free (void *ptr)
+{
+    __libc_free (ptr) ;
+}
+
+/*
+ * The CASAN engine is verbose: its output is discarded during
+ * the measures
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+uint8_t process_res (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+/******************************************************************************
+ * Corpus
+ */
+
+struct corpus
+{
+    char name [16] ;
+    Msg *m ;
+    uint8_t buf [MAXMSG] ;
+    uint16_t len ;
+} ;
+
+#define	NCORPUS		9		// hello, assoc, get1..get6, notify
+
+struct corpus corpus [NCORPUS] ;
+int ncorpus ;
+
+void push_opaque (Msg *m, optcode_t c, const char *val)
+{
+    option *o ;
+
+    o = initOptionOpaque (c, val, strlen (val)) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+void push_uint (Msg *m, optcode_t c, uint val)
+{
+    option *o ;
+
+    o = initOptionInteger (c, val) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+void set_token2 (Msg *m, uint16_t id)
+{
+    token tok ;
+
+    tok.toklen_ = 2 ;
+    tok.token_ [0] = id >> 8 ;
+    tok.token_ [1] = id & 0xff ;
+    set_token_msg (m, &tok) ;
+}
+
+Msg *mk_hello (l2net *l2)
+{
+    Msg *m = initMsg (l2) ;
+    char q [32] ;
+
+    set_id (m, 1) ;
+    set_type (m, COAP_TYPE_NON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    snprintf (q, sizeof q, "hello=%d", HLID) ;
+    push_opaque (m, MO_Uri_Query, q) ;
+    return m ;
+}
+
+Msg *mk_assoc (l2net *l2, uint16_t id)
+{
+    Msg *m = initMsg (l2) ;
+
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    push_opaque (m, MO_Uri_Query, "ttl=72000") ;	// 1 hour
+    push_opaque (m, MO_Uri_Query, "mtu=127") ;
+    return m ;
+}
+
+// GET request with nopt options (1 to 6), for the resource "res7"
+Msg *mk_get (l2net *l2, uint16_t id, int nopt)
+{
+    Msg *m = initMsg (l2) ;
+
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_GET) ;
+    set_token2 (m, id) ;
+    push_opaque (m, MO_Uri_Path, "res7") ;
+    if (nopt >= 2)
+	push_uint (m, MO_Accept, 0) ;
+    if (nopt >= 3)
+	push_opaque (m, MO_Uri_Query, "unit=lux") ;
+    if (nopt >= 4)
+	push_opaque (m, MO_Uri_Host, "node1") ;
+    if (nopt >= 5)
+	push_uint (m, MO_Uri_Port, 5683) ;
+    if (nopt >= 6)
+	push_opaque (m, MO_Uri_Query, "fmt=short") ;
+    return m ;
+}
+
+Msg *mk_notify (l2net *l2)
+{
+    Msg *m = initMsg (l2) ;
+
+    set_id (m, 7) ;
+    set_type (m, COAP_TYPE_NON) ;
+    set_code (m, COAP_RETURN_CODE (2, 5)) ;
+    set_token2 (m, 0x1234) ;
+    push_uint (m, MO_Observe, 12) ;
+    push_uint (m, MO_Content_Format, 0) ;
+    set_payload_msg (m, (uint8_t *) "21", 2) ;
+    return m ;
+}
+
+void add_corpus (const char *name, Msg *m)
+{
+    struct corpus *c = &corpus [ncorpus++] ;
+
+    snprintf (c->name, sizeof c->name, "%s", name) ;
+    c->m = m ;
+    c->len = sizeof c->buf ;
+    CHECK (coap_encode (m, c->buf, &c->len)) ;
+}
+
+void mk_corpus (l2net *l2)
+{
+    char name [16] ;
+    int i ;
+
+    add_corpus ("hello", mk_hello (l2)) ;
+    add_corpus ("assoc", mk_assoc (l2, 2)) ;
+    for (i = 1 ; i <= 6 ; i++)
+    {
+	snprintf (name, sizeof name, "get%d", i) ;
+	add_corpus (name, mk_get (l2, 100 + i, i)) ;
+    }
+    add_corpus ("notify", mk_notify (l2)) ;
+}
+
+/******************************************************************************
+ * Frames from the master to the slave, on the default simulated radio
+ */
+
+uint8_t macseq ;
+
+bool inject (Msg *m)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    uint16_t fcf, len ;
+
+    fcf = Z_SET_FRAMETYPE (Z_FT_DATA) | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_INTRA_PAN (1) | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
+	    | Z_SET_SRC_ADDR_MODE (Z_ADDRMODE_ADDR2) ;
+    frame [0] = fcf & 0xff ;
+    frame [1] = fcf >> 8 ;
+    frame [2] = macseq++ ;
+    frame [3] = PANID & 0xff ;
+    frame [4] = PANID >> 8 ;
+    frame [5] = SLAVE & 0xff ;
+    frame [6] = SLAVE >> 8 ;
+    frame [7] = MASTER & 0xff ;
+    frame [8] = MASTER >> 8 ;
+    len = sizeof frame - 9 ;
+    if (! coap_encode (m, frame + 9, &len))
+	return false ;
+    return sim_radio_receive (frame, 9 + len, 255) ;
+}
+
+/******************************************************************************
+ * Benchmarks
+ */
+
+void bench_codec (Bench *b, l2net *l2, long int n)
+{
+    char name [BENCH_NAMELEN] ;
+    uint8_t sbuf [MAXMSG] ;
+    struct corpus *c ;
+    uint16_t len ;
+    Msg *m ;
+    long int i ;
+    int k ;
+    bool ok ;
+
+    m = initMsg (l2) ;
+    for (k = 0 ; k < ncorpus ; k++)
+    {
+	c = &corpus [k] ;
+	snprintf (name, sizeof name, "coap_decode/%s", c->name) ;
+	ok = true ;
+	bench_begin (b) ;
+	for (i = 0 ; i < n ; i++)
+	    ok &= coap_decode (m, c->buf, c->len, false) ;
+	bench_end (b, name, n) ;
+	CHECK (ok) ;
+	resetMsg (m) ;
+    }
+    freeMsg (m) ;
+
+    for (k = 0 ; k < ncorpus ; k++)
+    {
+	c = &corpus [k] ;
+	snprintf (name, sizeof name, "coap_encode/%s", c->name) ;
+	ok = true ;
+	bench_begin (b) ;
+	for (i = 0 ; i < n ; i++)
+	{
+	    len = sizeof sbuf ;
+	    ok &= coap_encode (c->m, sbuf, &len) ;
+	}
+	bench_end (b, name, n) ;
+	CHECK (ok && len == c->len && memcmp (sbuf, c->buf, len) == 0) ;
+    }
+
+    for (k = 0 ; k < ncorpus ; k++)
+    {
+	size_t sz = 0 ;
+
+	c = &corpus [k] ;
+	snprintf (name, sizeof name, "coap_size/%s", c->name) ;
+	bench_begin (b) ;
+	for (i = 0 ; i < n ; i++)
+	    sz += coap_size (c->m, false) ;
+	bench_end (b, name, n) ;
+	CHECK (sz == (size_t) n * c->len) ;
+    }
+}
+
+// 6 options, pushed in reverse order (each one is inserted first)
+void bench_options (Bench *b, l2net *l2, long int n)
+{
+    option *o [6] ;
+    Msg *m ;
+    long int i ;
+    int k ;
+
+    o [0] = initOptionOpaque (MO_Uri_Query, "fmt=short", 9) ;
+    o [1] = initOptionOpaque (MO_Uri_Query, "unit=lux", 8) ;
+    o [2] = initOptionInteger (MO_Accept, 0) ;
+    o [3] = initOptionOpaque (MO_Uri_Path, "res7", 4) ;
+    o [4] = initOptionInteger (MO_Uri_Port, 5683) ;
+    o [5] = initOptionOpaque (MO_Uri_Host, "node1", 5) ;
+    m = initMsg (l2) ;
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	for (k = 0 ; k < 6 ; k++)
+	    push_option (m, o [k]) ;
+	resetMsg (m) ;
+    }
+    bench_end (b, "push_option+reset/6", n * 6) ;
+    freeMsg (m) ;
+    for (k = 0 ; k < 6 ; k++)
+	freeOption (o [k]) ;
+}
+
+void bench_resources (Bench *b, Casan *ca, l2net *l2, long int n)
+{
+    Resource *r = NULL ;
+    Msg *out ;
+    long int i ;
+    bool ok ;
+
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+	r = get_resource (ca, "res0") ;
+    bench_end (b, "get_resource/first", n) ;
+    CHECK (r != NULL) ;
+
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+	r = get_resource (ca, "res7") ;
+    bench_end (b, "get_resource/last", n) ;
+    CHECK (r != NULL) ;
+
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+	r = get_resource (ca, "nope") ;
+    bench_end (b, "get_resource/missing", n) ;
+    CHECK (r == NULL) ;
+
+    out = initMsg (l2) ;
+    ok = true ;
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	ok &= get_well_known (ca, out) ;
+	resetMsg (out) ;
+    }
+    bench_end (b, "get_well_known/8", n) ;
+    CHECK (ok) ;
+    freeMsg (out) ;
+}
+
+/*
+ * Full loop iterations: the slave is first associated. Time advances
+ * by STEP ms on each iteration, such that the CSMA/CA backoff of the
+ * answer is over before the next request, and MAC sequence numbers
+ * (which wrap after 256 frames) are never considered as duplicates.
+ */
+
+void bench_loop (Bench *b, Casan *ca, l2net *l2, long int n)
+{
+    ConMsg *cm ;
+    Msg *m ;
+    long int i ;
+    int sent ;
+
+    cm = L2_154 (l2)->cm_ ;
+    loop (ca) ;				// cold start: Discover
+    m = mk_assoc (l2, 1) ;
+    CHECK (inject (m)) ;
+    freeMsg (m) ;
+    clock_advance (STEP) ;
+    loop (ca) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	clock_advance (STEP) ;
+	loop (ca) ;
+    }
+    bench_end (b, "loop/idle", n) ;
+
+    // answers sent (or waiting for the end of their backoff)
+    sent = getstat (cm)->tx_sent + tx_pending (cm) ;
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	clock_advance (STEP) ;
+	inject (corpus [3].m) ;		// get2
+	loop (ca) ;
+    }
+    bench_end (b, "loop/get-dedup", n) ;
+    CHECK (getstat (cm)->tx_sent + tx_pending (cm) - sent == n) ;
+
+    sent = getstat (cm)->tx_sent + tx_pending (cm) ;
+    m = mk_get (l2, 0, 2) ;
+    bench_begin (b) ;
+    for (i = 0 ; i < n ; i++)
+    {
+	clock_advance (STEP) ;
+	set_id (m, 1000 + i) ;
+	inject (m) ;
+	loop (ca) ;
+    }
+    bench_end (b, "loop/get", n) ;
+    freeMsg (m) ;
+    CHECK (getstat (cm)->tx_sent + tx_pending (cm) - sent == n) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *jsonfile = JSONFILE ;
+    long int n = 100000 ;
+    l2addr_154 a ;
+    l2net *l2 ;
+    Resource *res ;
+    Casan *ca ;
+    Bench *b ;
+    char name [8] ;
+    int i ;
+
+    if (argc > 1)
+	n = atoi (argv [1]) ;
+    if (argc > 2)
+	jsonfile = argv [2] ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    b = initBench ("casan") ;
+
+    quiet (true) ;
+    a.addr_ = SLAVE ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    ca = initCasan (l2, 0, SLAVEID) ;
+    for (i = 0 ; i < NRES ; i++)
+    {
+	snprintf (name, sizeof name, "res%d", i) ;
+	res = initResource (name, name, "sensor") ;
+	setHandlerResource (res, COAP_CODE_GET, process_res) ;
+	register_resource (ca, res) ;
+    }
+    mk_corpus (l2) ;
+
+    bench_codec (b, l2, n) ;
+    bench_options (b, l2, n) ;
+    bench_resources (b, ca, l2, n) ;
+    bench_loop (b, ca, l2, n / 10) ;
+    quiet (false) ;
+
+    bench_print (b) ;
+    CHECK (bench_write_json (b, jsonfile)) ;
+    CHECK (b->nres_ == 3 * NCORPUS + 1 + 4 + 3) ;
+
+    for (i = 0 ; i < ncorpus ; i++)
+	freeMsg (corpus [i].m) ;
+    freeBench (b) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
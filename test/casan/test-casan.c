@@ -55,7 +55,7 @@ uint8_t process_temp2 (Msg *in, Msg *out)
 }
 
 
-l2net_154 *l2;
+l2net *l2;
 l2addr_154 *myaddr;
 Casan *ca;
 Resource *r1;
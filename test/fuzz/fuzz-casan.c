@@ -0,0 +1,573 @@
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Fuzz target for the receive path of a slave: arbitrary frames are
+ * given to the radio, and go through ConMsg, the L2 (fragmentation and
+ * aggregation), coap_decode and the CASAN engine (loop).
+ *
+ * Input format:
+ * - byte 0: mode. Bit 0 set: the slave is associated (with a canned
+ *   Assoc message) before the frames are received.
+ * - then a sequence of chunks. Each chunk starts with a byte b, and
+ *   contains n = (b & 0x7f) bytes (or less, at the end of the input).
+ *   If b & 0x80, the chunk is a raw 802.15.4 frame (without FCS).
+ *   Otherwise, the chunk is a MAC payload, sent by the master to the
+ *   slave (a valid MAC header is added).
+ * Each frame is followed by an iteration of loop, and time advances
+ * by STEP ms. The whole input (without the mode byte) is also given
+ * to coap_decode directly, and a successfully decoded message must
+ * be encoded again.
+ *
+ * The slave is reset before each input, such that an input always
+ * gives the same results.
+ *
+ * Build with sanitizers (default) and:
+ * - "make FUZZER=libfuzzer": libFuzzer target (clang)
+ * - "make CC=afl-clang-fast": AFL++ target, run with
+ *	afl-fuzz -i seeds -o findings -- ./fuzz-casan @@
+ * - "make": standalone program (gcc), with a simple built-in mutator
+ *
+ * Usage of the standalone program:
+ *	fuzz-casan			built-in campaign (ITER inputs)
+ *	fuzz-casan -n iterations	built-in campaign
+ *	fuzz-casan -s directory		write the seed corpus
+ *	fuzz-casan file ...		run each file (reproducer)
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVE		0x0001
+#define	MASTER		0x00fe
+#define	SLAVEID		1000
+
+#define	NRES		3
+#define	STEP		4		// ms between two frames
+#define	MACHDR		9
+#define	MAXIN		1024		// maximum input size
+
+#define	MODE_ASSOC	0x01
+
+#define	ITER		50000
+#define	SEED		0x2545f491
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+l2net *l2 ;
+Casan *ca ;
+Resource *res [NRES] ;
+uint8_t macseq ;
+
+/*
+ * The CASAN engine is verbose: its output is discarded while inputs
+ * are processed, unless a single input is run
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+/******************************************************************************
+ * Slave
+ */
+
+char value [16] = "on" ;
+int trigger ;
+
+uint8_t process_get (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) value, strlen (value)) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+uint8_t process_put (Msg *in, Msg *out)
+{
+    int len ;
+
+    len = get_paylen_msg (in) ;
+    if (len >= (int) sizeof value)
+	return COAP_RETURN_CODE (4, 13) ;
+    if (len > 0)
+	memcpy (value, get_payload_msg (in), len) ;
+    value [len] = '\0' ;
+    return COAP_RETURN_CODE (2, 4) ;
+}
+
+int obs_trigger (void)
+{
+    return trigger++ % 4 == 0 ;
+}
+
+void setup (void)
+{
+    l2addr_154 a ;
+    char name [16] ;
+    int i ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    a.addr_ = SLAVE ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    ca = initCasan (l2, 0, SLAVEID) ;
+    for (i = 0 ; i < NRES ; i++)
+    {
+	snprintf (name, sizeof name, "res%d", i) ;
+	res [i] = initResource (name, name, "sensor") ;
+	setHandlerResource (res [i], COAP_CODE_GET, process_get) ;
+	setHandlerResource (res [i], COAP_CODE_PUT, process_put) ;
+    }
+    ohandlerResource (res [0], NULL, NULL, obs_trigger) ;
+}
+
+/*
+ * Back to the initial state: frames still in the RX ring or in the
+ * TX queue are discarded, and the time advances past the MAC
+ * duplicate detection window
+ */
+
+void reset_slave (void)
+{
+    l2net_154 *l2154 = L2_154 (l2) ;
+    ConMsg *cm = l2154->cm_ ;
+    int i ;
+
+    while (get_received (cm) != NULL)
+	skip_received (cm) ;
+    l2154->curframe_ = NULL ;
+    initFrag (&l2154->frag_, cm) ;
+    initAgg (&l2154->agg_, cm) ;
+
+    clock_advance (1000) ;
+    poll_tx (cm) ;
+
+    resetCasan (ca) ;
+    for (i = 0 ; i < NRES ; i++)
+    {
+	observedResource (res [i], false, NULL) ;
+	register_resource (ca, res [i]) ;
+    }
+    strcpy (value, "on") ;
+    trigger = 0 ;
+}
+
+/*
+ * Frame from the master to the slave
+ */
+
+void mac_header (uint8_t *frame)
+{
+    uint16_t fcf ;
+
+    fcf = Z_SET_FRAMETYPE (Z_FT_DATA) | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_INTRA_PAN (1) | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
+	    | Z_SET_SRC_ADDR_MODE (Z_ADDRMODE_ADDR2) ;
+    frame [0] = fcf & 0xff ;
+    frame [1] = fcf >> 8 ;
+    frame [2] = macseq++ ;
+    frame [3] = PANID & 0xff ;
+    frame [4] = PANID >> 8 ;
+    frame [5] = SLAVE & 0xff ;
+    frame [6] = SLAVE >> 8 ;
+    frame [7] = MASTER & 0xff ;
+    frame [8] = MASTER >> 8 ;
+}
+
+void receive (const uint8_t *data, size_t len, bool raw)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    size_t hlen ;
+
+    hlen = raw ? 0 : MACHDR ;
+    if (hlen + len > sizeof frame)
+	len = sizeof frame - hlen ;
+    if (! raw)
+	mac_header (frame) ;
+    memcpy (frame + hlen, data, len) ;
+    sim_radio_receive (frame, hlen + len, 255) ;
+    loop (ca) ;
+    clock_advance (STEP) ;
+}
+
+void associate (void)
+{
+    uint8_t buf [MAX_PAYLOAD] ;
+    option *o ;
+    uint16_t len ;
+    Msg *m ;
+
+    loop (ca) ;				// cold start: Discover
+    m = initMsg (l2) ;
+    set_id (m, 1) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    o = initOptionOpaque (MO_Uri_Query, "ttl=72000", 9) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    len = sizeof buf - MACHDR ;
+    if (coap_encode (m, buf, &len))
+	receive (buf, len, false) ;
+    freeMsg (m) ;
+}
+
+/******************************************************************************
+ * Fuzz target
+ */
+
+/*
+ * A message accepted by the decoder can be encoded again
+ */
+
+void fuzz_decode (const uint8_t *data, size_t size)
+{
+    static uint8_t in [MAXIN] ;
+    uint8_t out [2 * MAXIN] ;
+    uint16_t len ;
+    Msg *m ;
+
+    if (size > sizeof in)
+	size = sizeof in ;
+    memcpy (in, data, size) ;		// exact size for the sanitizer
+    m = initMsg (l2) ;
+    if (coap_decode (m, in, size, false))
+    {
+	len = sizeof out ;
+	CHECK (coap_encode (m, out, &len)) ;
+    }
+    freeMsg (m) ;
+}
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+    size_t i, n ;
+
+    if (size == 0 || size > MAXIN)
+	return 0 ;
+
+    reset_slave () ;
+    fuzz_decode (data + 1, size - 1) ;
+    if (data [0] & MODE_ASSOC)
+	associate () ;
+
+    i = 1 ;
+    while (i < size)
+    {
+	n = data [i] & 0x7f ;
+	if (n > size - i - 1)
+	    n = size - i - 1 ;
+	receive (data + i + 1, n, data [i] & 0x80) ;
+	i += 1 + n ;
+    }
+    loop (ca) ;
+    return 0 ;
+}
+
+int LLVMFuzzerInitialize (int *argc, char ***argv)
+{
+    setup () ;
+    return 0 ;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+/******************************************************************************
+ * Seed corpus
+ */
+
+#define	NSEED		8
+
+struct seed
+{
+    uint8_t buf [MAXIN] ;
+    size_t len ;
+} ;
+
+struct seed seeds [NSEED] ;
+int nseed ;
+
+// append a chunk, with the message m encoded as a MAC payload
+void seed_msg (struct seed *s, Msg *m)
+{
+    uint16_t len ;
+
+    len = MAX_PAYLOAD - MACHDR ;
+    CHECK (coap_encode (m, s->buf + s->len + 1, &len)) ;
+    s->buf [s->len] = len ;
+    s->len += 1 + len ;
+    freeMsg (m) ;
+}
+
+Msg *seed_req (uint16_t id, coap_code_t code, const char *path)
+{
+    option *o ;
+    token tok ;
+    Msg *m ;
+
+    m = initMsg (l2) ;
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, code) ;
+    tok.toklen_ = 2 ;
+    tok.token_ [0] = id >> 8 ;
+    tok.token_ [1] = id & 0xff ;
+    set_token_msg (m, &tok) ;
+    o = initOptionOpaque (MO_Uri_Path, path, strlen (path)) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    return m ;
+}
+
+void mk_seeds (void)
+{
+    struct seed *s ;
+    option *o ;
+    Msg *m ;
+
+    quiet (true) ;
+
+    // Hello, then Assoc
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = 0 ;
+    m = initMsg (l2) ;
+    set_id (m, 1) ;
+    set_type (m, COAP_TYPE_NON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    o = initOptionOpaque (MO_Uri_Query, "hello=42", 8) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    seed_msg (s, m) ;
+    m = initMsg (l2) ;
+    set_id (m, 2) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    o = initOptionOpaque (MO_Uri_Query, "ttl=72000", 9) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    o = initOptionOpaque (MO_Uri_Query, "mtu=127", 7) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    seed_msg (s, m) ;
+
+    // associated: GET, GET .well-known, PUT, observe
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = MODE_ASSOC ;
+    seed_msg (s, seed_req (100, COAP_CODE_GET, "res1")) ;
+    seed_msg (s, seed_req (101, COAP_CODE_GET, "nope")) ;
+
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = MODE_ASSOC ;
+    m = seed_req (200, COAP_CODE_GET, ".well-known") ;
+    o = initOptionOpaque (MO_Uri_Path, "casan", 5) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    seed_msg (s, m) ;
+
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = MODE_ASSOC ;
+    m = seed_req (300, COAP_CODE_PUT, "res2") ;
+    set_payload_msg (m, (uint8_t *) "off", 3) ;
+    seed_msg (s, m) ;
+    seed_msg (s, seed_req (301, COAP_CODE_GET, "res2")) ;
+
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = MODE_ASSOC ;
+    m = seed_req (400, COAP_CODE_GET, "res0") ;
+    o = initOptionInteger (MO_Observe, 0) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    seed_msg (s, m) ;
+    seed_msg (s, seed_req (401, COAP_CODE_GET, "res1")) ;
+    seed_msg (s, seed_req (402, COAP_CODE_GET, "res1")) ;
+
+    // raw frame (MAC header included) with a GET
+    s = &seeds [nseed++] ;
+    s->buf [s->len++] = MODE_ASSOC ;
+    seed_msg (s, seed_req (500, COAP_CODE_GET, "res1")) ;
+    memmove (s->buf + 2 + MACHDR, s->buf + 2, s->len - 2) ;
+    mac_header (s->buf + 2) ;
+    s->buf [1] = 0x80 | (s->buf [1] + MACHDR) ;
+    s->len += MACHDR ;
+
+    quiet (false) ;
+}
+
+bool write_seeds (const char *dir)
+{
+    char path [256] ;
+    FILE *fp ;
+    int i ;
+
+    for (i = 0 ; i < nseed ; i++)
+    {
+	snprintf (path, sizeof path, "%s/seed-%d", dir, i) ;
+	fp = fopen (path, "w") ;
+	if (fp == NULL)
+	{
+	    perror (path) ;
+	    return false ;
+	}
+	fwrite (seeds [i].buf, 1, seeds [i].len, fp) ;
+	fclose (fp) ;
+    }
+    return true ;
+}
+
+/******************************************************************************
+ * Built-in campaign: deterministic random mutations of the seeds.
+ * Not coverage-guided (use libFuzzer or AFL for that), but the
+ * mutations favor the values which are special for CoAP and 802.15.4.
+ */
+
+uint32_t rng = SEED ;
+
+uint32_t rnd (uint32_t n)
+{
+    rng ^= rng << 13 ;
+    rng ^= rng >> 17 ;
+    rng ^= rng << 5 ;
+    return rng % n ;
+}
+
+const uint8_t special [] = {
+    0x00, 0x01, 0x0c, 0x0d, 0x0e, 0x0f, 0x40, 0x41, 0x48, 0x4f,
+    0x7f, 0x80, 0xc0, 0xd0, 0xe0, 0xf0, 0xfe, 0xff,
+} ;
+
+size_t mutate (uint8_t *buf, size_t len)
+{
+    const struct seed *s ;
+    size_t p, n ;
+    int k ;
+
+    for (k = 1 + rnd (4) ; k > 0 ; k--)
+    {
+	p = rnd (len) ;
+	switch (rnd (6))
+	{
+	    case 0 :				// flip a bit
+		buf [p] ^= 1 << rnd (8) ;
+		break ;
+	    case 1 :				// special value
+		buf [p] = special [rnd (sizeof special)] ;
+		break ;
+	    case 2 :				// random value
+		buf [p] = rnd (256) ;
+		break ;
+	    case 3 :				// insert a byte
+		if (len < MAXIN)
+		{
+		    memmove (buf + p + 1, buf + p, len - p) ;
+		    buf [p] = special [rnd (sizeof special)] ;
+		    len++ ;
+		}
+		break ;
+	    case 4 :				// remove bytes
+		n = 1 + rnd (8) ;
+		if (p + n < len)
+		{
+		    memmove (buf + p, buf + p + n, len - p - n) ;
+		    len -= n ;
+		}
+		break ;
+	    case 5 :				// append another seed
+		s = &seeds [rnd (nseed)] ;
+		n = s->len - 1 ;
+		if (len + n <= MAXIN)
+		{
+		    memcpy (buf + len, s->buf + 1, n) ;
+		    len += n ;
+		}
+		break ;
+	}
+    }
+    return len ;
+}
+
+void campaign (long int niter)
+{
+    static uint8_t buf [MAXIN] ;
+    const struct seed *s ;
+    long int i ;
+    size_t len ;
+
+    quiet (true) ;
+    for (i = 0 ; i < niter ; i++)
+    {
+	s = &seeds [i % nseed] ;
+	memcpy (buf, s->buf, s->len) ;
+	len = s->len ;
+	if (i >= nseed)
+	    len = mutate (buf, len) ;
+	LLVMFuzzerTestOneInput (buf, len) ;
+    }
+    quiet (false) ;
+}
+
+bool run_file (const char *file)
+{
+    static uint8_t buf [MAXIN + 1] ;
+    size_t len ;
+    FILE *fp ;
+
+    fp = strcmp (file, "-") == 0 ? stdin : fopen (file, "r") ;
+    if (fp == NULL)
+    {
+	perror (file) ;
+	return false ;
+    }
+    len = fread (buf, 1, sizeof buf, fp) ;
+    if (fp != stdin)
+	fclose (fp) ;
+    LLVMFuzzerTestOneInput (buf, len) ;
+    return true ;
+}
+
+int main (int argc, char *argv [])
+{
+    long int niter = ITER ;
+    int i ;
+
+    LLVMFuzzerInitialize (&argc, &argv) ;
+    mk_seeds () ;
+
+    if (argc == 3 && strcmp (argv [1], "-s") == 0)
+	return ! write_seeds (argv [2]) ;
+
+    if (argc == 3 && strcmp (argv [1], "-n") == 0)
+	niter = atoi (argv [2]) ;
+    else if (argc > 1)
+    {
+	for (i = 1 ; i < argc ; i++)
+	    if (! run_file (argv [i]))
+		nerr++ ;
+	return nerr != 0 ;
+    }
+
+    campaign (niter) ;
+    printf ("%ld inputs\n", niter) ;
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
+
+#endif
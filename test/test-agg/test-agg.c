@@ -0,0 +1,204 @@
+#include "../../libraries/L2-154/l2-154.h"
+#include "../../host/radio-sim.h"
+
+/*
+ * Test program for the aggregation of small messages, on the host
+ * with the simulated radio: sent frames are captured and given back
+ * to the same node.
+ */
+
+#define CHANNEL     17
+#define PANID       CONST16 (0xca, 0xfe)
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+#define	MAXCAPT	8
+
+uint8_t capt [MAXCAPT][MAX_PAYLOAD] ;	// captured frames (no fcs)
+int captlen [MAXCAPT] ;
+int ncapt = 0 ;
+
+ConMacParam nocsma = { 0, 0, 0, 0 } ;
+
+void tx_hook (void *arg, const uint8_t *frame, uint8_t len)
+{
+    if (ncapt < MAXCAPT)
+    {
+		memcpy (capt [ncapt], frame, len) ;
+		captlen [ncapt++] = len ;
+    }
+}
+
+void inject (int i)
+{
+    CHECK (sim_radio_receive (capt [i], captlen [i], 200)) ;
+}
+
+// a fake CoAP message, of the given length
+void mkmsg (uint8_t *m, int len, uint8_t id)
+{
+    int i ;
+
+    m [0] = 0x50 ;
+    for (i = 1 ; i < len ; i++)
+		m [i] = id + i ;
+}
+
+// receive a message and check it
+void check_recv (l2net *l2, int len, uint8_t id)
+{
+    uint8_t m [MAX_PAYLOAD] ;
+
+    mkmsg (m, len, id) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (get_paylen (l2) == len) ;
+    CHECK (memcmp (get_payload (l2, 0), m, len) == 0) ;
+}
+
+void test_off (l2net *l2, l2addr_154 *me)
+{
+    uint8_t m [20] ;
+
+    printf ("messages are sent at once without aggregation\n") ;
+    ncapt = 0 ;
+    mkmsg (m, sizeof m, 1) ;
+    CHECK (send (l2, me, m, sizeof m)) ;
+    CHECK (send (l2, me, m, sizeof m)) ;
+    CHECK (ncapt == 2) ;
+    CHECK (flush_send (l2)) ;
+    CHECK (ncapt == 2) ;
+    inject (0) ;
+    check_recv (l2, sizeof m, 1) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+}
+
+void test_pack (l2net *l2, l2addr_154 *me)
+{
+    uint8_t m [30] ;
+    int i ;
+
+    printf ("3 messages in one frame\n") ;
+    setAggregation (l2, true) ;
+    ncapt = 0 ;
+    for (i = 0 ; i < 3 ; i++)
+    {
+		mkmsg (m, 10 + i * 10, i) ;
+		CHECK (send (l2, me, m, 10 + i * 10)) ;
+    }
+    CHECK (ncapt == 0) ;
+    CHECK (flush_send (l2)) ;
+    CHECK (ncapt == 1) ;
+    CHECK (capt [0][9] == AGG_DISPATCH) ;
+    CHECK (captlen [0] == 9 + AGG_HLEN + 3 + 10 + 20 + 30) ;
+    CHECK (L2_154 (l2)->agg_.nframe_ == 1 && L2_154 (l2)->agg_.nmsg_ == 3) ;
+    inject (0) ;
+    for (i = 0 ; i < 3 ; i++)
+		check_recv (l2, 10 + i * 10, i) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+
+    printf ("a single message is sent as is\n") ;
+    ncapt = 0 ;
+    mkmsg (m, 15, 7) ;
+    CHECK (send (l2, me, m, 15)) ;
+    CHECK (flush_send (l2)) ;
+    CHECK (ncapt == 1 && captlen [0] == 9 + 15) ;
+    CHECK (capt [0][9] == 0x50) ;
+    inject (0) ;
+    check_recv (l2, 15, 7) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+}
+
+void test_limits (l2net *l2, l2addr_154 *me)
+{
+    uint8_t m [MAX_PAYLOAD] ;
+    l2addr_154 other = { 0x0002 } ;
+    int i ;
+
+    printf ("full buffer is sent\n") ;
+    ncapt = 0 ;
+    for (i = 0 ; i < 3 ; i++)
+    {
+		mkmsg (m, 50, i) ;
+		CHECK (send (l2, me, m, 50)) ;
+    }
+    CHECK (ncapt == 1) ;			// 2 messages of 50 bytes
+    CHECK (flush_send (l2)) ;
+    CHECK (ncapt == 2) ;
+    inject (0) ;
+    inject (1) ;
+    for (i = 0 ; i < 3 ; i++)
+		check_recv (l2, 50, i) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+
+    printf ("one buffer per destination\n") ;
+    ncapt = 0 ;
+    mkmsg (m, 10, 0) ;
+    CHECK (send (l2, me, m, 10)) ;
+    CHECK (send (l2, &other, m, 10)) ;
+    CHECK (send (l2, me, m, 10)) ;
+    CHECK (send (l2, &other, m, 10)) ;
+    CHECK (ncapt == 0) ;
+    CHECK (flush_send (l2)) ;
+    CHECK (ncapt == 2) ;
+    CHECK (capt [0][5] != capt [1][5]) ;	// dst addr
+
+    printf ("large message is sent after pending ones\n") ;
+    ncapt = 0 ;
+    mkmsg (m, 10, 1) ;
+    CHECK (send (l2, me, m, 10)) ;
+    mkmsg (m, 115, 2) ;			// too large to be aggregated
+    CHECK (send (l2, me, m, 115)) ;
+    CHECK (ncapt == 2) ;
+    inject (0) ;
+    inject (1) ;
+    check_recv (l2, 10, 1) ;
+    check_recv (l2, 115, 2) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+
+    printf ("turning aggregation off sends pending messages\n") ;
+    ncapt = 0 ;
+    CHECK (send (l2, me, m, 10)) ;
+    setAggregation (l2, false) ;
+    CHECK (ncapt == 1) ;
+}
+
+void test_malformed (l2net *l2)
+{
+    uint8_t frame [] = {
+	0x41, 0x88, 0x77,		// fcf (data, intra-pan, addr2), seq
+	0xca, 0xfe,			// dst panid
+	0x01, 0x00,			// dst addr
+	0x34, 0x12,			// src addr
+	AGG_DISPATCH, 2, 0x50, 0x01, 40, 0x50,
+    } ;
+
+    printf ("malformed aggregated frame\n") ;
+    CHECK (sim_radio_receive (frame, sizeof frame, 200)) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (get_paylen (l2) == 2) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;	// bad length ends the frame
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+    l2net *l2 ;
+
+    a = init_l2addr_154_char ("01:00") ;
+    l2 = startL2_154 (a, CHANNEL, PANID) ;
+    setMacParam (L2_154 (l2)->cm_, &nocsma) ;
+    sim_radio_set_tx_hook (tx_hook, NULL) ;
+
+    test_off (l2, a) ;
+    test_pack (l2, a) ;
+    test_limits (l2, a) ;
+    test_malformed (l2) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,452 @@
+#include "../../host/sched.h"
+#include "../../host/medium.h"
+#include "../../host/master.h"
+#include "../../host/replay.h"
+
+/*
+ * Test program for frame capture and replay, on the host:
+ * - capture of the frames received and sent by a slave, during a
+ *   simulation with a master stand-in and some other slaves
+ * - overwrite of the oldest records when the capture ring is full
+ * - export as a pcap file, and reading of this file
+ * - replay of the capture to a new slave, alone, under the virtual
+ *   clock: the slave must receive the same frames and get associated,
+ *   and two replays must give the same frames sent by the slave
+ *
+ * Usage: test-capture [minutes [pcap-file]]
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	MASTER		0x00fe
+#define	HLID		42
+#define	SEED		12345
+#define	NSLAVES		4
+
+#define	START		1000
+#define	BOOT		2000		// boot time of slave i: BOOT * (i+1)
+#define	MINUTE		(60UL * 1000)
+
+#define	CAPTURE		16384		// records for the captured slave
+#define	SMALLCAP	16
+
+#define	PCAPFILE	"/tmp/test-capture.pcap"
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * The CASAN engine is verbose: its output is discarded during
+ * the simulations
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+Casan *start_slave (l2net *l2, long int slaveid)
+{
+    Casan *ca ;
+    Resource *res ;
+
+    ca = initCasan (l2, 0, slaveid) ;
+    res = initResource ("light", "light", "light") ;
+    setHandlerResource (res, COAP_CODE_GET, process_light) ;
+    register_resource (ca, res) ;
+    return ca ;
+}
+
+// frames of a capture, by direction
+int count_dir (ConMsg *cm, uint8_t dir)
+{
+    int i, n = 0 ;
+
+    for (i = 0 ; i < capture_count (cm) ; i++)
+	if (capture_get (cm, i)->dir == dir)
+	    n++ ;
+    return n ;
+}
+
+/******************************************************************************
+ * Capture during a simulation
+ */
+
+struct slave
+{
+    Casan *ca ;
+    ConMsg *cm ;
+    int node ;
+    int agent ;
+    clock_time_t tboot ;
+} ;
+
+struct sim
+{
+    Sched *s ;
+    Medium *m ;
+    Master *ms ;
+    int mnode ;
+    int magent ;
+    int msagent ;
+    struct slave sl [NSLAVES] ;
+} ;
+
+struct sim *cursim ;
+
+bool rx_pending (ConMsg *cm)
+{
+    int n ;
+
+    getRxOccupancy (cm, &n) ;
+    return n > 0 ;
+}
+
+bool medium_agent_next (void *arg, clock_time_t *next)
+{
+    return medium_next (cursim->m, next) ;
+}
+
+void medium_agent_run (void *arg)
+{
+    medium_step (cursim->m) ;
+}
+
+void medium_agent_rx (void *arg, int node)
+{
+    sched_wake (cursim->s, node == cursim->mnode ? cursim->msagent
+				: cursim->sl [node - cursim->mnode - 1].agent) ;
+}
+
+bool master_agent_next (void *arg, clock_time_t *next)
+{
+    if (rx_pending (medium_node (cursim->m, cursim->mnode)->conmsg_))
+    {
+	*next = clock_time () ;
+	return true ;
+    }
+    return master_next (cursim->ms, next) ;
+}
+
+void master_agent_run (void *arg)
+{
+    medium_select (cursim->m, cursim->mnode) ;
+    master_loop (cursim->ms) ;
+    sched_wake (cursim->s, cursim->magent) ;
+}
+
+bool slave_agent_next (void *arg, clock_time_t *next)
+{
+    struct slave *sl = arg ;
+
+    if (clock_time () < sl->tboot)
+	*next = sl->tboot ;
+    else if (rx_pending (sl->cm))
+	*next = clock_time () ;
+    else *next = (clock_time_t) next_wakeup (sl->ca) ;
+    return true ;
+}
+
+void slave_agent_run (void *arg)
+{
+    struct slave *sl = arg ;
+
+    if (clock_time () < sl->tboot)
+	return ;
+    medium_select (cursim->m, sl->node) ;
+    loop (sl->ca) ;
+    sched_wake (cursim->s, cursim->magent) ;
+}
+
+void start_sim (struct sim *sim)
+{
+    struct slave *sl ;
+    int i ;
+
+    sim->s = initSched (NSLAVES + 2, START) ;
+    sim->m = initMedium (NSLAVES + 1, SEED) ;
+    cursim = sim ;
+    medium_set_rx_hook (sim->m, medium_agent_rx, sim) ;
+
+    sim->mnode = medium_add_node (sim->m, MASTER, 0, CHANNEL, PANID) ;
+    sim->ms = initMaster (medium_node (sim->m, sim->mnode)->l2_, HLID, SEED) ;
+    master_set_hello (sim->ms, 10000) ;
+    master_add_resource (sim->ms, "light", COAP_CODE_GET, NULL, false, 1) ;
+    for (i = 0 ; i < NSLAVES ; i++)
+    {
+	sl = &sim->sl [i] ;
+	sl->node = medium_add_node (sim->m, 0x0001 + i, 0, CHANNEL, PANID) ;
+	sl->cm = medium_node (sim->m, sl->node)->conmsg_ ;
+	sl->ca = start_slave (medium_node (sim->m, sl->node)->l2_, 1000 + i) ;
+	sl->tboot = START + BOOT * (i + 1) ;
+    }
+
+    sim->magent = sched_add_agent (sim->s, medium_agent_next,
+					medium_agent_run, NULL) ;
+    sim->msagent = sched_add_agent (sim->s, master_agent_next,
+					master_agent_run, NULL) ;
+    for (i = 0 ; i < NSLAVES ; i++)
+	sim->sl [i].agent = sched_add_agent (sim->s, slave_agent_next,
+					slave_agent_run, &sim->sl [i]) ;
+}
+
+void stop_sim (struct sim *sim)
+{
+    freeMaster (sim->ms) ;
+    freeMedium (sim->m) ;
+    freeSched (sim->s) ;
+}
+
+void run_sim (struct sim *sim, clock_time_t duration)
+{
+    sched_wake (sim->s, sim->msagent) ;
+    quiet (true) ;
+    sched_run_for (sim->s, duration) ;
+    quiet (false) ;
+}
+
+/******************************************************************************
+ * Replay to a new slave, alone on the default radio (transmissions
+ * complete at once)
+ */
+
+struct replayed
+{
+    Sched *s ;
+    Replay *rp ;
+    struct slave sl ;
+    int ragent ;
+} ;
+
+bool replay_agent_next (void *arg, clock_time_t *next)
+{
+    struct replayed *r = arg ;
+
+    return replay_next (r->rp, next) ;
+}
+
+void replay_agent_run (void *arg)
+{
+    struct replayed *r = arg ;
+
+    if (replay_run (r->rp) > 0)
+	sched_wake (r->s, r->sl.agent) ;
+}
+
+bool replayed_slave_next (void *arg, clock_time_t *next)
+{
+    struct replayed *r = arg ;
+
+    if (clock_time () < r->sl.tboot)
+	*next = r->sl.tboot ;
+    else if (rx_pending (r->sl.cm))
+	*next = clock_time () ;
+    else *next = (clock_time_t) next_wakeup (r->sl.ca) ;
+    return true ;
+}
+
+void replayed_slave_run (void *arg)
+{
+    struct replayed *r = arg ;
+
+    if (clock_time () >= r->sl.tboot)
+	loop (r->sl.ca) ;
+}
+
+// replay to slave 0 (address 0x0001), up to the end of the capture
+void replay_slave (struct replayed *r, Replay *rp, clock_time_t end)
+{
+    l2addr_154 a ;
+    l2net *l2 ;
+
+    r->rp = rp ;
+    replay_rewind (rp) ;
+    r->s = initSched (2, START) ;
+    sim_radio_select (NULL) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    a.addr_ = 0x0001 ;
+    quiet (true) ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    r->sl.cm = L2_154 (l2)->cm_ ;
+    setCapture (r->sl.cm, CAPTURE) ;
+    r->sl.ca = start_slave (l2, 1000) ;
+    r->sl.tboot = START + BOOT ;
+    r->ragent = sched_add_agent (r->s, replay_agent_next, replay_agent_run, r) ;
+    r->sl.agent = sched_add_agent (r->s, replayed_slave_next,
+					replayed_slave_run, r) ;
+    sched_run_until (r->s, end) ;
+    quiet (false) ;
+}
+
+void end_replay (struct replayed *r)
+{
+    setCapture (r->sl.cm, 0) ;
+    freeSched (r->s) ;
+}
+
+// digest of the frames sent by a node
+uint32_t tx_digest (ConMsg *cm)
+{
+    const ConCapRec *c ;
+    uint32_t h = 2166136261u ;
+    int i, j ;
+
+    for (i = 0 ; i < capture_count (cm) ; i++)
+    {
+	c = capture_get (cm, i) ;
+	if (c->dir != CONCAP_TX)
+	    continue ;
+	h = (h ^ (uint32_t) c->time) * 16777619u ;
+	for (j = 0 ; j < c->len ; j++)
+	    h = (h ^ c->frame [j]) * 16777619u ;
+    }
+    return h ;
+}
+
+/******************************************************************************
+ * Tests
+ */
+
+void test_capture (int minutes, const char *pcapfile)
+{
+    struct sim sim ;
+    struct replayed r1, r2 ;
+    ConMsg *cm, *small ;
+    const ConCapRec *c ;
+    ConStat st ;
+    Replay *rp, *fp ;
+    clock_time_t end ;
+    int nrx, ntx, i ;
+    bool ok ;
+
+    printf ("capture (%d slaves, %d min)\n", NSLAVES, minutes) ;
+    quiet (true) ;
+    start_sim (&sim) ;
+    quiet (false) ;
+    cm = sim.sl [0].cm ;
+    small = sim.sl [1].cm ;
+    CHECK (setCapture (cm, CAPTURE)) ;
+    CHECK (setCapture (small, SMALLCAP)) ;
+    run_sim (&sim, MINUTE) ;
+    CHECK (master_set_load (sim.ms, 5, 8, 0)) ;
+    run_sim (&sim, minutes * MINUTE) ;
+    master_print_stat (sim.ms) ;
+    CHECK (sim.ms->nassoc_ == NSLAVES) ;
+    end = sched_now (sim.s) ;
+
+    // all frames heard or given to the radio by slave 0
+    nrx = count_dir (cm, CONCAP_RX) ;
+    ntx = count_dir (cm, CONCAP_TX) ;
+    st = *getstat (cm) ;
+    printf ("slave 0: captured rx=%d tx=%d\n", nrx, ntx) ;
+    CHECK (capture_lost (cm) == 0) ;
+    CHECK (nrx == st.rx_heard) ;
+    CHECK (ntx == st.tx_sent + st.tx_error_noack + st.tx_retry) ;
+    CHECK (ntx > 0) ;
+    for (i = 1 ; i < capture_count (cm) ; i++)
+	CHECK (capture_get (cm, i - 1)->time <= capture_get (cm, i)->time) ;
+
+    // small ring: only the last frames
+    CHECK (capture_count (small) == SMALLCAP) ;
+    CHECK (capture_lost (small) > 0) ;
+    st = *getstat (small) ;
+    CHECK (capture_lost (small) + SMALLCAP == st.rx_heard
+			+ st.tx_sent + st.tx_error_noack + st.tx_retry) ;
+    CHECK (capture_get (small, SMALLCAP - 1)->time >= end - MINUTE) ;
+    CHECK (capture_get (small, SMALLCAP) == NULL) ;
+
+    st = *getstat (cm) ;
+    printf ("pcap export\n") ;
+    CHECK (capture_save_pcap (cm, pcapfile)) ;
+    fp = initReplay () ;
+    CHECK (replay_load_pcap (fp, pcapfile)) ;
+    CHECK (fp->nrec_ == nrx + ntx) ;
+    CHECK (fp->nbadrec_ == 0) ;
+    ok = fp->nrec_ == capture_count (cm) ;
+    for (i = 0 ; ok && i < fp->nrec_ ; i++)
+    {
+	c = capture_get (cm, i) ;
+	ok = c->time == fp->rec_ [i].time && c->len == fp->rec_ [i].len
+		&& memcmp (c->frame, fp->rec_ [i].frame, c->len) == 0 ;
+    }
+    CHECK (ok) ;
+    CHECK (! replay_load_pcap (fp, "/nonexistent/file.pcap")) ;
+
+    printf ("replay\n") ;
+    rp = initReplay () ;
+    CHECK (replay_add_capture (rp, cm)) ;
+    CHECK (rp->nrec_ == nrx) ;
+    replay_slave (&r1, rp, end) ;
+    replay_print_stat (rp) ;
+    printf ("replay: %lu ns per frame (decode and processing)\n",
+		(unsigned long int) (r1.s->nsrun_ / (rp->nfed_ ? rp->nfed_ : 1))) ;
+    CHECK (rp->nfed_ == (uint32_t) nrx) ;
+    CHECK (rp->nmissed_ == 0) ;
+    CHECK (getstat (r1.sl.cm)->rx_heard == st.rx_heard) ;
+    CHECK (getstat (r1.sl.cm)->rx_stored == st.rx_stored) ;
+    CHECK (r1.sl.ca->status_ == SL_RUNNING) ;
+    CHECK (getstat (r1.sl.cm)->tx_sent > 0) ;
+
+    // same replay, same frames sent
+    replay_slave (&r2, rp, end) ;
+    CHECK (rp->nfed_ == (uint32_t) nrx) ;
+    CHECK (tx_digest (r1.sl.cm) == tx_digest (r2.sl.cm)) ;
+    CHECK (getstat (r2.sl.cm)->tx_sent == getstat (r1.sl.cm)->tx_sent) ;
+    end_replay (&r2) ;
+
+    // the pcap file gives the same replay, once own frames are skipped
+    printf ("replay from pcap\n") ;
+    replay_skip_source (fp, 0x0001) ;
+    replay_slave (&r2, fp, end) ;
+    replay_print_stat (fp) ;
+    CHECK (fp->nskipped_ == (uint32_t) ntx) ;
+    CHECK (fp->nfed_ == (uint32_t) nrx) ;
+    CHECK (getstat (r2.sl.cm)->rx_stored == st.rx_stored) ;
+    CHECK (r2.sl.ca->status_ == SL_RUNNING) ;
+    end_replay (&r2) ;
+
+    end_replay (&r1) ;
+    freeReplay (rp) ;
+    freeReplay (fp) ;
+    setCapture (cm, 0) ;
+    setCapture (small, 0) ;
+    stop_sim (&sim) ;
+}
+
+int main (int argc, char *argv [])
+{
+    const char *pcapfile = PCAPFILE ;
+    int minutes = 5 ;
+
+    if (argc > 1)
+	minutes = atoi (argv [1]) ;
+    if (argc > 2)
+	pcapfile = argv [2] ;
+
+    test_capture (minutes, pcapfile) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
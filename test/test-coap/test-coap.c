@@ -21,7 +21,7 @@ PROCESS(test, "bah... test !");
 AUTOSTART_PROCESSES(&test);
 
 
-void test_recv (l2net_154 *l2)
+void test_recv (l2net *l2)
 {
     Msg *in = initMsg(l2) ;
     l2_recv_t r ;
@@ -40,7 +40,7 @@ void res_send (int msgnum, bool ok)
 }
 
 
-void test_send (l2net_154 *l2, l2addr_154 *dest)
+void test_send (l2net *l2, l2addr_154 *dest)
 {
     Msg *m1 = initMsg(l2) ;
     Msg *m2 = initMsg(l2) ;
@@ -69,7 +69,7 @@ void test_send (l2net_154 *l2, l2addr_154 *dest)
 
 l2addr_154 *myaddr;
 l2addr_154 *dest;
-l2net_154 *l2;
+l2net *l2;
 
 PROCESS_THREAD(test, ev, data)
 {
@@ -79,7 +79,7 @@ PROCESS_THREAD(test, ev, data)
 	PROCESS_BEGIN();
 		myaddr = init_l2addr_154_char("45:67");
 	    l2 = startL2_154( myaddr, CHANNEL, PANID); 
-	    dest = l2addr_154_broadcast;
+	    dest = bcastaddr ();
 	    setMTU(l2, MTU);
 		while(1) {    
 
@@ -66,7 +66,7 @@ AUTOSTART_PROCESSES(&test);
 char testpkt [] = "This is a very long test packet (more than 46 bytes) to send to a broadcast address" ;
 char testpkt2 [] = "brun the world";
 
-void print_paylen_src_dst (l2net_154 *l2)
+void print_paylen_src_dst (l2net *l2)
 {
     l2addr_154 *src, *dst ;
 
@@ -81,7 +81,7 @@ void print_paylen_src_dst (l2net_154 *l2)
 }
 
 
-void recv_l2 (l2net_154 *l2)
+void recv_l2 (l2net *l2)
 {
     l2_recv_t r ;
 
@@ -119,7 +119,7 @@ void recv_l2 (l2net_154 *l2)
 }
 
 
-void send_l2 (l2net_154 *l2, l2addr_154 *destaddr)
+void send_l2 (l2net *l2, l2addr_154 *destaddr)
 {
 
     bool r ;
@@ -137,7 +137,8 @@ PROCESS_THREAD(test, ev, data)
     l2addr_154 *myaddr = init_l2addr_154_char("45:67");
     l2addr_154 *destaddr = init_l2addr_154_char("12:34");
 
-    l2net_154 *l2 = (l2net_154 *) malloc (sizeof(l2net_154));
+    l2net *l2 = (l2net *) malloc (sizeof(l2net));
+    static ConMsg *cm ;
 
     PROCESS_BEGIN();
 
@@ -146,20 +147,21 @@ PROCESS_THREAD(test, ev, data)
 
     printf ("%s : %s=", YELLOW ("OPTION"), RED ("optcode")) ;
 
-    conmsg = (ConMsg * ) malloc (sizeof(ConMsg));
-    setMsgbufsize(10);
-    setChannel(17);
-    start();
+    cm = (ConMsg *) malloc (sizeof (ConMsg)) ;
+    init (cm);
+    setMsgbufsize (cm, 10);
+    setChannel (cm, 17);
+    start (cm);
     
      
     while(1) {
 
         etimer_set(&et,5*CLOCK_SECOND);
         PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-        if(sendto( ( destaddr)->addr_, (uint8_t *) testpkt, sizeof testpkt - 1)) {
+        if(sendto (cm, ( destaddr)->addr_, (uint8_t *) testpkt, sizeof testpkt - 1)) {
             printf("message sent\n");
         }
-        if (sendto(( destaddr)->addr_, (uint8_t *) testpkt2, sizeof testpkt2 - 1)){
+        if (sendto (cm, ( destaddr)->addr_, (uint8_t *) testpkt2, sizeof testpkt2 - 1)){
             printf("message sent\n");
         }
 
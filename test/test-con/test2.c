@@ -16,20 +16,23 @@ PROCESS_THREAD(test, ev, data)
 	static struct etimer et;
 
 	ConReceivedFrame *r;
+	static ConMsg *cm ;
 	PROCESS_BEGIN();
 
 	printf("rimeaddr_node_addr = [%u, %u]\n", rimeaddr_node_addr.u8[0],
                          rimeaddr_node_addr.u8[1]);
-	conmsg = (ConMsg * ) malloc (sizeof(ConMsg));
-	setChannel(17);
+	cm = (ConMsg *) malloc (sizeof (ConMsg)) ;
+	init (cm);
+	setPromiscuous (cm, true);		// display all frames
+	setChannel (cm, 17);
 	
-	start();
+	start (cm);
 
 	while(1){
 		etimer_set(&et,20*CLOCK_SECOND);
 		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
 
-		r = get_received() ;
+		r = get_received (cm) ;
 		printf("%s  : %d\n",r->payload, r->paylen );
 		printf("dest : ");
 		printf("%x",BYTE_LOW(r->dstaddr));
@@ -40,8 +43,8 @@ PROCESS_THREAD(test, ev, data)
 		printf(" : " );
 		printf("%x\n",BYTE_HIGH(r->srcaddr) );
 
-		skip_received();
-		r = get_received() ;
+		skip_received (cm);
+		r = get_received (cm) ;
 		printf("%s  : %d\n",r->payload, r->paylen );
 		printf("dest : ");
 		printf("%x",BYTE_LOW(r->dstaddr));
@@ -51,7 +54,7 @@ PROCESS_THREAD(test, ev, data)
 		printf("%x",BYTE_LOW(r->srcaddr));
 		printf(" : " );
 		printf("%x\n",BYTE_HIGH(r->srcaddr) );
-		skip_received();
+		skip_received (cm);
 	}
 
 	PROCESS_END();
@@ -0,0 +1,286 @@
+#include "../../libraries/L2-154/l2-154.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../host/radio-sim.h"
+
+/*
+ * Latency/energy trade-off of the sleepy slave mode, on the host
+ * with the simulated radio and a virtual clock.
+ *
+ * A minimal master sends a Hello every HELLO_PERIOD ms, answers
+ * Discover messages with an Assoc, and sends GET requests at
+ * random times. A request is retransmitted every REQ_RETRANS ms
+ * until it is answered. Frames sent while the slave receiver is
+ * off are lost.
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVEID		169
+#define	MASTER		0x00fe
+
+#define	HELLO_PERIOD	2000
+#define	REQ_PERIOD	1700		// mean time between requests
+#define	REQ_RETRANS	40
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+l2net *l2 ;
+ConMsg *cm ;
+Casan *ca ;
+addr2_t slave ;
+
+/*
+ * Frames sent by the slave, processed after each loop
+ */
+
+#define	MAXCAPT	8
+
+uint8_t capt [MAXCAPT][MAX_PAYLOAD] ;
+int captlen [MAXCAPT] ;
+int ncapt = 0 ;
+
+void tx_hook (void *arg, const uint8_t *frame, uint8_t len)
+{
+    if (ncapt < MAXCAPT)
+    {
+		memcpy (capt [ncapt], frame, len) ;
+		captlen [ncapt++] = len ;
+    }
+}
+
+/*
+ * Master
+ */
+
+struct mstate
+{
+    uint16_t id ;			// next message id
+    uint32_t rnd ;
+    clock_time_t nexthello ;
+    bool drophello ;			// simulate lost Hellos
+    clock_time_t nextreq ;
+    bool pending ;			// request waiting for an answer
+    uint16_t reqid ;
+    clock_time_t reqfirst, reqnext ;
+    int nlost ;				// frames sent while slave is off
+} mst ;
+
+struct result
+{
+    int nreq ;				// answered requests
+    unsigned long latsum, latmax ;
+    clock_time_t start, ontime ;
+} result ;
+
+void inject (Msg *m, addr2_t dst)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    uint16_t len ;
+    static uint8_t seq ;
+
+    len = sizeof frame - 9 ;
+    CHECK (coap_encode (m, frame + 9, &len)) ;
+    frame [0] = 0x41 ; frame [1] = 0x88 ;	// data, intra-pan, addr2
+    frame [2] = seq++ ;
+    frame [3] = BYTE_LOW (PANID) ; frame [4] = BYTE_HIGH (PANID) ;
+    frame [5] = BYTE_LOW (dst) ; frame [6] = BYTE_HIGH (dst) ;
+    frame [7] = BYTE_LOW (MASTER) ; frame [8] = BYTE_HIGH (MASTER) ;
+    if (! sim_radio_receive (frame, 9 + len, 200))
+		mst.nlost++ ;
+}
+
+void add_query (Msg *m, const char *q)
+{
+    option *o = initOptionOpaque (MO_Uri_Query, q, strlen (q)) ;
+
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+void send_ctl (uint8_t type, const char *q1, const char *q2, addr2_t dst)
+{
+    Msg *m = initMsg (l2) ;
+
+    set_id (m, mst.id++) ;
+    set_type (m, type) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    add_query (m, q1) ;
+    if (q2 != NULL)
+		add_query (m, q2) ;
+    inject (m, dst) ;
+    freeMsg (m) ;
+}
+
+void send_request (void)
+{
+    Msg *m = initMsg (l2) ;
+    option *o = initOptionOpaque (MO_Uri_Path, "light", 5) ;
+
+    set_id (m, mst.reqid) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_GET) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    inject (m, slave) ;
+    freeMsg (m) ;
+}
+
+void master_step (clock_time_t now)
+{
+    if (now >= mst.nexthello)
+    {
+		if (! mst.drophello)
+		    send_ctl (COAP_TYPE_NON, "hello=7", NULL, 0xffff) ;
+		mst.nexthello += HELLO_PERIOD ;
+    }
+    if (! mst.pending && now >= mst.nextreq)
+    {
+		mst.pending = true ;
+		mst.reqid = mst.id++ ;
+		mst.reqfirst = now ;
+		mst.reqnext = now ;
+    }
+    if (mst.pending && now >= mst.reqnext)
+    {
+		send_request () ;
+		mst.reqnext = now + REQ_RETRANS ;
+    }
+}
+
+void master_receive (clock_time_t now)
+{
+    Msg *m ;
+    int i ;
+
+    for (i = 0 ; i < ncapt ; i++)
+    {
+		m = initMsg (l2) ;
+		if (coap_decode (m, capt [i] + 9, captlen [i] - 9, false))
+		{
+		    if (is_ctl_msg (m) && get_type (m) == COAP_TYPE_NON)
+				send_ctl (COAP_TYPE_CON, "ttl=100000", "mtu=127", slave) ;
+		    else if (get_type (m) == COAP_TYPE_ACK && mst.pending
+				&& get_id (m) == mst.reqid
+				&& get_code (m) == COAP_RETURN_CODE (2, 5))
+		    {
+				unsigned long lat = now - mst.reqfirst ;
+
+				result.nreq++ ;
+				result.latsum += lat ;
+				if (lat > result.latmax)
+				    result.latmax = lat ;
+				mst.pending = false ;
+				mst.rnd = mst.rnd * 1103515245 + 12345 ;
+				mst.nextreq = now + REQ_PERIOD / 2
+					+ (mst.rnd >> 16) % REQ_PERIOD ;
+		    }
+		}
+		freeMsg (m) ;
+    }
+    ncapt = 0 ;
+}
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+/*
+ * Run the simulation for the given duration
+ */
+
+void run (clock_time_t duration)
+{
+    clock_time_t end ;
+
+    end = clock_time () + duration ;
+    while (clock_time () < end)
+    {
+		clock_advance (1) ;
+		master_step (clock_time ()) ;
+		loop (ca) ;
+		master_receive (clock_time ()) ;
+    }
+}
+
+void measure (const char *name, bool sleepy, uint32_t maxlatency,
+				clock_time_t duration)
+{
+    unsigned long duty ;
+    clock_time_t now ;
+
+    set_sleepy (ca, sleepy, maxlatency, 0) ;
+    memset (&result, 0, sizeof result) ;
+    result.start = clock_time () ;
+    result.ontime = radio_on_time (cm, getstat (cm), result.start) ;
+    run (duration) ;
+    now = clock_time () ;
+    duty = (radio_on_time (cm, getstat (cm), now) - result.ontime) * 1000
+				/ (now - result.start) ;
+    printf ("%-24s duty=%3lu.%lu%% requests=%3d latency avg=%4lu max=%4lu ms\n",
+		name, duty / 10, duty % 10, result.nreq,
+		result.nreq > 0 ? result.latsum / result.nreq : 0,
+		result.latmax) ;
+    CHECK (result.nreq >= duration / REQ_PERIOD / 2) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+    Resource *res ;
+    Dcycle *d ;
+    int missed ;
+
+    clock_set_virtual (1000) ;
+    a = init_l2addr_154_char ("01:00") ;
+    slave = a->addr_ ;
+    l2 = startL2_154 (a, CHANNEL, PANID) ;
+    cm = L2_154 (l2)->cm_ ;
+    sim_radio_set_tx_hook (tx_hook, NULL) ;
+    ca = initCasan (l2, 0, SLAVEID) ;
+    res = initResource ("light", "light", "light") ;
+    setHandlerResource (res, COAP_CODE_GET, process_light) ;
+    register_resource (ca, res) ;
+
+    mst.nexthello = clock_time () + 100 ;
+    mst.nextreq = clock_time () + 5000 ;
+    run (5000) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+
+    d = &ca->dcycle_ ;
+    printf ("\n") ;
+    measure ("always on", false, 0, 60000) ;
+    CHECK (result.latmax < 10) ;
+    measure ("sleepy, latency 500", true, 500, 60000) ;
+    CHECK (result.latmax <= 500 + 2 * REQ_RETRANS) ;
+    measure ("sleepy, latency 1000", true, 1000, 60000) ;
+    CHECK (result.latmax <= 1000 + 2 * REQ_RETRANS) ;
+    measure ("sleepy, Hello only", true, 100000, 60000) ;
+    CHECK (result.latmax <= HELLO_PERIOD + 2 * REQ_RETRANS) ;
+    CHECK (d->hlperiod_ >= HELLO_PERIOD - 10 && d->hlperiod_ <= HELLO_PERIOD + 10) ;
+    CHECK (d->nmissed_ == 0) ;
+
+    printf ("\nlost Hellos\n") ;
+    missed = d->nmissed_ ;
+    mst.drophello = true ;
+    run (2 * HELLO_PERIOD + 100) ;
+    CHECK (d->nmissed_ == missed + 2) ;
+    CHECK (! getRadioOn (cm) || d->inhello_) ;	// still synchronized
+    run (3 * HELLO_PERIOD) ;
+    CHECK (d->hlperiod_ == 0 && getRadioOn (cm)) ;	// lost: listen
+    mst.drophello = false ;
+    run (3 * HELLO_PERIOD) ;
+    CHECK (d->hlperiod_ >= HELLO_PERIOD - 10) ;	// synchronized again
+    print_dcycle (d) ;
+    print_stat (cm, getstat (cm)) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,237 @@
+#include "../../libraries/L2-154/l2-154.h"
+#include "../../host/radio-sim.h"
+
+/*
+ * Test program for the fragmentation layer, on the host with the
+ * simulated radio: sent frames are captured and given back to the
+ * same node.
+ */
+
+#define CHANNEL     17
+#define PANID       CONST16 (0xca, 0xfe)
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+#define	MAXCAPT	8
+
+uint8_t capt [MAXCAPT][MAX_PAYLOAD] ;	// captured frames (no fcs)
+int captlen [MAXCAPT] ;
+int ncapt = 0 ;
+
+ConMacParam nocsma = { 0, 0, 0, 0 } ;
+
+void tx_hook (void *arg, const uint8_t *frame, uint8_t len)
+{
+    if (ncapt < MAXCAPT)
+    {
+		memcpy (capt [ncapt], frame, len) ;
+		captlen [ncapt++] = len ;
+    }
+}
+
+void inject (int i)
+{
+    CHECK (sim_radio_receive (capt [i], captlen [i], 200)) ;
+}
+
+void mkdgram (uint8_t *d, int len, uint8_t seed)
+{
+    int i ;
+
+    for (i = 0 ; i < len ; i++)
+		d [i] = seed + i * 7 ;
+}
+
+void test_small (l2net *l2, l2addr_154 *me)
+{
+    uint8_t d [50] ;
+
+    printf ("small message is not fragmented\n") ;
+    ncapt = 0 ;
+    mkdgram (d, sizeof d, 1) ;
+    d [0] = 0x40 ;				// looks like CoAP
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (ncapt == 1 && captlen [0] == 9 + sizeof d) ;
+    inject (0) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (get_paylen (l2) == sizeof d) ;
+    CHECK (memcmp (get_payload (l2, 0), d, sizeof d) == 0) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+}
+
+void test_large (l2net *l2, l2addr_154 *me)
+{
+    uint8_t d [300] ;
+    int nreass = L2_154 (l2)->frag_.nreass_ ;
+
+    printf ("300 byte message in 3 fragments\n") ;
+    ncapt = 0 ;
+    mkdgram (d, sizeof d, 2) ;
+    CHECK (maxpayload (l2) >= sizeof d) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (ncapt == 3) ;
+    CHECK (capt [0][9] == (FRAG1_DISPATCH | 0x01) && capt [0][10] == 0x2c) ;
+    CHECK (FRAG_IS_FRAGN (capt [1] + 9) && FRAG_IS_FRAGN (capt [2] + 9)) ;
+    CHECK (FRAG_TAG (capt [0] + 9) == FRAG_TAG (capt [2] + 9)) ;
+    inject (0) ;
+    inject (1) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;		// still incomplete
+    inject (2) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (get_paylen (l2) == sizeof d) ;
+    CHECK (memcmp (get_payload (l2, 0), d, sizeof d) == 0) ;
+    CHECK (L2_154 (l2)->frag_.nreass_ == nreass + 1) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+
+    printf ("fragments out of order, duplicated fragment\n") ;
+    ncapt = 0 ;
+    mkdgram (d, sizeof d, 3) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    inject (2) ;
+    inject (1) ;
+    capt [1][2]++ ;				// new MAC seq: not a MAC dup
+    inject (1) ;
+    inject (0) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (get_paylen (l2) == sizeof d) ;
+    CHECK (memcmp (get_payload (l2, 0), d, sizeof d) == 0) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+}
+
+void test_toobig (l2net *l2)
+{
+    int len ;
+
+    printf ("first fragment of a too large datagram\n") ;
+    len = captlen [0] ;
+    capt [0][2] = 0x80 ;			// new MAC seq
+    capt [0][9] = FRAG1_DISPATCH | 0x07 ;	// 2047 bytes
+    CHECK (sim_radio_receive (capt [0], len, 200)) ;
+    CHECK (recv (l2) == RECV_TRUNCATED) ;
+    CHECK (get_paylen (l2) == len - 9 - FRAG1_HLEN) ;
+    CHECK (get_payload (l2, 0) [0] == capt [0][9 + FRAG1_HLEN]) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+}
+
+void test_timeout (l2net *l2, l2addr_154 *me)
+{
+    uint8_t d [200] ;
+    clock_time_t t ;
+    int ntimeout = L2_154 (l2)->frag_.ntimeout_ ;
+
+    printf ("incomplete datagram expires\n") ;
+    ncapt = 0 ;
+    mkdgram (d, sizeof d, 4) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (ncapt == 2) ;
+    inject (0) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+    t = clock_time () ;
+    while (clock_time () - t <= FRAG_TIMEOUT)
+		;
+    inject (1) ;				// reassembly restarts
+    CHECK (recv (l2) == RECV_EMPTY) ;
+    CHECK (L2_154 (l2)->frag_.ntimeout_ == ntimeout + 1) ;
+    t = clock_time () ;
+    while (clock_time () - t <= FRAG_TIMEOUT)
+		;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+
+    printf ("reassembly buffers exhausted\n") ;
+    ncapt = 0 ;
+    mkdgram (d, sizeof d, 5) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (send (l2, me, d, sizeof d)) ;
+    CHECK (ncapt == 6) ;
+    inject (0) ;
+    inject (2) ;
+    inject (4) ;				// no buffer left
+    inject (1) ;
+    inject (3) ;
+    inject (5) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (recv (l2) == RECV_OK) ;
+    CHECK (recv (l2) == RECV_EMPTY) ;
+    CHECK (L2_154 (l2)->frag_.ndrop_ >= 2) ;
+}
+
+/*
+ * Fragment of a 32 byte datagram, with the given tag, offset (-1:
+ * first fragment) and length, filled with the given value
+ */
+
+uint8_t *dgram ;			// last completed datagram
+size_t dglen ;
+
+frag_status_t fragment (Frag *f, uint16_t tag, int off, int n, uint8_t v)
+{
+    uint8_t pay [FRAGN_HLEN + 32] ;
+    size_t hlen ;
+
+    hlen = off < 0 ? FRAG1_HLEN : FRAGN_HLEN ;
+    pay [0] = off < 0 ? FRAG1_DISPATCH : FRAGN_DISPATCH ;
+    pay [1] = 32 ;
+    pay [2] = tag >> 8 ;
+    pay [3] = tag & 0xff ;
+    pay [4] = off < 0 ? 0 : off / 8 ;
+    memset (pay + hlen, v, n) ;
+    return frag_input (f, 0x0002, pay, hlen + n, &dgram, &dglen) ;
+}
+
+void test_overlap (void)
+{
+    Frag f ;
+
+    printf ("overlapping fragments do not complete a datagram\n") ;
+    initFrag (&f, NULL) ;
+    CHECK (fragment (&f, 1, -1, 16, 1) == FRAG_PENDING) ;
+    CHECK (fragment (&f, 1, 16, 16, 1) == FRAG_COMPLETE) ;
+
+    CHECK (fragment (&f, 2, 16, 16, 2) == FRAG_PENDING) ;
+    CHECK (fragment (&f, 2, 8, 16, 2) == FRAG_DROPPED) ;	// overlap
+    CHECK (fragment (&f, 2, 16, 16, 2) == FRAG_PENDING) ;	// duplicate
+    CHECK (fragment (&f, 2, -1, 8, 2) == FRAG_PENDING) ;	// block 1 missing
+    CHECK (fragment (&f, 2, 8, 4, 2) == FRAG_DROPPED) ;	// not a whole block
+    CHECK (fragment (&f, 2, 8, 8, 2) == FRAG_COMPLETE) ;
+    CHECK (dglen == 32 && dgram [0] == 2 && dgram [8] == 2 && dgram [31] == 2) ;
+    CHECK (f.ndrop_ == 2 && f.nreass_ == 2) ;
+}
+
+void test_mtu (l2net *l2, l2addr_154 *me)
+{
+    uint8_t d [300] ;
+
+    printf ("no fragmentation with a negociated MTU of one frame\n") ;
+    setMTU (l2, I154_MTU) ;
+    CHECK (! send (l2, me, d, sizeof d)) ;
+    setMTU (l2, 10000) ;			// clamped
+    CHECK (maxpayload (l2) == I154_DGRAM_MAX) ;
+    CHECK (! send (l2, me, d, I154_DGRAM_MAX + 1)) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+    l2net *l2 ;
+
+    a = init_l2addr_154_char ("01:00") ;
+    l2 = startL2_154 (a, CHANNEL, PANID) ;
+    setMacParam (L2_154 (l2)->cm_, &nocsma) ;
+    sim_radio_set_tx_hook (tx_hook, NULL) ;
+
+    test_small (l2, a) ;
+    test_large (l2, a) ;
+    test_toobig (l2) ;
+    test_timeout (l2, a) ;
+    test_overlap () ;
+    test_mtu (l2, a) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
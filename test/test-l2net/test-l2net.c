@@ -13,7 +13,7 @@ AUTOSTART_PROCESSES(&test);
 
 char testpkt [] = "This is a very long test packet (more than 46 bytes) to send to a broadcast address" ;
 
-void print_paylen_src_dst (l2net_154 *l2)
+void print_paylen_src_dst (l2net *l2)
 {
     l2addr_154 *src, *dst ;
 
@@ -28,7 +28,7 @@ void print_paylen_src_dst (l2net_154 *l2)
 }
 
 
-void recv_l2 (l2net_154 *l2)
+void recv_l2 (l2net *l2)
 {
     l2_recv_t r ;
 
@@ -66,7 +66,7 @@ void recv_l2 (l2net_154 *l2)
 }
 
 
-void send_l2 (l2net_154 *l2, l2addr_154 *destaddr)
+void send_l2 (l2net *l2, l2addr_154 *destaddr)
 {
 
     bool r ;
@@ -85,7 +85,7 @@ void send_l2 (l2net_154 *l2, l2addr_154 *destaddr)
 
 l2addr_154 *myaddr;
 l2addr_154 *destaddr;
-l2net_154 *l2;
+l2net *l2;
 
 PROCESS_THREAD(test, ev, data)
 {
@@ -0,0 +1,431 @@
+#include "../../host/sched.h"
+#include "../../host/medium.h"
+#include "../../host/master.h"
+#include "../../libraries/L2-UDP/l2-udp.h"
+
+/*
+ * Test program for the master stand-in, on the host:
+ * - association of slaves on the simulated medium, then an open-loop
+ *   workload (GET, PUT, observe, unknown resource), with the
+ *   notifications of the observed resource (confirmable ones are
+ *   acknowledged, which gives RTT measures to the slaves)
+ * - concurrency limit: requests are skipped, never delayed
+ * - the same master on the UDP network
+ *
+ * Usage: test-master [nslaves [rate [concurrency [minutes]]]]
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	MASTER		0x00fe
+#define	HLID		42
+#define	SEED		12345
+
+#define	PORT		27100		// UDP: base port for this test
+#define	UDP_SLAVES	3
+
+#define	TEMP_PERIOD	5000		// temp changes every 5 s
+#define	BOOT_MAX	10000		// slaves are started in the first 10 s
+#define	MINUTE		(60UL * 1000)
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * The CASAN engine is verbose: its output is discarded during
+ * the simulations
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+/******************************************************************************
+ * Slave resources
+ */
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+uint8_t process_led (Msg *in, Msg *out)
+{
+    return COAP_RETURN_CODE (2, 4) ;
+}
+
+uint8_t process_temp (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "21", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+/*
+ * Observe trigger for temp. Slaves may be run by several threads:
+ * the date of the next change is the one of the slave being run
+ * (NULL outside of the simulated medium: no notification).
+ */
+
+PLATFORM_THREAD_LOCAL clock_time_t *tnotify ;
+
+int trigger_temp (void)
+{
+    if (tnotify == NULL || clock_time () < *tnotify)
+	return 0 ;
+    *tnotify = clock_time () + TEMP_PERIOD ;
+    return 1 ;
+}
+
+Casan *start_slave (l2net *l2, long int slaveid)
+{
+    Casan *ca ;
+    Resource *res ;
+
+    ca = initCasan (l2, 0, slaveid) ;
+    res = initResource ("light", "light", "light") ;
+    setHandlerResource (res, COAP_CODE_GET, process_light) ;
+    register_resource (ca, res) ;
+    res = initResource ("led", "led", "led") ;
+    setHandlerResource (res, COAP_CODE_PUT, process_led) ;
+    register_resource (ca, res) ;
+    res = initResource ("temp", "temp", "celsius") ;
+    setHandlerResource (res, COAP_CODE_GET, process_temp) ;
+    ohandlerResource (res, NULL, NULL, trigger_temp) ;
+    register_resource (ca, res) ;
+    return ca ;
+}
+
+// has the slave measured a RTT to a peer?
+bool rtt_measured (Casan *ca)
+{
+    int i ;
+
+    for (i = 0 ; i < RTO_NPEERS ; i++)
+	if (ca->retrans_->rto_.peer_ [i].strong_)
+	    return true ;
+    return false ;
+}
+
+// the workload mix used by all tests
+void add_mix (Master *ms)
+{
+    master_add_resource (ms, "light", COAP_CODE_GET, NULL, false, 5) ;
+    master_add_resource (ms, "led", COAP_CODE_PUT, "on", false, 3) ;
+    master_add_resource (ms, "temp", COAP_CODE_GET, NULL, true, 1) ;
+    master_add_resource (ms, "nope", COAP_CODE_GET, NULL, false, 1) ;
+}
+
+uint32_t ncode (MasterRes *r, uint8_t code)
+{
+    int i ;
+
+    for (i = 0 ; i < r->ncodes_ ; i++)
+	if (r->codes_ [i].code_ == code)
+	    return r->codes_ [i].n_ ;
+    return 0 ;
+}
+
+/******************************************************************************
+ * Simulated medium
+ */
+
+struct slave
+{
+    Casan *ca ;
+    int node ;
+    int agent ;
+    clock_time_t tboot ;
+    clock_time_t tnotify ;		// next temp notification
+} ;
+
+struct sim
+{
+    Sched *s ;
+    Medium *m ;
+    Master *ms ;
+    int mnode ;				// master node
+    int magent ;			// medium agent
+    int msagent ;			// master agent
+    struct slave *sl ;
+    int nslaves ;
+} ;
+
+struct sim *cursim ;
+
+bool rx_pending (int node)
+{
+    int n ;
+
+    getRxOccupancy (medium_node (cursim->m, node)->conmsg_, &n) ;
+    return n > 0 ;
+}
+
+bool medium_agent_next (void *arg, clock_time_t *next)
+{
+    return medium_next (cursim->m, next) ;
+}
+
+void medium_agent_run (void *arg)
+{
+    medium_step (cursim->m) ;
+}
+
+void medium_agent_rx (void *arg, int node)
+{
+    sched_wake (cursim->s, node == cursim->mnode ? cursim->msagent
+				: cursim->sl [node - cursim->mnode - 1].agent) ;
+}
+
+bool master_agent_next (void *arg, clock_time_t *next)
+{
+    if (rx_pending (cursim->mnode))
+    {
+	*next = clock_time () ;
+	return true ;
+    }
+    return master_next (cursim->ms, next) ;
+}
+
+void master_agent_run (void *arg)
+{
+    medium_select (cursim->m, cursim->mnode) ;
+    master_loop (cursim->ms) ;
+    sched_wake (cursim->s, cursim->magent) ;
+}
+
+bool slave_agent_next (void *arg, clock_time_t *next)
+{
+    struct slave *sl = arg ;
+
+    if (clock_time () < sl->tboot)
+	*next = sl->tboot ;
+    else if (rx_pending (sl->node))
+	*next = clock_time () ;
+    else *next = (clock_time_t) next_wakeup (sl->ca) ;
+    return true ;
+}
+
+void slave_agent_run (void *arg)
+{
+    struct slave *sl = arg ;
+
+    if (clock_time () < sl->tboot)
+	return ;
+    medium_select (cursim->m, sl->node) ;
+    tnotify = &sl->tnotify ;
+    loop (sl->ca) ;
+    tnotify = NULL ;
+    sched_wake (cursim->s, cursim->magent) ;
+}
+
+void start_sim (struct sim *sim, int nslaves)
+{
+    struct slave *sl ;
+    clock_time_t start = 1000 ;
+    uint32_t rnd = SEED ;
+    int i ;
+
+    sim->s = initSched (nslaves + 2, start) ;
+    sim->m = initMedium (nslaves + 1, SEED) ;
+    sim->nslaves = nslaves ;
+    sim->sl = (struct slave *) calloc (nslaves, sizeof *sim->sl) ;
+    cursim = sim ;
+    medium_set_rx_hook (sim->m, medium_agent_rx, sim) ;
+
+    sim->mnode = medium_add_node (sim->m, MASTER, 0, CHANNEL, PANID) ;
+    sim->ms = initMaster (medium_node (sim->m, sim->mnode)->l2_, HLID, SEED) ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+	sl = &sim->sl [i] ;
+	sl->node = medium_add_node (sim->m, 0x0001 + i, 0, CHANNEL, PANID) ;
+	sl->ca = start_slave (medium_node (sim->m, sl->node)->l2_, 1000 + i) ;
+	rnd = rnd * 1103515245 + 12345 ;
+	sl->tboot = start + (rnd >> 8) % BOOT_MAX ;
+    }
+
+    sim->magent = sched_add_agent (sim->s, medium_agent_next,
+					medium_agent_run, NULL) ;
+    sim->msagent = sched_add_agent (sim->s, master_agent_next,
+					master_agent_run, NULL) ;
+    for (i = 0 ; i < nslaves ; i++)
+	sim->sl [i].agent = sched_add_agent (sim->s, slave_agent_next,
+					slave_agent_run, &sim->sl [i]) ;
+}
+
+void stop_sim (struct sim *sim)
+{
+    freeMaster (sim->ms) ;
+    free (sim->sl) ;
+    freeMedium (sim->m) ;
+    freeSched (sim->s) ;
+}
+
+// the master parameters have changed: get its next deadline
+void run_sim (struct sim *sim, clock_time_t duration)
+{
+    sched_wake (sim->s, sim->msagent) ;
+    quiet (true) ;
+    sched_run_for (sim->s, duration) ;
+    quiet (false) ;
+}
+
+void test_medium (int nslaves, uint32_t rate, int conc, int minutes)
+{
+    struct sim sim ;
+    MasterRes *r ;
+    Master *ms ;
+    int i, nrtt ;
+
+    printf ("association (%d slaves)\n", nslaves) ;
+    quiet (true) ;
+    start_sim (&sim, nslaves) ;
+    quiet (false) ;
+    ms = sim.ms ;
+    master_set_hello (ms, 10000) ;
+    add_mix (ms) ;
+    run_sim (&sim, BOOT_MAX + MINUTE) ;
+    CHECK (ms->nslaves_ == nslaves) ;
+    CHECK (ms->nassoc_ == nslaves) ;
+    CHECK (ms->nhello_ >= 7) ;
+
+    printf ("workload: %lu req/s, concurrency %d, %d min\n",
+			(unsigned long int) rate, conc, minutes) ;
+    CHECK (master_set_load (ms, rate, conc, 0)) ;
+    run_sim (&sim, minutes * MINUTE) ;
+    master_print_stat (ms) ;
+    CHECK (ms->nassoc_ == nslaves) ;
+    CHECK (ms->nnoslave_ == 0) ;
+    for (i = 0 ; i < ms->nres_ ; i++)
+    {
+	r = &ms->res_ [i] ;
+	CHECK (r->nsent_ > 0) ;
+	CHECK (r->nanswer_ + r->ntimeout_ + 1 >= r->nsent_) ;	// 1 pending
+	CHECK (r->nanswer_ >= r->nsent_ * 95 / 100) ;
+	CHECK (master_percentile (r, 50) <= master_percentile (r, 99)) ;
+	CHECK (master_percentile (r, 99) <= master_percentile (r, 100)) ;
+	CHECK (master_percentile (r, 100) < MASTER_TIMEOUT) ;
+    }
+    CHECK (ncode (&ms->res_ [0], COAP_RETURN_CODE (2, 5)) == ms->res_ [0].nanswer_) ;
+    CHECK (ncode (&ms->res_ [1], COAP_RETURN_CODE (2, 4)) == ms->res_ [1].nanswer_) ;
+    CHECK (ncode (&ms->res_ [2], COAP_RETURN_CODE (2, 5)) == ms->res_ [2].nanswer_) ;
+    CHECK (ncode (&ms->res_ [3], COAP_RETURN_CODE (4, 4)) == ms->res_ [3].nanswer_) ;
+    CHECK (ms->res_ [2].nnotify_ > 0) ;		// observed temp
+    for (nrtt = 0, i = 0 ; i < nslaves ; i++)
+	nrtt += rtt_measured (sim.sl [i].ca) ;
+    CHECK (nrtt > 0) ;				// acked CON notifications
+
+    // the total rate is the requested one (open loop)
+    {
+	uint32_t nsent = ms->nskipped_ ;
+
+	for (i = 0 ; i < ms->nres_ ; i++)
+	    nsent += ms->res_ [i].nsent_ ;
+	CHECK (nsent == rate * minutes * 60 || nsent == rate * minutes * 60 + 1) ;
+    }
+
+    printf ("concurrency limit\n") ;
+    master_set_load (ms, 0, conc, 0) ;
+    run_sim (&sim, 10000) ;		// let outstanding requests end
+    CHECK (ms->nout_ == 0) ;
+    CHECK (master_set_load (ms, 200, 1, 0)) ;
+    ms->nskipped_ = 0 ;
+    run_sim (&sim, 10000) ;
+    CHECK (ms->nskipped_ > 0) ;
+    CHECK (ms->nout_ <= 1) ;
+
+    stop_sim (&sim) ;
+}
+
+/******************************************************************************
+ * UDP network
+ */
+
+void test_udp (void)
+{
+    l2net *ml, *sl [UDP_SLAVES] ;
+    Casan *ca [UDP_SLAVES] ;
+    Master *ms ;
+    l2addr a ;
+    uint32_t nanswer ;
+    int i, j ;
+
+    printf ("udp\n") ;
+    clock_set_virtual (1000) ;
+    a.addr_ = MASTER ;
+    ml = startL2_udp (&a, PORT) ;
+    CHECK (ml != NULL) ;
+    if (ml == NULL)
+	return ;
+    quiet (true) ;
+    for (i = 0 ; i < UDP_SLAVES ; i++)
+    {
+	a.addr_ = 0x0001 + i ;
+	sl [i] = startL2_udp (&a, PORT) ;
+	ca [i] = start_slave (sl [i], 2000 + i) ;
+    }
+    ms = initMaster (ml, HLID, SEED) ;
+    add_mix (ms) ;
+    master_set_load (ms, 20, 4, 0) ;
+
+    // the kernel delivers loopback datagrams synchronously
+    for (j = 0 ; j < 3000 ; j++)
+    {
+	clock_advance (10) ;
+	master_loop (ms) ;
+	for (i = 0 ; i < UDP_SLAVES ; i++)
+	    loop (ca [i]) ;
+    }
+    quiet (false) ;
+    master_print_stat (ms) ;
+
+    nanswer = 0 ;
+    for (i = 0 ; i < ms->nres_ ; i++)
+	nanswer += ms->res_ [i].nanswer_ ;
+    CHECK (ms->nassoc_ == UDP_SLAVES) ;
+    CHECK (nanswer > 500) ;
+    CHECK (ms->res_ [0].ntimeout_ == 0) ;
+
+    freeMaster (ms) ;
+    for (i = 0 ; i < UDP_SLAVES ; i++)
+	stopL2_udp (sl [i]) ;
+    stopL2_udp (ml) ;
+}
+
+int main (int argc, char *argv [])
+{
+    int nslaves = 20, conc = 8, minutes = 10 ;
+    uint32_t rate = 10 ;
+
+    if (argc > 1)
+	nslaves = atoi (argv [1]) ;
+    if (argc > 2)
+	rate = atoi (argv [2]) ;
+    if (argc > 3)
+	conc = atoi (argv [3]) ;
+    if (argc > 4)
+	minutes = atoi (argv [4]) ;
+
+    test_medium (nslaves, rate, conc, minutes) ;
+    test_udp () ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,314 @@
+#include "../../host/medium.h"
+#include "../../libraries/Casan/casan.h"
+
+/*
+ * Test program for the simulated radio medium, on the host:
+ * - L2 behaviour between a few nodes (domains, collisions, loss)
+ * - a master stand-in and many CASAN slaves: association time,
+ *   request round-trip time and loss are measured
+ *
+ * Usage: test-medium [nslaves [loss per mille]]
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	MASTER		0x00fe
+#define	SEED		12345
+
+#define	ASSOC_MAX	120000		// max time for all associations (ms)
+#define	REQ_TIMEOUT	2000		// request considered as lost (ms)
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+void run (Medium *m, clock_time_t ms)
+{
+    while (ms-- > 0)
+    {
+		clock_advance (1) ;
+		medium_step (m) ;
+    }
+}
+
+// send from a node
+bool send_from (Medium *m, int node, addr2_t dst, const char *data)
+{
+    l2addr a = { dst } ;
+
+    medium_select (m, node) ;
+    return send (medium_node (m, node)->l2_, &a, (uint8_t *) data,
+				strlen (data)) ;
+}
+
+// number of messages received by a node
+int nrecv (Medium *m, int node)
+{
+    int n = 0 ;
+
+    medium_select (m, node) ;
+    while (recv (medium_node (m, node)->l2_) == RECV_OK)
+		n++ ;
+    return n ;
+}
+
+void test_l2 (void)
+{
+    Medium *m ;
+    int a, b, c, d ;
+    ConStat *st ;
+
+    m = initMedium (4, SEED) ;
+    a = medium_add_node (m, 0x0001, 0, CHANNEL, PANID) ;
+    b = medium_add_node (m, 0x0002, 0, CHANNEL, PANID) ;
+    c = medium_add_node (m, 0x0003, 0, CHANNEL, PANID) ;
+    d = medium_add_node (m, 0x0004, 1, CHANNEL, PANID) ;
+
+    printf ("unicast\n") ;
+    CHECK (send_from (m, a, 0x0002, "hello")) ;
+    run (m, 20) ;
+    CHECK (nrecv (m, b) == 1) ;
+    CHECK (nrecv (m, c) == 0) ;		// heard, but not for c
+    CHECK (nrecv (m, d) == 0) ;
+    CHECK (medium_node (m, c)->nrx_ == 1) ;
+    CHECK (medium_node (m, d)->nrx_ == 0) ;	// other domain
+    CHECK (getstat (medium_node (m, a)->conmsg_)->tx_sent == 1) ;
+
+    printf ("broadcast\n") ;
+    CHECK (send_from (m, a, 0xffff, "all")) ;
+    run (m, 20) ;
+    CHECK (nrecv (m, b) == 1 && nrecv (m, c) == 1 && nrecv (m, d) == 0) ;
+
+    printf ("hidden terminals\n") ;
+    medium_cut_link (m, a, c) ;
+    medium_cut_link (m, c, a) ;
+    CHECK (send_from (m, a, 0x0002, "from a")) ;
+    CHECK (send_from (m, c, 0x0002, "from c")) ;
+    run (m, 20) ;			// both in the same backoff period
+    st = getstat (medium_node (m, b)->conmsg_) ;
+    CHECK (st->rx_crcfail >= 1) ;
+    run (m, 200) ;			// MAC retransmissions
+    CHECK (nrecv (m, b) == 2) ;
+
+    printf ("lossy link\n") ;
+    medium_set_link (m, a, b, 1000, 100) ;
+    CHECK (send_from (m, a, 0x0002, "lost")) ;
+    run (m, 200) ;
+    CHECK (nrecv (m, b) == 0) ;
+    CHECK (getstat (medium_node (m, a)->conmsg_)->tx_error_noack == 1) ;
+
+    medium_print_stat (m) ;
+    freeMedium (m) ;
+}
+
+/*
+ * Slaves and master stand-in
+ */
+
+struct slave
+{
+    Casan *ca ;
+    clock_time_t tassoc ;		// association time
+} ;
+
+struct master
+{
+    int node ;
+    uint16_t id ;
+    int cur ;				// slave with a pending request
+    clock_time_t tsent ;
+    int nreq, nanswer ;
+    unsigned long rttsum, rttmax ;
+} mst ;
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+void master_send (l2net *l2, l2addr *dest, bool assoc)
+{
+    Msg *m = initMsg (l2) ;
+    const char *q [] = { "ttl=100000", "mtu=127" } ;
+    option *o ;
+    int i ;
+
+    set_id (m, mst.id++) ;
+    set_type (m, COAP_TYPE_CON) ;
+    if (assoc)
+    {
+		set_code (m, COAP_CODE_POST) ;
+		mk_ctl_msg (m) ;
+		for (i = 0 ; i < NTAB (q) ; i++)
+		{
+		    o = initOptionOpaque (MO_Uri_Query, q [i], strlen (q [i])) ;
+		    push_option (m, o) ;
+		    freeOption (o) ;
+		}
+    }
+    else
+    {
+		set_code (m, COAP_CODE_GET) ;
+		o = initOptionOpaque (MO_Uri_Path, "light", 5) ;
+		push_option (m, o) ;
+		freeOption (o) ;
+    }
+    sendMsg (m, dest) ;
+    freeMsg (m) ;
+}
+
+// answer Discover messages, and check answers to requests
+void master_recv (Medium *m)
+{
+    l2net *l2 = medium_node (m, mst.node)->l2_ ;
+    Msg *in ;
+    l2addr *src ;
+
+    medium_select (m, mst.node) ;
+    in = initMsg (l2) ;
+    while (recvMsg (in) == RECV_OK)
+    {
+		src = get_src (l2) ;
+		if (is_ctl_msg (in) && get_type (in) == COAP_TYPE_NON)
+		    master_send (l2, src, true) ;
+		else if (get_type (in) == COAP_TYPE_ACK && mst.cur >= 0
+			&& get_id (in) == (uint16_t) (mst.id - 1)
+			&& get_code (in) == COAP_RETURN_CODE (2, 5))
+		{
+		    unsigned long rtt = clock_time () - mst.tsent ;
+
+		    mst.nanswer++ ;
+		    mst.rttsum += rtt ;
+		    if (rtt > mst.rttmax)
+				mst.rttmax = rtt ;
+		    mst.cur = -1 ;
+		}
+		freel2addr (src) ;
+    }
+    freeMsg (in) ;
+}
+
+// send the next request, one at a time
+void master_request (Medium *m, int nslaves)
+{
+    l2addr dest ;
+    static int next = 0 ;
+
+    if (mst.cur >= 0 && clock_time () - mst.tsent < REQ_TIMEOUT)
+		return ;
+    mst.cur = next ;
+    next = (next + 1) % nslaves ;
+    dest.addr_ = 0x0001 + mst.cur ;
+    mst.tsent = clock_time () ;
+    mst.nreq++ ;
+    medium_select (m, mst.node) ;
+    master_send (medium_node (m, mst.node)->l2_, &dest, false) ;
+}
+
+void run_casan (Medium *m, struct slave *sl, int nslaves, bool requests)
+{
+    int i ;
+
+    clock_advance (1) ;
+    medium_step (m) ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+		medium_select (m, i + 1) ;
+		loop (sl [i].ca) ;
+		if (sl [i].tassoc == 0 && sl [i].ca->status_ == SL_RUNNING)
+		    sl [i].tassoc = clock_time () ;
+    }
+    master_recv (m) ;
+    if (requests)
+		master_request (m, nslaves) ;
+}
+
+void test_scale (int nslaves, int loss)
+{
+    Medium *m ;
+    struct slave *sl ;
+    Resource *res ;
+    clock_time_t start, end ;
+    unsigned long sum, max ;
+    int i, nassoc ;
+
+    printf ("\n%d slaves, loss %d/1000\n", nslaves, loss) ;
+    m = initMedium (nslaves + 1, SEED) ;
+    medium_set_default (m, loss, MEDIUM_LQI, 0) ;
+    sl = (struct slave *) calloc (nslaves, sizeof *sl) ;
+
+    mst.node = medium_add_node (m, MASTER, 0, CHANNEL, PANID) ;
+    mst.cur = -1 ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+		medium_add_node (m, 0x0001 + i, 0, CHANNEL, PANID) ;
+		sl [i].ca = initCasan (medium_node (m, i + 1)->l2_, 0, 1000 + i) ;
+		res = initResource ("light", "light", "light") ;
+		setHandlerResource (res, COAP_CODE_GET, process_light) ;
+		register_resource (sl [i].ca, res) ;
+    }
+
+    // association
+    start = clock_time () ;
+    nassoc = 0 ;
+    while (nassoc < nslaves && clock_time () - start < ASSOC_MAX)
+    {
+		run_casan (m, sl, nslaves, false) ;
+		for (nassoc = i = 0 ; i < nslaves ; i++)
+		    if (sl [i].tassoc != 0)
+				nassoc++ ;
+    }
+    sum = max = 0 ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+		if (sl [i].tassoc == 0)
+		    continue ;
+		sum += sl [i].tassoc - start ;
+		if (sl [i].tassoc - start > max)
+		    max = sl [i].tassoc - start ;
+    }
+
+    // requests
+    end = clock_time () + 2 * nslaves * 50 ;
+    while (clock_time () < end)
+		run_casan (m, sl, nslaves, true) ;
+
+    printf ("association: %d/%d slaves, time avg=%lu max=%lu ms\n",
+		nassoc, nslaves, nassoc > 0 ? sum / nassoc : 0, max) ;
+    printf ("requests: %d sent, %d answered (loss %d%%), rtt avg=%lu max=%lu ms\n",
+		mst.nreq, mst.nanswer,
+		mst.nreq > 0 ? 100 * (mst.nreq - mst.nanswer) / mst.nreq : 0,
+		mst.nanswer > 0 ? mst.rttsum / mst.nanswer : 0, mst.rttmax) ;
+    medium_print_stat (m) ;
+
+    CHECK (nassoc == nslaves) ;
+    if (loss == 0)
+    {
+		CHECK (mst.nreq > 0 && mst.nanswer >= mst.nreq - 1) ;
+		CHECK (mst.rttmax < 100) ;
+    }
+
+    free (sl) ;
+    freeMedium (m) ;
+}
+
+int main (int argc, char *argv [])
+{
+    int nslaves = 50, loss = 0 ;
+
+    if (argc > 1)
+		nslaves = atoi (argv [1]) ;
+    if (argc > 2)
+		loss = atoi (argv [2]) ;
+
+    clock_set_virtual (1000) ;
+    test_l2 () ;
+    test_scale (nslaves, loss) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,298 @@
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Test program for the static pools (library compiled with
+ * CASAN_STATIC_POOLS), on the host with a single engine:
+ * - no dynamic allocation after initCasan, while requests are answered
+ * - an exhausted pool is a clean error: the allocation returns NULL,
+ *   the failure is counted, and the engine recovers when blocks are
+ *   released (a request received without a free address is dropped)
+ * - buffers are frame-sized, a payload larger than a frame is taken
+ *   from the datagram pool
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVE		0x0001
+#define	MASTER		0x00fe
+#define	SLAVEID		1000
+
+#define	STEP		4		// ms between two loop iterations
+#define	NREQ		1000
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * Dynamic allocations are counted
+ */
+
+void *__libc_malloc (size_t size) ;
+void *__libc_calloc (size_t nmemb, size_t size) ;
+void *__libc_realloc (void *ptr, size_t size) ;
+void __libc_free (void *ptr) ;
+
+long int nallocs ;
+
+void *malloc (size_t size)
+{
+    nallocs++ ;
+    return __libc_malloc (size) ;
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+    nallocs++ ;
+    return __libc_calloc (nmemb, size) ;
+}
+
+void *realloc (void *ptr, size_t size)
+{
+    nallocs++ ;
+    return __libc_realloc (ptr, size) ;
+}
+
+void free (void *ptr)
+{
+    __libc_free (ptr) ;
+}
+
+uint8_t process_res (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+/******************************************************************************
+ * Frames from the master to the slave, on the default simulated radio
+ */
+
+uint8_t macseq ;
+
+bool inject (Msg *m)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    uint16_t fcf, len ;
+
+    fcf = Z_SET_FRAMETYPE (Z_FT_DATA) | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_INTRA_PAN (1) | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
+	    | Z_SET_SRC_ADDR_MODE (Z_ADDRMODE_ADDR2) ;
+    frame [0] = fcf & 0xff ;
+    frame [1] = fcf >> 8 ;
+    frame [2] = macseq++ ;
+    frame [3] = PANID & 0xff ;
+    frame [4] = PANID >> 8 ;
+    frame [5] = SLAVE & 0xff ;
+    frame [6] = SLAVE >> 8 ;
+    frame [7] = MASTER & 0xff ;
+    frame [8] = MASTER >> 8 ;
+    len = sizeof frame - 9 ;
+    if (! coap_encode (m, frame + 9, &len))
+	return false ;
+    return sim_radio_receive (frame, 9 + len, 255) ;
+}
+
+void push_opaque (Msg *m, optcode_t c, const char *val)
+{
+    option *o ;
+
+    o = initOptionOpaque (c, val, strlen (val)) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+// answers sent (or waiting for the end of their backoff)
+int nsent (Casan *ca)
+{
+    ConMsg *cm = L2_154 (ca->l2_)->cm_ ;
+
+    return getstat (cm)->tx_sent + tx_pending (cm) ;
+}
+
+// inject the given request and run the engine: true if answered
+bool request (Casan *ca, Msg *m)
+{
+    int sent ;
+
+    sent = nsent (ca) ;
+    clock_advance (STEP) ;
+    if (! inject (m))
+	return false ;
+    loop (ca) ;
+    return nsent (ca) == sent + 1 ;
+}
+
+Casan *start_slave (void)
+{
+    l2addr_154 a ;
+    l2net *l2 ;
+    Resource *res ;
+    Casan *ca ;
+    Msg *m ;
+
+    a.addr_ = SLAVE ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    ca = initCasan (l2, 0, SLAVEID) ;
+    res = initResource ("res", "res", "sensor") ;
+    setHandlerResource (res, COAP_CODE_GET, process_res) ;
+    register_resource (ca, res) ;
+
+    loop (ca) ;				// cold start: Discover
+    m = initMsg (l2) ;
+    set_id (m, 1) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    push_opaque (m, MO_Uri_Query, "ttl=72000") ;
+    push_opaque (m, MO_Uri_Query, "mtu=127") ;
+    CHECK (inject (m)) ;
+    freeMsg (m) ;
+    clock_advance (STEP) ;
+    loop (ca) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+    return ca ;
+}
+
+Msg *mk_get (l2net *l2, uint16_t id)
+{
+    Msg *m = initMsg (l2) ;
+
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_GET) ;
+    push_opaque (m, MO_Uri_Path, "res") ;
+    return m ;
+}
+
+/******************************************************************************
+ * Tests
+ */
+
+void test_noalloc (Casan *ca)
+{
+    long int n ;
+    Msg *m ;
+    int i, ok ;
+
+    printf ("no allocation after initCasan\n") ;
+    m = mk_get (ca->l2_, 0) ;
+    n = nallocs ;
+    ok = 0 ;
+    for (i = 0 ; i < NREQ ; i++)
+    {
+	set_id (m, 1000 + i) ;
+	ok += request (ca, m) ;
+	clock_advance (STEP) ;
+	loop (ca) ;			// idle
+    }
+    CHECK (ok == NREQ) ;
+    CHECK (nallocs == n) ;
+    CHECK (pool_msg.used_ == 1) ;		// m
+    CHECK (pool_msg.fail_ == 0 && pool_option.fail_ == 0) ;
+    CHECK (pool_buf.fail_ == 0 && pool_pktbuf.fail_ == 0) ;
+    freeMsg (m) ;
+}
+
+void test_exhausted (Casan *ca)
+{
+    Msg *m, *msg [POOL_NB_MSG + 1] ;
+    option *opt [POOL_NB_OPTION + 1] ;
+    l2addr *addr [POOL_NB_L2ADDR + 1] ;
+    int i, n, fail, sent ;
+
+    printf ("exhausted pools\n") ;
+    m = mk_get (ca->l2_, 2000) ;
+
+    // options
+    fail = pool_option.fail_ ;
+    for (n = 0 ; n < NTAB (opt) ; n++)
+	if ((opt [n] = initOptionInteger (MO_Uri_Port, n)) == NULL)
+	    break ;
+    CHECK (n > 0 && n < NTAB (opt)) ;
+    CHECK (pool_option.fail_ == fail + 1) ;
+    CHECK (pool_option.used_ == POOL_NB_OPTION) ;
+    CHECK (initOptionOpaque (MO_Uri_Query, "x=1", 3) == NULL) ;
+    CHECK (! request (ca, m)) ;		// no option to decode the request
+    for (i = 0 ; i < n ; i++)
+	freeOption (opt [i]) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+    set_id (m, 2001) ;
+    CHECK (request (ca, m)) ;
+
+    // messages: the request stays in the receive ring
+    fail = pool_msg.fail_ ;
+    for (n = 0 ; n < NTAB (msg) ; n++)
+	if ((msg [n] = initMsg (ca->l2_)) == NULL)
+	    break ;
+    CHECK (n < NTAB (msg)) ;
+    CHECK (pool_msg.fail_ == fail + 1) ;
+    CHECK (pool_msg.used_ == POOL_NB_MSG) ;
+    set_id (m, 2002) ;
+    sent = nsent (ca) ;
+    CHECK (! request (ca, m)) ;
+    CHECK (pool_msg.fail_ > fail + 1) ;
+    for (i = 0 ; i < n ; i++)
+	freeMsg (msg [i]) ;
+    clock_advance (STEP) ;
+    loop (ca) ;				// pending request answered
+    CHECK (nsent (ca) == sent + 1) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+    set_id (m, 2003) ;
+    CHECK (request (ca, m)) ;
+
+    // addresses: the request is dropped, the master will retransmit it
+    fail = pool_l2addr.fail_ ;
+    for (n = 0 ; n < NTAB (addr) ; n++)
+	if ((addr [n] = init_l2addr_char ("00:fe")) == NULL)
+	    break ;
+    CHECK (n < NTAB (addr)) ;
+    CHECK (pool_l2addr.fail_ == fail + 1) ;
+    set_id (m, 2004) ;
+    CHECK (! request (ca, m)) ;
+    for (i = 0 ; i < n ; i++)
+	freel2addr (addr [i]) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+    CHECK (request (ca, m)) ;
+
+    freeMsg (m) ;
+    CHECK (pool_msg.used_ == 0) ;
+    print_pools () ;
+}
+
+void test_large (Casan *ca)
+{
+    static uint8_t payload [200] ;
+    Msg *m ;
+    int used ;
+
+    printf ("large payload\n") ;
+    CHECK (pool_buf.size_ < I154_DGRAM_MAX) ;
+    CHECK (pool_pktbuf.size_ < I154_DGRAM_MAX) ;
+    used = pool_dgram.used_ ;
+    m = mk_get (ca->l2_, 3000) ;
+    set_payload_msg (m, payload, sizeof payload) ;
+    CHECK (pool_dgram.used_ == used + 1) ;
+    freeMsg (m) ;
+    CHECK (pool_dgram.used_ == used) ;
+}
+
+int main (int argc, char *argv [])
+{
+    Casan *ca ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    ca = start_slave () ;
+    test_noalloc (ca) ;
+    test_exhausted (ca) ;
+    test_large (ca) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
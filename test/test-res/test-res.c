@@ -41,7 +41,7 @@ uint8_t process_temp (Msg *in, Msg *out)
 
 
 
-void test_resource (Casan *ca, l2net_154 *l2, const char *name) {
+void test_resource (Casan *ca, l2net *l2, const char *name) {
 	Msg *in = initMsg(l2) ;
     Msg *out = initMsg(l2) ;
 
@@ -76,7 +76,7 @@ const char *resname [] =
     R2_name,
 } ;
 
-l2net_154 *l2;
+l2net *l2;
 l2addr_154 *myaddr;
 Casan *ca;
 Resource *r1;
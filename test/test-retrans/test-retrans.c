@@ -0,0 +1,245 @@
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/retrans.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Test program for the retransmission queue, on the host with the
+ * simulated radio:
+ * - entries are sorted by time of next transmission
+ * - an incoming message acknowledges an entry given the peer
+ *   address, the message id and the token (not checked for an
+ *   empty ACK), and gives a RTT measure for the peer
+ * - due entries are retransmitted with a backoff, then expire
+ * - removal of all entries for a destination
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+ConMacParam nocsma = { 0, 0, 0, 0 } ;
+
+int nframes ;
+
+void tx_hook (void *arg, const uint8_t *frame, uint8_t len)
+{
+    nframes++ ;
+}
+
+l2net *l2 ;
+l2addr peer [3] ;			// destinations
+time_t curtime ;
+
+/*
+ * Sent message with the given type, code, id and token
+ */
+
+Msg *mk_msg (uint8_t type, coap_code_t code, uint16_t id, char *tok)
+{
+    token *t ;
+    Msg *m ;
+
+    m = initMsg (l2) ;
+    set_type (m, type) ;
+    set_code (m, code) ;
+    set_id (m, id) ;
+    if (tok != NULL)
+    {
+	t = initTokenChar (tok) ;
+	set_token_msg (m, t) ;
+	freeToken (t) ;
+    }
+    return m ;
+}
+
+// send a CON request to a peer and put it in the queue
+void send_con (Retrans *rt, l2addr *dest, uint16_t id, char *tok)
+{
+    Msg *m ;
+
+    m = mk_msg (COAP_TYPE_CON, COAP_CODE_GET, id, tok) ;
+    CHECK (sendMsg (m, dest)) ;
+    check_msg_sent (rt, m, dest) ;
+    freeMsg (m) ;
+}
+
+int qlen (Retrans *rt)
+{
+    retransq *r ;
+    int n ;
+
+    for (n = 0, r = rt->retransq_ ; r != NULL ; r = r->next)
+	n++ ;
+    return n ;
+}
+
+bool sorted (Retrans *rt)
+{
+    retransq *r ;
+
+    for (r = rt->retransq_ ; r != NULL && r->next != NULL ; r = r->next)
+	if (r->next->timenext < r->timenext || r->next->prev != r)
+	    return false ;
+    return true ;
+}
+
+void run (Retrans *rt, time_t duration)
+{
+    time_t end ;
+
+    sync_time (&curtime) ;
+    for (end = curtime + duration ; curtime < end ; sync_time (&curtime))
+    {
+	clock_advance (10) ;
+	sync_time (&curtime) ;
+	loopRetrans (rt, l2, &curtime) ;
+    }
+}
+
+/******************************************************************************
+ * Tests
+ */
+
+void test_order (Retrans *rt)
+{
+    time_t next ;
+    int i ;
+
+    printf ("queue sorted by time of next transmission\n") ;
+    CHECK (! nextRetrans (rt, &next)) ;
+    getRtoPeer (&rt->rto_, &peer [0], &curtime)->rto_ = 3000 ;
+    getRtoPeer (&rt->rto_, &peer [1], &curtime)->rto_ = 200 ;
+    getRtoPeer (&rt->rto_, &peer [2], &curtime)->rto_ = 1000 ;
+    for (i = 0 ; i < 3 ; i++)
+	send_con (rt, &peer [i], 100 + i, "tk") ;
+    send_con (rt, &peer [1], 100 + 8, "tk") ;	// same hash bucket
+    CHECK (qlen (rt) == 4) ;
+    CHECK (sorted (rt)) ;
+    CHECK (rt->retransq_->id == 101 || rt->retransq_->id == 108) ;
+    CHECK (rt->retransq_->next->next->id == 102) ;
+    CHECK (rt->retransq_->next->next->next->id == 100) ;
+    CHECK (nextRetrans (rt, &next) && next == rt->retransq_->timenext) ;
+
+    // non confirmable messages are not kept
+    {
+	Msg *m = mk_msg (COAP_TYPE_NON, COAP_CODE_GET, 200, "tk") ;
+
+	CHECK (sendMsg (m, &peer [0])) ;
+	check_msg_sent (rt, m, &peer [0]) ;
+	freeMsg (m) ;
+	CHECK (qlen (rt) == 4) ;
+    }
+}
+
+void test_match (Retrans *rt)
+{
+    Msg *m ;
+
+    printf ("acknowledgement: address, id and token\n") ;
+    m = mk_msg (COAP_TYPE_ACK, COAP_RETURN_CODE (2, 5), 100, "tk") ;
+    CHECK (getRetrans (rt, m, &peer [1]) == NULL) ;	// other peer
+    CHECK (getRetrans (rt, m, &peer [0]) != NULL) ;
+    freeMsg (m) ;
+
+    m = mk_msg (COAP_TYPE_ACK, COAP_RETURN_CODE (2, 5), 100, "xy") ;
+    CHECK (getRetrans (rt, m, &peer [0]) == NULL) ;	// other token
+    freeMsg (m) ;
+
+    m = mk_msg (COAP_TYPE_ACK, COAP_CODE_EMPTY, 100, NULL) ;
+    CHECK (getRetrans (rt, m, &peer [0]) != NULL) ;	// empty ACK
+    CHECK (getRetrans (rt, m, &peer [1]) == NULL) ;
+    check_msg_received (rt, m, &peer [0]) ;
+    CHECK (getRetrans (rt, m, &peer [0]) == NULL) ;
+    CHECK (qlen (rt) == 3 && sorted (rt)) ;
+    CHECK (getRtoPeer (&rt->rto_, &peer [0], &curtime)->strong_) ;
+    freeMsg (m) ;
+
+    m = mk_msg (COAP_TYPE_RST, COAP_CODE_EMPTY, 108, NULL) ;
+    check_msg_received (rt, m, &peer [1]) ;
+    CHECK (qlen (rt) == 2 && sorted (rt)) ;
+    freeMsg (m) ;
+
+    m = mk_msg (COAP_TYPE_CON, COAP_CODE_GET, 101, "tk") ;
+    check_msg_received (rt, m, &peer [1]) ;	// not an acknowledgement
+    CHECK (qlen (rt) == 2) ;
+    freeMsg (m) ;
+}
+
+void test_loop (Retrans *rt)
+{
+    retransq *r ;
+    uint32_t t0 ;
+    int n ;
+
+    printf ("retransmissions and expiration\n") ;
+    r = rt->retransq_ ;
+    CHECK (r != NULL && r->id == 101) ;
+    if (r == NULL)
+	return ;
+    t0 = r->timeout0 ;
+    n = nframes ;
+    sync_time (&curtime) ;
+    run (rt, r->timenext - curtime + 10) ;
+    CHECK (r->ntrans == 1 && nframes == n + 1) ;
+    CHECK (r->timeout == backoff_timeout (t0, t0)) ;
+    CHECK (sorted (rt)) ;
+
+    n = nframes ;
+    run (rt, 200000) ;
+    CHECK (nframes == n + MAX_RETRANSMIT - 1 + MAX_RETRANSMIT) ;	// 101, 102
+    CHECK (qlen (rt) == 0) ;
+}
+
+void test_dest (Retrans *rt)
+{
+    int i ;
+
+    printf ("removal of all messages for a destination\n") ;
+    for (i = 0 ; i < 6 ; i++)
+	send_con (rt, &peer [i % 3], 300 + i, "tk") ;
+    CHECK (qlen (rt) == 6) ;
+    delRetransDest (rt, &peer [1]) ;
+    CHECK (qlen (rt) == 4 && sorted (rt)) ;
+    for (i = 0 ; i < RETRANS_HASH ; i++)
+    {
+	retransq *r ;
+
+	for (r = rt->hash_ [i] ; r != NULL ; r = r->hnext)
+	    CHECK (! isEqualAddr (&r->dest, &peer [1])) ;
+    }
+    resetRetrans (rt) ;
+    CHECK (qlen (rt) == 0) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+    Retrans *rt ;
+    int i ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    a = init_l2addr_154_char ("01:00") ;
+    l2 = startL2_154 (a, CHANNEL, PANID) ;
+    setMacParam (L2_154 (l2)->cm_, &nocsma) ;
+    sim_radio_set_tx_hook (tx_hook, NULL) ;
+    for (i = 0 ; i < 3 ; i++)
+	peer [i].addr_ = 0x0010 + i ;
+
+    sync_time (&curtime) ;
+    rt = initRetrans (&curtime) ;
+    test_order (rt) ;
+    test_match (rt) ;
+    test_loop (rt) ;
+    test_dest (rt) ;
+    freeRetrans (rt) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,209 @@
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Test program for the retransmission timeout estimation, on the
+ * host:
+ * - initial timeouts are randomized in [RTO, RTO * ACK_RANDOM_FACTOR[
+ * - strong (k = 4, no retransmission) and weak (k = 1, 1 or 2
+ *   retransmissions) estimators, bounds of the RTO
+ * - aging of a RTO which has not been updated
+ * - variable backoff factor
+ * - inflation of the initial timeout on a poor link
+ * - each slave draws a different sequence
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	NSLAVES		8
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+Rto rto ;
+time_t curtime ;
+
+rtopeer *new_peer (addr2_t addr)
+{
+    l2addr a ;
+
+    a.addr_ = addr ;
+    return getRtoPeer (&rto, &a, &curtime) ;
+}
+
+void test_random (void)
+{
+    rtopeer *p ;
+    uint32_t t, first ;
+    bool differ ;
+    int i ;
+
+    printf ("initial timeouts\n") ;
+    p = new_peer (0x42) ;
+    CHECK (p->rto_ == ACK_TIMEOUT) ;
+    first = initial_timeout (&rto, p, &curtime) ;
+    differ = false ;
+    for (i = 0 ; i < 100 ; i++)
+    {
+	t = initial_timeout (&rto, p, &curtime) ;
+	CHECK (t >= ACK_TIMEOUT && t < ACK_TIMEOUT * ACK_RANDOM_FACTOR) ;
+	if (t != first)
+	    differ = true ;
+    }
+    CHECK (differ) ;
+}
+
+void test_estimator (void)
+{
+    rtopeer *p ;
+    uint32_t prev ;
+    int i ;
+
+    printf ("strong estimator\n") ;
+    p = new_peer (0x43) ;
+    update_rtt (p, 100, 0, &curtime) ;
+    CHECK (p->strong_ && ! p->weak_) ;
+    CHECK (p->ssrtt_ == 100 && p->srttvar_ == 50) ;
+    CHECK (p->rto_ == (100 + 4 * 50 + ACK_TIMEOUT) / 2) ;
+    for (i = 0 ; i < 20 ; i++)
+    {
+	prev = p->rto_ ;
+	update_rtt (p, 100, 0, &curtime) ;
+	CHECK (p->rto_ <= prev) ;
+    }
+    CHECK (p->rto_ < 200 && p->rto_ >= RTO_MIN) ;
+    for (i = 0 ; i < 50 ; i++)
+	update_rtt (p, 10, 0, &curtime) ;
+    CHECK (p->rto_ == RTO_MIN) ;
+
+    printf ("weak estimator\n") ;
+    prev = p->rto_ ;
+    update_rtt (p, 1500, 1, &curtime) ;
+    CHECK (p->weak_) ;
+    CHECK (p->wsrtt_ == 1500 && p->wrttvar_ == 750) ;
+    CHECK (p->rto_ == (1500 + 750 + 3 * prev) / 4) ;
+    prev = p->rto_ ;
+    update_rtt (p, 1500, 2, &curtime) ;
+    CHECK (p->wsrtt_ == 1500 && p->wrttvar_ == 562) ;
+    CHECK (p->rto_ == (1500 + 562 + 3 * prev) / 4) ;
+    prev = p->rto_ ;
+    update_rtt (p, 1500, 3, &curtime) ;		// ambiguous: ignored
+    CHECK (p->rto_ == prev) ;
+    for (i = 0 ; i < 50 ; i++)
+	update_rtt (p, 60000, 1, &curtime) ;
+    CHECK (p->rto_ == RTO_MAX) ;
+}
+
+void test_aging (void)
+{
+    rtopeer *p ;
+
+    printf ("aging\n") ;
+    p = new_peer (0x44) ;
+    p->rto_ = 500 ;
+    p->lastupd_ = curtime ;
+    curtime += 16 * 500 ;
+    (void) initial_timeout (&rto, p, &curtime) ;
+    CHECK (p->rto_ == 500) ;			// not idle for long enough
+    curtime += 1 ;
+    (void) initial_timeout (&rto, p, &curtime) ;
+    CHECK (p->rto_ == 1000 && p->lastupd_ == curtime) ;
+
+    p->rto_ = 8000 ;
+    curtime += 4 * 8000 + 1 ;
+    (void) initial_timeout (&rto, p, &curtime) ;
+    CHECK (p->rto_ == (ACK_TIMEOUT + 8000) / 2) ;
+
+    p->rto_ = 2000 ;				// neither small nor large
+    curtime += 1000000 ;
+    (void) initial_timeout (&rto, p, &curtime) ;
+    CHECK (p->rto_ == 2000) ;
+}
+
+void test_backoff (void)
+{
+    printf ("backoff factor\n") ;
+    CHECK (backoff_timeout (600, 600) == 1800) ;	// x 3
+    CHECK (backoff_timeout (1800, 600) == 5400) ;
+    CHECK (backoff_timeout (2000, 2000) == 4000) ;	// x 2
+    CHECK (backoff_timeout (4000, 4000) == 6000) ;	// x 1.5
+}
+
+void test_lqi (void)
+{
+    rtopeer *p ;
+    uint32_t t ;
+    int i ;
+
+    printf ("poor link\n") ;
+    p = new_peer (0x45) ;
+    update_lqi (p, 200) ;
+    CHECK (p->lqi_ == 200) ;
+    for (i = 0 ; i < 20 ; i++)
+    {
+	t = initial_timeout (&rto, p, &curtime) ;
+	CHECK (t >= ACK_TIMEOUT && t < ACK_TIMEOUT * ACK_RANDOM_FACTOR) ;
+    }
+    update_lqi (p, 32) ;
+    CHECK (p->lqi_ == (3 * 200 + 32) / 4) ;
+    for (i = 0 ; i < 20 ; i++)
+	update_lqi (p, 32) ;
+    CHECK (p->lqi_ < 40) ;
+    for (i = 0 ; i < 20 ; i++)
+    {
+	t = initial_timeout (&rto, p, &curtime) ;
+	// inflated by (128 - lqi) / 128, at most twice
+	CHECK (t >= ACK_TIMEOUT * 7 / 4) ;
+	CHECK (t < 2 * ACK_TIMEOUT * ACK_RANDOM_FACTOR) ;
+    }
+}
+
+void test_seeds (void)
+{
+    Casan *ca [NSLAVES] ;
+    uint32_t rnd [NSLAVES] ;
+    l2addr_154 *a ;
+    l2net *l2 ;
+    int i, j ;
+
+    printf ("distinct seeds per slave\n") ;
+    a = init_l2addr_154_char ("01:00") ;
+    l2 = startL2_154 (a, CHANNEL, PANID) ;
+    for (i = 0 ; i < NSLAVES ; i++)
+    {
+	ca [i] = initCasan (l2, 0, 1000 + i) ;
+	rnd [i] = next_random (&ca [i]->retrans_->rto_) ;
+    }
+    for (i = 0 ; i < NSLAVES ; i++)
+	for (j = i + 1 ; j < NSLAVES ; j++)
+	    CHECK (rnd [i] != rnd [j]) ;
+    for (i = 0 ; i < NSLAVES ; i++)
+	freeCasan (ca [i]) ;
+
+    seed_random (&rto, 0) ;			// xorshift is stuck on 0
+    CHECK (next_random (&rto) != 0) ;
+}
+
+int main (int argc, char *argv [])
+{
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    sync_time (&curtime) ;
+    resetRto (&rto) ;
+    seed_random (&rto, 12345) ;
+
+    test_random () ;
+    test_estimator () ;
+    test_aging () ;
+    test_backoff () ;
+    test_lqi () ;
+    test_seeds () ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,237 @@
+#include "../../libraries/L2-154/l2-154.h"
+#include "../../host/radio-sim.h"
+
+/*
+ * Test program for the ConMsg receive ring, on the host with the
+ * simulated radio.
+ */
+
+#define CHANNEL     17
+#define PANID       CONST16 (0xca, 0xfe)
+
+ConMsg *cm ;
+int nerr = 0 ;
+
+// entry point of the rf2xx driver (see fich_Compl/radio-rf2xx.c)
+uint8_t *usr_radio_receive_frame_lqi (uint8_t len, uint8_t lqi, uint8_t *frm) ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+// build a data frame with the given sequence number and payload length
+int mkframe (uint8_t *frame, uint8_t seq, addr2_t src, int paylen)
+{
+    int i ;
+
+    frame [0] = 0x41 ; frame [1] = 0x88 ;	// data, intra-pan, addr2
+    frame [2] = seq ;
+    frame [3] = BYTE_LOW (PANID) ; frame [4] = BYTE_HIGH (PANID) ;
+    frame [5] = 0x01 ; frame [6] = 0x00 ;	// dst addr
+    frame [7] = BYTE_LOW (src) ; frame [8] = BYTE_HIGH (src) ;
+    for (i = 0 ; i < paylen ; i++)
+		frame [9 + i] = seq + i ;
+    frame [9 + paylen] = frame [10 + paylen] = 0 ;	// fcs
+    return 9 + paylen + 2 ;
+}
+
+void test_descriptor (void)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    ConReceivedFrame *r, *r2 ;
+    int len ;
+
+    printf ("descriptor decoded on reception\n") ;
+    resetstat (cm) ;
+    len = mkframe (frame, 7, 0x1234, 20) ;
+    CHECK (sim_radio_receive (frame, len, 180)) ;
+    CHECK (getstat (cm)->rx_heard == 1 && getstat (cm)->rx_stored == 1) ;
+    CHECK (getstat (cm)->rx_lqi [180 / 32] == 1) ;
+    CHECK (getstat (cm)->rx_airtime == Z_AIRTIME_US (len + 2)) ;
+    sim_radio_crcfail () ;
+    CHECK (getstat (cm)->rx_crcfail == 1) ;
+    r = get_received (cm) ;
+    CHECK (r != NULL) ;
+    CHECK (r->frametype == Z_FT_DATA) ;
+    CHECK (r->seq == 7 && r->srcaddr == 0x1234 && r->dstaddr == 0x0001) ;
+    CHECK (r->dstpan == PANID && r->srcpan == PANID) ;
+    CHECK (r->lqi == 180) ;
+    CHECK (r->paylen == 22 && r->payload [0] == 7 && r->payload [19] == 26) ;
+    r2 = get_received (cm) ;			// same frame, no decoding
+    CHECK (r2 == r) ;
+    skip_received (cm) ;
+    CHECK (get_received (cm) == NULL) ;
+}
+
+/*
+ * The LQI read by the driver reaches the statistics and the frame.
+ * The frame is received in the buffer given to the driver, as the
+ * rf2xx driver does.
+ */
+
+void test_driver_lqi (void)
+{
+    uint8_t frame [MAX_PAYLOAD], *buf ;
+    ConReceivedFrame *r ;
+    int len ;
+
+    printf ("lqi from the driver\n") ;
+    resetstat (cm) ;
+    len = mkframe (frame, 9, 0x4321, 10) ;
+    buf = cm->rbuffer_ + cm->rbufhead_ + CONMSG_DESCSZ ;
+    memcpy (buf, frame, len) ;
+    buf = usr_radio_receive_frame_lqi (len, 230, buf) ;
+    initBuf (buf, MAX_PAYLOAD) ;		// next frame, as the driver
+    CHECK (getstat (cm)->rx_stored == 1) ;
+    CHECK (getstat (cm)->rx_lqi [230 / 32] == 1) ;
+    r = get_received (cm) ;
+    CHECK (r != NULL && r->seq == 9 && r->lqi == 230) ;
+    skip_received (cm) ;
+}
+
+// must be called on an empty ring
+void test_capacity (void)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    ConReceivedFrame *r ;
+    int i, n, len, nframes ;
+
+    printf ("capacity for short frames\n") ;
+    for (n = 0 ; ; n++)
+    {
+		len = mkframe (frame, n, 0x1234, 20) ;
+		CHECK (sim_radio_receive (frame, len, 200)) ;
+		if (getstat (cm)->rx_overrun > 0)
+		    break ;
+    }
+    printf ("%d frames of %d bytes (%d full frames)\n",
+			n, len, getMsgbufsize (cm)) ;
+    CHECK (n >= 3 * (getMsgbufsize (cm) - 1)) ;
+    CHECK (getstat (cm)->rx_hwm_frames == n) ;
+    CHECK (getstat (cm)->rx_overrun == 1) ;
+    CHECK (getRxOccupancy (cm, &nframes) == getstat (cm)->rx_hwm_bytes) ;
+    CHECK (nframes == n) ;
+    for (i = 0 ; (r = get_received (cm)) != NULL ; i++)
+    {
+		CHECK (r->seq == i && r->paylen == 22) ;
+		skip_received (cm) ;
+    }
+    CHECK (i == n) ;
+    CHECK (getRxOccupancy (cm, &nframes) == 0 && nframes == 0) ;
+}
+
+void test_wrap (void)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    ConReceivedFrame *r ;
+    int i, len, nframes ;
+    uint8_t expected ;
+
+    printf ("wraparound with frames of various sizes\n") ;
+    expected = 0 ;
+    for (i = 0 ; i < 1000 ; i++)
+    {
+		len = mkframe (frame, i, 0x1234, ((uint8_t) i * 37) % 100) ;
+		CHECK (sim_radio_receive (frame, len, 200)) ;
+		if (i % 3 != 0)
+		{
+		    r = get_received (cm) ;
+		    if (r != NULL)
+		    {
+			// frames are either consumed or dropped, never reordered
+			CHECK ((uint8_t) (r->seq - expected) < 128) ;
+			CHECK (r->paylen == (r->seq * 37) % 100 + 2) ;
+			CHECK (r->paylen == 2 || r->payload [0] == r->seq) ;
+			expected = r->seq + 1 ;
+			skip_received (cm) ;
+		    }
+		}
+    }
+    while ((r = get_received (cm)) != NULL)
+		skip_received (cm) ;
+    CHECK (getRxOccupancy (cm, &nframes) == 0 && nframes == 0) ;
+}
+
+void test_filter (void)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    ConReceivedFrame *r ;
+    ConStat *st = getstat (cm) ;
+    int len, overrun ;
+
+    printf ("filtering on reception\n") ;
+    overrun = st->rx_overrun ;
+    len = mkframe (frame, 1, 0x1234, 5) ;
+    frame [5] = 0x02 ;				// another node
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (st->rx_drop_dest == 1) ;
+    frame [5] = 0xff ; frame [6] = 0xff ;	// broadcast is accepted
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    frame [3] = 0x00 ;				// another PAN
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (st->rx_drop_pan == 1) ;
+    len = mkframe (frame, 2, 0x1234, 5) ;
+    frame [0] = 0x42 ;				// ack frame type
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    frame [0] = 0x01 ;				// data, not intra-pan
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (st->rx_drop_type == 2) ;
+    CHECK (sim_radio_receive (frame, 5, 200)) ;	// truncated
+    CHECK (st->rx_drop_short == 1) ;
+    CHECK (st->rx_overrun == overrun) ;
+
+    r = get_received (cm) ;
+    CHECK (r != NULL && r->dstaddr == 0xffff) ;
+    skip_received (cm) ;
+    CHECK (get_received (cm) == NULL) ;
+
+    printf ("promiscuous mode\n") ;
+    setPromiscuous (cm, true) ;
+    len = mkframe (frame, 3, 0x1234, 5) ;
+    frame [5] = 0x02 ;
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (get_received (cm) != NULL) ;
+    skip_received (cm) ;
+    setPromiscuous (cm, false) ;
+}
+
+void test_duplicate (void)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    ConStat *st = getstat (cm) ;
+    int len, n ;
+
+    printf ("duplicate suppression\n") ;
+    len = mkframe (frame, 42, 0x1234, 10) ;
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (sim_radio_receive (frame, len, 200)) ;	// MAC retransmission
+    CHECK (st->rx_duplicate == 1) ;
+    len = mkframe (frame, 42, 0x5678, 10) ;		// other neighbour
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    len = mkframe (frame, 43, 0x1234, 10) ;		// next frame
+    CHECK (sim_radio_receive (frame, len, 200)) ;
+    CHECK (st->rx_duplicate == 1) ;
+
+    for (n = 0 ; get_received (cm) != NULL ; n++)
+		skip_received (cm) ;
+    CHECK (n == 3) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+
+    a = init_l2addr_154_char ("01:00") ;
+    cm = L2_154 (startL2_154 (a, CHANNEL, PANID))->cm_ ;
+
+    test_capacity () ;
+    test_descriptor () ;
+    test_driver_lqi () ;
+    test_filter () ;
+    test_duplicate () ;
+    test_wrap () ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,557 @@
+#include "../../host/sched.h"
+#include "../../host/medium.h"
+#include "../../libraries/Casan/casan.h"
+
+/*
+ * Test program for the discrete-event scheduler, on the host:
+ * - scheduler behaviour (events, agents, time jumps)
+ * - association/renew soak: a master stand-in and many CASAN
+ *   slaves on the simulated medium during a long simulated time.
+ *   A short run is done twice to check that results only depend
+ *   on the seed.
+ * - parallel mode: a sequential run (0 thread), a run with one
+ *   thread and a run with several threads must give the same results
+ *
+ * Usage: test-sched [nslaves [hours [seed [threads]]]]
+ * (threads = 0: sequential mode for the soak)
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	MASTER		0x00fe
+
+#define	MASTER_TTL	"ttl=72000"	// 3600 s (see is_assoc)
+#define	REQ_PERIOD	10000		// one request every 10 s
+#define	REQ_TIMEOUT	2000		// request considered as lost (ms)
+
+#define	BOOT_MAX	60000		// slaves are started in the first minute
+
+#define	HOUR		(3600UL * 1000)
+
+#define	PAR_SLAVES	100		// parallel test
+#define	PAR_THREADS	4
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * The CASAN engine is verbose: its output is discarded during
+ * the soak
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+/******************************************************************************
+ * Scheduler behaviour
+ */
+
+struct ticker
+{
+    clock_time_t next ;			// next deadline
+    clock_time_t period ;		// 0: as soon as possible
+    int nrun ;
+    clock_time_t last ;
+} ;
+
+bool ticker_next (void *arg, clock_time_t *next)
+{
+    struct ticker *t = arg ;
+
+    if (t->next == SCHED_NEVER)
+	return false ;
+    *next = t->next ;
+    return true ;
+}
+
+void ticker_run (void *arg)
+{
+    struct ticker *t = arg ;
+
+    t->nrun++ ;
+    t->last = clock_time () ;
+    if (t->period == SCHED_NEVER)
+	t->next = SCHED_NEVER ;
+    else t->next = t->last + t->period ;
+}
+
+char order [10] ;
+int norder = 0 ;
+
+void ev_a (void *arg) { order [norder++] = 'a' ; }
+void ev_b (void *arg) { order [norder++] = 'b' ; }
+void ev_c (void *arg) { order [norder++] = 'c' ; }
+
+void test_sched (void)
+{
+    Sched *s ;
+    struct ticker t1 = { 0, 1000, 0, 0 } ;
+    struct ticker t2 = { SCHED_NEVER, SCHED_NEVER, 0, 0 } ;
+    struct ticker t3 = { 0, 0, 0, 0 } ;
+    int a2 ;
+
+    printf ("events\n") ;
+    s = initSched (4, 5000) ;
+    CHECK (clock_time () == 5000) ;
+    sched_at (s, 7000, ev_c, NULL) ;
+    sched_at (s, 6000, ev_a, NULL) ;
+    sched_at (s, 7000, ev_b, NULL) ;	// same time: insertion order
+    sched_at (s, 1000, ev_a, NULL) ;	// in the past: now
+    sched_run_until (s, 6500) ;
+    CHECK (norder == 2 && memcmp (order, "aa", 2) == 0) ;
+    CHECK (clock_time () == 6500) ;
+    sched_run_for (s, 1000) ;
+    CHECK (norder == 4 && memcmp (order, "aacb", 4) == 0) ;
+    CHECK (s->nsteps_ == 2) ;		// 6000 and 7000 only
+
+    printf ("agents\n") ;
+    t1.next = sched_now (s) + 1000 ;
+    sched_add_agent (s, ticker_next, ticker_run, &t1) ;
+    a2 = sched_add_agent (s, ticker_next, ticker_run, &t2) ;
+    sched_run_for (s, 10 * 1000) ;
+    CHECK (t1.nrun == 10 && t1.last == 17500) ;
+    CHECK (t2.nrun == 0) ;
+    t2.next = 25000 ;			// no wake up: not seen
+    sched_run_for (s, 5000) ;
+    CHECK (t2.nrun == 0) ;
+    sched_wake (s, a2) ;
+    sched_run_for (s, 5000) ;
+    CHECK (t2.nrun == 1 && t2.last == 25000) ;
+
+    printf ("as soon as possible\n") ;
+    t3.next = 0 ;			// deadline in the past
+    sched_add_agent (s, ticker_next, ticker_run, &t3) ;
+    sched_run_for (s, 10) ;
+    CHECK (t3.nrun == 11) ;		// once per ms
+
+    freeSched (s) ;
+    CHECK (clock_time () == 27510) ;	// time kept by the clock
+}
+
+/******************************************************************************
+ * Association/renew soak
+ */
+
+struct slave
+{
+    Casan *ca ;
+    int node ;
+    int agent ;
+    clock_time_t tboot ;		// start time
+    slave_status status ;
+    clock_time_t tassoc ;		// first association
+    int nrenew ;			// renew -> running
+    int nlost ;				// running/renew -> waiting
+} ;
+
+struct master
+{
+    int node ;
+    int agent ;
+    uint16_t id ;
+    uint16_t reqid ;			// id of the pending request
+    int cur ;				// slave with a pending request
+    int next ;
+    clock_time_t tsent ;
+    clock_time_t nextreq ;
+    int nassoc, nreq, nanswer ;
+    unsigned long rttmax ;
+} mst ;
+
+struct sim
+{
+    Sched *s ;
+    Medium *m ;
+    int magent ;			// medium agent
+    struct slave *sl ;
+    int nslaves ;
+} ;
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+void master_send (l2net *l2, l2addr *dest, bool assoc)
+{
+    Msg *m = initMsg (l2) ;
+    const char *q [] = { MASTER_TTL, "mtu=127" } ;
+    option *o ;
+    int i ;
+
+    set_id (m, mst.id++) ;
+    set_type (m, COAP_TYPE_CON) ;
+    if (assoc)
+    {
+	set_code (m, COAP_CODE_POST) ;
+	mk_ctl_msg (m) ;
+	for (i = 0 ; i < NTAB (q) ; i++)
+	{
+	    o = initOptionOpaque (MO_Uri_Query, q [i], strlen (q [i])) ;
+	    push_option (m, o) ;
+	    freeOption (o) ;
+	}
+    }
+    else
+    {
+	set_code (m, COAP_CODE_GET) ;
+	o = initOptionOpaque (MO_Uri_Path, "light", 5) ;
+	push_option (m, o) ;
+	freeOption (o) ;
+    }
+    sendMsg (m, dest) ;
+    freeMsg (m) ;
+}
+
+bool rx_pending (Medium *m, int node)
+{
+    int n ;
+
+    getRxOccupancy (medium_node (m, node)->conmsg_, &n) ;
+    return n > 0 ;
+}
+
+// earliest of a deadline and the next TX attempt of a node (the
+// deferred medium does not poll the TX queue of nodes)
+clock_time_t tx_deadline (struct sim *sim, int node, clock_time_t next)
+{
+    clock_time_t tx ;
+
+    if (next_tx (medium_node (sim->m, node)->conmsg_, &tx) && tx < next)
+	next = tx ;
+    return next ;
+}
+
+void poll_node (struct sim *sim, int node)
+{
+    poll_tx (medium_node (sim->m, node)->conmsg_) ;
+}
+
+// medium agent
+bool medium_agent_next (void *arg, clock_time_t *next)
+{
+    return medium_next (((struct sim *) arg)->m, next) ;
+}
+
+void medium_agent_run (void *arg)
+{
+    medium_step (((struct sim *) arg)->m) ;
+}
+
+// deliver frames with the threads of the scheduler
+void medium_agent_par (void *runarg, int n, medium_item_t fn, void *arg)
+{
+    sched_parallel_for ((Sched *) runarg, n, fn, arg) ;
+}
+
+// end of a step in parallel mode: frames sent by nodes are in the air
+void medium_agent_commit (void *arg)
+{
+    struct sim *sim = arg ;
+
+    medium_commit (sim->m) ;
+    sched_wake (sim->s, sim->magent) ;
+}
+
+// a node has received a frame: its agent must be run
+void medium_agent_rx (void *arg, int node)
+{
+    struct sim *sim = arg ;
+
+    sched_wake (sim->s, node == mst.node ? mst.agent : sim->sl [node - 1].agent) ;
+}
+
+// master agent
+bool master_agent_next (void *arg, clock_time_t *next)
+{
+    struct sim *sim = arg ;
+
+    *next = rx_pending (sim->m, mst.node) ? clock_time () : mst.nextreq ;
+    *next = tx_deadline (sim, mst.node, *next) ;
+    return true ;
+}
+
+void master_agent_run (void *arg)
+{
+    struct sim *sim = arg ;
+    l2net *l2 = medium_node (sim->m, mst.node)->l2_ ;
+    l2addr dest, *src ;
+    Msg *in ;
+
+    medium_select (sim->m, mst.node) ;
+    in = initMsg (l2) ;
+    while (recvMsg (in) == RECV_OK)
+    {
+	src = get_src (l2) ;
+	if (is_ctl_msg (in) && get_type (in) == COAP_TYPE_NON)
+	{
+	    master_send (l2, src, true) ;
+	    mst.nassoc++ ;
+	}
+	else if (get_type (in) == COAP_TYPE_ACK && mst.cur >= 0
+		&& get_id (in) == mst.reqid
+		&& get_code (in) == COAP_RETURN_CODE (2, 5))
+	{
+	    unsigned long rtt = clock_time () - mst.tsent ;
+
+	    mst.nanswer++ ;
+	    if (rtt > mst.rttmax)
+		mst.rttmax = rtt ;
+	    mst.cur = -1 ;
+	}
+	freel2addr (src) ;
+    }
+    freeMsg (in) ;
+
+    // one request at a time, to associated slaves only
+    if (clock_time () >= mst.nextreq)
+    {
+	mst.nextreq = clock_time () + REQ_PERIOD ;
+	mst.cur = mst.next ;
+	mst.next = (mst.next + 1) % sim->nslaves ;
+	if (sim->sl [mst.cur].tassoc != 0)
+	{
+	    dest.addr_ = medium_node (sim->m, sim->sl [mst.cur].node)->addr_ ;
+	    mst.tsent = clock_time () ;
+	    mst.reqid = mst.id ;
+	    mst.nreq++ ;
+	    master_send (l2, &dest, false) ;
+	}
+	else mst.cur = -1 ;
+    }
+    poll_node (sim, mst.node) ;
+    sched_wake (sim->s, sim->magent) ;
+}
+
+// slave agents
+struct sim *cursim ;			// for slave agents
+
+bool slave_agent_next (void *arg, clock_time_t *next)
+{
+    struct slave *sl = arg ;
+
+    if (clock_time () < sl->tboot)
+	*next = sl->tboot ;		// not started yet
+    else if (rx_pending (cursim->m, sl->node))
+	*next = clock_time () ;
+    else *next = tx_deadline (cursim, sl->node,
+				(clock_time_t) next_wakeup (sl->ca)) ;
+    return true ;
+}
+
+void slave_agent_run (void *arg)
+{
+    struct slave *sl = arg ;
+    slave_status old = sl->status ;
+
+    if (clock_time () < sl->tboot)
+	return ;
+    medium_select (cursim->m, sl->node) ;
+    loop (sl->ca) ;
+    sl->status = sl->ca->status_ ;
+    if (sl->status == SL_RUNNING && sl->tassoc == 0)
+	sl->tassoc = clock_time () ;
+    if (old == SL_RENEW && sl->status == SL_RUNNING)
+	sl->nrenew++ ;
+    if ((old == SL_RUNNING || old == SL_RENEW)
+		&& (sl->status == SL_WAITING_KNOWN
+			|| sl->status == SL_WAITING_UNKNOWN))
+	sl->nlost++ ;
+    poll_node (cursim, sl->node) ;
+    sched_wake (cursim->s, cursim->magent) ;
+}
+
+/*
+ * Results of a soak run, which must only depend on the seed
+ */
+
+struct result
+{
+    int nassoc ;			// associated slaves
+    clock_time_t tassocmax ;
+    int nrenew, nlost ;
+    int nreq, nanswer ;
+    unsigned long rttmax ;
+    uint32_t nsent, ncoll ;
+    uint64_t nruns ;
+    uint32_t digest ;			// state of all slaves and nodes
+} ;
+
+void hash (uint32_t *h, const void *data, size_t len)
+{
+    const uint8_t *p = data ;
+
+    while (len-- > 0)
+	*h = (*h ^ *p++) * 16777619 ;		// FNV-1a
+}
+
+/*
+ * threads = 0: sequential mode, else parallel mode. The medium is
+ * deferred in both modes, such that results do not depend on threads.
+ */
+
+struct result soak (int nslaves, clock_time_t duration, uint32_t seed,
+				int threads)
+{
+    struct sim sim ;
+    struct result r ;
+    struct slave *sl ;
+    Resource *res ;
+    clock_time_t start ;
+    uint32_t rnd ;
+    int i ;
+
+    start = 1000 ;
+    rnd = seed ;
+    sim.s = initSched (nslaves + 2, start) ;
+    sim.m = initMedium (nslaves + 1, seed) ;
+    sim.nslaves = nslaves ;
+    sim.sl = (struct slave *) calloc (nslaves, sizeof *sim.sl) ;
+    cursim = &sim ;
+    quiet (true) ;
+    medium_set_rx_hook (sim.m, medium_agent_rx, &sim) ;
+
+    memset (&mst, 0, sizeof mst) ;
+    mst.cur = -1 ;
+    mst.nextreq = start + REQ_PERIOD ;
+    mst.node = medium_add_node (sim.m, MASTER, 0, CHANNEL, PANID) ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+	sl = &sim.sl [i] ;
+	sl->node = medium_add_node (sim.m, 0x0001 + i, 0, CHANNEL, PANID) ;
+	sl->ca = initCasan (medium_node (sim.m, sl->node)->l2_, 0,
+					(seed % 1000) * 1000 + i) ;
+	res = initResource ("light", "light", "light") ;
+	setHandlerResource (res, COAP_CODE_GET, process_light) ;
+	register_resource (sl->ca, res) ;
+	sl->status = sl->ca->status_ ;
+	rnd = rnd * 1103515245 + 12345 ;
+	sl->tboot = start + (rnd >> 8) % BOOT_MAX ;
+    }
+
+    // the medium first, such that frames are delivered before nodes run
+    sim.magent = sched_add_agent (sim.s, medium_agent_next,
+					medium_agent_run, &sim) ;
+    mst.agent = sched_add_agent (sim.s, master_agent_next, master_agent_run, &sim) ;
+    for (i = 0 ; i < nslaves ; i++)
+	sim.sl [i].agent = sched_add_agent (sim.s, slave_agent_next,
+					slave_agent_run, &sim.sl [i]) ;
+
+    // the master reads the state of slaves: it is never run in parallel
+    medium_set_deferred (sim.m, true, medium_agent_par, sim.s) ;
+    sched_set_serial (sim.s, sim.magent) ;
+    sched_set_serial (sim.s, mst.agent) ;
+    sched_set_barrier (sim.s, medium_agent_commit, &sim) ;
+    if (threads > 0 && ! sched_set_threads (sim.s, threads))
+	nerr++ ;
+
+    sched_run_for (sim.s, duration) ;
+    quiet (false) ;
+
+    memset (&r, 0, sizeof r) ;
+    r.digest = 2166136261 ;
+    for (i = 0 ; i < nslaves ; i++)
+    {
+	sl = &sim.sl [i] ;
+	hash (&r.digest, &sl->tassoc, sizeof sl->tassoc) ;
+	hash (&r.digest, &sl->nrenew, sizeof sl->nrenew) ;
+	hash (&r.digest, &sl->nlost, sizeof sl->nlost) ;
+	hash (&r.digest, &sl->status, sizeof sl->status) ;
+	if (sl->tassoc != 0)
+	{
+	    r.nassoc++ ;
+	    if (sl->tassoc - sl->tboot > r.tassocmax)
+		r.tassocmax = sl->tassoc - sl->tboot ;
+	}
+	r.nrenew += sl->nrenew ;
+	r.nlost += sl->nlost ;
+    }
+    r.nreq = mst.nreq ;
+    r.nanswer = mst.nanswer ;
+    r.rttmax = mst.rttmax ;
+    r.nsent = sim.m->nsent_ ;
+    r.ncoll = sim.m->ncoll_ ;
+    r.nruns = sim.s->nruns_ ;
+    for (i = 0 ; i < sim.m->nnodes_ ; i++)
+    {
+	SimNode *n = medium_node (sim.m, i) ;
+
+	hash (&r.digest, &n->ntx_, sizeof n->ntx_) ;
+	hash (&r.digest, &n->nrx_, sizeof n->nrx_) ;
+	hash (&r.digest, &n->ncoll_, sizeof n->ncoll_) ;
+	hash (&r.digest, &n->noff_, sizeof n->noff_) ;
+    }
+
+    printf ("%d slaves, %lu s: associated=%d (max %lu ms) renewed=%d lost=%d\n",
+		nslaves, (unsigned long int) duration / 1000,
+		r.nassoc, (unsigned long int) r.tassocmax, r.nrenew, r.nlost) ;
+    printf ("requests: %d sent, %d answered, rtt max=%lu ms\n",
+		r.nreq, r.nanswer, r.rttmax) ;
+    medium_print_stat (sim.m) ;
+    sched_print_stat (sim.s) ;
+
+    free (sim.sl) ;
+    freeMedium (sim.m) ;
+    freeSched (sim.s) ;
+    return r ;
+}
+
+int main (int argc, char *argv [])
+{
+    int nslaves = 200, hours = 24, threads = 0 ;
+    uint32_t seed = 12345 ;
+    struct result r1, r2 ;
+
+    if (argc > 1)
+	nslaves = atoi (argv [1]) ;
+    if (argc > 2)
+	hours = atoi (argv [2]) ;
+    if (argc > 3)
+	seed = atoi (argv [3]) ;
+    if (argc > 4)
+	threads = atoi (argv [4]) ;
+
+    test_sched () ;
+
+    printf ("\ndeterminism\n") ;
+    r1 = soak (20, HOUR / 6, seed, 0) ;
+    r2 = soak (20, HOUR / 6, seed, 0) ;
+    CHECK (memcmp (&r1, &r2, sizeof r1) == 0) ;
+
+    printf ("\nparallel\n") ;
+    r1 = soak (PAR_SLAVES, HOUR / 6, seed, 0) ;
+    r2 = soak (PAR_SLAVES, HOUR / 6, seed, 1) ;
+    CHECK (memcmp (&r1, &r2, sizeof r1) == 0) ;
+    r2 = soak (PAR_SLAVES, HOUR / 6, seed, PAR_THREADS) ;
+    CHECK (memcmp (&r1, &r2, sizeof r1) == 0) ;
+    CHECK (r1.nassoc == PAR_SLAVES) ;
+
+    printf ("\nsoak\n") ;
+    r1 = soak (nslaves, hours * HOUR, seed, threads) ;
+    CHECK (r1.nassoc == nslaves) ;
+    CHECK (r1.nlost == 0) ;
+    CHECK (hours < 2 || r1.nrenew >= nslaves * (hours - 1)) ;
+    CHECK (r1.nanswer >= r1.nreq * 99 / 100) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,537 @@
+#include "../../host/radio-sim.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+#include <limits.h>
+
+/*
+ * Long-run (soak) test of a slave on the host, with allocations
+ * tracked by subsystem (CASAN_TRACK_ALLOC, see pool.h).
+ *
+ * A scripted master sends Hello messages (and changes its hlid from
+ * time to time, such that the slave associates again), answers the
+ * Discover messages with a short TTL (such that the association is
+ * often renewed), and sends a mix of requests: GET, PUT with large
+ * payloads, observe registration and deregistration, unknown
+ * resource, /.well-known/casan, duplicates, NON requests, malformed
+ * or truncated messages.
+ *
+ * Time advances by STEP ms on each loop iteration. The run is cut in
+ * NCHECK periods, and the floor of the bytes allocated by each tag is
+ * recorded for each period: a tag fails if its floor grows (see
+ * analyze). At the end, the engine is freed, and nothing must remain
+ * allocated but the L2 network.
+ *
+ * A second, shorter run leaks an option every LEAKPERIOD iterations,
+ * and the leak must be detected (and attributed to options).
+ *
+ * Usage: test-soak [iterations]
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVE		0x0001
+#define	MASTER		0x00fe
+#define	SLAVEID		1000
+
+#define	STEP		4		// ms between two loop iterations
+#define	HELLO		30000		// Hello period (ms)
+#define	HLID_PERIOD	(20 * 60000)	// master reboot period (ms)
+#define	ASSOC_PERIOD	2000		// Assoc answer period (ms)
+#define	TTL		2400		// slave TTL (50 ms units): 2 minutes
+#define	REQ_PERIOD	10		// iterations between two requests
+#define	NCHECK		20		// checkpoints
+
+#define	ITER		5000000
+#define	LEAKITER	200000
+#define	LEAKPERIOD	1000
+
+#define	MACHDR		9
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+/*
+ * The CASAN engine is verbose: its output is discarded during
+ * the simulations
+ */
+
+FILE *realstdout ;
+
+void quiet (bool on)
+{
+    fflush (stdout) ;
+    if (on)
+    {
+	realstdout = stdout ;
+	stdout = fopen ("/dev/null", "w") ;
+    }
+    else
+    {
+	fclose (stdout) ;
+	stdout = realstdout ;
+    }
+}
+
+const char *tagname [ALLOC_NTAGS] = {
+    "msg", "option", "retrans", "casan", "l2",
+} ;
+
+/******************************************************************************
+ * Slave resources
+ */
+
+char ledval [128] = "off" ;
+int obsevent ;
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+uint8_t process_led (Msg *in, Msg *out)
+{
+    int len ;
+
+    len = get_paylen_msg (in) ;
+    if (len >= (int) sizeof ledval)
+	return COAP_RETURN_CODE (4, 13) ;
+    if (len > 0)
+	memcpy (ledval, get_payload_msg (in), len) ;
+    ledval [len] = '\0' ;
+    return COAP_RETURN_CODE (2, 4) ;
+}
+
+uint8_t process_temp (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "21", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+int trigger_temp (void)
+{
+    return ++obsevent % 50 == 0 ;
+}
+
+/******************************************************************************
+ * Scripted master
+ */
+
+struct master
+{
+    l2net *l2 ;
+    Casan *ca ;
+    long int hlid ;
+    uint16_t id ;
+    uint8_t macseq ;
+    int nreq ;
+    bool observing ;
+    uint8_t last [MAX_PAYLOAD] ;	// last request, for duplicates
+    uint16_t lastlen ;
+} ;
+
+void mac_header (struct master *ms, uint8_t *frame)
+{
+    uint16_t fcf ;
+
+    fcf = Z_SET_FRAMETYPE (Z_FT_DATA) | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_INTRA_PAN (1) | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
+	    | Z_SET_SRC_ADDR_MODE (Z_ADDRMODE_ADDR2) ;
+    frame [0] = fcf & 0xff ;
+    frame [1] = fcf >> 8 ;
+    frame [2] = ms->macseq++ ;
+    frame [3] = PANID & 0xff ;
+    frame [4] = PANID >> 8 ;
+    frame [5] = SLAVE & 0xff ;
+    frame [6] = SLAVE >> 8 ;
+    frame [7] = MASTER & 0xff ;
+    frame [8] = MASTER >> 8 ;
+}
+
+void send_raw (struct master *ms, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+
+    if (MACHDR + len > sizeof frame)
+	len = sizeof frame - MACHDR ;
+    mac_header (ms, frame) ;
+    memcpy (frame + MACHDR, payload, len) ;
+    sim_radio_receive (frame, MACHDR + len, 255) ;
+}
+
+// encode, send and free the message
+void send_msg (struct master *ms, Msg *m)
+{
+    uint16_t len ;
+
+    len = sizeof ms->last - MACHDR ;
+    if (coap_encode (m, ms->last, &len))
+    {
+	ms->lastlen = len ;
+	send_raw (ms, ms->last, len) ;
+    }
+    freeMsg (m) ;
+}
+
+void push_opaque (Msg *m, optcode_t c, const char *val)
+{
+    option *o ;
+
+    o = initOptionOpaque (c, val, strlen (val)) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+void push_uint (Msg *m, optcode_t c, uint val)
+{
+    option *o ;
+
+    o = initOptionInteger (c, val) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+}
+
+Msg *mk_ctl (struct master *ms, uint8_t type)
+{
+    Msg *m ;
+
+    m = initMsg (ms->l2) ;
+    set_id (m, ms->id++) ;
+    set_type (m, type) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    return m ;
+}
+
+void send_hello (struct master *ms)
+{
+    char q [32] ;
+    Msg *m ;
+
+    m = mk_ctl (ms, COAP_TYPE_NON) ;
+    snprintf (q, sizeof q, "hello=%ld", ms->hlid) ;
+    push_opaque (m, MO_Uri_Query, q) ;
+    send_msg (ms, m) ;
+}
+
+void send_assoc (struct master *ms)
+{
+    char q [32] ;
+    Msg *m ;
+
+    m = mk_ctl (ms, COAP_TYPE_CON) ;
+    snprintf (q, sizeof q, "ttl=%d", TTL) ;
+    push_opaque (m, MO_Uri_Query, q) ;
+    push_opaque (m, MO_Uri_Query, "mtu=127") ;
+    send_msg (ms, m) ;
+}
+
+Msg *mk_req (struct master *ms, uint8_t type, coap_code_t code,
+			const char *path)
+{
+    token tok ;
+    Msg *m ;
+
+    m = initMsg (ms->l2) ;
+    set_id (m, ms->id) ;
+    set_type (m, type) ;
+    set_code (m, code) ;
+    tok.toklen_ = 2 ;
+    tok.token_ [0] = ms->id >> 8 ;
+    tok.token_ [1] = ms->id & 0xff ;
+    set_token_msg (m, &tok) ;
+    ms->id++ ;
+    push_opaque (m, MO_Uri_Path, path) ;
+    return m ;
+}
+
+#define	NKINDS		10
+
+void send_request (struct master *ms)
+{
+    uint8_t bad [16] ;
+    char big [64] ;
+    Msg *m ;
+
+    switch (ms->nreq++ % NKINDS)
+    {
+	case 0 :
+	    send_msg (ms, mk_req (ms, COAP_TYPE_CON, COAP_CODE_GET, "light")) ;
+	    break ;
+	case 1 :				// payload and options in pool_buf
+	    memset (big, 'a' + ms->nreq % 26, sizeof big - 1) ;
+	    big [sizeof big - 1] = '\0' ;
+	    m = mk_req (ms, COAP_TYPE_CON, COAP_CODE_PUT, "led") ;
+	    push_opaque (m, MO_Uri_Query, "a-rather-long-query-string") ;
+	    set_payload_msg (m, (uint8_t *) big, strlen (big)) ;
+	    send_msg (ms, m) ;
+	    break ;
+	case 2 :				// observe on, then off
+	    m = mk_req (ms, COAP_TYPE_CON, COAP_CODE_GET, "temp") ;
+	    push_uint (m, MO_Observe, ms->observing ? 1 : 0) ;
+	    ms->observing = ! ms->observing ;
+	    send_msg (ms, m) ;
+	    break ;
+	case 3 :
+	    send_msg (ms, mk_req (ms, COAP_TYPE_CON, COAP_CODE_GET, "nope")) ;
+	    break ;
+	case 4 :
+	    m = mk_req (ms, COAP_TYPE_CON, COAP_CODE_GET, ".well-known") ;
+	    push_opaque (m, MO_Uri_Path, "casan") ;
+	    send_msg (ms, m) ;
+	    break ;
+	case 5 :				// duplicate of the last one
+	    send_raw (ms, ms->last, ms->lastlen) ;
+	    break ;
+	case 6 :
+	    send_msg (ms, mk_req (ms, COAP_TYPE_NON, COAP_CODE_GET, "light")) ;
+	    break ;
+	case 7 :				// option longer than message
+	    m = mk_req (ms, COAP_TYPE_CON, COAP_CODE_GET, "light") ;
+	    send_msg (ms, m) ;
+	    send_raw (ms, ms->last, ms->lastlen - 2) ;
+	    break ;
+	case 8 :				// token length 15
+	    memset (bad, 0, sizeof bad) ;
+	    bad [0] = 0x4f ;
+	    bad [1] = COAP_CODE_GET ;
+	    send_raw (ms, bad, sizeof bad) ;
+	    break ;
+	case 9 :				// DELETE: no handler
+	    send_msg (ms, mk_req (ms, COAP_TYPE_CON, COAP_CODE_DELETE, "led")) ;
+	    break ;
+    }
+}
+
+/******************************************************************************
+ * Soak run
+ */
+
+struct soak
+{
+    long int low [NCHECK][ALLOC_NTAGS] ;	// floor of each period
+    long int live [ALLOC_NTAGS] ;		// end of run
+    long int peak [ALLOC_NTAGS] ;
+    unsigned long int nalloc [ALLOC_NTAGS] ;
+    int ncheck ;
+    unsigned int grow ;				// tags which grow
+    int nassoc ;				// associations and renewals
+    uint32_t nsent ;				// frames sent by the slave
+} ;
+
+/*
+ * Bytes allocated between two iterations of loop come and go (answers
+ * kept for duplicates, observers, master address), but their floor
+ * over a period stays the same, unless memory leaks: a tag grows if
+ * its floor during the second half of the run is above all floors of
+ * the first half (the first period, which includes the association,
+ * is ignored).
+ */
+
+void analyze (struct soak *sk)
+{
+    long int first, second ;
+    int t, i, half ;
+
+    sk->grow = 0 ;
+    half = 1 + (sk->ncheck - 1) / 2 ;
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+    {
+	first = 0 ;
+	second = LONG_MAX ;
+	for (i = 1 ; i < sk->ncheck ; i++)
+	{
+	    if (i < half && sk->low [i][t] > first)
+		first = sk->low [i][t] ;
+	    if (i >= half && sk->low [i][t] < second)
+		second = sk->low [i][t] ;
+	}
+	if (second > first)
+	    sk->grow |= 1 << t ;
+    }
+}
+
+void print_soak (struct soak *sk)
+{
+    int t ;
+
+    printf ("%-8s %8s %8s %8s %8s %12s\n", "tag", "bytes", "peak",
+		    "floor1", "floor2", "allocs") ;
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+	printf ("%-8s %8ld %8ld %8ld %8ld %12lu%s\n", tagname [t],
+		    sk->live [t], sk->peak [t], sk->low [1][t],
+		    sk->low [sk->ncheck - 1][t], sk->nalloc [t],
+		    sk->grow & (1 << t) ? "  GROWS" : "") ;
+}
+
+void soak (struct soak *sk, l2net *l2, long int niter, bool leak)
+{
+    Resource *res [3] ;
+    struct master ms ;
+    clock_time_t now, nexthello, nextassoc, nexthlid ;
+    uint8_t status ;
+    long int low [ALLOC_NTAGS] ;
+    unsigned long int nalloc [ALLOC_NTAGS] ;
+    AllocStat st ;
+    Casan *ca ;
+    long int i ;
+    int t ;
+
+    memset (sk, 0, sizeof *sk) ;
+    memset (&ms, 0, sizeof ms) ;
+    ms.l2 = l2 ;
+    ms.hlid = 42 ;
+    ms.id = 1 ;
+
+    ca = initCasan (l2, 0, SLAVEID) ;
+    res [0] = initResource ("light", "light", "light") ;
+    setHandlerResource (res [0], COAP_CODE_GET, process_light) ;
+    res [1] = initResource ("led", "led", "led") ;
+    setHandlerResource (res [1], COAP_CODE_PUT, process_led) ;
+    res [2] = initResource ("temp", "temp", "celsius") ;
+    setHandlerResource (res [2], COAP_CODE_GET, process_temp) ;
+    ohandlerResource (res [2], NULL, NULL, trigger_temp) ;
+    for (t = 0 ; t < 3 ; t++)
+	register_resource (ca, res [t]) ;
+    ms.ca = ca ;
+
+    now = clock_time () ;
+    nexthello = nextassoc = now ;
+    nexthlid = now + HLID_PERIOD ;
+    reset_alloc_peak () ;
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+    {
+	alloc_stat (t, &st) ;
+	nalloc [t] = st.nalloc_ ;
+	low [t] = LONG_MAX ;
+    }
+
+    for (i = 0 ; i < niter ; i++)
+    {
+	now = clock_time () ;
+	if (now >= nexthlid)
+	{
+	    ms.hlid++ ;				// master reboot
+	    nexthlid += HLID_PERIOD ;
+	}
+	if (now >= nexthello)
+	{
+	    send_hello (&ms) ;
+	    nexthello += HELLO ;
+	}
+	else if (ca->status_ != SL_RUNNING && now >= nextassoc)
+	{
+	    send_assoc (&ms) ;
+	    nextassoc = now + ASSOC_PERIOD ;
+	}
+	else if (ca->status_ == SL_RUNNING && i % REQ_PERIOD == 0)
+	    send_request (&ms) ;
+
+	status = ca->status_ ;
+	loop (ca) ;
+	if (status != SL_RUNNING && ca->status_ == SL_RUNNING)
+	    sk->nassoc++ ;
+
+	if (leak && i % LEAKPERIOD == 0)
+	    (void) initOptionInteger (MO_Max_Age, i) ;	// never freed
+
+	clock_advance (STEP) ;
+	for (t = 0 ; t < ALLOC_NTAGS ; t++)
+	{
+	    alloc_stat (t, &st) ;
+	    if (st.bytes_ < low [t])
+		low [t] = st.bytes_ ;
+	}
+	if ((i + 1) % (niter / NCHECK) == 0 && sk->ncheck < NCHECK)
+	{
+	    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+	    {
+		sk->low [sk->ncheck][t] = low [t] ;
+		low [t] = LONG_MAX ;
+	    }
+	    sk->ncheck++ ;
+	}
+    }
+
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+    {
+	alloc_stat (t, &st) ;
+	sk->live [t] = st.bytes_ ;
+	sk->peak [t] = st.peak_ ;
+	sk->nalloc [t] = st.nalloc_ - nalloc [t] ;
+    }
+    sk->nsent = getstat (L2_154 (l2)->cm_)->tx_sent ;
+    analyze (sk) ;
+
+    // the slave is stopped: only the L2 network remains
+    freeCasan (ca) ;
+    for (t = 0 ; t < 3 ; t++)
+	freeResource (res [t]) ;
+}
+
+int main (int argc, char *argv [])
+{
+    long int niter = ITER ;
+    long int base [ALLOC_NTAGS] ;
+    struct soak *sk ;
+    l2addr_154 a ;
+    AllocStat st ;
+    l2net *l2 ;
+    int t ;
+
+    if (argc > 1)
+	niter = atoi (argv [1]) ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    sk = (struct soak *) malloc (sizeof *sk) ;
+
+    quiet (true) ;
+    a.addr_ = SLAVE ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+    {
+	alloc_stat (t, &st) ;
+	base [t] = st.bytes_ ;
+    }
+    soak (sk, l2, niter, false) ;
+    quiet (false) ;
+
+    printf ("Soak: %ld iterations, %ld simulated s\n",
+		niter, niter * STEP / 1000) ;
+    print_soak (sk) ;
+    printf ("%d associations, %lu frames sent\n", sk->nassoc,
+		(unsigned long int) sk->nsent) ;
+    CHECK (sk->ncheck == NCHECK) ;
+    CHECK (sk->nassoc >= niter * STEP / HLID_PERIOD) ;
+    CHECK (sk->nsent >= niter / REQ_PERIOD / 2) ;
+    CHECK (sk->grow == 0) ;
+    for (t = 0 ; t < ALLOC_NTAGS ; t++)
+    {
+	alloc_stat (t, &st) ;
+	if (st.bytes_ != base [t])
+	    printf ("%s: %ld bytes leaked\n", tagname [t], st.bytes_ - base [t]) ;
+	CHECK (st.bytes_ == base [t]) ;
+	CHECK (st.fail_ == 0) ;
+    }
+    alloc_stat (ALLOC_RETRANS, &st) ;
+    CHECK (st.nalloc_ > 0) ;		// dedup used
+
+    // a leak must be detected, and attributed to its subsystem
+    quiet (true) ;
+    soak (sk, l2, LEAKITER, true) ;
+    quiet (false) ;
+    printf ("Soak with a leak: %d iterations\n", LEAKITER) ;
+    print_soak (sk) ;
+    CHECK (sk->grow == 1 << ALLOC_OPTION) ;
+    alloc_stat (ALLOC_OPTION, &st) ;
+    CHECK (st.nblocks_ == LEAKITER / LEAKPERIOD) ;
+
+    free (sk) ;
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
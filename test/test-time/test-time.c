@@ -5,6 +5,8 @@
  * Test program for the "time" class
  */
 
+time_t curtime ;
+
 void test_diff (void)
 {
     time_t x = 0 ;
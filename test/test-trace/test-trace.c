@@ -0,0 +1,343 @@
+#include "../../host/radio-sim.h"
+#include "../../host/tracedec.h"
+#include "../../host/bench.h"
+#include "../../libraries/Casan/casan.h"
+#include "../../libraries/L2-154/l2-154.h"
+
+/*
+ * Test program for the binary event trace (compiled with CASAN_TRACE,
+ * see Casan/trace.h), on the host:
+ * - ring: size, overwrite of the oldest records, no recording when
+ *   no trace is selected
+ * - export and decoding of the exported data, rejection of invalid
+ *   data
+ * - trace of a slave associated by a scripted master, which then
+ *   sends a request: state changes, frames, control messages and
+ *   requests must be found in order in the decoded trace
+ * - cost of an event, with and without a selected trace
+ *
+ * Usage: test-trace [trace-file]
+ *	with a file (a trace exported by a node), the file is decoded
+ *	and printed instead
+ */
+
+#define CHANNEL		17
+#define PANID		CONST16 (0xca, 0xfe)
+#define	SLAVE		0x0001
+#define	MASTER		0x00fe
+#define	SLAVEID		1000
+#define	HLID		42
+
+#define	STEP		10		// ms between two loop iterations
+#define	MACHDR		9
+
+#define	NREC		1024
+#define	NCOST		10000000
+
+#define	TRACEFILE	"/tmp/test-trace.trc"
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+TraceRec ring [NREC] ;
+
+/******************************************************************************
+ * Ring and export
+ */
+
+struct membuf
+{
+    uint8_t data [TRACE_HDRLEN + NREC * TRACE_RECLEN] ;
+    int len ;
+} ;
+
+void write_mem (void *arg, const uint8_t *data, int len)
+{
+    struct membuf *mb = (struct membuf *) arg ;
+
+    memcpy (mb->data + mb->len, data, len) ;
+    mb->len += len ;
+}
+
+void test_ring (void)
+{
+    static struct membuf mb ;
+    TraceFile *tf ;
+    Trace t ;
+    int i ;
+
+    CHECK (! initTrace (&t, ring, 0)) ;
+    CHECK (initTrace (&t, ring, 100)) ;
+    CHECK (t.mask_ == 63) ;
+
+    trace_select (NULL) ;
+    trace_event (TR_USER, 1, 2, 3) ;
+    CHECK (trace_count (&t) == 0) ;
+
+    trace_select (&t) ;
+    for (i = 0 ; i < 100 ; i++)
+	trace_event (TR_USER + i, i, 1000 + i, 0xdeadbeef) ;
+    trace_select (NULL) ;
+    CHECK (trace_count (&t) == 64) ;
+    CHECK (trace_lost (&t) == 36) ;
+    CHECK (trace_get (&t, 0)->id == TR_USER + 36) ;
+    CHECK (trace_get (&t, 63)->arg1 == 1099) ;
+    CHECK (trace_get (&t, 64) == NULL) ;
+
+    mb.len = 0 ;
+    trace_write (&t, write_mem, &mb) ;
+    CHECK (mb.len == TRACE_HDRLEN + 64 * TRACE_RECLEN) ;
+    tf = trace_decode (mb.data, mb.len) ;
+    CHECK (tf != NULL) ;
+    if (tf != NULL)
+    {
+	CHECK (tf->nrec_ == 64 && tf->lost_ == 36) ;
+	CHECK (tf->hz_ == CLOCK_SECOND) ;
+	for (i = 0 ; i < tf->nrec_ ; i++)
+	    CHECK (memcmp (&tf->rec_ [i], trace_get (&t, i),
+				    sizeof (TraceRec)) == 0) ;
+	freeTraceFile (tf) ;
+    }
+    CHECK (trace_decode (mb.data, mb.len - 1) == NULL) ;	// truncated
+    mb.data [0] = 'X' ;
+    CHECK (trace_decode (mb.data, mb.len) == NULL) ;
+
+    trace_clear (&t) ;
+    CHECK (trace_count (&t) == 0 && trace_lost (&t) == 0) ;
+}
+
+/******************************************************************************
+ * Scripted master
+ */
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+uint8_t macseq ;
+uint16_t msgid = 1 ;
+
+void send_msg (l2net *l2, Msg *m)
+{
+    uint8_t frame [MAX_PAYLOAD] ;
+    uint16_t fcf, len ;
+
+    fcf = Z_SET_FRAMETYPE (Z_FT_DATA) | Z_SET_ACK_REQUEST (1)
+	    | Z_SET_INTRA_PAN (1) | Z_SET_DST_ADDR_MODE (Z_ADDRMODE_ADDR2)
+	    | Z_SET_SRC_ADDR_MODE (Z_ADDRMODE_ADDR2) ;
+    frame [0] = fcf & 0xff ;
+    frame [1] = fcf >> 8 ;
+    frame [2] = macseq++ ;
+    frame [3] = PANID & 0xff ;
+    frame [4] = PANID >> 8 ;
+    frame [5] = SLAVE & 0xff ;
+    frame [6] = SLAVE >> 8 ;
+    frame [7] = MASTER & 0xff ;
+    frame [8] = MASTER >> 8 ;
+    len = sizeof frame - MACHDR ;
+    if (coap_encode (m, frame + MACHDR, &len))
+	sim_radio_receive (frame, MACHDR + len, 200) ;
+    freeMsg (m) ;
+}
+
+Msg *mk_msg (l2net *l2, uint8_t type, coap_code_t code, const char *query)
+{
+    option *o ;
+    Msg *m ;
+
+    m = initMsg (l2) ;
+    set_id (m, msgid++) ;
+    set_type (m, type) ;
+    set_code (m, code) ;
+    if (query != NULL)
+    {
+	mk_ctl_msg (m) ;
+	o = initOptionOpaque (MO_Uri_Query, query, strlen (query)) ;
+	push_option (m, o) ;
+	freeOption (o) ;
+    }
+    return m ;
+}
+
+void run (Casan *ca, int niter)
+{
+    int i ;
+
+    for (i = 0 ; i < niter ; i++)
+    {
+	loop (ca) ;
+	clock_advance (STEP) ;
+    }
+}
+
+/*
+ * Next record of the given event from index *i, with the given
+ * first argument (-1: any). *i is left after this record.
+ */
+
+const TraceRec *expect (TraceFile *tf, int *i, uint16_t id, long int a0)
+{
+    int j ;
+
+    for (j = trace_find (tf, *i, id) ; j >= 0 ; j = trace_find (tf, j + 1, id))
+    {
+	if (a0 == -1 || tf->rec_ [j].arg0 == a0)
+	{
+	    *i = j + 1 ;
+	    return &tf->rec_ [j] ;
+	}
+    }
+    printf ("event %s (arg0 %ld) not found after record %d\n",
+				trace_event_name (id), a0, *i) ;
+    return NULL ;
+}
+
+void test_slave (void)
+{
+    static Trace t ;
+    const TraceRec *r ;
+    TraceFile *tf ;
+    Resource *res ;
+    l2addr_154 a ;
+    l2net *l2 ;
+    Casan *ca ;
+    option *o ;
+    Msg *m ;
+    int i ;
+
+    clock_set_virtual (1000) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    initTrace (&t, ring, NREC) ;
+    trace_select (&t) ;
+
+    a.addr_ = SLAVE ;
+    l2 = startL2_154 (&a, CHANNEL, PANID) ;
+    ca = initCasan (l2, 0, SLAVEID) ;
+    res = initResource ("light", "light", "light") ;
+    setHandlerResource (res, COAP_CODE_GET, process_light) ;
+    register_resource (ca, res) ;
+
+    run (ca, 10) ;				// Discover
+    send_msg (l2, mk_msg (l2, COAP_TYPE_NON, COAP_CODE_POST, "hello=42")) ;
+    run (ca, 10) ;
+    m = mk_msg (l2, COAP_TYPE_CON, COAP_CODE_POST, "ttl=72000") ;
+    o = initOptionOpaque (MO_Uri_Query, "mtu=127", 7) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    send_msg (l2, m) ;
+    run (ca, 10) ;
+    m = mk_msg (l2, COAP_TYPE_CON, COAP_CODE_GET, NULL) ;
+    o = initOptionOpaque (MO_Uri_Path, "light", 5) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    send_msg (l2, m) ;
+    run (ca, 10) ;
+    trace_select (NULL) ;
+
+    CHECK (ca->status_ == SL_RUNNING) ;
+    CHECK (trace_lost (&t) == 0) ;
+    CHECK (trace_save (&t, TRACEFILE)) ;
+    tf = trace_load (TRACEFILE) ;
+    CHECK (tf != NULL) ;
+    if (tf == NULL)
+	return ;
+    CHECK (tf->nrec_ == trace_count (&t)) ;
+
+    i = 0 ;
+    r = expect (tf, &i, TR_DISCOVER, -1) ;
+    CHECK (r != NULL && r->arg1 == SLAVEID) ;
+    r = expect (tf, &i, TR_STATUS, SL_WAITING_UNKNOWN) ;
+    CHECK (r != NULL && r->arg1 == SL_COLDSTART) ;
+    r = expect (tf, &i, TR_TX, -1) ;			// sent at loop end
+    CHECK (r != NULL && r->arg1 == 0xffff) ;
+    r = expect (tf, &i, TR_RX, -1) ;
+    CHECK (r != NULL && r->arg1 == MASTER && r->arg2 == 200) ;
+    r = expect (tf, &i, TR_HELLO, -1) ;
+    CHECK (r != NULL && r->arg1 == HLID) ;
+    r = expect (tf, &i, TR_MASTER, MASTER) ;
+    CHECK (r != NULL && r->arg1 == HLID) ;
+    CHECK (expect (tf, &i, TR_STATUS, SL_WAITING_KNOWN) != NULL) ;
+    r = expect (tf, &i, TR_ASSOC, 127) ;
+    CHECK (r != NULL && r->arg1 == 72000 * 50) ;
+    CHECK (expect (tf, &i, TR_SEND, -1) != NULL) ;	// Assoc answer
+    CHECK (expect (tf, &i, TR_STATUS, SL_RUNNING) != NULL) ;
+    CHECK (expect (tf, &i, TR_TX_DONE, TX_OK) != NULL) ;
+    r = expect (tf, &i, TR_REQUEST, COAP_CODE_GET) ;
+    CHECK (r != NULL && r->arg2 == 0) ;
+    r = expect (tf, &i, TR_SEND, -1) ;
+    CHECK (r != NULL && r->arg2 == (COAP_TYPE_ACK << 8 | COAP_RETURN_CODE (2, 5))) ;
+    for (i = 1 ; i < tf->nrec_ ; i++)
+	CHECK (tf->rec_ [i].time >= tf->rec_ [i - 1].time) ;
+
+    printf ("Trace of a slave:\n") ;
+    trace_print (tf, stdout) ;
+    freeTraceFile (tf) ;
+
+    freeCasan (ca) ;
+    freeResource (res) ;
+}
+
+/******************************************************************************
+ * Cost of an event
+ */
+
+void test_cost (void)
+{
+    static Trace t ;
+    BenchResult *r ;
+    Bench *b ;
+    long int i ;
+
+    b = initBench ("trace") ;
+    initTrace (&t, ring, NREC) ;
+
+    trace_select (NULL) ;
+    bench_begin (b) ;
+    for (i = 0 ; i < NCOST ; i++)
+	trace_event (TR_USER, i, i, i) ;
+    bench_end (b, "trace_event (not selected)", NCOST) ;
+
+    trace_select (&t) ;
+    bench_begin (b) ;
+    for (i = 0 ; i < NCOST ; i++)
+	trace_event (TR_USER, i, i, i) ;
+    r = bench_end (b, "trace_event", NCOST) ;
+    trace_select (NULL) ;
+
+    bench_print (b) ;
+    CHECK (trace_lost (&t) == NCOST - NREC) ;
+    CHECK (trace_get (&t, NREC - 1)->arg1 == NCOST - 1) ;
+    CHECK (r->ns_ < 100 * NCOST) ;		// well under 100 ns
+    freeBench (b) ;
+}
+
+int main (int argc, char *argv [])
+{
+    TraceFile *tf ;
+
+    if (argc > 1)
+    {
+	tf = trace_load (argv [1]) ;
+	if (tf == NULL)
+	{
+	    fprintf (stderr, "%s: not a valid trace\n", argv [1]) ;
+	    return 1 ;
+	}
+	trace_print (tf, stdout) ;
+	freeTraceFile (tf) ;
+	return 0 ;
+    }
+
+    test_ring () ;
+    test_slave () ;
+    test_cost () ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
@@ -0,0 +1,205 @@
+#include "../../libraries/L2-154/l2-154.h"
+#include "../../host/radio-sim.h"
+
+/*
+ * Test program for the asynchronous transmission queue of ConMsg,
+ * on the host with the simulated radio and the virtual clock.
+ */
+
+#define CHANNEL     17
+#define PANID       CONST16 (0xca, 0xfe)
+
+ConMsg *cm ;
+int nerr = 0 ;
+int nonair = 0 ;			// frames given to the radio
+int ndone [TX_FAIL + 1] ;		// completions, by status
+uint8_t lastseq ;
+
+ConMacParam nocsma = { 0, 0, 0, 0 } ;	// no backoff, no retry
+ConMacParam csma = { 3, 5, 4, 3 } ;	// 802.15.4 defaults
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+void tx_hook (void *arg, const uint8_t *frame, uint8_t len)
+{
+    nonair++ ;
+}
+
+void tx_done (void *arg, uint8_t seq, addr2_t dst, tx_status_t status)
+{
+    ndone [status]++ ;
+    lastseq = seq ;
+}
+
+/*
+ * Wait until all frames are sent: poll the queue, and advance the
+ * virtual clock to the end of the current backoff. ConMsg has no
+ * such function, since a node must not spin: the completion of a
+ * frame comes from the radio driver, which does not run meanwhile.
+ */
+
+#define	MAXPOLL		1000
+
+bool drain_tx (ConMsg *cm)
+{
+    clock_time_t next ;
+    int i ;
+
+    for (i = 0 ; i < MAXPOLL && tx_pending (cm) > 0 ; i++)
+    {
+	poll_tx (cm) ;
+	if (next_tx (cm, &next) && (long int) (next - clock_time ()) > 0)
+	    clock_set_virtual (next) ;
+    }
+    return tx_pending (cm) == 0 ;
+}
+
+void test_queue (void)
+{
+    uint8_t pkt [] = "hello" ;
+    int i ;
+
+    printf ("queue frames while radio is busy\n") ;
+    setMacParam (cm, &nocsma) ;
+    sim_radio_set_sync (false, TX_OK) ;
+    for (i = 0 ; i < CONMSG_TXQ_SIZE ; i++)
+		CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (nonair == 1) ;			// only the head is on air
+    CHECK (tx_pending (cm) == CONMSG_TXQ_SIZE) ;
+
+    printf ("queue overflow\n") ;
+    CHECK (! sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (getstat (cm)->tx_overrun == 1) ;
+
+    printf ("drain the queue\n") ;
+    CHECK (sim_radio_complete (TX_OK)) ;
+    poll_tx (cm) ;
+    CHECK (ndone [TX_OK] == 1) ;
+    CHECK (nonair == 2) ;
+    CHECK (sim_radio_complete (TX_NOACK)) ;
+    CHECK (! sim_radio_complete (TX_OK)) ;	// radio not restarted yet
+    poll_tx (cm) ;
+    CHECK (ndone [TX_NOACK] == 1) ;
+    CHECK (sim_radio_complete (TX_CCA_FAIL)) ;
+    poll_tx (cm) ;
+    CHECK (ndone [TX_CCA_FAIL] == 1) ;
+    CHECK (sim_radio_complete (TX_OK)) ;
+    poll_tx (cm) ;
+    CHECK (tx_pending (cm) == 0) ;
+    CHECK (nonair == CONMSG_TXQ_SIZE) ;
+    CHECK (lastseq == cm->seqnum_) ;
+    CHECK (getstat (cm)->tx_sent == 2) ;
+    CHECK (getstat (cm)->tx_error_noack == 1) ;
+    CHECK (getstat (cm)->tx_error_cca == 1) ;
+}
+
+void test_rx_while_tx (void)
+{
+    uint8_t pkt [] = "data" ;
+    uint8_t frame [] = {
+	0x41, 0x88, 0x01,		// fcf (data, intra-pan, addr2), seq
+	0xca, 0xfe,			// dst panid
+	0x01, 0x00,			// dst addr
+	0x34, 0x12,			// src addr
+	'a', 'b', 'c',
+	0x00, 0x00			// fcs
+    } ;
+    ConReceivedFrame *r ;
+
+    printf ("receive while a frame is being sent\n") ;
+    CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (sim_radio_busy ()) ;
+    CHECK (sim_radio_receive (frame, sizeof frame, 200)) ;
+    r = get_received (cm) ;
+    CHECK (r != NULL && r->srcaddr == 0x1234 && r->paylen == 5) ;
+    skip_received (cm) ;
+    CHECK (sim_radio_complete (TX_OK)) ;
+    CHECK (drain_tx (cm)) ;
+    CHECK (tx_pending (cm) == 0) ;
+}
+
+void test_stat (void)
+{
+    uint8_t pkt [20] ;
+    ConStat snap ;
+
+    printf ("statistics snapshot and reset\n") ;
+    resetstat (cm) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (drain_tx (cm)) ;
+    getstat_snapshot (cm, &snap) ;
+    CHECK (snap.tx_sent == 1) ;
+    CHECK (snap.tx_airtime == Z_AIRTIME_US (9 + sizeof pkt + 2)) ;
+    CHECK (snap.rx_airtime == Z_AIRTIME_US (Z_ACK_LEN)) ;
+    CHECK (snap.tx_hwm_frames == 1) ;
+    CHECK (chan_busy_permille (&snap, snap.since + CLOCK_SECOND) ==
+	    (int) ((snap.tx_airtime + snap.rx_airtime) / 1000)) ;
+    // no acknowledgement for a broadcast frame
+    CHECK (sendto (cm, 0xffff, pkt, sizeof pkt)) ;
+    CHECK (drain_tx (cm)) ;
+    CHECK (getstat (cm)->tx_airtime == 2 * snap.tx_airtime) ;
+    CHECK (getstat (cm)->rx_airtime == snap.rx_airtime) ;
+    resetstat (cm) ;
+    CHECK (getstat (cm)->tx_sent == 0 && getstat (cm)->tx_airtime == 0) ;
+}
+
+void test_csma (void)
+{
+    uint8_t pkt [] = "csma" ;
+    ConStat *st = getstat (cm) ;
+    int n ;
+
+    printf ("CSMA/CA on a busy channel\n") ;
+    setMacParam (cm, &csma) ;
+    sim_radio_set_sync (true, TX_OK) ;
+    resetstat (cm) ;
+    n = nonair ;
+    sim_radio_set_busy (2) ;
+    CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (drain_tx (cm)) ;
+    CHECK (last_tx_status (cm) == TX_OK) ;
+    CHECK (st->tx_backoff == 2 && st->tx_sent == 1) ;
+    CHECK (nonair == n + 1) ;
+
+    sim_radio_set_busy (10) ;
+    CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (drain_tx (cm)) ;
+    CHECK (last_tx_status (cm) == TX_CCA_FAIL) ;
+    CHECK (st->tx_backoff == 2 + csma.maxbackoffs) ;
+    CHECK (st->tx_error_cca == 1) ;
+    CHECK (nonair == n + 1) ;
+    sim_radio_set_busy (0) ;
+
+    printf ("MAC retransmissions\n") ;
+    sim_radio_set_sync (true, TX_NOACK) ;
+    CHECK (sendto (cm, 0x1234, pkt, sizeof pkt)) ;
+    CHECK (drain_tx (cm)) ;
+    CHECK (last_tx_status (cm) == TX_NOACK) ;
+    CHECK (st->tx_retry == csma.maxretries && st->tx_error_noack == 1) ;
+    CHECK (nonair == n + 2 + csma.maxretries) ;
+    CHECK (ndone [TX_NOACK] == 2) ;
+    sim_radio_set_sync (true, TX_OK) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr_154 *a ;
+
+    clock_set_virtual (1000) ;
+    a = init_l2addr_154_char ("01:00") ;
+    cm = L2_154 (startL2_154 (a, CHANNEL, PANID))->cm_ ;
+    sim_radio_set_tx_hook (tx_hook, NULL) ;
+    set_tx_callback (cm, tx_done, NULL) ;
+
+    test_queue () ;
+    test_rx_while_tx () ;
+    test_stat () ;
+    test_csma () ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}
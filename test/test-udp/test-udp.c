@@ -0,0 +1,219 @@
+#include "../../libraries/L2-UDP/l2-udp.h"
+#include "../../libraries/Casan/casan.h"
+
+/*
+ * Test program for the UDP network, on the host: L2 methods
+ * between two nodes, then the CASAN engine talking over UDP to a
+ * minimal master running in the same process.
+ */
+
+#define	PORT		27000		// base port for this test
+#define	SLAVEID		169
+
+int nerr = 0 ;
+
+#define	CHECK(c)	do { if (! (c)) { \
+			    printf ("\033[31mFAIL\033[00m %s:%d: %s\n", \
+					__FILE__, __LINE__, #c) ; \
+			    nerr++ ; } } while (0)
+
+// the kernel delivers loopback datagrams synchronously
+l2_recv_t recv_check (l2net *l2, size_t len, const char *data)
+{
+    l2_recv_t r ;
+    l2addr *src ;
+
+    r = recv (l2) ;
+    if (r == RECV_OK)
+    {
+		CHECK (get_paylen (l2) == len) ;
+		CHECK (memcmp (get_payload (l2, 0), data, len) == 0) ;
+		src = get_src (l2) ;
+		CHECK (src->addr_ != l2->myaddr_) ;
+		freel2addr (src) ;
+    }
+    return r ;
+}
+
+void test_l2 (l2net *a, l2net *b, l2addr *aa, l2addr *ab)
+{
+    uint8_t big [L2UDP_MAXMTU] ;
+    l2addr *dst ;
+
+    printf ("unicast\n") ;
+    CHECK (send (a, ab, (uint8_t *) "hello", 5)) ;
+    CHECK (recv_check (b, 5, "hello") == RECV_OK) ;
+    dst = get_dst (b) ;
+    CHECK (isEqualAddr (dst, ab)) ;
+    freel2addr (dst) ;
+    CHECK (recv (b) == RECV_EMPTY) ;
+    CHECK (recv (a) == RECV_EMPTY) ;
+
+    printf ("broadcast\n") ;
+    CHECK (send (a, bcastaddr (), (uint8_t *) "all", 3)) ;
+    CHECK (recv_check (b, 3, "all") == RECV_OK) ;
+    dst = get_dst (b) ;
+    CHECK (isEqualAddr (dst, bcastaddr ())) ;
+    freel2addr (dst) ;
+    CHECK (recv (a) == RECV_EMPTY) ;	// own broadcast ignored
+
+    printf ("mtu\n") ;
+    CHECK (maxpayload (a) == L2UDP_MTU - L2UDP_OVERHEAD) ;
+    memset (big, 0x55, sizeof big) ;
+    CHECK (! send (a, ab, big, maxpayload (a) + 1)) ;
+    setMTU (a, 10000) ;
+    CHECK (getMTU (a) == L2UDP_MAXMTU) ;
+    CHECK (send (a, ab, big, PKTBUF_SIZE)) ;
+    CHECK (recv_check (b, PKTBUF_SIZE, (char *) big) == RECV_OK) ;
+    setMTU (a, L2UDP_OVERHEAD - 1) ;	// no room for a payload
+    CHECK (maxpayload (a) == 0) ;
+    CHECK (! send (a, ab, big, 1)) ;
+    setMTU (a, L2UDP_MTU) ;
+
+    CHECK (! canAggregate (a)) ;
+    setAggregation (a, true) ;
+    CHECK (! getAggregation (a)) ;
+    CHECK (get_lqi (b) == 0) ;
+}
+
+/*
+ * Minimal master: answers Discover messages with an Assoc, and
+ * sends a GET request once the slave is associated
+ */
+
+void send_assoc (l2net *l2, l2addr *dest, uint16_t id, const char *mtu)
+{
+    Msg *m = initMsg (l2) ;
+    const char *q [] = { "ttl=100000", mtu } ;
+    option *o ;
+    int i ;
+
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_POST) ;
+    mk_ctl_msg (m) ;
+    for (i = 0 ; i < NTAB (q) ; i++)
+    {
+		o = initOptionOpaque (MO_Uri_Query, q [i], strlen (q [i])) ;
+		push_option (m, o) ;
+		freeOption (o) ;
+    }
+    CHECK (sendMsg (m, dest)) ;
+    freeMsg (m) ;
+}
+
+void send_get (l2net *l2, l2addr *dest, uint16_t id)
+{
+    Msg *m = initMsg (l2) ;
+    option *o = initOptionOpaque (MO_Uri_Path, "light", 5) ;
+
+    set_id (m, id) ;
+    set_type (m, COAP_TYPE_CON) ;
+    set_code (m, COAP_CODE_GET) ;
+    push_option (m, o) ;
+    freeOption (o) ;
+    CHECK (sendMsg (m, dest)) ;
+    freeMsg (m) ;
+}
+
+uint8_t process_light (Msg *in, Msg *out)
+{
+    set_payload_msg (out, (uint8_t *) "on", 2) ;
+    return COAP_RETURN_CODE (2, 5) ;
+}
+
+void test_casan (l2net *sl, l2net *ml, l2addr *as)
+{
+    Casan *ca ;
+    Resource *res ;
+    Msg *in ;
+    l2addr *src ;
+    int i, ndiscover = 0, nanswer = 0 ;
+    bool sent = false ;
+
+    printf ("casan engine\n") ;
+    ca = initCasan (sl, 0, SLAVEID) ;
+    res = initResource ("light", "light", "light") ;
+    setHandlerResource (res, COAP_CODE_GET, process_light) ;
+    register_resource (ca, res) ;
+
+    in = initMsg (ml) ;
+    for (i = 0 ; i < 200 && nanswer == 0 ; i++)
+    {
+		clock_advance (10) ;
+		loop (ca) ;
+		while (recvMsg (in) == RECV_OK)
+		{
+		    src = get_src (ml) ;
+		    CHECK (isEqualAddr (src, as)) ;
+		    if (is_ctl_msg (in) && get_type (in) == COAP_TYPE_NON)
+		    {
+				ndiscover++ ;
+				send_assoc (ml, src, 100, "mtu=127") ;
+		    }
+		    else if (get_type (in) == COAP_TYPE_ACK && get_id (in) == 200)
+		    {
+				CHECK (get_code (in) == COAP_RETURN_CODE (2, 5)) ;
+				CHECK (get_paylen_msg (in) == 2) ;
+				nanswer++ ;
+		    }
+		    freel2addr (src) ;
+		}
+		if (ca->status_ == SL_RUNNING && ! sent)
+		{
+		    send_get (ml, as, 200) ;
+		    sent = true ;
+		}
+    }
+    CHECK (ndiscover >= 1) ;
+    CHECK (ca->status_ == SL_RUNNING) ;
+    CHECK (nanswer == 1) ;
+
+    // an Assoc renewal with an MTU smaller than the UDP overhead
+    // leaves no room for the answer, which must fail cleanly
+    send_assoc (ml, as, 101, "mtu=5") ;
+    for (i = 0 ; i < 10 ; i++)
+    {
+		clock_advance (10) ;
+		loop (ca) ;
+    }
+    CHECK (getMTU (sl) == 5) ;
+    CHECK (maxpayload (sl) == 0) ;
+    CHECK (recvMsg (in) == RECV_EMPTY) ;	// nothing could be sent
+    send_assoc (ml, as, 102, "mtu=127") ;
+    for (i = 0 ; i < 10 ; i++)
+    {
+		clock_advance (10) ;
+		loop (ca) ;
+    }
+    CHECK (maxpayload (sl) == 127 - L2UDP_OVERHEAD) ;
+    CHECK (recvMsg (in) == RECV_OK && get_id (in) == 102) ;
+    freeMsg (in) ;
+}
+
+int main (int argc, char *argv [])
+{
+    l2addr *aa, *ab ;
+    l2net *a, *b ;
+
+    clock_set_virtual (1000) ;
+    aa = init_l2addr_char ("01:00") ;
+    ab = init_l2addr_char ("fe:00") ;
+    a = startL2_udp (aa, PORT) ;
+    b = startL2_udp (ab, PORT) ;
+    CHECK (a != NULL && b != NULL) ;
+    if (a == NULL || b == NULL)
+		return 1 ;
+    CHECK (startL2_udp (aa, PORT) == NULL) ;	// address in use
+
+    test_l2 (a, b, aa, ab) ;
+    test_casan (a, b, aa) ;
+
+    stopL2_udp (a) ;
+    stopL2_udp (b) ;
+    freel2addr (aa) ;
+    freel2addr (ab) ;
+
+    printf ("%s\n", nerr == 0 ? "OK" : "FAILED") ;
+    return nerr != 0 ;
+}